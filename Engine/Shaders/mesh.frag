@@ -0,0 +1,54 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec3 inNormal;
+layout (location = 2) in vec2 inUV;
+// Comes from the push constants or, when drawn GPU driven, the object being drawn
+layout (location = 3) flat in uint inMaterialIndex;
+
+layout (location = 0) out vec4 outFragColor;
+
+// Bindless resource table, see BindlessTable
+layout (set = 0, binding = 0) uniform texture2D textures[];
+layout (set = 0, binding = 1) uniform sampler samplers[];
+
+const uint NO_BINDLESS_INDEX = 0xFFFFFFFFu;
+
+struct Material
+{
+    vec4 baseColorFactor;
+    uint baseColorTexture;
+    uint baseColorSampler;
+    uint padding0;
+    uint padding1;
+};
+
+layout (buffer_reference, std430) readonly buffer MaterialBuffer
+{
+    Material materials[];
+};
+
+// Same block as the mesh vertex shaders, we only need the material buffer address after the vertex buffer address
+layout (push_constant) uniform constants
+{
+    layout (offset = 72) MaterialBuffer materialBuffer;
+} PushConstants;
+
+void main()
+{
+    Material material = PushConstants.materialBuffer.materials[inMaterialIndex];
+
+    vec4 baseColor = material.baseColorFactor * vec4(inColor, 1.0f);
+    if (material.baseColorTexture != NO_BINDLESS_INDEX)
+    {
+        baseColor *= texture(sampler2D(textures[nonuniformEXT(material.baseColorTexture)], samplers[nonuniformEXT(material.baseColorSampler)]), inUV);
+    }
+
+    // Simple directional light with a bit of ambient so unlit sides are not pitch black
+    const vec3 lightDirection = normalize(vec3(0.3f, 1.0f, 0.4f));
+    float lightValue = max(dot(normalize(inNormal), lightDirection), 0.1f);
+
+    outFragColor = vec4(baseColor.rgb * lightValue, baseColor.a);
+}
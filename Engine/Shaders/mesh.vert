@@ -0,0 +1,43 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+
+layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec3 outNormal;
+layout (location = 2) out vec2 outUV;
+layout (location = 3) flat out uint outMaterialIndex;
+
+struct Vertex
+{
+    vec3 position;
+    float uv_x;
+    vec3 normal;
+    float uv_y;
+    vec4 color;
+};
+
+layout (buffer_reference, std430) readonly buffer VertexBuffer
+{
+    Vertex vertices[];
+};
+
+// Push constants block
+layout (push_constant) uniform constants
+{
+    mat4 worldMatrix;
+    VertexBuffer vertexBuffer;
+    // The material buffer in between is only read by the fragment shader
+    layout (offset = 80) uint materialIndex;
+} PushConstants;
+
+void main()
+{
+    // Load vertex data from device address
+    Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+
+    // Output data
+    gl_Position = PushConstants.worldMatrix * vec4(v.position, 1.0f);
+    outColor = v.color.xyz;
+    outNormal = v.normal;
+    outUV = vec2(v.uv_x, v.uv_y);
+    outMaterialIndex = PushConstants.materialIndex;
+}
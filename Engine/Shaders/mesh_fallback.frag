@@ -0,0 +1,12 @@
+#version 450
+
+// Cheap to compile stand-in for mesh.frag, used while the real pipeline is still compiling
+
+layout (location = 0) in vec3 inColor;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main()
+{
+    outFragColor = vec4(inColor, 1.0f);
+}
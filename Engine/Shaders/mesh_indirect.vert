@@ -0,0 +1,64 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+
+// mesh.vert for the GPU driven path. cull.comp points every draw's first instance at the object it draws,
+// which is where the matrix and the material come from instead of the push constants
+
+layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec3 outNormal;
+layout (location = 2) out vec2 outUV;
+layout (location = 3) flat out uint outMaterialIndex;
+
+struct Vertex
+{
+    vec3 position;
+    float uv_x;
+    vec3 normal;
+    float uv_y;
+    vec4 color;
+};
+
+layout (buffer_reference, std430) readonly buffer VertexBuffer
+{
+    Vertex vertices[];
+};
+
+// Matches GPUDrawObject on the CPU side
+struct DrawObject
+{
+    mat4 worldMatrix;
+    vec4 boundingSphere;
+    uint surfaceIndex;
+    uint materialIndex;
+    float lodScale;
+    uint padding;
+};
+
+layout (buffer_reference, std430) readonly buffer ObjectBuffer
+{
+    DrawObject objects[];
+};
+
+// Push constants block
+layout (push_constant) uniform constants
+{
+    mat4 viewProjection;
+    VertexBuffer vertexBuffer;
+    // The material buffer in between is only read by the fragment shader
+    layout (offset = 80) ObjectBuffer objectBuffer;
+} PushConstants;
+
+void main()
+{
+    DrawObject object = PushConstants.objectBuffer.objects[gl_InstanceIndex];
+
+    // Load vertex data from device address
+    Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+
+    // Output data
+    gl_Position = PushConstants.viewProjection * object.worldMatrix * vec4(v.position, 1.0f);
+    outColor = v.color.xyz;
+    outNormal = v.normal;
+    outUV = vec2(v.uv_x, v.uv_y);
+    outMaterialIndex = object.materialIndex;
+}
@@ -0,0 +1,76 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+
+// mesh_packed.vert for the GPU driven path, see mesh_indirect.vert
+
+layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec3 outNormal;
+layout (location = 2) out vec2 outUV;
+layout (location = 3) flat out uint outMaterialIndex;
+
+// Matches PackedVertex on the CPU side, every member is unpacked by hand
+struct PackedVertex
+{
+    uint positionXY;
+    uint positionZ;
+    uint normal;
+    uint uv;
+    uint color;
+};
+
+layout (buffer_reference, std430) readonly buffer VertexBuffer
+{
+    PackedVertex vertices[];
+};
+
+// Matches GPUDrawObject on the CPU side
+struct DrawObject
+{
+    // Also maps the quantized positions back onto the bounds of the surface being drawn
+    mat4 worldMatrix;
+    vec4 boundingSphere;
+    uint surfaceIndex;
+    uint materialIndex;
+    float lodScale;
+    uint padding;
+};
+
+layout (buffer_reference, std430) readonly buffer ObjectBuffer
+{
+    DrawObject objects[];
+};
+
+// Push constants block
+layout (push_constant) uniform constants
+{
+    mat4 viewProjection;
+    VertexBuffer vertexBuffer;
+    // The material buffer in between is only read by the fragment shader
+    layout (offset = 80) ObjectBuffer objectBuffer;
+} PushConstants;
+
+vec3 decode_octahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return normalize(n);
+}
+
+void main()
+{
+    DrawObject object = PushConstants.objectBuffer.objects[gl_InstanceIndex];
+
+    // Load vertex data from device address
+    PackedVertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+
+    vec3 position = vec3(unpackUnorm2x16(v.positionXY), unpackUnorm2x16(v.positionZ).x);
+
+    // Output data
+    gl_Position = PushConstants.viewProjection * object.worldMatrix * vec4(position, 1.0f);
+    outColor = unpackUnorm4x8(v.color).xyz;
+    outNormal = decode_octahedral(unpackSnorm2x16(v.normal));
+    outUV = unpackHalf2x16(v.uv);
+    outMaterialIndex = object.materialIndex;
+}
@@ -0,0 +1,210 @@
+#include "benchmarks.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fmt/core.h>
+#include <random>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "culling.h"
+#include "job_system.h"
+
+namespace
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    double elapsed_ms(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    std::vector<uint32_t> thread_counts()
+    {
+        const uint32_t hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+        std::vector<uint32_t> counts;
+        for (uint32_t count = 1; count < hardwareThreads; count *= 2)
+        {
+            counts.push_back(count);
+        }
+        counts.push_back(hardwareThreads);
+        return counts;
+    }
+}
+
+void bench::job_system()
+{
+    constexpr uint32_t emptyJobCount = 200000;
+    constexpr uint32_t workBatchCount = 512;
+    constexpr uint32_t workPerBatch = 100000;
+
+    fmt::println("Job system: {} empty jobs, {} batches of {} iterations", emptyJobCount, workBatchCount, workPerBatch);
+    fmt::println("{:>8} {:>14} {:>14} {:>12} {:>9}", "threads", "ns/empty job", "ns/for batch", "work ms", "speedup");
+
+    double singleThreadMs = 0.0;
+
+    for (const uint32_t threadCount : thread_counts())
+    {
+        JobSystem jobs;
+        // The calling thread is one of them, so the 1 thread row runs without any workers
+        jobs.Init(threadCount - 1);
+
+        // Scheduling overhead: jobs that do nothing, so all we measure is push, pop, steal and counting
+        auto start = Clock::now();
+        JobSystem::Counter counter;
+        for (uint32_t i = 0; i < emptyJobCount; i++)
+        {
+            jobs.Run([](uint32_t) {}, &counter);
+        }
+        jobs.Wait(counter);
+        const double emptyNs = elapsed_ms(start) * 1e6 / emptyJobCount;
+
+        start = Clock::now();
+        jobs.ParallelFor(emptyJobCount, 1, [](uint32_t, uint32_t, uint32_t) {});
+        const double batchNs = elapsed_ms(start) * 1e6 / emptyJobCount;
+
+        // Scaling: independent CPU bound batches
+        std::atomic<double> sink{0.0};
+        start = Clock::now();
+        jobs.ParallelFor(workBatchCount, 1, [&sink](uint32_t begin, uint32_t, uint32_t)
+        {
+            double sum = 0.0;
+            for (uint32_t i = 0; i < workPerBatch; i++)
+            {
+                sum += std::sqrt(static_cast<double>(begin * workPerBatch + i));
+            }
+
+            double expected = sink.load(std::memory_order_relaxed);
+            while (!sink.compare_exchange_weak(expected, expected + sum, std::memory_order_relaxed)) {}
+        });
+        const double workMs = elapsed_ms(start);
+
+        if (threadCount == 1)
+        {
+            singleThreadMs = workMs;
+        }
+
+        fmt::println("{:>8} {:>14.1f} {:>14.1f} {:>12.2f} {:>8.2f}x", threadCount, emptyNs, batchNs, workMs, singleThreadMs / workMs);
+
+        jobs.Shutdown();
+    }
+}
+
+void bench::frustum_culling()
+{
+    constexpr uint32_t objectCounts[] = {10000, 100000, 1000000};
+    // Every measurement culls at least this many objects in total, and keeps the fastest of its passes
+    constexpr uint32_t minimumObjectsPerMeasurement = 20000000;
+
+    // Objects scattered through a cube around a camera at the origin, so about a tenth of them ends up visible
+    const uint32_t maxObjectCount = objectCounts[std::size(objectCounts) - 1];
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> angle(0.0f, glm::two_pi<float>());
+    std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> extent(0.1f, 5.0f);
+
+    std::vector<glm::mat4> worldMatrices(maxObjectCount);
+    std::vector<float> centerX(maxObjectCount), centerY(maxObjectCount), centerZ(maxObjectCount);
+    std::vector<float> extentX(maxObjectCount), extentY(maxObjectCount), extentZ(maxObjectCount), radius(maxObjectCount);
+    for (uint32_t i = 0; i < maxObjectCount; i++)
+    {
+        const glm::vec3 axis = glm::normalize(glm::vec3{offset(random), offset(random), offset(random)} + glm::vec3{0.0f, 0.01f, 0.0f});
+        worldMatrices[i] = glm::translate(glm::mat4(1.0f), glm::vec3{position(random), position(random), position(random)});
+        worldMatrices[i] = glm::rotate(worldMatrices[i], angle(random), axis);
+        worldMatrices[i] = glm::scale(worldMatrices[i], glm::vec3{scale(random)});
+
+        centerX[i] = offset(random);
+        centerY[i] = offset(random);
+        centerZ[i] = offset(random);
+        extentX[i] = extent(random);
+        extentY[i] = extent(random);
+        extentZ[i] = extent(random);
+        radius[i] = std::sqrt(extentX[i] * extentX[i] + extentY[i] * extentY[i] + extentZ[i] * extentZ[i]);
+    }
+
+    const culling::BoxArrays boxes{centerX.data(), centerY.data(), centerZ.data(), extentX.data(), extentY.data(), extentZ.data()};
+    const culling::SphereArrays spheres{centerX.data(), centerY.data(), centerZ.data(), radius.data()};
+
+    // The same reversed depth projection the engine renders with
+    glm::mat4 projection = glm::perspective(glm::radians(70.0f), 16.0f / 9.0f, 10000.0f, 0.1f);
+    projection[1][1] *= -1;
+    const culling::Frustum frustum = culling::extract_frustum(projection);
+
+    std::vector<culling::InstructionSet> instructionSets = {culling::InstructionSet::Scalar};
+    if (culling::get_instruction_set() >= culling::InstructionSet::Sse)
+    {
+        instructionSets.push_back(culling::InstructionSet::Sse);
+    }
+    if (culling::get_instruction_set() >= culling::InstructionSet::Avx2)
+    {
+        instructionSets.push_back(culling::InstructionSet::Avx2);
+    }
+
+    std::vector<uint32_t> visibleIndices(maxObjectCount);
+    // What the scalar kernels found, every instruction set does its math in the same order so anything else is a bug
+    std::vector<uint32_t> referenceBoxIndices;
+    std::vector<uint32_t> referenceSphereIndices;
+    const auto matches_reference = [&](culling::InstructionSet instructionSet, uint32_t visibleCount, std::vector<uint32_t>& reference) -> bool
+    {
+        if (instructionSet == culling::InstructionSet::Scalar)
+        {
+            reference.assign(visibleIndices.begin(), visibleIndices.begin() + visibleCount);
+            return true;
+        }
+        return reference.size() == visibleCount && std::equal(reference.begin(), reference.end(), visibleIndices.begin());
+    };
+
+    // Runs one kernel over the first objectCount objects, returns the fastest pass in nanoseconds per object
+    const auto measure = [&](auto&& cull, uint32_t objectCount, uint32_t& visibleCount) -> double
+    {
+        const uint32_t passCount = std::max(minimumObjectsPerMeasurement / objectCount, 3u);
+        double bestMs = 1e30;
+        for (uint32_t pass = 0; pass < passCount; pass++)
+        {
+            const auto start = Clock::now();
+            visibleCount = cull(objectCount);
+            bestMs = std::min(bestMs, elapsed_ms(start));
+        }
+        return bestMs * 1e6 / objectCount;
+    };
+
+    fmt::println("Frustum culling: objects with random transforms and bounds, best of at least {} objects culled", minimumObjectsPerMeasurement);
+    fmt::println("{:>9} {:>8} {:>10} {:>13} {:>10} {:>13}", "objects", "isa", "ns/box", "visible", "ns/sphere", "visible");
+
+    for (const uint32_t objectCount : objectCounts)
+    {
+        for (const culling::InstructionSet instructionSet : instructionSets)
+        {
+            uint32_t boxCount = 0;
+            const double boxNs = measure([&](uint32_t count) -> uint32_t
+            {
+                return culling::cull_boxes(frustum, boxes, worldMatrices.data(), count, visibleIndices.data(), instructionSet);
+            }, objectCount, boxCount);
+            bool bMatches = matches_reference(instructionSet, boxCount, referenceBoxIndices);
+
+            uint32_t sphereCount = 0;
+            const double sphereNs = measure([&](uint32_t count) -> uint32_t
+            {
+                return culling::cull_spheres(frustum, spheres, worldMatrices.data(), count, visibleIndices.data(), instructionSet);
+            }, objectCount, sphereCount);
+            bMatches = matches_reference(instructionSet, sphereCount, referenceSphereIndices) && bMatches;
+
+            fmt::println(
+                "{:>9} {:>8} {:>10.2f} {:>13} {:>10.2f} {:>13}{}",
+                objectCount,
+                culling::get_instruction_set_name(instructionSet),
+                boxNs,
+                boxCount,
+                sphereNs,
+                sphereCount,
+                bMatches ? "" : "  MISMATCH"
+            );
+        }
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// Micro-benchmarks that run without a window or a Vulkan device.
+// Selected from the command line, see main.cpp.
+namespace bench
+{
+    // Scheduling overhead per job, and scaling of a CPU bound workload from 1 to N threads
+    void job_system();
+
+    // Nanoseconds per object of the frustum culling kernels, for every instruction set the CPU supports
+    void frustum_culling();
+} // namespace bench
@@ -1 +1,56 @@
 #include "camera.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+glm::mat4 Camera::GetViewMatrix() const
+{
+    // To create a correct model view, we need to move the world in opposite direction to the camera,
+    // so we will create the camera model matrix and invert it
+    const glm::mat4 cameraTranslation = glm::translate(glm::mat4(1.0f), position);
+    const glm::mat4 cameraRotation = GetRotationMatrix();
+    return glm::inverse(cameraTranslation * cameraRotation);
+}
+
+glm::mat4 Camera::GetRotationMatrix() const
+{
+    // Fairly typical FPS style camera. We join the pitch and yaw rotations into the final rotation matrix
+    const glm::quat pitchRotation = glm::angleAxis(pitch, glm::vec3{1.0f, 0.0f, 0.0f});
+    const glm::quat yawRotation = glm::angleAxis(yaw, glm::vec3{0.0f, -1.0f, 0.0f});
+
+    return glm::mat4_cast(yawRotation) * glm::mat4_cast(pitchRotation);
+}
+
+culling::Frustum Camera::GetFrustum(const glm::mat4& projection) const
+{
+    return culling::extract_frustum(projection * GetViewMatrix());
+}
+
+void Camera::ProcessSDLEvent(const SDL_Event& e)
+{
+    if (e.type == SDL_KEYDOWN)
+    {
+        if (e.key.keysym.sym == SDLK_w) { velocity.z = -1.0f; }
+        if (e.key.keysym.sym == SDLK_s) { velocity.z = 1.0f; }
+        if (e.key.keysym.sym == SDLK_a) { velocity.x = -1.0f; }
+        if (e.key.keysym.sym == SDLK_d) { velocity.x = 1.0f; }
+    }
+
+    if (e.type == SDL_KEYUP)
+    {
+        if (e.key.keysym.sym == SDLK_w || e.key.keysym.sym == SDLK_s) { velocity.z = 0.0f; }
+        if (e.key.keysym.sym == SDLK_a || e.key.keysym.sym == SDLK_d) { velocity.x = 0.0f; }
+    }
+
+    if (e.type == SDL_MOUSEMOTION)
+    {
+        yaw += static_cast<float>(e.motion.xrel) / 200.0f;
+        pitch -= static_cast<float>(e.motion.yrel) / 200.0f;
+    }
+}
+
+void Camera::Update()
+{
+    const glm::mat4 cameraRotation = GetRotationMatrix();
+    position += glm::vec3(cameraRotation * glm::vec4(velocity * 0.5f, 0.0f));
+}
\ No newline at end of file
@@ -1,8 +1,25 @@
 #pragma once
 
+#include <SDL_events.h>
+#include <culling.h>
 #include <vk_types.h>
 
+// Free-flying camera, WASD to move and the mouse to look around
 class Camera
 {
 public:
-};
+    glm::vec3 velocity{0.0f};
+    glm::vec3 position{0.0f};
+    // Vertical rotation
+    float pitch{0.0f};
+    // Horizontal rotation
+    float yaw{0.0f};
+
+    glm::mat4 GetViewMatrix() const;
+    glm::mat4 GetRotationMatrix() const;
+    // World space planes of what the camera sees through projection, for culling::cull_boxes and culling::cull_spheres
+    culling::Frustum GetFrustum(const glm::mat4& projection) const;
+
+    void ProcessSDLEvent(const SDL_Event& e);
+    void Update();
+};
\ No newline at end of file
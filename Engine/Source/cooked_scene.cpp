@@ -0,0 +1,340 @@
+#include "cooked_scene.h"
+
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+namespace
+{
+    constexpr uint32_t COOKED_MAGIC = 0x48534D43; // "CMSH"
+    // Bump whenever the layout of the header, a table or a vertex format changes. Older files are rejected and have to be cooked again
+    constexpr uint32_t COOKED_VERSION = 4;
+    constexpr size_t COOKED_TABLE_ALIGNMENT = 16;
+    // Page aligned, so the payload maps and copies on page boundaries
+    constexpr size_t COOKED_PAYLOAD_ALIGNMENT = 4096;
+
+    struct CookedTable
+    {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    struct CookedHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        VertexFormat vertexFormat;
+        // Catches files cooked by a build with a different vertex layout
+        uint32_t vertexStride;
+        uint32_t indexStride;
+        uint32_t padding;
+
+        CookedTable meshes;     // CookedMesh
+        CookedTable surfaces;   // GeoSurface, with the material index pointing into the materials table
+        CookedTable instances;  // MeshInstance
+        CookedTable materials;  // SceneMaterial
+        CookedTable images;     // cooked::Image
+        CookedTable names;      // char, the mesh names back to back
+        CookedTable meshlets;   // Meshlet
+
+        uint64_t payloadOffset;
+        uint64_t payloadSize;
+        uint64_t vertexBufferSize;
+        uint64_t indexBufferSize;
+    };
+
+    struct CookedMesh
+    {
+        uint32_t firstSurface;
+        uint32_t surfaceCount;
+        uint32_t nameOffset;
+        uint32_t nameLength;
+    };
+
+    size_t align_up(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    template<typename T>
+    void append_cooked_table(std::vector<char>& bytes, CookedTable& table, const T* data, size_t count)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Cooked tables are written as raw bytes");
+
+        bytes.resize(align_up(bytes.size(), COOKED_TABLE_ALIGNMENT), 0);
+        table.offset = bytes.size();
+        table.count = count;
+        if (count > 0)
+        {
+            bytes.insert(bytes.end(), reinterpret_cast<const char*>(data), reinterpret_cast<const char*>(data + count));
+        }
+    }
+
+    template<typename T>
+    bool read_cooked_table(const char* data, size_t size, const CookedTable& table, std::vector<T>& values)
+    {
+        if (table.offset > size || table.count > (size - table.offset) / sizeof(T))
+        {
+            return false;
+        }
+
+        // Tables are small, copying them out keeps the structs properly aligned
+        values.resize(static_cast<size_t>(table.count));
+        if (!values.empty())
+        {
+            std::memcpy(values.data(), data + table.offset, values.size() * sizeof(T));
+        }
+        return true;
+    }
+
+    // Whether every index of a range that is already known to be inside the index buffer stays below vertexCount
+    template<typename T>
+    bool cooked_indices_below(const char* indexData, uint64_t startIndex, uint64_t count, uint64_t vertexCount)
+    {
+        for (uint64_t i = startIndex; i < startIndex + count; i++)
+        {
+            T index;
+            std::memcpy(&index, indexData + i * sizeof(T), sizeof(T));
+            if (index >= vertexCount)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool validate_cooked_scene(
+        const CookedHeader& header,
+        const char* payload,
+        const std::vector<CookedMesh>& meshes,
+        const std::vector<GeoSurface>& surfaces,
+        const std::vector<MeshInstance>& instances,
+        const std::vector<SceneMaterial>& materials,
+        const std::vector<cooked::Image>& images,
+        const std::vector<char>& names,
+        const std::vector<Meshlet>& meshlets
+    ) {
+        if (header.vertexBufferSize == 0
+            || header.indexBufferSize == 0
+            || header.vertexBufferSize + header.indexBufferSize > header.payloadSize)
+        {
+            return false;
+        }
+
+        for (const CookedMesh& mesh : meshes)
+        {
+            if (static_cast<uint64_t>(mesh.firstSurface) + mesh.surfaceCount > surfaces.size()
+                || static_cast<uint64_t>(mesh.nameOffset) + mesh.nameLength > names.size())
+            {
+                return false;
+            }
+        }
+
+        const uint64_t vertexCount = header.vertexBufferSize / header.vertexStride;
+        const uint64_t indexCount = header.indexBufferSize / header.indexStride;
+        for (const GeoSurface& surface : surfaces)
+        {
+            if (static_cast<uint64_t>(surface.startIndex) + surface.count > indexCount
+                || surface.vertexOffset < 0
+                || static_cast<uint64_t>(surface.vertexOffset) >= vertexCount
+                || surface.materialIndex >= materials.size()
+                || surface.lodCount > MAX_SURFACE_LODS
+                || static_cast<uint64_t>(surface.firstMeshlet) + surface.meshletCount > meshlets.size())
+            {
+                return false;
+            }
+
+            for (uint32_t lod = 0; lod < surface.lodCount; lod++)
+            {
+                if (static_cast<uint64_t>(surface.lods[lod].startIndex) + surface.lods[lod].count > indexCount)
+                {
+                    return false;
+                }
+            }
+        }
+
+        for (const Meshlet& meshlet : meshlets)
+        {
+            if (static_cast<uint64_t>(meshlet.startIndex) + meshlet.count > indexCount)
+            {
+                return false;
+            }
+        }
+
+        // Every range drawn for a surface, in full, as a LOD or meshlet by meshlet, only indexes the vertices it owns
+        const char* indexData = payload + header.vertexBufferSize;
+        for (const GeoSurface& surface : surfaces)
+        {
+            const uint64_t surfaceVertexCount = vertexCount - static_cast<uint64_t>(surface.vertexOffset);
+            const auto indices_in_bounds = [&](uint32_t startIndex, uint32_t count) -> bool
+            {
+                return header.indexStride == sizeof(uint16_t)
+                    ? cooked_indices_below<uint16_t>(indexData, startIndex, count, surfaceVertexCount)
+                    : cooked_indices_below<uint32_t>(indexData, startIndex, count, surfaceVertexCount);
+            };
+
+            if (!indices_in_bounds(surface.startIndex, surface.count))
+            {
+                return false;
+            }
+
+            for (uint32_t lod = 0; lod < surface.lodCount; lod++)
+            {
+                if (!indices_in_bounds(surface.lods[lod].startIndex, surface.lods[lod].count))
+                {
+                    return false;
+                }
+            }
+
+            for (uint32_t i = surface.firstMeshlet; i < surface.firstMeshlet + surface.meshletCount; i++)
+            {
+                if (!indices_in_bounds(meshlets[i].startIndex, meshlets[i].count))
+                {
+                    return false;
+                }
+            }
+        }
+
+        for (const MeshInstance& instance : instances)
+        {
+            if (instance.meshIndex >= meshes.size())
+            {
+                return false;
+            }
+        }
+
+        for (const SceneMaterial& material : materials)
+        {
+            if (material.baseColorImage != NO_BINDLESS_INDEX && material.baseColorImage >= images.size())
+            {
+                return false;
+            }
+        }
+
+        for (const cooked::Image& image : images)
+        {
+            const uint64_t byteSize = static_cast<uint64_t>(image.width) * image.height * 4;
+            if (image.payloadOffset > header.payloadSize || byteSize > header.payloadSize - image.payloadOffset)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
+std::vector<char> cooked::write_tables(const Scene& scene, uint64_t payloadSize)
+{
+    std::vector<CookedMesh> meshes;
+    std::vector<GeoSurface> surfaces;
+    std::string names;
+    for (const MeshAsset& mesh : scene.meshes)
+    {
+        CookedMesh cookedMesh;
+        cookedMesh.firstSurface = static_cast<uint32_t>(surfaces.size());
+        cookedMesh.surfaceCount = static_cast<uint32_t>(mesh.surfaces.size());
+        cookedMesh.nameOffset = static_cast<uint32_t>(names.size());
+        cookedMesh.nameLength = static_cast<uint32_t>(mesh.name.size());
+        meshes.push_back(cookedMesh);
+
+        surfaces.insert(surfaces.end(), mesh.surfaces.begin(), mesh.surfaces.end());
+        names += mesh.name;
+    }
+
+    CookedHeader header = {};
+    header.magic = COOKED_MAGIC;
+    header.version = COOKED_VERSION;
+    header.vertexFormat = scene.vertexFormat;
+    header.vertexStride = get_vertex_stride(scene.vertexFormat);
+    header.indexStride = scene.indexStride;
+    header.vertexBufferSize = scene.vertexBufferSize;
+    header.indexBufferSize = scene.indexBufferSize;
+
+    std::vector<char> bytes(sizeof(CookedHeader), 0);
+    append_cooked_table(bytes, header.meshes, meshes.data(), meshes.size());
+    append_cooked_table(bytes, header.surfaces, surfaces.data(), surfaces.size());
+    append_cooked_table(bytes, header.instances, scene.instances.data(), scene.instances.size());
+    append_cooked_table(bytes, header.materials, scene.materials.data(), scene.materials.size());
+    append_cooked_table(bytes, header.images, scene.images.data(), scene.images.size());
+    append_cooked_table(bytes, header.names, names.data(), names.size());
+    append_cooked_table(bytes, header.meshlets, scene.meshlets.data(), scene.meshlets.size());
+
+    bytes.resize(align_up(bytes.size(), COOKED_PAYLOAD_ALIGNMENT), 0);
+    header.payloadOffset = bytes.size();
+    header.payloadSize = payloadSize;
+    std::memcpy(bytes.data(), &header, sizeof(CookedHeader));
+
+    return bytes;
+}
+
+cooked::ReadResult cooked::read(const char* data, size_t size, Scene& scene, uint64_t& payloadOffset, uint64_t& payloadSize)
+{
+    CookedHeader header;
+    if (size < sizeof(CookedHeader))
+    {
+        return ReadResult::NotCooked;
+    }
+    std::memcpy(&header, data, sizeof(CookedHeader));
+
+    if (header.magic != COOKED_MAGIC)
+    {
+        return ReadResult::NotCooked;
+    }
+
+    const bool bKnownIndexStride = header.indexStride == sizeof(uint16_t) || header.indexStride == sizeof(uint32_t);
+    const bool bKnownVertexFormat = header.vertexFormat == VertexFormat::Full || header.vertexFormat == VertexFormat::Packed;
+    if (header.version != COOKED_VERSION
+        || !bKnownVertexFormat
+        || header.vertexStride != get_vertex_stride(header.vertexFormat)
+        || !bKnownIndexStride)
+    {
+        return ReadResult::OtherVersion;
+    }
+
+    std::vector<CookedMesh> meshes;
+    std::vector<GeoSurface> surfaces;
+    std::vector<MeshInstance> instances;
+    std::vector<SceneMaterial> materials;
+    std::vector<Image> images;
+    std::vector<char> names;
+    std::vector<Meshlet> meshlets;
+    const bool bTablesRead = read_cooked_table(data, size, header.meshes, meshes)
+        && read_cooked_table(data, size, header.surfaces, surfaces)
+        && read_cooked_table(data, size, header.instances, instances)
+        && read_cooked_table(data, size, header.materials, materials)
+        && read_cooked_table(data, size, header.images, images)
+        && read_cooked_table(data, size, header.names, names)
+        && read_cooked_table(data, size, header.meshlets, meshlets);
+
+    if (!bTablesRead
+        || header.payloadSize == 0
+        || header.payloadOffset > size
+        || header.payloadSize > size - header.payloadOffset
+        || !validate_cooked_scene(header, data + header.payloadOffset, meshes, surfaces, instances, materials, images, names, meshlets))
+    {
+        return ReadResult::Damaged;
+    }
+
+    scene.vertexFormat = header.vertexFormat;
+    scene.indexStride = header.indexStride;
+    scene.vertexBufferSize = header.vertexBufferSize;
+    scene.indexBufferSize = header.indexBufferSize;
+
+    scene.meshes.clear();
+    scene.meshes.reserve(meshes.size());
+    for (const CookedMesh& mesh : meshes)
+    {
+        MeshAsset& newMesh = scene.meshes.emplace_back();
+        newMesh.name = std::string(names.data() + mesh.nameOffset, mesh.nameLength);
+        newMesh.surfaces.assign(surfaces.begin() + mesh.firstSurface, surfaces.begin() + mesh.firstSurface + mesh.surfaceCount);
+    }
+    scene.instances = std::move(instances);
+    scene.meshlets = std::move(meshlets);
+    scene.materials = std::move(materials);
+    scene.images = std::move(images);
+
+    payloadOffset = header.payloadOffset;
+    payloadSize = header.payloadSize;
+    return ReadResult::Success;
+}
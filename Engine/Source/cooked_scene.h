@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "vk_loader.h"
+
+// A cooked scene is the header, the tables describing the scene and then the payload. The payload is a byte for byte
+// copy of the staging buffer the importer filled ([vertices][indices][pixels of every image]), so loading it needs no
+// parsing at all. Everything is stored little endian, the way the structs are laid out in memory.
+// These only deal with the bytes, load_cooked() and the cooking loaders do the files and the GPU.
+namespace cooked
+{
+    // Images that failed to decode when cooking are kept with a size of zero, so material image indices stay valid
+    struct Image
+    {
+        uint32_t width;
+        uint32_t height;
+        // Where the RGBA8 pixels start in the payload
+        uint64_t payloadOffset;
+    };
+
+    // Everything a cooked file describes its payload with
+    struct Scene
+    {
+        VertexFormat vertexFormat{VertexFormat::Full};
+        // 2 or 4 bytes
+        uint32_t indexStride{sizeof(uint32_t)};
+        uint64_t vertexBufferSize{0};
+        uint64_t indexBufferSize{0};
+
+        std::vector<MeshAsset> meshes;
+        std::vector<MeshInstance> instances;
+        std::vector<Meshlet> meshlets;
+        // The surfaces' material indices point in here
+        std::vector<SceneMaterial> materials;
+        std::vector<Image> images;
+    };
+
+    enum class ReadResult
+    {
+        Success,
+        NotCooked,
+        // Cooked by a build with another version of the format or another vertex layout
+        OtherVersion,
+        Damaged,
+    };
+
+    // The header and the tables, padded so the payloadSize bytes of payload can be written right after them
+    std::vector<char> write_tables(const Scene& scene, uint64_t payloadSize);
+
+    // Reads the tables of a whole cooked file and checks that nothing in them points outside of the payload or makes
+    // the GPU read outside of the scene's buffers. On success the payload is the payloadSize bytes at data + payloadOffset
+    ReadResult read(const char* data, size_t size, Scene& scene, uint64_t& payloadOffset, uint64_t& payloadSize);
+} // namespace cooked
@@ -0,0 +1,537 @@
+#include "culling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/matrix.hpp>
+#include <glm/vec3.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CULLING_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define CULLING_X86 0
+#endif
+
+// GCC and Clang only emit AVX2 in functions that ask for it, MSVC emits it anywhere
+#if defined(__GNUC__) || defined(__clang__)
+#define CULLING_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CULLING_TARGET_AVX2
+#endif
+
+namespace
+{
+    using culling::BoxArrays;
+    using culling::Frustum;
+    using culling::InstructionSet;
+    using culling::SphereArrays;
+
+    // The kernels below do their math in this exact order, so every instruction set finds the same objects visible
+    glm::vec3 transform_point(const glm::mat4& m, float x, float y, float z)
+    {
+        return {
+            m[0][0] * x + m[1][0] * y + m[2][0] * z + m[3][0],
+            m[0][1] * x + m[1][1] * y + m[2][1] * z + m[3][1],
+            m[0][2] * x + m[1][2] * y + m[2][2] * z + m[3][2]
+        };
+    }
+
+    bool is_inside_planes(const Frustum& frustum, const glm::vec3& center, const glm::vec3& extent, float radius)
+    {
+        for (const glm::vec4& plane : frustum.planes)
+        {
+            const float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+            const float reach = std::abs(plane.x) * extent.x + std::abs(plane.y) * extent.y + std::abs(plane.z) * extent.z + radius;
+            if (!(distance >= -reach))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t cull_boxes_scalar(
+        const Frustum& frustum,
+        const BoxArrays& boxes,
+        const glm::mat4* worldMatrices,
+        uint32_t begin,
+        uint32_t end,
+        uint32_t* visibleIndices,
+        uint32_t visibleCount
+    ) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const glm::mat4& m = worldMatrices[i];
+            const glm::vec3 center = transform_point(m, boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+
+            // The box around the transformed box: every world axis gets the local extents projected onto it
+            const float ex = boxes.extentX[i];
+            const float ey = boxes.extentY[i];
+            const float ez = boxes.extentZ[i];
+            const glm::vec3 extent = {
+                std::abs(m[0][0]) * ex + std::abs(m[1][0]) * ey + std::abs(m[2][0]) * ez,
+                std::abs(m[0][1]) * ex + std::abs(m[1][1]) * ey + std::abs(m[2][1]) * ez,
+                std::abs(m[0][2]) * ex + std::abs(m[1][2]) * ey + std::abs(m[2][2]) * ez
+            };
+
+            visibleIndices[visibleCount] = i;
+            visibleCount += is_inside_planes(frustum, center, extent, 0.0f) ? 1 : 0;
+        }
+        return visibleCount;
+    }
+
+    float get_max_scale(const glm::mat4& m)
+    {
+        const float scaleX = m[0][0] * m[0][0] + m[0][1] * m[0][1] + m[0][2] * m[0][2];
+        const float scaleY = m[1][0] * m[1][0] + m[1][1] * m[1][1] + m[1][2] * m[1][2];
+        const float scaleZ = m[2][0] * m[2][0] + m[2][1] * m[2][1] + m[2][2] * m[2][2];
+        return std::sqrt(std::max(std::max(scaleX, scaleY), scaleZ));
+    }
+
+    uint32_t cull_spheres_scalar(
+        const Frustum& frustum,
+        const SphereArrays& spheres,
+        const glm::mat4* worldMatrices,
+        uint32_t begin,
+        uint32_t end,
+        uint32_t* visibleIndices,
+        uint32_t visibleCount
+    ) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const glm::mat4& m = worldMatrices[i];
+            const glm::vec3 center = transform_point(m, spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i]);
+            const float radius = spheres.radius[i] * get_max_scale(m);
+
+            visibleIndices[visibleCount] = i;
+            visibleCount += is_inside_planes(frustum, center, glm::vec3{0.0f}, radius) ? 1 : 0;
+        }
+        return visibleCount;
+    }
+
+    // Appends the lanes set in mask without branching. Every lane is written, but only visible ones advance the count,
+    // which never runs past the lane's own index so the writes stay within the caller's array
+    uint32_t append_visible(uint32_t* visibleIndices, uint32_t visibleCount, uint32_t firstIndex, uint32_t mask, uint32_t laneCount)
+    {
+        for (uint32_t lane = 0; lane < laneCount; lane++)
+        {
+            visibleIndices[visibleCount] = firstIndex + lane;
+            visibleCount += (mask >> lane) & 1;
+        }
+        return visibleCount;
+    }
+
+#if CULLING_X86
+    // Rows 0 to 2 of four matrices, as rows[row][column] holding that element of every matrix. The last row of
+    // an affine transform is never needed
+    struct MatrixRows4
+    {
+        __m128 rows[3][4];
+    };
+
+    MatrixRows4 load_matrices_sse(const glm::mat4* matrices)
+    {
+        MatrixRows4 result;
+        for (int column = 0; column < 4; column++)
+        {
+            __m128 a = _mm_loadu_ps(&matrices[0][column][0]);
+            __m128 b = _mm_loadu_ps(&matrices[1][column][0]);
+            __m128 c = _mm_loadu_ps(&matrices[2][column][0]);
+            __m128 d = _mm_loadu_ps(&matrices[3][column][0]);
+            _MM_TRANSPOSE4_PS(a, b, c, d);
+
+            result.rows[0][column] = a;
+            result.rows[1][column] = b;
+            result.rows[2][column] = c;
+        }
+        return result;
+    }
+
+    __m128 abs_sse(__m128 value)
+    {
+        return _mm_andnot_ps(_mm_set1_ps(-0.0f), value);
+    }
+
+    // Lane mask of the objects with a world center and reach, along every plane normal, that touch the frustum
+    uint32_t test_planes_sse(
+        const Frustum& frustum,
+        __m128 x,
+        __m128 y,
+        __m128 z,
+        __m128 extentX,
+        __m128 extentY,
+        __m128 extentZ,
+        __m128 radius
+    ) {
+        __m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const glm::vec4& plane : frustum.planes)
+        {
+            __m128 distance = _mm_mul_ps(_mm_set1_ps(plane.x), x);
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.y), y));
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.z), z));
+            distance = _mm_add_ps(distance, _mm_set1_ps(plane.w));
+
+            __m128 reach = _mm_mul_ps(_mm_set1_ps(std::abs(plane.x)), extentX);
+            reach = _mm_add_ps(reach, _mm_mul_ps(_mm_set1_ps(std::abs(plane.y)), extentY));
+            reach = _mm_add_ps(reach, _mm_mul_ps(_mm_set1_ps(std::abs(plane.z)), extentZ));
+            reach = _mm_add_ps(reach, radius);
+
+            visible = _mm_and_ps(visible, _mm_cmpge_ps(distance, _mm_xor_ps(reach, _mm_set1_ps(-0.0f))));
+        }
+        return static_cast<uint32_t>(_mm_movemask_ps(visible));
+    }
+
+    __m128 transform_sse(const __m128 (&row)[4], __m128 x, __m128 y, __m128 z)
+    {
+        __m128 result = _mm_mul_ps(row[0], x);
+        result = _mm_add_ps(result, _mm_mul_ps(row[1], y));
+        result = _mm_add_ps(result, _mm_mul_ps(row[2], z));
+        return _mm_add_ps(result, row[3]);
+    }
+
+    __m128 transform_extent_sse(const __m128 (&row)[4], __m128 x, __m128 y, __m128 z)
+    {
+        __m128 result = _mm_mul_ps(abs_sse(row[0]), x);
+        result = _mm_add_ps(result, _mm_mul_ps(abs_sse(row[1]), y));
+        return _mm_add_ps(result, _mm_mul_ps(abs_sse(row[2]), z));
+    }
+
+    uint32_t cull_boxes_sse(const Frustum& frustum, const BoxArrays& boxes, const glm::mat4* worldMatrices, uint32_t count, uint32_t* visibleIndices)
+    {
+        uint32_t visibleCount = 0;
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            const MatrixRows4 m = load_matrices_sse(worldMatrices + i);
+
+            const __m128 cx = _mm_loadu_ps(boxes.centerX + i);
+            const __m128 cy = _mm_loadu_ps(boxes.centerY + i);
+            const __m128 cz = _mm_loadu_ps(boxes.centerZ + i);
+            const __m128 ex = _mm_loadu_ps(boxes.extentX + i);
+            const __m128 ey = _mm_loadu_ps(boxes.extentY + i);
+            const __m128 ez = _mm_loadu_ps(boxes.extentZ + i);
+
+            const uint32_t mask = test_planes_sse(
+                frustum,
+                transform_sse(m.rows[0], cx, cy, cz),
+                transform_sse(m.rows[1], cx, cy, cz),
+                transform_sse(m.rows[2], cx, cy, cz),
+                transform_extent_sse(m.rows[0], ex, ey, ez),
+                transform_extent_sse(m.rows[1], ex, ey, ez),
+                transform_extent_sse(m.rows[2], ex, ey, ez),
+                _mm_setzero_ps()
+            );
+            visibleCount = append_visible(visibleIndices, visibleCount, i, mask, 4);
+        }
+        return cull_boxes_scalar(frustum, boxes, worldMatrices, i, count, visibleIndices, visibleCount);
+    }
+
+    __m128 get_max_scale_sse(const MatrixRows4& m)
+    {
+        __m128 scale = _mm_setzero_ps();
+        for (int column = 0; column < 3; column++)
+        {
+            __m128 lengthSquared = _mm_mul_ps(m.rows[0][column], m.rows[0][column]);
+            lengthSquared = _mm_add_ps(lengthSquared, _mm_mul_ps(m.rows[1][column], m.rows[1][column]));
+            lengthSquared = _mm_add_ps(lengthSquared, _mm_mul_ps(m.rows[2][column], m.rows[2][column]));
+            scale = _mm_max_ps(scale, lengthSquared);
+        }
+        return _mm_sqrt_ps(scale);
+    }
+
+    uint32_t cull_spheres_sse(const Frustum& frustum, const SphereArrays& spheres, const glm::mat4* worldMatrices, uint32_t count, uint32_t* visibleIndices)
+    {
+        uint32_t visibleCount = 0;
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            const MatrixRows4 m = load_matrices_sse(worldMatrices + i);
+
+            const __m128 cx = _mm_loadu_ps(spheres.centerX + i);
+            const __m128 cy = _mm_loadu_ps(spheres.centerY + i);
+            const __m128 cz = _mm_loadu_ps(spheres.centerZ + i);
+            const __m128 radius = _mm_mul_ps(_mm_loadu_ps(spheres.radius + i), get_max_scale_sse(m));
+
+            const __m128 zero = _mm_setzero_ps();
+            const uint32_t mask = test_planes_sse(
+                frustum,
+                transform_sse(m.rows[0], cx, cy, cz),
+                transform_sse(m.rows[1], cx, cy, cz),
+                transform_sse(m.rows[2], cx, cy, cz),
+                zero,
+                zero,
+                zero,
+                radius
+            );
+            visibleCount = append_visible(visibleIndices, visibleCount, i, mask, 4);
+        }
+        return cull_spheres_scalar(frustum, spheres, worldMatrices, i, count, visibleIndices, visibleCount);
+    }
+
+    // The AVX2 kernels are the SSE ones at twice the width. Matrices are still transposed four at a time,
+    // the two halves are then joined into one register
+    struct MatrixRows8
+    {
+        __m256 rows[3][4];
+    };
+
+    CULLING_TARGET_AVX2 MatrixRows8 load_matrices_avx2(const glm::mat4* matrices)
+    {
+        const MatrixRows4 low = load_matrices_sse(matrices);
+        const MatrixRows4 high = load_matrices_sse(matrices + 4);
+
+        MatrixRows8 result;
+        for (int row = 0; row < 3; row++)
+        {
+            for (int column = 0; column < 4; column++)
+            {
+                result.rows[row][column] = _mm256_insertf128_ps(_mm256_castps128_ps256(low.rows[row][column]), high.rows[row][column], 1);
+            }
+        }
+        return result;
+    }
+
+    CULLING_TARGET_AVX2 __m256 abs_avx2(__m256 value)
+    {
+        return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), value);
+    }
+
+    CULLING_TARGET_AVX2 uint32_t test_planes_avx2(
+        const Frustum& frustum,
+        __m256 x,
+        __m256 y,
+        __m256 z,
+        __m256 extentX,
+        __m256 extentY,
+        __m256 extentZ,
+        __m256 radius
+    ) {
+        __m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const glm::vec4& plane : frustum.planes)
+        {
+            __m256 distance = _mm256_mul_ps(_mm256_set1_ps(plane.x), x);
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.y), y));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.z), z));
+            distance = _mm256_add_ps(distance, _mm256_set1_ps(plane.w));
+
+            __m256 reach = _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.x)), extentX);
+            reach = _mm256_add_ps(reach, _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.y)), extentY));
+            reach = _mm256_add_ps(reach, _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.z)), extentZ));
+            reach = _mm256_add_ps(reach, radius);
+
+            visible = _mm256_and_ps(visible, _mm256_cmp_ps(distance, _mm256_xor_ps(reach, _mm256_set1_ps(-0.0f)), _CMP_GE_OQ));
+        }
+        return static_cast<uint32_t>(_mm256_movemask_ps(visible));
+    }
+
+    CULLING_TARGET_AVX2 __m256 transform_avx2(const __m256 (&row)[4], __m256 x, __m256 y, __m256 z)
+    {
+        __m256 result = _mm256_mul_ps(row[0], x);
+        result = _mm256_add_ps(result, _mm256_mul_ps(row[1], y));
+        result = _mm256_add_ps(result, _mm256_mul_ps(row[2], z));
+        return _mm256_add_ps(result, row[3]);
+    }
+
+    CULLING_TARGET_AVX2 __m256 transform_extent_avx2(const __m256 (&row)[4], __m256 x, __m256 y, __m256 z)
+    {
+        __m256 result = _mm256_mul_ps(abs_avx2(row[0]), x);
+        result = _mm256_add_ps(result, _mm256_mul_ps(abs_avx2(row[1]), y));
+        return _mm256_add_ps(result, _mm256_mul_ps(abs_avx2(row[2]), z));
+    }
+
+    CULLING_TARGET_AVX2 uint32_t cull_boxes_avx2(
+        const Frustum& frustum,
+        const BoxArrays& boxes,
+        const glm::mat4* worldMatrices,
+        uint32_t count,
+        uint32_t* visibleIndices
+    ) {
+        uint32_t visibleCount = 0;
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            const MatrixRows8 m = load_matrices_avx2(worldMatrices + i);
+
+            const __m256 cx = _mm256_loadu_ps(boxes.centerX + i);
+            const __m256 cy = _mm256_loadu_ps(boxes.centerY + i);
+            const __m256 cz = _mm256_loadu_ps(boxes.centerZ + i);
+            const __m256 ex = _mm256_loadu_ps(boxes.extentX + i);
+            const __m256 ey = _mm256_loadu_ps(boxes.extentY + i);
+            const __m256 ez = _mm256_loadu_ps(boxes.extentZ + i);
+
+            const uint32_t mask = test_planes_avx2(
+                frustum,
+                transform_avx2(m.rows[0], cx, cy, cz),
+                transform_avx2(m.rows[1], cx, cy, cz),
+                transform_avx2(m.rows[2], cx, cy, cz),
+                transform_extent_avx2(m.rows[0], ex, ey, ez),
+                transform_extent_avx2(m.rows[1], ex, ey, ez),
+                transform_extent_avx2(m.rows[2], ex, ey, ez),
+                _mm256_setzero_ps()
+            );
+            visibleCount = append_visible(visibleIndices, visibleCount, i, mask, 8);
+        }
+        return cull_boxes_scalar(frustum, boxes, worldMatrices, i, count, visibleIndices, visibleCount);
+    }
+
+    CULLING_TARGET_AVX2 __m256 get_max_scale_avx2(const MatrixRows8& m)
+    {
+        __m256 scale = _mm256_setzero_ps();
+        for (int column = 0; column < 3; column++)
+        {
+            __m256 lengthSquared = _mm256_mul_ps(m.rows[0][column], m.rows[0][column]);
+            lengthSquared = _mm256_add_ps(lengthSquared, _mm256_mul_ps(m.rows[1][column], m.rows[1][column]));
+            lengthSquared = _mm256_add_ps(lengthSquared, _mm256_mul_ps(m.rows[2][column], m.rows[2][column]));
+            scale = _mm256_max_ps(scale, lengthSquared);
+        }
+        return _mm256_sqrt_ps(scale);
+    }
+
+    CULLING_TARGET_AVX2 uint32_t cull_spheres_avx2(
+        const Frustum& frustum,
+        const SphereArrays& spheres,
+        const glm::mat4* worldMatrices,
+        uint32_t count,
+        uint32_t* visibleIndices
+    ) {
+        uint32_t visibleCount = 0;
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            const MatrixRows8 m = load_matrices_avx2(worldMatrices + i);
+
+            const __m256 cx = _mm256_loadu_ps(spheres.centerX + i);
+            const __m256 cy = _mm256_loadu_ps(spheres.centerY + i);
+            const __m256 cz = _mm256_loadu_ps(spheres.centerZ + i);
+            const __m256 radius = _mm256_mul_ps(_mm256_loadu_ps(spheres.radius + i), get_max_scale_avx2(m));
+
+            const __m256 zero = _mm256_setzero_ps();
+            const uint32_t mask = test_planes_avx2(
+                frustum,
+                transform_avx2(m.rows[0], cx, cy, cz),
+                transform_avx2(m.rows[1], cx, cy, cz),
+                transform_avx2(m.rows[2], cx, cy, cz),
+                zero,
+                zero,
+                zero,
+                radius
+            );
+            visibleCount = append_visible(visibleIndices, visibleCount, i, mask, 8);
+        }
+        return cull_spheres_scalar(frustum, spheres, worldMatrices, i, count, visibleIndices, visibleCount);
+    }
+#endif
+
+    InstructionSet detect_instruction_set()
+    {
+#if CULLING_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+        // AVX2 needs both the CPU to support it and the OS to save the wider registers on a context switch
+        int info[4];
+        __cpuid(info, 0);
+        const int maxLeaf = info[0];
+        __cpuid(info, 1);
+        const bool bOsSavesAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+        if (bOsSavesAvx && maxLeaf >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            if ((info[1] & (1 << 5)) != 0)
+            {
+                return InstructionSet::Avx2;
+            }
+        }
+        return InstructionSet::Sse;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? InstructionSet::Avx2 : InstructionSet::Sse;
+#endif
+#else
+        return InstructionSet::Scalar;
+#endif
+    }
+}
+
+culling::Frustum culling::extract_frustum(const glm::mat4& viewProjection)
+{
+    // Gribb and Hartmann: a clip space bound like -w <= x is a plane through the rows of the matrix, row 3 + row 0 there
+    const glm::mat4 rows = glm::transpose(viewProjection);
+
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0];
+    frustum.planes[1] = rows[3] - rows[0];
+    frustum.planes[2] = rows[3] + rows[1];
+    frustum.planes[3] = rows[3] - rows[1];
+    // Depth bounds follow whatever range glm builds its projections for, both planes hold with reversed depth too
+#if GLM_CONFIG_CLIP_CONTROL & GLM_CLIP_CONTROL_ZO_BIT
+    frustum.planes[4] = rows[2];
+#else
+    frustum.planes[4] = rows[3] + rows[2];
+#endif
+    frustum.planes[5] = rows[3] - rows[2];
+
+    // Normalized, so sphere radii and box extents compare against actual distances
+    for (glm::vec4& plane : frustum.planes)
+    {
+        plane /= std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+    }
+
+    return frustum;
+}
+
+culling::InstructionSet culling::get_instruction_set()
+{
+    static const InstructionSet instructionSet = detect_instruction_set();
+    return instructionSet;
+}
+
+const char* culling::get_instruction_set_name(InstructionSet instructionSet)
+{
+    switch (instructionSet)
+    {
+        case InstructionSet::Scalar: return "scalar";
+        case InstructionSet::Sse: return "SSE";
+        case InstructionSet::Avx2: return "AVX2";
+    }
+    return "unknown";
+}
+
+uint32_t culling::cull_boxes(
+    const Frustum& frustum,
+    const BoxArrays& boxes,
+    const glm::mat4* worldMatrices,
+    uint32_t count,
+    uint32_t* visibleIndices,
+    InstructionSet instructionSet
+) {
+    // Never run more than the CPU supports, whatever was asked for
+    switch (std::min(instructionSet, get_instruction_set()))
+    {
+#if CULLING_X86
+        case InstructionSet::Avx2: return cull_boxes_avx2(frustum, boxes, worldMatrices, count, visibleIndices);
+        case InstructionSet::Sse: return cull_boxes_sse(frustum, boxes, worldMatrices, count, visibleIndices);
+#endif
+        default: return cull_boxes_scalar(frustum, boxes, worldMatrices, 0, count, visibleIndices, 0);
+    }
+}
+
+uint32_t culling::cull_spheres(
+    const Frustum& frustum,
+    const SphereArrays& spheres,
+    const glm::mat4* worldMatrices,
+    uint32_t count,
+    uint32_t* visibleIndices,
+    InstructionSet instructionSet
+) {
+    switch (std::min(instructionSet, get_instruction_set()))
+    {
+#if CULLING_X86
+        case InstructionSet::Avx2: return cull_spheres_avx2(frustum, spheres, worldMatrices, count, visibleIndices);
+        case InstructionSet::Sse: return cull_spheres_sse(frustum, spheres, worldMatrices, count, visibleIndices);
+#endif
+        default: return cull_spheres_scalar(frustum, spheres, worldMatrices, 0, count, visibleIndices, 0);
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+
+// Frustum culling of large batches of objects on the CPU. Bounds come in structure-of-arrays form so the kernels
+// transform and test 4 (SSE) or 8 (AVX2) objects at once, the widest one the CPU supports is picked at runtime.
+namespace culling
+{
+    // World space planes as (normal, distance) with the normals pointing inward,
+    // a point p is inside a plane when dot(normal, p) + distance >= 0
+    struct Frustum
+    {
+        std::array<glm::vec4, 6> planes;
+    };
+
+    // Works for any projection that maps the view volume to Vulkan's clip space, reversed depth included
+    Frustum extract_frustum(const glm::mat4& viewProjection);
+
+    // Local space axis aligned boxes, every array holds one element per object
+    struct BoxArrays
+    {
+        const float* centerX;
+        const float* centerY;
+        const float* centerZ;
+        const float* extentX;
+        const float* extentY;
+        const float* extentZ;
+    };
+
+    // Local space spheres, every array holds one element per object
+    struct SphereArrays
+    {
+        const float* centerX;
+        const float* centerY;
+        const float* centerZ;
+        const float* radius;
+    };
+
+    enum class InstructionSet
+    {
+        Scalar,
+        Sse,
+        Avx2,
+    };
+
+    // The widest instruction set the CPU running this supports, detected once
+    InstructionSet get_instruction_set();
+    const char* get_instruction_set_name(InstructionSet instructionSet);
+
+    // Transforms every box by its world matrix and writes the indices of the ones touching the frustum to
+    // visibleIndices, in increasing order. visibleIndices must have room for count indices. Returns the amount visible.
+    // Boxes are tested as the world space box around the transformed box, which is conservative.
+    uint32_t cull_boxes(
+        const Frustum& frustum,
+        const BoxArrays& boxes,
+        const glm::mat4* worldMatrices,
+        uint32_t count,
+        uint32_t* visibleIndices,
+        InstructionSet instructionSet = get_instruction_set()
+    );
+
+    // The same for spheres, which grow with the largest axis scale of their world matrix
+    uint32_t cull_spheres(
+        const Frustum& frustum,
+        const SphereArrays& spheres,
+        const glm::mat4* worldMatrices,
+        uint32_t count,
+        uint32_t* visibleIndices,
+        InstructionSet instructionSet = get_instruction_set()
+    );
+} // namespace culling
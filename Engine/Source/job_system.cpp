@@ -0,0 +1,321 @@
+#include "job_system.h"
+
+#include <algorithm>
+
+namespace
+{
+    thread_local uint32_t tlsThreadIndex = 0;
+}
+
+JobSystem::~JobSystem()
+{
+    Shutdown();
+}
+
+void JobSystem::Init(std::optional<uint32_t> requestedWorkerCount)
+{
+    uint32_t workerCount = 0;
+    if (requestedWorkerCount)
+    {
+        workerCount = *requestedWorkerCount;
+    }
+    else
+    {
+        const uint32_t hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        workerCount = hardwareThreads - 1;
+    }
+
+    // Queue 0 belongs to the thread calling Init(), the rest to the workers
+    tlsThreadIndex = 0;
+    queues.resize(workerCount + 1);
+    for (auto& queue : queues)
+    {
+        queue = std::make_unique<JobQueue>();
+    }
+
+    bRunning = true;
+    workers.reserve(workerCount);
+    for (uint32_t i = 1; i <= workerCount; i++)
+    {
+        workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+    }
+}
+
+void JobSystem::Shutdown()
+{
+    if (!bRunning)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard lock(sleepMutex);
+        bRunning = false;
+    }
+    sleepCondition.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    workers.clear();
+    queues.clear();
+    backgroundQueue.jobs.clear();
+}
+
+uint32_t JobSystem::GetThreadIndex()
+{
+    return tlsThreadIndex;
+}
+
+void JobSystem::Run(JobFunction&& job, Counter* counter)
+{
+    if (counter)
+    {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Push({std::move(job), counter});
+}
+
+void JobSystem::RunBackground(JobFunction&& job, Counter* counter)
+{
+    if (counter)
+    {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard lock(backgroundQueue.mutex);
+        backgroundQueue.jobs.push_back({std::move(job), counter});
+    }
+
+    queuedJobs.fetch_add(1, std::memory_order_release);
+
+    {
+        std::lock_guard lock(sleepMutex);
+    }
+    sleepCondition.notify_one();
+}
+
+void JobSystem::RunAfter(Counter& dependency, JobFunction&& job, Counter* counter)
+{
+    if (counter)
+    {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    {
+        // Finish() drops the dependency to zero under the same lock,
+        // so a continuation added while it is still pending can never be missed.
+        std::lock_guard lock(dependency.continuationMutex);
+        if (!dependency.IsDone())
+        {
+            dependency.continuations.emplace_back(std::move(job), counter);
+            return;
+        }
+    }
+
+    Push({std::move(job), counter});
+}
+
+void JobSystem::Wait(const Counter& counter)
+{
+    const uint32_t threadIndex = GetThreadIndex();
+
+    while (!counter.IsDone())
+    {
+        if (!TryExecuteOne(threadIndex) && !TryExecuteBackground(threadIndex, &counter))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    // The last job may still be inside Finish(). Once we get the lock it is done touching the counter,
+    // so the caller is free to destroy it.
+    std::lock_guard lock(counter.continuationMutex);
+}
+
+void JobSystem::ParallelFor(uint32_t count, uint32_t batchSize, const std::function<void(uint32_t begin, uint32_t end, uint32_t threadIndex)>& function)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    batchSize = std::max(batchSize, 1u);
+
+    Counter counter;
+    for (uint32_t begin = 0; begin < count; begin += batchSize)
+    {
+        const uint32_t end = std::min(begin + batchSize, count);
+        Run([&function, begin, end](uint32_t threadIndex) { function(begin, end, threadIndex); }, &counter);
+    }
+
+    Wait(counter);
+}
+
+void JobSystem::Push(Job&& job)
+{
+    uint32_t threadIndex = GetThreadIndex();
+    if (threadIndex >= queues.size())
+    {
+        threadIndex = 0;
+    }
+
+    {
+        JobQueue& queue = *queues[threadIndex];
+        std::lock_guard lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+
+    queuedJobs.fetch_add(1, std::memory_order_release);
+
+    // Take the lock so a worker that just decided to go to sleep cannot miss the notification
+    {
+        std::lock_guard lock(sleepMutex);
+    }
+    sleepCondition.notify_one();
+}
+
+bool JobSystem::TryPop(uint32_t threadIndex, Job& job)
+{
+    JobQueue& queue = *queues[threadIndex];
+    std::lock_guard lock(queue.mutex);
+
+    if (queue.jobs.empty())
+    {
+        return false;
+    }
+
+    // Newest first, its data is most likely still in cache
+    job = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+    return true;
+}
+
+bool JobSystem::TrySteal(uint32_t threadIndex, Job& job)
+{
+    const uint32_t queueCount = static_cast<uint32_t>(queues.size());
+
+    for (uint32_t offset = 1; offset < queueCount; offset++)
+    {
+        JobQueue& victim = *queues[(threadIndex + offset) % queueCount];
+        std::unique_lock lock(victim.mutex, std::try_to_lock);
+
+        if (!lock.owns_lock() || victim.jobs.empty())
+        {
+            continue;
+        }
+
+        // Oldest first, those tend to be the biggest chunks of remaining work
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+bool JobSystem::TryExecuteOne(uint32_t threadIndex)
+{
+    if (threadIndex >= queues.size())
+    {
+        threadIndex = 0;
+    }
+
+    Job job;
+    if (!TryPop(threadIndex, job) && !TrySteal(threadIndex, job))
+    {
+        return false;
+    }
+
+    Execute(threadIndex, job);
+    return true;
+}
+
+bool JobSystem::TryExecuteBackground(uint32_t threadIndex, const Counter* counter)
+{
+    if (threadIndex >= queues.size())
+    {
+        threadIndex = 0;
+    }
+
+    Job job;
+    {
+        std::lock_guard lock(backgroundQueue.mutex);
+
+        // Oldest first, they were asked for first
+        const auto found = counter
+            ? std::find_if(backgroundQueue.jobs.begin(), backgroundQueue.jobs.end(), [counter](const Job& queued) { return queued.counter == counter; })
+            : backgroundQueue.jobs.begin();
+        if (found == backgroundQueue.jobs.end())
+        {
+            return false;
+        }
+
+        job = std::move(*found);
+        backgroundQueue.jobs.erase(found);
+    }
+
+    Execute(threadIndex, job);
+    return true;
+}
+
+void JobSystem::Execute(uint32_t threadIndex, Job& job)
+{
+    queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+
+    job.function(threadIndex);
+    Finish(job.counter);
+}
+
+void JobSystem::Finish(Counter* counter)
+{
+    if (!counter)
+    {
+        return;
+    }
+
+    std::vector<std::pair<JobFunction, Counter*>> released;
+    {
+        // Decrementing under the lock means RunAfter() either sees the counter pending and gets its
+        // continuation released here, or sees it done and runs the job itself.
+        std::lock_guard lock(counter->continuationMutex);
+        if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        {
+            return;
+        }
+        released.swap(counter->continuations);
+    }
+
+    for (auto& [function, continuationCounter] : released)
+    {
+        Push({std::move(function), continuationCounter});
+    }
+}
+
+void JobSystem::WorkerLoop(uint32_t threadIndex)
+{
+    tlsThreadIndex = threadIndex;
+
+    while (true)
+    {
+        if (TryExecuteOne(threadIndex) || TryExecuteBackground(threadIndex, nullptr))
+        {
+            continue;
+        }
+
+        std::unique_lock lock(sleepMutex);
+        sleepCondition.wait(lock, [this]() -> bool
+        {
+            return !bRunning || queuedJobs.load(std::memory_order_acquire) > 0;
+        });
+
+        if (!bRunning)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Work-stealing job scheduler.
+// Every thread (the main thread is thread 0, workers are 1..N) owns a deque of jobs.
+// Threads push and pop their own deque from the back and steal from the front of the others,
+// so freshly spawned work stays hot in the cache of the thread that spawned it.
+class JobSystem
+{
+public:
+    // The thread index is stable for the lifetime of the job system,
+    // which lets jobs index per-thread resources (command pools, scratch memory) without locking.
+    using JobFunction = std::function<void(uint32_t threadIndex)>;
+
+    // Tracks a group of jobs. Wait() on it returns once every job added to it has finished,
+    // and RunAfter() can chain jobs onto it.
+    struct Counter
+    {
+        std::atomic<uint32_t> pending{0};
+
+        // Also guards the final decrement, see JobSystem::Finish()
+        mutable std::mutex continuationMutex;
+        std::vector<std::pair<JobFunction, Counter*>> continuations;
+
+        bool IsDone() const { return pending.load(std::memory_order_acquire) == 0; }
+    };
+
+    JobSystem() = default;
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+    ~JobSystem();
+
+    // Without a workerCount it spawns one worker per hardware thread, minus the calling thread.
+    // 0 workers runs every job on the calling thread while it waits
+    void Init(std::optional<uint32_t> workerCount = std::nullopt);
+    void Shutdown();
+
+    // Worker threads plus the thread that called Init()
+    uint32_t GetThreadCount() const { return static_cast<uint32_t>(queues.size()); }
+    // Index of the calling thread, 0 for the main thread
+    static uint32_t GetThreadIndex();
+
+    void Run(JobFunction&& job, Counter* counter = nullptr);
+    // For long running work nothing waits on soon, such as pipeline compiles. Workers only pick these up once they are
+    // out of other jobs, and Wait() only runs the ones tracked by the counter it waits on, so waiting for a batch of
+    // frame work never gets stuck behind one of these on the main thread
+    void RunBackground(JobFunction&& job, Counter* counter = nullptr);
+    // Schedules job once every job tracked by dependency has finished
+    void RunAfter(Counter& dependency, JobFunction&& job, Counter* counter = nullptr);
+
+    // Executes other jobs while waiting, so waiting from inside a job does not deadlock. Of the background jobs it only
+    // executes the ones counted by counter
+    void Wait(const Counter& counter);
+
+    // Splits [0, count) into batches of batchSize and runs function(begin, end, threadIndex) on each, then waits
+    void ParallelFor(uint32_t count, uint32_t batchSize, const std::function<void(uint32_t begin, uint32_t end, uint32_t threadIndex)>& function);
+
+private:
+    struct Job
+    {
+        JobFunction function;
+        Counter* counter;
+    };
+
+    struct alignas(64) JobQueue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    void Push(Job&& job);
+    bool TryPop(uint32_t threadIndex, Job& job);
+    bool TrySteal(uint32_t threadIndex, Job& job);
+    bool TryExecuteOne(uint32_t threadIndex);
+    // Any background job when counter is null, otherwise only one counted by it
+    bool TryExecuteBackground(uint32_t threadIndex, const Counter* counter);
+    void Execute(uint32_t threadIndex, Job& job);
+    void Finish(Counter* counter);
+    void WorkerLoop(uint32_t threadIndex);
+
+    std::vector<std::unique_ptr<JobQueue>> queues;
+    // Shared by every thread and never stolen from, see RunBackground()
+    JobQueue backgroundQueue;
+    std::vector<std::thread> workers;
+
+    // Sleeping workers are woken up whenever new work arrives
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<uint32_t> queuedJobs{0};
+    std::atomic<bool> bRunning{false};
+};
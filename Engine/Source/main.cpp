@@ -1,12 +1,81 @@
+#include <benchmarks.h>
+#include <cstdlib>
+#include <cstring>
+#include <tests.h>
 #include <vk_engine.h>
 
+static EngineSettings ParseSettings(int argc, char* argv[])
+{
+    EngineSettings settings;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const bool bHasValue = i + 1 < argc;
+
+        if (strcmp(argv[i], "--headless") == 0) { settings.bHeadless = true; }
+        else if (strcmp(argv[i], "--frames-in-flight") == 0 && bHasValue) { settings.framesInFlight = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10)); }
+        else if (strcmp(argv[i], "--workers") == 0 && bHasValue) { settings.workerThreadCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10)); }
+        else if (strcmp(argv[i], "--headless-images") == 0 && bHasValue) { settings.headlessImageCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10)); }
+        else if (strcmp(argv[i], "--frames") == 0 && bHasValue) { settings.headlessFrameCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10)); }
+        else if (strcmp(argv[i], "--scene") == 0 && bHasValue) { settings.scenePath = argv[++i]; }
+        else if (strcmp(argv[i], "--cook") == 0 && bHasValue) { settings.cookPath = argv[++i]; }
+        else if (strcmp(argv[i], "--no-mesh-optimization") == 0) { settings.bOptimizeMeshes = false; }
+        else if (strcmp(argv[i], "--pack-vertices") == 0) { settings.bPackVertices = true; }
+        else if (strcmp(argv[i], "--generate-lods") == 0) { settings.bGenerateLods = true; }
+        else if (strcmp(argv[i], "--no-meshlets") == 0) { settings.bBuildMeshlets = false; }
+        else if (strcmp(argv[i], "--lod-pixel-error") == 0 && bHasValue) { settings.lodPixelError = std::strtof(argv[++i], nullptr); }
+        else if (strcmp(argv[i], "--gpu-driven") == 0) { settings.bGpuDriven = true; }
+        else if (strcmp(argv[i], "--no-occlusion-culling") == 0) { settings.bOcclusionCulling = false; }
+        else if (strcmp(argv[i], "--staging-ring-mb") == 0 && bHasValue) { settings.stagingRingSize = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024; }
+        else if (strcmp(argv[i], "--no-direct-device-writes") == 0) { settings.bDirectDeviceWrites = false; }
+        else if (strcmp(argv[i], "--frame-data-mb") == 0 && bHasValue) { settings.frameDataSize = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024; }
+        else if (strcmp(argv[i], "--defrag-mb-per-frame") == 0 && bHasValue) { settings.defragmentationBytesPerFrame = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024; }
+        else if (strcmp(argv[i], "--memory-stats") == 0 && bHasValue) { settings.memoryStatsPath = argv[++i]; settings.bDumpMemoryStatsOnExit = true; }
+        else { fmt::println("Ignoring unknown argument: {}", argv[i]); }
+    }
+
+    return settings;
+}
+
 int main(int argc, char* argv[])
 {
+    // Benchmarks and tests run standalone, without bringing up the engine
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--test") == 0)
+        {
+            return tests::run_all() == 0 ? 0 : 1;
+        }
+        if (strcmp(argv[i], "--bench-jobs") == 0)
+        {
+            bench::job_system();
+            return 0;
+        }
+        if (strcmp(argv[i], "--bench-culling") == 0)
+        {
+            bench::frustum_culling();
+            return 0;
+        }
+    }
+
     VulkanEngine engine;
+    engine.settings = ParseSettings(argc, argv);
+
+    // Cooking only needs the scene loaded, there is nothing to show
+    const bool bCookOnly = !engine.settings.cookPath.empty();
+    if (bCookOnly)
+    {
+        engine.settings.bHeadless = true;
+    }
 
     engine.Init();
-    engine.Run();
+    // The loaders drop a scene they failed to cook, so scripts cooking their assets find out from the exit code
+    const bool bCookFailed = bCookOnly && engine.loadedScenes.empty();
+    if (!bCookOnly)
+    {
+        engine.Run();
+    }
     engine.Cleanup();
 
-    return 0;
+    return bCookFailed ? 1 : 0;
 }
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+// Read-only view of a whole file, mapped into the address space instead of read up front.
+// Pages are faulted in on first touch, so several threads can parse different parts of a big file
+// without anyone having to copy it into a buffer first.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    // Fails for missing and for empty files, as there is nothing to map in the latter
+    bool Open(const std::filesystem::path& path);
+    void Close();
+
+    const char* GetData() const { return data; }
+    size_t GetSize() const { return size; }
+
+private:
+    const char* data{nullptr};
+    size_t size{0};
+
+#ifdef _WIN32
+    void* fileHandle{nullptr};
+    void* mappingHandle{nullptr};
+#endif
+};
\ No newline at end of file
@@ -0,0 +1,1185 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <glm/geometric.hpp>
+
+namespace
+{
+    // Forsyth's tuning. The cache is simulated as LRU and a little bigger than the analysis one,
+    // which the original article found to give the best results on all cache sizes
+    constexpr uint32_t FORSYTH_CACHE_SIZE = 32;
+    constexpr float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+    constexpr float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+    constexpr float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+    constexpr float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+    // Vertices with more triangles left than this share the score of the last table entry
+    constexpr uint32_t FORSYTH_VALENCE_TABLE_SIZE = 64;
+
+    constexpr size_t NO_TRIANGLE = ~static_cast<size_t>(0);
+
+    // How much worse the ACMR is allowed to get to reduce overdraw
+    constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+    struct ForsythScoreTables
+    {
+        float cache[FORSYTH_CACHE_SIZE];
+        float valence[FORSYTH_VALENCE_TABLE_SIZE];
+
+        ForsythScoreTables()
+        {
+            for (uint32_t i = 0; i < FORSYTH_CACHE_SIZE; i++)
+            {
+                // The last triangle's vertices get a fixed score that is deliberately lower than the next few,
+                // otherwise the optimizer would keep picking triangles that share an edge with the last one
+                const float scaler = 1.0f / static_cast<float>(FORSYTH_CACHE_SIZE - 3);
+                cache[i] = i < 3
+                    ? FORSYTH_LAST_TRIANGLE_SCORE
+                    : std::pow(1.0f - static_cast<float>(i - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+            }
+
+            valence[0] = 0.0f;
+            for (uint32_t i = 1; i < FORSYTH_VALENCE_TABLE_SIZE; i++)
+            {
+                // Vertices with few triangles left get a boost, so they are finished off instead of left behind
+                valence[i] = FORSYTH_VALENCE_BOOST_SCALE * std::pow(static_cast<float>(i), -FORSYTH_VALENCE_BOOST_POWER);
+            }
+        }
+    };
+
+    float get_forsyth_score(const ForsythScoreTables& tables, int32_t cachePosition, uint32_t remainingTriangles)
+    {
+        if (remainingTriangles == 0)
+        {
+            return -1.0f;
+        }
+
+        const float cacheScore = cachePosition >= 0 ? tables.cache[cachePosition] : 0.0f;
+        return cacheScore + tables.valence[std::min(remainingTriangles, FORSYTH_VALENCE_TABLE_SIZE - 1)];
+    }
+
+    // Simulates a FIFO cache the cheap way: a vertex is still cached when fewer than cacheSize misses happened since it was loaded.
+    // Moving time forward by more than cacheSize flushes the whole cache.
+    struct FifoCache
+    {
+        std::vector<uint32_t> loadedAt;
+        uint32_t time;
+        uint32_t cacheSize;
+
+        FifoCache(size_t vertexCount, uint32_t size) : loadedAt(vertexCount, 0), time(size + 1), cacheSize(size) {}
+
+        // Returns 1 for a miss
+        uint32_t Access(uint32_t vertex)
+        {
+            if (time - loadedAt[vertex] > cacheSize)
+            {
+                loadedAt[vertex] = time++;
+                return 1;
+            }
+
+            return 0;
+        }
+
+        void Flush() { time += cacheSize + 1; }
+    };
+
+    // Sum of squared distances to a set of planes, weighted by the area of the triangles they came from.
+    // Stored as the upper half of the symmetric 4x4 matrix, in doubles as the terms get large before they cancel out.
+    struct Quadric
+    {
+        double a00{0.0}, a11{0.0}, a22{0.0};
+        double a01{0.0}, a02{0.0}, a12{0.0};
+        double b0{0.0}, b1{0.0}, b2{0.0};
+        double c{0.0};
+        double weight{0.0};
+
+        void AddPlane(const glm::dvec3& normal, double distance, double planeWeight)
+        {
+            a00 += planeWeight * normal.x * normal.x;
+            a11 += planeWeight * normal.y * normal.y;
+            a22 += planeWeight * normal.z * normal.z;
+            a01 += planeWeight * normal.x * normal.y;
+            a02 += planeWeight * normal.x * normal.z;
+            a12 += planeWeight * normal.y * normal.z;
+            b0 += planeWeight * normal.x * distance;
+            b1 += planeWeight * normal.y * distance;
+            b2 += planeWeight * normal.z * distance;
+            c += planeWeight * distance * distance;
+            weight += planeWeight;
+        }
+
+        void Add(const Quadric& other)
+        {
+            a00 += other.a00; a11 += other.a11; a22 += other.a22;
+            a01 += other.a01; a02 += other.a02; a12 += other.a12;
+            b0 += other.b0; b1 += other.b1; b2 += other.b2;
+            c += other.c;
+            weight += other.weight;
+        }
+
+        // Average squared distance of p to the planes
+        double Evaluate(const glm::dvec3& p) const
+        {
+            const double sum = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z
+                + 2.0 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z)
+                + 2.0 * (b0 * p.x + b1 * p.y + b2 * p.z)
+                + c;
+            return weight > 0.0 ? std::abs(sum) / weight : 0.0;
+        }
+    };
+
+    struct Collapse
+    {
+        uint32_t from;
+        uint32_t to;
+        // Squared distance plus the weighted attribute difference, what collapses are ordered by
+        double cost;
+    };
+
+    // The triangles using every vertex, as ranges of one flat array
+    struct TriangleAdjacency
+    {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> triangles;
+
+        void Build(const uint32_t* indices, size_t indexCount, size_t vertexCount)
+        {
+            offsets.assign(vertexCount + 1, 0);
+            for (size_t i = 0; i < indexCount; i++)
+            {
+                offsets[indices[i] + 1]++;
+            }
+            for (size_t vertex = 0; vertex < vertexCount; vertex++)
+            {
+                offsets[vertex + 1] += offsets[vertex];
+            }
+
+            triangles.resize(indexCount);
+            std::vector<uint32_t> cursors(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indexCount; i++)
+            {
+                triangles[cursors[indices[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        const uint32_t* Begin(uint32_t vertex) const { return triangles.data() + offsets[vertex]; }
+        const uint32_t* End(uint32_t vertex) const { return triangles.data() + offsets[vertex + 1]; }
+    };
+
+    // Distance from p to the closest point of the triangle abc (Ericson, "Real-Time Collision Detection" 5.1.5)
+    float get_triangle_distance(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+    {
+        const glm::vec3 ab = b - a;
+        const glm::vec3 ac = c - a;
+        const glm::vec3 ap = p - a;
+        const float d1 = glm::dot(ab, ap);
+        const float d2 = glm::dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f)
+        {
+            return glm::length(ap);
+        }
+
+        const glm::vec3 bp = p - b;
+        const float d3 = glm::dot(ab, bp);
+        const float d4 = glm::dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3)
+        {
+            return glm::length(bp);
+        }
+
+        const float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        {
+            return glm::length(ap - ab * (d1 / (d1 - d3)));
+        }
+
+        const glm::vec3 cp = p - c;
+        const float d5 = glm::dot(ab, cp);
+        const float d6 = glm::dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6)
+        {
+            return glm::length(cp);
+        }
+
+        const float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        {
+            return glm::length(ap - ac * (d2 / (d2 - d6)));
+        }
+
+        const float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+        {
+            return glm::length(bp - (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))));
+        }
+
+        // Inside the face, degenerate triangles end up here as well and fall back to their corners
+        const float sum = va + vb + vc;
+        if (sum <= 0.0f)
+        {
+            return std::min({glm::length(ap), glm::length(bp), glm::length(cp)});
+        }
+        return glm::length(ap - ab * (vb / sum) - ac * (vc / sum));
+    }
+
+    uint64_t get_edge_key(uint32_t a, uint32_t b)
+    {
+        return static_cast<uint64_t>(a) << 32 | b;
+    }
+
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3& position) const
+        {
+            // Adding zero turns -0 into 0, which compare equal and so have to hash the same
+            const glm::vec3 normalized = position + 0.0f;
+            uint32_t bits[3];
+            std::memcpy(bits, &normalized, sizeof(bits));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+
+    // Marks the vertices a collapse may not move: the ones on an open border, where the surface has no triangle on the
+    // other side of an edge, and the ones on an attribute seam, where several vertices share a position
+    std::vector<bool> find_locked_vertices(const uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount)
+    {
+        std::vector<bool> bLocked(vertexCount, false);
+
+        // Borders and seams are found on positions, as both sides of a seam use different vertices
+        std::vector<uint32_t> positionIds(vertexCount);
+        std::vector<uint32_t> sharedCount;
+        {
+            std::unordered_map<glm::vec3, uint32_t, PositionHash> positions;
+            positions.reserve(vertexCount);
+            for (size_t vertex = 0; vertex < vertexCount; vertex++)
+            {
+                const auto [it, bInserted] = positions.try_emplace(vertices[vertex].position, static_cast<uint32_t>(sharedCount.size()));
+                if (bInserted)
+                {
+                    sharedCount.push_back(0);
+                }
+                positionIds[vertex] = it->second;
+                sharedCount[it->second]++;
+            }
+        }
+
+        std::unordered_set<uint64_t> halfEdges;
+        halfEdges.reserve(indexCount);
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            const uint32_t a = positionIds[indices[i]];
+            const uint32_t b = positionIds[indices[i - i % 3 + (i % 3 + 1) % 3]];
+            halfEdges.insert(get_edge_key(a, b));
+        }
+
+        std::vector<bool> bBorderPosition(sharedCount.size(), false);
+        for (uint64_t halfEdge : halfEdges)
+        {
+            const uint32_t a = static_cast<uint32_t>(halfEdge >> 32);
+            const uint32_t b = static_cast<uint32_t>(halfEdge);
+            if (halfEdges.find(get_edge_key(b, a)) == halfEdges.end())
+            {
+                bBorderPosition[a] = true;
+                bBorderPosition[b] = true;
+            }
+        }
+
+        for (size_t vertex = 0; vertex < vertexCount; vertex++)
+        {
+            const uint32_t position = positionIds[vertex];
+            bLocked[vertex] = bBorderPosition[position] || sharedCount[position] > 1;
+        }
+
+        return bLocked;
+    }
+}
+
+meshopt::VertexCacheStatistics meshopt::analyze_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+    VertexCacheStatistics statistics;
+    statistics.vertexCount = static_cast<uint32_t>(vertexCount);
+    statistics.triangleCount = static_cast<uint32_t>(indexCount / 3);
+
+    FifoCache cache(vertexCount, cacheSize);
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        statistics.transformCount += cache.Access(indices[i]);
+    }
+
+    return statistics;
+}
+
+void meshopt::optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    static const ForsythScoreTables tables;
+
+    // The triangles using every vertex, as ranges of one flat array. Only the first remainingTriangles[vertex] entries
+    // of a range are still to be emitted, emitted triangles are swapped behind those.
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+    {
+        adjacencyOffsets[indices[i] + 1]++;
+    }
+
+    std::vector<uint32_t> remainingTriangles(vertexCount);
+    for (size_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        remainingTriangles[vertex] = adjacencyOffsets[vertex + 1];
+        adjacencyOffsets[vertex + 1] += adjacencyOffsets[vertex];
+    }
+
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    {
+        std::vector<uint32_t> cursors(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+        {
+            adjacency[cursors[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    std::vector<int32_t> cachePositions(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        vertexScores[vertex] = get_forsyth_score(tables, -1, remainingTriangles[vertex]);
+    }
+
+    std::vector<float> triangleScores(triangleCount);
+    for (size_t triangle = 0; triangle < triangleCount; triangle++)
+    {
+        const uint32_t* corners = indices + triangle * 3;
+        triangleScores[triangle] = vertexScores[corners[0]] + vertexScores[corners[1]] + vertexScores[corners[2]];
+    }
+
+    const std::vector<uint32_t> input(indices, indices + triangleCount * 3);
+    std::vector<bool> bEmitted(triangleCount, false);
+
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+    size_t cacheCount = 0;
+
+    size_t bestTriangle = NO_TRIANGLE;
+    size_t nextUnemitted = 0;
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+    {
+        if (bestTriangle == NO_TRIANGLE)
+        {
+            // None of the cached vertices have triangles left. Forsyth scans every triangle for the best one here,
+            // taking the next one in input order keeps the whole thing linear at next to no cost in quality
+            while (bEmitted[nextUnemitted])
+            {
+                nextUnemitted++;
+            }
+            bestTriangle = nextUnemitted;
+        }
+
+        const uint32_t* corners = input.data() + bestTriangle * 3;
+        std::copy(corners, corners + 3, indices + emittedCount * 3);
+        bEmitted[bestTriangle] = true;
+
+        // The triangle's vertices move to the front of the LRU cache, pushing the rest back
+        size_t newCount = 0;
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            const uint32_t vertex = corners[k];
+
+            // Swap the triangle out of the vertex's remaining triangles. A degenerate triangle was listed once per
+            // corner it shares with itself, so every corner takes out one entry
+            uint32_t* vertexTriangles = adjacency.data() + adjacencyOffsets[vertex];
+            uint32_t* last = vertexTriangles + remainingTriangles[vertex] - 1;
+            *std::find(vertexTriangles, last, static_cast<uint32_t>(bestTriangle)) = *last;
+            remainingTriangles[vertex]--;
+
+            if (std::find(newCache, newCache + newCount, vertex) == newCache + newCount)
+            {
+                newCache[newCount++] = vertex;
+            }
+        }
+
+        for (size_t c = 0; c < cacheCount; c++)
+        {
+            const uint32_t vertex = cache[c];
+            if (vertex != corners[0] && vertex != corners[1] && vertex != corners[2])
+            {
+                newCache[newCount++] = vertex;
+            }
+        }
+
+        // Rescore everything that moved, including the vertices that just fell out of the cache
+        for (size_t c = 0; c < newCount; c++)
+        {
+            const uint32_t vertex = newCache[c];
+            cachePositions[vertex] = c < FORSYTH_CACHE_SIZE ? static_cast<int32_t>(c) : -1;
+
+            const float score = get_forsyth_score(tables, cachePositions[vertex], remainingTriangles[vertex]);
+            const float delta = score - vertexScores[vertex];
+            vertexScores[vertex] = score;
+
+            const uint32_t* vertexTriangles = adjacency.data() + adjacencyOffsets[vertex];
+            for (uint32_t t = 0; t < remainingTriangles[vertex]; t++)
+            {
+                triangleScores[vertexTriangles[t]] += delta;
+            }
+        }
+
+        // Only triangles touching the cache can have gained score
+        bestTriangle = NO_TRIANGLE;
+        float bestScore = -1.0f;
+        cacheCount = std::min<size_t>(newCount, FORSYTH_CACHE_SIZE);
+        for (size_t c = 0; c < cacheCount; c++)
+        {
+            const uint32_t vertex = newCache[c];
+            cache[c] = vertex;
+
+            const uint32_t* vertexTriangles = adjacency.data() + adjacencyOffsets[vertex];
+            for (uint32_t t = 0; t < remainingTriangles[vertex]; t++)
+            {
+                if (triangleScores[vertexTriangles[t]] > bestScore)
+                {
+                    bestScore = triangleScores[vertexTriangles[t]];
+                    bestTriangle = vertexTriangles[t];
+                }
+            }
+        }
+    }
+}
+
+void meshopt::optimize_overdraw(uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount, float threshold)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+    {
+        return;
+    }
+
+    FifoCache cache(vertexCount, ANALYSIS_CACHE_SIZE);
+    const auto access_triangle = [&](size_t triangle) -> uint32_t
+    {
+        const uint32_t* corners = indices + triangle * 3;
+        return cache.Access(corners[0]) + cache.Access(corners[1]) + cache.Access(corners[2]);
+    };
+
+    // Hard boundaries are the places where the cache optimizer had to start over somewhere else,
+    // recognizable by a triangle that misses the cache with every vertex. The first triangle always starts a cluster,
+    // even when it is degenerate and misses fewer
+    std::vector<size_t> hardBoundaries{0};
+    for (size_t triangle = 0; triangle < triangleCount; triangle++)
+    {
+        if (access_triangle(triangle) == 3 && triangle > 0)
+        {
+            hardBoundaries.push_back(triangle);
+        }
+    }
+    hardBoundaries.push_back(triangleCount);
+
+    // Clusters between hard boundaries are split further wherever the part so far has an ACMR within threshold of
+    // the whole cluster's. Every cluster starts with a cold cache, as there is no telling what gets drawn before it.
+    std::vector<size_t> clusterStarts;
+    for (size_t h = 0; h + 1 < hardBoundaries.size(); h++)
+    {
+        const size_t begin = hardBoundaries[h];
+        const size_t end = hardBoundaries[h + 1];
+
+        cache.Flush();
+        uint32_t clusterMisses = 0;
+        for (size_t triangle = begin; triangle < end; triangle++)
+        {
+            clusterMisses += access_triangle(triangle);
+        }
+        const float clusterACMR = static_cast<float>(clusterMisses) / static_cast<float>(end - begin);
+
+        cache.Flush();
+        size_t start = begin;
+        uint32_t misses = 0;
+        for (size_t triangle = begin; triangle < end; triangle++)
+        {
+            misses += access_triangle(triangle);
+
+            const float acmr = static_cast<float>(misses) / static_cast<float>(triangle + 1 - start);
+            if (triangle + 1 < end && acmr <= clusterACMR * threshold)
+            {
+                clusterStarts.push_back(start);
+                start = triangle + 1;
+                misses = 0;
+                cache.Flush();
+            }
+        }
+        clusterStarts.push_back(start);
+    }
+    clusterStarts.push_back(triangleCount);
+
+    // Clusters on the outside of the mesh, facing away from its center, are the likely occluders. Those go first
+    const size_t clusterCount = clusterStarts.size() - 1;
+    std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3{0.0f});
+    std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3{0.0f});
+    glm::vec3 meshCentroid{0.0f};
+    float meshArea = 0.0f;
+
+    for (size_t cluster = 0; cluster < clusterCount; cluster++)
+    {
+        float clusterArea = 0.0f;
+        for (size_t triangle = clusterStarts[cluster]; triangle < clusterStarts[cluster + 1]; triangle++)
+        {
+            const uint32_t* corners = indices + triangle * 3;
+            const glm::vec3& a = vertices[corners[0]].position;
+            const glm::vec3& b = vertices[corners[1]].position;
+            const glm::vec3& c = vertices[corners[2]].position;
+
+            // Its length is twice the triangle's area, which weighs both the normal and the centroid by area
+            const glm::vec3 normal = glm::cross(b - a, c - a);
+            const float area = glm::length(normal);
+
+            clusterNormals[cluster] += normal;
+            clusterCentroids[cluster] += (a + b + c) * (area / 3.0f);
+            clusterArea += area;
+        }
+
+        meshCentroid += clusterCentroids[cluster];
+        meshArea += clusterArea;
+        if (clusterArea > 0.0f)
+        {
+            clusterCentroids[cluster] /= clusterArea;
+        }
+    }
+
+    if (meshArea > 0.0f)
+    {
+        meshCentroid /= meshArea;
+    }
+
+    std::vector<float> sortKeys(clusterCount, 0.0f);
+    for (size_t cluster = 0; cluster < clusterCount; cluster++)
+    {
+        const float normalLength = glm::length(clusterNormals[cluster]);
+        if (normalLength > 0.0f)
+        {
+            sortKeys[cluster] = glm::dot(clusterCentroids[cluster] - meshCentroid, clusterNormals[cluster] / normalLength);
+        }
+    }
+
+    std::vector<uint32_t> order(clusterCount);
+    for (size_t cluster = 0; cluster < clusterCount; cluster++)
+    {
+        order[cluster] = static_cast<uint32_t>(cluster);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t left, uint32_t right) -> bool
+    {
+        return sortKeys[left] > sortKeys[right];
+    });
+
+    const std::vector<uint32_t> input(indices, indices + triangleCount * 3);
+    uint32_t* output = indices;
+    for (uint32_t cluster : order)
+    {
+        const uint32_t* begin = input.data() + clusterStarts[cluster] * 3;
+        const uint32_t* end = input.data() + clusterStarts[cluster + 1] * 3;
+        output = std::copy(begin, end, output);
+    }
+}
+
+size_t meshopt::optimize_vertex_fetch(Vertex* vertices, uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+    constexpr uint32_t UNUSED_VERTEX = ~0u;
+
+    std::vector<uint32_t> remap(vertexCount, UNUSED_VERTEX);
+    uint32_t nextVertex = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        uint32_t& newIndex = remap[indices[i]];
+        if (newIndex == UNUSED_VERTEX)
+        {
+            newIndex = nextVertex++;
+        }
+        indices[i] = newIndex;
+    }
+
+    const size_t usedCount = nextVertex;
+    for (uint32_t& newIndex : remap)
+    {
+        if (newIndex == UNUSED_VERTEX)
+        {
+            newIndex = nextVertex++;
+        }
+    }
+
+    const std::vector<Vertex> input(vertices, vertices + vertexCount);
+    for (size_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        vertices[remap[vertex]] = input[vertex];
+    }
+
+    return usedCount;
+}
+
+void meshopt::optimize_mesh(Vertex* vertices, size_t vertexCount, uint32_t* indices, size_t indexCount)
+{
+    // The passes trust the indices, a broken file must not make them write out of bounds
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        if (indices[i] >= vertexCount)
+        {
+            return;
+        }
+    }
+
+    optimize_vertex_cache(indices, indexCount, vertexCount);
+    optimize_overdraw(indices, indexCount, vertices, vertexCount, OVERDRAW_THRESHOLD);
+    optimize_vertex_fetch(vertices, indices, indexCount, vertexCount);
+}
+
+size_t meshopt::simplify(
+    uint32_t* destination,
+    const uint32_t* indices,
+    size_t indexCount,
+    const Vertex* vertices,
+    size_t vertexCount,
+    size_t targetIndexCount,
+    const SimplifyWeights& weights,
+    float& error
+) {
+    error = 0.0f;
+
+    // Degenerate triangles have no plane to contribute and only get in the way, so they go first
+    size_t resultCount = 0;
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        const uint32_t a = indices[i];
+        const uint32_t b = indices[i + 1];
+        const uint32_t c = indices[i + 2];
+        if (a >= vertexCount || b >= vertexCount || c >= vertexCount)
+        {
+            // Same as optimize_mesh(), broken indices are passed through untouched
+            std::copy(indices, indices + indexCount, destination);
+            return indexCount;
+        }
+
+        if (a != b && b != c && c != a)
+        {
+            destination[resultCount++] = a;
+            destination[resultCount++] = b;
+            destination[resultCount++] = c;
+        }
+    }
+
+    if (resultCount <= targetIndexCount)
+    {
+        return resultCount;
+    }
+
+    // Errors are measured with the mesh scaled into a unit cube, so the attribute weights mean the same on every mesh
+    glm::vec3 boundsMin{std::numeric_limits<float>::max()};
+    glm::vec3 boundsMax{std::numeric_limits<float>::lowest()};
+    for (size_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        boundsMin = glm::min(boundsMin, vertices[vertex].position);
+        boundsMax = glm::max(boundsMax, vertices[vertex].position);
+    }
+    const glm::vec3 boundsSize = boundsMax - boundsMin;
+    const float scale = std::max(std::max(boundsSize.x, boundsSize.y), boundsSize.z);
+    const double inverseScale = scale > 0.0f ? 1.0 / scale : 0.0;
+
+    std::vector<glm::dvec3> positions(vertexCount);
+    for (size_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        positions[vertex] = glm::dvec3(vertices[vertex].position - boundsMin) * inverseScale;
+    }
+
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < resultCount; i += 3)
+    {
+        const glm::dvec3& p0 = positions[destination[i]];
+        const glm::dvec3& p1 = positions[destination[i + 1]];
+        const glm::dvec3& p2 = positions[destination[i + 2]];
+
+        const glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        const double doubleArea = glm::length(normal);
+        if (doubleArea <= 0.0)
+        {
+            continue;
+        }
+
+        const glm::dvec3 unitNormal = normal / doubleArea;
+        Quadric plane;
+        plane.AddPlane(unitNormal, -glm::dot(unitNormal, p0), doubleArea * 0.5);
+        quadrics[destination[i]].Add(plane);
+        quadrics[destination[i + 1]].Add(plane);
+        quadrics[destination[i + 2]].Add(plane);
+    }
+
+    const std::vector<bool> bLocked = find_locked_vertices(destination, resultCount, vertices, vertexCount);
+
+    const auto get_collapse = [&](uint32_t from, uint32_t to) -> Collapse
+    {
+        if (bLocked[from])
+        {
+            return {from, to, std::numeric_limits<double>::max()};
+        }
+
+        Quadric merged = quadrics[from];
+        merged.Add(quadrics[to]);
+        const double distance = merged.Evaluate(positions[to]);
+
+        const glm::vec3 normalDelta = vertices[from].normal - vertices[to].normal;
+        const glm::vec2 uvDelta(vertices[from].uv_x - vertices[to].uv_x, vertices[from].uv_y - vertices[to].uv_y);
+        const double cost = distance + weights.normal * glm::dot(normalDelta, normalDelta) + weights.uv * glm::dot(uvDelta, uvDelta);
+        return {from, to, cost};
+    };
+
+    // Every pass collapses as many edges as it can without two collapses touching the same triangles,
+    // cheapest first, then rebuilds everything for the next pass
+    TriangleAdjacency adjacency;
+    std::vector<uint64_t> edges;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<bool> bTouched(vertexCount);
+    // The vertex every vertex has been collapsed into so far, through any amount of passes
+    std::vector<uint32_t> representatives(vertexCount);
+    for (size_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        representatives[vertex] = static_cast<uint32_t>(vertex);
+    }
+    const std::vector<uint32_t> inputIndices(destination, destination + resultCount);
+
+    while (resultCount > targetIndexCount)
+    {
+        const size_t triangleCount = resultCount / 3;
+
+        adjacency.Build(destination, resultCount, vertexCount);
+
+        edges.clear();
+        for (size_t i = 0; i < resultCount; i++)
+        {
+            const uint32_t a = destination[i];
+            const uint32_t b = destination[i - i % 3 + (i % 3 + 1) % 3];
+            edges.push_back(get_edge_key(std::min(a, b), std::max(a, b)));
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        collapses.clear();
+        for (uint64_t edge : edges)
+        {
+            const uint32_t a = static_cast<uint32_t>(edge >> 32);
+            const uint32_t b = static_cast<uint32_t>(edge);
+            const Collapse collapseAB = get_collapse(a, b);
+            const Collapse collapseBA = get_collapse(b, a);
+            const Collapse& cheapest = collapseAB.cost <= collapseBA.cost ? collapseAB : collapseBA;
+            if (cheapest.cost < std::numeric_limits<double>::max())
+            {
+                collapses.push_back(cheapest);
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& left, const Collapse& right) -> bool
+        {
+            return left.cost < right.cost;
+        });
+
+        for (size_t vertex = 0; vertex < vertexCount; vertex++)
+        {
+            remap[vertex] = static_cast<uint32_t>(vertex);
+        }
+        std::fill(bTouched.begin(), bTouched.end(), false);
+
+        const size_t removableTriangles = triangleCount - targetIndexCount / 3;
+        size_t removedTriangles = 0;
+        size_t collapseCount = 0;
+
+        for (const Collapse& collapse : collapses)
+        {
+            if (bTouched[collapse.from] || bTouched[collapse.to])
+            {
+                continue;
+            }
+
+            // Moving the vertex may not turn any of its other triangles inside out
+            const uint32_t* fromTriangles = adjacency.Begin(collapse.from);
+            const uint32_t fromTriangleCount = static_cast<uint32_t>(adjacency.End(collapse.from) - fromTriangles);
+            bool bFlips = false;
+            uint32_t collapsedTriangles = 0;
+            for (uint32_t t = 0; t < fromTriangleCount && !bFlips; t++)
+            {
+                const uint32_t* corners = destination + static_cast<size_t>(fromTriangles[t]) * 3;
+                if (corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to)
+                {
+                    collapsedTriangles++;
+                    continue;
+                }
+
+                glm::dvec3 before[3];
+                glm::dvec3 after[3];
+                for (uint32_t k = 0; k < 3; k++)
+                {
+                    before[k] = positions[corners[k]];
+                    after[k] = corners[k] == collapse.from ? positions[collapse.to] : before[k];
+                }
+
+                const glm::dvec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                const glm::dvec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                bFlips = glm::dot(normalBefore, normalAfter) <= 0.0;
+            }
+
+            if (bFlips)
+            {
+                continue;
+            }
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to].Add(quadrics[collapse.from]);
+            collapseCount++;
+
+            // Every vertex sharing a triangle with the collapsed one sits out the rest of the pass,
+            // the flip test above only holds while their positions stay put
+            for (uint32_t t = 0; t < fromTriangleCount; t++)
+            {
+                const uint32_t* corners = destination + static_cast<size_t>(fromTriangles[t]) * 3;
+                bTouched[corners[0]] = true;
+                bTouched[corners[1]] = true;
+                bTouched[corners[2]] = true;
+            }
+
+            removedTriangles += collapsedTriangles;
+            if (removedTriangles >= removableTriangles)
+            {
+                break;
+            }
+        }
+
+        if (collapseCount == 0)
+        {
+            break;
+        }
+
+        for (uint32_t& representative : representatives)
+        {
+            representative = remap[representative];
+        }
+
+        size_t writeCount = 0;
+        for (size_t i = 0; i < resultCount; i += 3)
+        {
+            const uint32_t a = remap[destination[i]];
+            const uint32_t b = remap[destination[i + 1]];
+            const uint32_t c = remap[destination[i + 2]];
+            if (a != b && b != c && c != a)
+            {
+                destination[writeCount++] = a;
+                destination[writeCount++] = b;
+                destination[writeCount++] = c;
+            }
+        }
+        resultCount = writeCount;
+    }
+
+    // The quadrics only average the distances to the planes, so the error is measured on the result instead. Every input
+    // vertex that is gone is measured against the result's triangles around the vertices its neighbours ended up in,
+    // which cover about where it used to be. When that would raise the error, it walks on to the triangles two rings
+    // around the closest one for as long as they are closer, which also steps over the slivers left along locked borders.
+    // The surface is at least as close as any triangle, so the error bounds the distance of every input vertex to the result
+    TriangleAdjacency inputAdjacency;
+    inputAdjacency.Build(inputIndices.data(), inputIndices.size(), vertexCount);
+    adjacency.Build(destination, resultCount, vertexCount);
+    for (uint32_t vertex = 0; vertex < vertexCount && resultCount > 0; vertex++)
+    {
+        if (inputAdjacency.Begin(vertex) == inputAdjacency.End(vertex) || adjacency.Begin(vertex) != adjacency.End(vertex))
+        {
+            continue;
+        }
+
+        const glm::vec3& position = vertices[vertex].position;
+        float distance = std::numeric_limits<float>::max();
+        size_t closestTriangle = NO_TRIANGLE;
+        const auto measure_triangle = [&](uint32_t triangle) -> void
+        {
+            const uint32_t* corners = destination + static_cast<size_t>(triangle) * 3;
+            const float triangleDistance = get_triangle_distance(position, vertices[corners[0]].position, vertices[corners[1]].position, vertices[corners[2]].position);
+            if (triangleDistance < distance)
+            {
+                distance = triangleDistance;
+                closestTriangle = triangle;
+            }
+        };
+
+        for (const uint32_t* inputTriangle = inputAdjacency.Begin(vertex); inputTriangle != inputAdjacency.End(vertex); inputTriangle++)
+        {
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                const uint32_t representative = representatives[inputIndices[static_cast<size_t>(*inputTriangle) * 3 + k]];
+                std::for_each(adjacency.Begin(representative), adjacency.End(representative), measure_triangle);
+            }
+        }
+
+        if (closestTriangle == NO_TRIANGLE)
+        {
+            // The whole neighbourhood collapsed into vertices without triangles left, which leaves searching them all
+            for (uint32_t triangle = 0; triangle < resultCount / 3; triangle++)
+            {
+                measure_triangle(triangle);
+            }
+        }
+
+        for (size_t walkedFrom = NO_TRIANGLE; walkedFrom != closestTriangle && distance > error;)
+        {
+            walkedFrom = closestTriangle;
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                const uint32_t corner = destination[walkedFrom * 3 + k];
+                for (const uint32_t* triangle = adjacency.Begin(corner); triangle != adjacency.End(corner); triangle++)
+                {
+                    for (uint32_t j = 0; j < 3; j++)
+                    {
+                        const uint32_t ringCorner = destination[static_cast<size_t>(*triangle) * 3 + j];
+                        std::for_each(adjacency.Begin(ringCorner), adjacency.End(ringCorner), measure_triangle);
+                    }
+                }
+            }
+        }
+
+        error = std::max(error, distance);
+    }
+
+    return resultCount;
+}
+
+void meshopt::build_meshlets(uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount, std::vector<MeshletRange>& meshlets)
+{
+    constexpr size_t NO_MESHLET = ~static_cast<size_t>(0);
+
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    const std::vector<uint32_t> input(indices, indices + triangleCount * 3);
+
+    TriangleAdjacency adjacency;
+    adjacency.Build(input.data(), input.size(), vertexCount);
+
+    std::vector<glm::vec3> triangleCentroids(triangleCount);
+    for (size_t triangle = 0; triangle < triangleCount; triangle++)
+    {
+        const uint32_t* corners = input.data() + triangle * 3;
+        triangleCentroids[triangle] = (vertices[corners[0]].position + vertices[corners[1]].position + vertices[corners[2]].position) / 3.0f;
+    }
+
+    std::vector<bool> bEmitted(triangleCount, false);
+    // The meshlet that last took each vertex, which tells how many new vertices a triangle would bring
+    std::vector<size_t> vertexMeshlets(vertexCount, NO_MESHLET);
+
+    uint32_t meshletVertices[MESHLET_MAX_VERTICES];
+    uint32_t meshletVertexCount = 0;
+    uint32_t meshletTriangleCount = 0;
+    glm::vec3 centroidSum{0.0f};
+
+    size_t emittedCount = 0;
+    size_t nextSeed = 0;
+
+    const auto count_new_vertices = [&](size_t triangle) -> uint32_t
+    {
+        const uint32_t* corners = input.data() + triangle * 3;
+        const size_t meshlet = meshlets.size();
+        return (vertexMeshlets[corners[0]] != meshlet ? 1u : 0u)
+            + (vertexMeshlets[corners[1]] != meshlet && corners[1] != corners[0] ? 1u : 0u)
+            + (vertexMeshlets[corners[2]] != meshlet && corners[2] != corners[0] && corners[2] != corners[1] ? 1u : 0u);
+    };
+
+    const auto add_triangle = [&](size_t triangle) -> void
+    {
+        const uint32_t* corners = input.data() + triangle * 3;
+        std::copy(corners, corners + 3, indices + emittedCount * 3);
+        bEmitted[triangle] = true;
+        emittedCount++;
+
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            if (vertexMeshlets[corners[k]] != meshlets.size())
+            {
+                vertexMeshlets[corners[k]] = meshlets.size();
+                meshletVertices[meshletVertexCount++] = corners[k];
+            }
+        }
+
+        centroidSum += triangleCentroids[triangle];
+        meshletTriangleCount++;
+    };
+
+    while (emittedCount < triangleCount)
+    {
+        const size_t firstTriangle = emittedCount;
+        meshletVertexCount = 0;
+        meshletTriangleCount = 0;
+        centroidSum = glm::vec3{0.0f};
+
+        while (bEmitted[nextSeed])
+        {
+            nextSeed++;
+        }
+        add_triangle(nextSeed);
+
+        while (meshletTriangleCount < MESHLET_MAX_TRIANGLES)
+        {
+            const glm::vec3 center = centroidSum / static_cast<float>(meshletTriangleCount);
+
+            size_t bestTriangle = NO_TRIANGLE;
+            uint32_t bestNewVertices = 4;
+            float bestDistance = std::numeric_limits<float>::max();
+
+            // Only triangles sharing a vertex with the meshlet are considered, the rest would bring three new vertices
+            for (uint32_t v = 0; v < meshletVertexCount; v++)
+            {
+                for (const uint32_t* triangle = adjacency.Begin(meshletVertices[v]); triangle != adjacency.End(meshletVertices[v]); triangle++)
+                {
+                    if (bEmitted[*triangle])
+                    {
+                        continue;
+                    }
+
+                    const uint32_t newVertices = count_new_vertices(*triangle);
+                    if (meshletVertexCount + newVertices > MESHLET_MAX_VERTICES || newVertices > bestNewVertices)
+                    {
+                        continue;
+                    }
+
+                    const glm::vec3 offset = triangleCentroids[*triangle] - center;
+                    const float distance = glm::dot(offset, offset);
+                    if (newVertices < bestNewVertices || distance < bestDistance)
+                    {
+                        bestTriangle = *triangle;
+                        bestNewVertices = newVertices;
+                        bestDistance = distance;
+                    }
+                }
+            }
+
+            if (bestTriangle == NO_TRIANGLE)
+            {
+                break;
+            }
+            add_triangle(bestTriangle);
+        }
+
+        MeshletRange& meshlet = meshlets.emplace_back();
+        meshlet.firstTriangle = static_cast<uint32_t>(firstTriangle);
+        meshlet.triangleCount = meshletTriangleCount;
+        meshlet.vertexCount = meshletVertexCount;
+    }
+}
+
+void meshopt::optimize_meshlet_vertex_cache(uint32_t* indices, size_t indexCount)
+{
+    // Remapped to the meshlet's local vertices, there are at most MESHLET_MAX_VERTICES of them so a linear search is
+    // cheaper than a map
+    thread_local std::vector<uint32_t> meshletVertices;
+    thread_local std::vector<uint32_t> localIndices;
+    meshletVertices.clear();
+    localIndices.resize(indexCount);
+
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        const auto it = std::find(meshletVertices.begin(), meshletVertices.end(), indices[i]);
+        localIndices[i] = static_cast<uint32_t>(it - meshletVertices.begin());
+        if (it == meshletVertices.end())
+        {
+            meshletVertices.push_back(indices[i]);
+        }
+    }
+
+    optimize_vertex_cache(localIndices.data(), indexCount, meshletVertices.size());
+
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        indices[i] = meshletVertices[localIndices[i]];
+    }
+}
+
+meshopt::ClusterBounds meshopt::compute_cluster_bounds(const uint32_t* indices, size_t indexCount, const Vertex* vertices)
+{
+    ClusterBounds bounds{};
+    bounds.coneAxis = glm::vec3{0.0f, 0.0f, 1.0f};
+    bounds.coneCutoff = 1.0f;
+    if (indexCount < 3)
+    {
+        return bounds;
+    }
+
+    glm::vec3 boundsMin = vertices[indices[0]].position;
+    glm::vec3 boundsMax = boundsMin;
+    for (size_t i = 1; i < indexCount; i++)
+    {
+        boundsMin = glm::min(boundsMin, vertices[indices[i]].position);
+        boundsMax = glm::max(boundsMax, vertices[indices[i]].position);
+    }
+
+    bounds.center = (boundsMin + boundsMax) * 0.5f;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        bounds.radius = std::max(bounds.radius, glm::length(vertices[indices[i]].position - bounds.center));
+    }
+
+    const auto get_unit_normal = [&](size_t i, glm::vec3& normal) -> bool
+    {
+        const glm::vec3& a = vertices[indices[i]].position;
+        const glm::vec3& b = vertices[indices[i + 1]].position;
+        const glm::vec3& c = vertices[indices[i + 2]].position;
+        normal = glm::cross(b - a, c - a);
+
+        const float length = glm::length(normal);
+        if (length <= 0.0f)
+        {
+            return false;
+        }
+        normal /= length;
+        return true;
+    };
+
+    glm::vec3 normalSum{0.0f};
+    glm::vec3 normal;
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        if (get_unit_normal(i, normal))
+        {
+            normalSum += normal;
+        }
+    }
+
+    const float normalSumLength = glm::length(normalSum);
+    if (normalSumLength <= 0.0f)
+    {
+        return bounds;
+    }
+    const glm::vec3 axis = normalSum / normalSumLength;
+
+    float minDot = 1.0f;
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        if (get_unit_normal(i, normal))
+        {
+            minDot = std::min(minDot, glm::dot(axis, normal));
+        }
+    }
+
+    // A cone spreading 90 degrees or more has a back side that is never entirely hidden
+    if (minDot <= 0.0f)
+    {
+        return bounds;
+    }
+
+    // Every normal is within acos(minDot) of the axis. Widening that by 90 degrees on both sides and turning the cone
+    // around gives the directions the cluster can only be seen from the back: a cutoff of sin(acos(minDot))
+    bounds.coneAxis = axis;
+    bounds.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    return bounds;
+}
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "vk_types.h"
+
+// Reorders the triangles and vertices of an indexed triangle list so the GPU does less work drawing it.
+// Every pass keeps the mesh exactly the same, only the order things are stored in changes.
+namespace meshopt
+{
+    // FIFO cache the statistics are simulated with. Current GPUs do not have a fixed size post-transform cache anymore,
+    // but batch vertices in a way that behaves close to a small FIFO
+    constexpr uint32_t ANALYSIS_CACHE_SIZE = 16;
+
+    struct VertexCacheStatistics
+    {
+        uint32_t vertexCount{0};
+        uint32_t triangleCount{0};
+        // Vertices the vertex shader ran for
+        uint32_t transformCount{0};
+
+        // Average cache miss ratio: vertex shader invocations per triangle, 0.5 at best and 3 at worst
+        float GetACMR() const { return triangleCount > 0 ? static_cast<float>(transformCount) / static_cast<float>(triangleCount) : 0.0f; }
+        // Average transform to vertex ratio: vertex shader invocations per vertex, 1 at best
+        float GetATVR() const { return vertexCount > 0 ? static_cast<float>(transformCount) / static_cast<float>(vertexCount) : 0.0f; }
+
+        void Add(const VertexCacheStatistics& other)
+        {
+            vertexCount += other.vertexCount;
+            triangleCount += other.triangleCount;
+            transformCount += other.transformCount;
+        }
+    };
+
+    VertexCacheStatistics analyze_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = ANALYSIS_CACHE_SIZE);
+
+    // Orders the triangles so vertices get reused while they are still in the post-transform cache,
+    // using Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+    void optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+    // Splits the cache optimized triangle order into clusters and sorts those so the ones facing away from the mesh
+    // center come first, which draws occluders before what they occlude (Sander, Nehab and Barczak, "Fast Triangle
+    // Reordering for Vertex Locality and Reduced Overdraw"). threshold is how much worse the ACMR may get for it, 1.05 allows 5%.
+    void optimize_overdraw(uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount, float threshold);
+
+    // Moves the vertices into the order the indices first use them, so vertex fetches walk through memory linearly.
+    // Vertices no index refers to end up at the back. Returns the amount of vertices that are referenced.
+    size_t optimize_vertex_fetch(Vertex* vertices, uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+    // All of the above, in the order they have to run in
+    void optimize_mesh(Vertex* vertices, size_t vertexCount, uint32_t* indices, size_t indexCount);
+
+    // How much differences in the attributes count towards the error of a collapse, next to the squared distance
+    // the surface moves relative to its size. Keeps shading and texture detail from being collapsed before flat geometry
+    struct SimplifyWeights
+    {
+        float normal{0.25f};
+        float uv{1.0f};
+    };
+
+    // Quadric error metric simplification (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics").
+    // Edges are collapsed into one of their vertices, so the result indexes the same vertex buffer as the input.
+    // Vertices on open borders and attribute seams stay where they are, which keeps holes from opening up.
+    // Writes at most indexCount indices to destination and returns how many, stopping once targetIndexCount is reached
+    // or nothing can be collapsed anymore. error receives how far any vertex of the input is from the result at most,
+    // in the units of the positions.
+    size_t simplify(
+        uint32_t* destination,
+        const uint32_t* indices,
+        size_t indexCount,
+        const Vertex* vertices,
+        size_t vertexCount,
+        size_t targetIndexCount,
+        const SimplifyWeights& weights,
+        float& error
+    );
+
+    // Limits of a meshlet, sized for mesh shader workgroups: 64 vertices, and 124 triangles so their indices
+    // fit 372 bytes with room left for the counts in a 384 byte block
+    constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+    constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+    // Triangles [firstTriangle, firstTriangle + triangleCount) of an index list, using vertexCount unique vertices
+    struct MeshletRange
+    {
+        uint32_t firstTriangle;
+        uint32_t triangleCount;
+        uint32_t vertexCount;
+    };
+
+    // Bounding sphere and normal cone of a cluster of triangles. The cluster faces away from a camera at p when
+    // dot(center - p, coneAxis) >= coneCutoff * length(center - p) + radius. coneCutoff is 1 when its triangles
+    // face too many directions for that to ever hold.
+    struct ClusterBounds
+    {
+        glm::vec3 center;
+        float radius;
+        glm::vec3 coneAxis;
+        float coneCutoff;
+    };
+
+    // Reorders the triangles so they form meshlets of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES
+    // triangles, each a contiguous range of the index list. Meshlets grow from a seed triangle by adding the
+    // neighbouring triangle that brings the fewest new vertices, the closest to the meshlet's center on ties.
+    // Seeds are taken in the order the triangles had, so a cache and overdraw optimized order carries over.
+    void build_meshlets(uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount, std::vector<MeshletRange>& meshlets);
+
+    // optimize_vertex_cache() for the triangles of one meshlet. Works on the meshlet's own few vertices, so the cost
+    // does not grow with the size of the mesh the meshlet belongs to
+    void optimize_meshlet_vertex_cache(uint32_t* indices, size_t indexCount);
+
+    ClusterBounds compute_cluster_bounds(const uint32_t* indices, size_t indexCount, const Vertex* vertices);
+} // namespace meshopt
\ No newline at end of file
@@ -0,0 +1,483 @@
+#include "obj_parser.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+#include "job_system.h"
+
+namespace
+{
+    using obj::Corner;
+
+    // OBJ indices are 1-based, with 0 meaning "not present". Negative indices count back from the last element parsed,
+    // which a chunk can only resolve locally. Those are stored biased by RELATIVE_BIAS until the chunk's offset is known.
+    constexpr int32_t RELATIVE_BIAS = -(1 << 30);
+
+    // Everything a line-aligned slice of the file contributes
+    struct Chunk
+    {
+        const char* begin;
+        const char* end;
+
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> uvs;
+        std::vector<glm::vec3> normals;
+        // Indices as parsed, see RELATIVE_BIAS
+        std::vector<Corner> corners;
+        // usemtl statements, with the first triangle counted from the start of the chunk
+        std::vector<std::pair<uint32_t, std::string_view>> materialSwitches;
+        std::string_view materialLibrary;
+    };
+
+    const char* skip_spaces(const char* cursor, const char* end)
+    {
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t'))
+        {
+            cursor++;
+        }
+
+        return cursor;
+    }
+
+    const char* find_line_end(const char* cursor, const char* end)
+    {
+        const void* lineBreak = std::memchr(cursor, '\n', static_cast<size_t>(end - cursor));
+        return lineBreak ? static_cast<const char*>(lineBreak) : end;
+    }
+
+    // The rest of the line, without the whitespace around it
+    std::string_view read_rest(const char* cursor, const char* end)
+    {
+        cursor = skip_spaces(cursor, end);
+        while (end > cursor && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+        {
+            end--;
+        }
+
+        return std::string_view(cursor, static_cast<size_t>(end - cursor));
+    }
+
+    bool starts_with_keyword(std::string_view line, std::string_view keyword)
+    {
+        return line.size() > keyword.size()
+            && line.compare(0, keyword.size(), keyword) == 0
+            && (line[keyword.size()] == ' ' || line[keyword.size()] == '\t');
+    }
+
+    const char* parse_float(const char* cursor, const char* end, float& value)
+    {
+        cursor = skip_spaces(cursor, end);
+        value = 0.0f;
+        return std::from_chars(cursor, end, value).ptr;
+    }
+
+    const char* parse_index(const char* cursor, const char* end, size_t parsedCount, int32_t& index)
+    {
+        int32_t value = 0;
+        const char* next = std::from_chars(cursor, end, value).ptr;
+        index = value < 0 ? RELATIVE_BIAS + static_cast<int32_t>(parsedCount) + value : value;
+        return next;
+    }
+
+    // Turns a parsed index into a 0-based index into the whole file, -1 when not present
+    int32_t resolve_index(int32_t index, uint32_t chunkOffset)
+    {
+        if (index < 0)
+        {
+            return static_cast<int32_t>(chunkOffset) + (index - RELATIVE_BIAS);
+        }
+
+        return index - 1;
+    }
+
+    void parse_chunk(Chunk& chunk)
+    {
+        thread_local std::vector<Corner> polygon;
+
+        const char* cursor = chunk.begin;
+        while (cursor < chunk.end)
+        {
+            const char* lineEnd = find_line_end(cursor, chunk.end);
+            const char* line = skip_spaces(cursor, lineEnd);
+            cursor = lineEnd < chunk.end ? lineEnd + 1 : chunk.end;
+
+            if (lineEnd - line < 2)
+            {
+                continue;
+            }
+
+            if (line[0] == 'v' && line[1] == ' ')
+            {
+                glm::vec3 position;
+                const char* next = parse_float(line + 2, lineEnd, position.x);
+                next = parse_float(next, lineEnd, position.y);
+                parse_float(next, lineEnd, position.z);
+                chunk.positions.push_back(position);
+            }
+            else if (line[0] == 'v' && line[1] == 't')
+            {
+                glm::vec2 uv;
+                const char* next = parse_float(line + 2, lineEnd, uv.x);
+                parse_float(next, lineEnd, uv.y);
+                chunk.uvs.push_back(uv);
+            }
+            else if (line[0] == 'v' && line[1] == 'n')
+            {
+                glm::vec3 normal;
+                const char* next = parse_float(line + 2, lineEnd, normal.x);
+                next = parse_float(next, lineEnd, normal.y);
+                parse_float(next, lineEnd, normal.z);
+                chunk.normals.push_back(normal);
+            }
+            else if (line[0] == 'f' && line[1] == ' ')
+            {
+                // Corners come as p, p/t, p//n or p/t/n
+                polygon.clear();
+                const char* next = line + 2;
+                while (true)
+                {
+                    next = skip_spaces(next, lineEnd);
+                    if (next >= lineEnd || *next == '\r' || *next == '#')
+                    {
+                        break;
+                    }
+
+                    Corner corner{0, 0, 0};
+                    const char* after = parse_index(next, lineEnd, chunk.positions.size(), corner.position);
+                    if (after == next)
+                    {
+                        // Malformed, keep the corners we have
+                        break;
+                    }
+
+                    next = after;
+                    if (next < lineEnd && *next == '/')
+                    {
+                        next++;
+                        if (next < lineEnd && *next != '/')
+                        {
+                            next = parse_index(next, lineEnd, chunk.uvs.size(), corner.uv);
+                        }
+                        if (next < lineEnd && *next == '/')
+                        {
+                            next = parse_index(next + 1, lineEnd, chunk.normals.size(), corner.normal);
+                        }
+                    }
+
+                    polygon.push_back(corner);
+                }
+
+                // Triangulate as a fan, which is exact for the convex polygons exporters write
+                for (size_t i = 1; i + 1 < polygon.size(); i++)
+                {
+                    chunk.corners.push_back(polygon[0]);
+                    chunk.corners.push_back(polygon[i]);
+                    chunk.corners.push_back(polygon[i + 1]);
+                }
+            }
+            else
+            {
+                const std::string_view text(line, static_cast<size_t>(lineEnd - line));
+                if (starts_with_keyword(text, "usemtl"))
+                {
+                    chunk.materialSwitches.emplace_back(static_cast<uint32_t>(chunk.corners.size() / 3), read_rest(line + 6, lineEnd));
+                }
+                else if (starts_with_keyword(text, "mtllib"))
+                {
+                    chunk.materialLibrary = read_rest(line + 6, lineEnd);
+                }
+            }
+        }
+    }
+
+    size_t hash_corner(const Corner& corner)
+    {
+        uint64_t hash = static_cast<uint32_t>(corner.position);
+        hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(corner.uv);
+        hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(corner.normal);
+        hash *= 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(hash ^ (hash >> 32));
+    }
+
+    Vertex make_vertex(const Corner& corner, const obj::Geometry& geometry)
+    {
+        Vertex vertex;
+        vertex.position = corner.position >= 0 && static_cast<size_t>(corner.position) < geometry.positions.size()
+            ? geometry.positions[corner.position]
+            : glm::vec3(0.0f);
+        vertex.normal = corner.normal >= 0 && static_cast<size_t>(corner.normal) < geometry.normals.size()
+            ? geometry.normals[corner.normal]
+            : glm::vec3(1.0f, 0.0f, 0.0f);
+        vertex.color = glm::vec4(1.0f);
+
+        if (corner.uv >= 0 && static_cast<size_t>(corner.uv) < geometry.uvs.size())
+        {
+            // OBJ puts the texture origin at the bottom left
+            vertex.uv_x = geometry.uvs[corner.uv].x;
+            vertex.uv_y = 1.0f - geometry.uvs[corner.uv].y;
+        }
+        else
+        {
+            vertex.uv_x = 0.0f;
+            vertex.uv_y = 0.0f;
+        }
+
+        return vertex;
+    }
+
+    void weld_block(obj::WeldBlock& block, const obj::Geometry& geometry)
+    {
+        constexpr uint32_t EMPTY_SLOT = ~0u;
+
+        const size_t cornerCount = static_cast<size_t>(block.triangleCount) * 3;
+
+        // Open addressing table of vertex indices, never more than half full so probe chains stay short
+        size_t tableSize = 1;
+        while (tableSize < cornerCount * 2)
+        {
+            tableSize <<= 1;
+        }
+
+        std::vector<uint32_t> table(tableSize, EMPTY_SLOT);
+        std::vector<Corner> uniqueCorners;
+        uniqueCorners.reserve(cornerCount / 2);
+        block.vertices.reserve(cornerCount / 2);
+        block.indices.reserve(cornerCount);
+
+        for (const auto& [firstTriangle, lastTriangle] : block.triangleRanges)
+        {
+            for (size_t i = static_cast<size_t>(firstTriangle) * 3; i < static_cast<size_t>(lastTriangle) * 3; i++)
+            {
+                const Corner& corner = geometry.corners[i];
+
+                size_t slot = hash_corner(corner) & (tableSize - 1);
+                while (table[slot] != EMPTY_SLOT && !(uniqueCorners[table[slot]] == corner))
+                {
+                    slot = (slot + 1) & (tableSize - 1);
+                }
+
+                if (table[slot] == EMPTY_SLOT)
+                {
+                    table[slot] = static_cast<uint32_t>(uniqueCorners.size());
+                    uniqueCorners.push_back(corner);
+                    block.vertices.push_back(make_vertex(corner, geometry));
+                }
+
+                block.indices.push_back(table[slot]);
+            }
+        }
+    }
+}
+
+obj::Geometry obj::parse_geometry(JobSystem& jobs, const char* data, size_t size, size_t chunkCount)
+{
+    const char* dataEnd = data + size;
+    chunkCount = std::max<size_t>(chunkCount, 1);
+
+    std::vector<Chunk> chunks(chunkCount);
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        const char* chunkBegin = i == 0 ? data : chunks[i - 1].end;
+        const char* chunkEnd = dataEnd;
+        if (i + 1 < chunkCount)
+        {
+            // Move the cut to just past the next line break
+            chunkEnd = std::max(chunkBegin, data + size * (i + 1) / chunkCount);
+            const char* lineEnd = find_line_end(chunkEnd, dataEnd);
+            chunkEnd = lineEnd < dataEnd ? lineEnd + 1 : dataEnd;
+        }
+
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+    }
+
+    jobs.ParallelFor(static_cast<uint32_t>(chunkCount), 1, [&](uint32_t begin, uint32_t end, uint32_t) -> void
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            parse_chunk(chunks[i]);
+        }
+    });
+
+    // A chunk only knows its own elements, the file-wide indices need the counts of every chunk before it
+    struct ChunkOffsets
+    {
+        uint32_t position;
+        uint32_t uv;
+        uint32_t normal;
+        uint32_t corner;
+    };
+
+    std::vector<ChunkOffsets> offsets(chunkCount);
+    ChunkOffsets totals = {0, 0, 0, 0};
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        offsets[i] = totals;
+        totals.position += static_cast<uint32_t>(chunks[i].positions.size());
+        totals.uv += static_cast<uint32_t>(chunks[i].uvs.size());
+        totals.normal += static_cast<uint32_t>(chunks[i].normals.size());
+        totals.corner += static_cast<uint32_t>(chunks[i].corners.size());
+    }
+
+    Geometry geometry;
+    geometry.positions.resize(totals.position);
+    geometry.uvs.resize(totals.uv);
+    geometry.normals.resize(totals.normal);
+    geometry.corners.resize(totals.corner);
+
+    jobs.ParallelFor(static_cast<uint32_t>(chunkCount), 1, [&](uint32_t begin, uint32_t end, uint32_t) -> void
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            Chunk& chunk = chunks[i];
+            const ChunkOffsets& offset = offsets[i];
+
+            std::copy(chunk.positions.begin(), chunk.positions.end(), geometry.positions.begin() + offset.position);
+            std::copy(chunk.uvs.begin(), chunk.uvs.end(), geometry.uvs.begin() + offset.uv);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), geometry.normals.begin() + offset.normal);
+
+            for (size_t j = 0; j < chunk.corners.size(); j++)
+            {
+                const Corner& corner = chunk.corners[j];
+                Corner& resolved = geometry.corners[offset.corner + j];
+                resolved.position = resolve_index(corner.position, offset.position);
+                resolved.uv = resolve_index(corner.uv, offset.uv);
+                resolved.normal = resolve_index(corner.normal, offset.normal);
+            }
+
+            std::vector<glm::vec3>().swap(chunk.positions);
+            std::vector<glm::vec2>().swap(chunk.uvs);
+            std::vector<glm::vec3>().swap(chunk.normals);
+            std::vector<Corner>().swap(chunk.corners);
+        }
+    });
+
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        for (const auto& [firstTriangle, name] : chunks[i].materialSwitches)
+        {
+            geometry.materialSwitches.emplace_back(offsets[i].corner / 3 + firstTriangle, name);
+        }
+
+        if (geometry.materialLibrary.empty())
+        {
+            geometry.materialLibrary = chunks[i].materialLibrary;
+        }
+    }
+
+    return geometry;
+}
+
+std::vector<obj::Material> obj::parse_materials(const char* data, size_t size)
+{
+    std::vector<Material> materials;
+
+    const char* cursor = data;
+    const char* end = data + size;
+    while (cursor < end)
+    {
+        const char* lineEnd = find_line_end(cursor, end);
+        const std::string_view line = read_rest(cursor, lineEnd);
+        cursor = lineEnd < end ? lineEnd + 1 : end;
+
+        const char* lineBegin = line.data();
+        const char* lineStop = line.data() + line.size();
+
+        if (starts_with_keyword(line, "newmtl"))
+        {
+            materials.emplace_back().name = std::string(read_rest(lineBegin + 6, lineStop));
+        }
+        else if (materials.empty())
+        {
+            continue;
+        }
+        else if (starts_with_keyword(line, "Kd"))
+        {
+            glm::vec4& color = materials.back().diffuseColor;
+            const char* next = parse_float(lineBegin + 2, lineStop, color.r);
+            next = parse_float(next, lineStop, color.g);
+            parse_float(next, lineStop, color.b);
+        }
+        else if (starts_with_keyword(line, "d"))
+        {
+            parse_float(lineBegin + 1, lineStop, materials.back().diffuseColor.a);
+        }
+        else if (starts_with_keyword(line, "Tr"))
+        {
+            float transparency;
+            parse_float(lineBegin + 2, lineStop, transparency);
+            materials.back().diffuseColor.a = 1.0f - transparency;
+        }
+        else if (starts_with_keyword(line, "map_Kd"))
+        {
+            // Options such as -s or -o come first, the file name is always last
+            const std::string_view rest = read_rest(lineBegin + 6, lineStop);
+            const size_t lastSpace = rest.find_last_of(" \t");
+            materials.back().diffuseTexture = std::string(lastSpace == std::string_view::npos ? rest : rest.substr(lastSpace + 1));
+        }
+        else if (starts_with_keyword(line, "interpolateMode"))
+        {
+            // Extension used by the voxel exporters, they want their textures to stay blocky
+            const std::string_view mode = read_rest(lineBegin + 15, lineStop);
+            materials.back().bNearestFilter = mode.compare(0, 21, "NEAREST_MAGNIFICATION") == 0;
+        }
+    }
+
+    return materials;
+}
+
+std::vector<obj::WeldBlock> obj::weld_geometry(
+    JobSystem& jobs,
+    const Geometry& geometry,
+    const std::vector<std::pair<uint32_t, uint32_t>>& materialRuns,
+    uint32_t materialCount,
+    uint32_t blockTriangles
+) {
+    const uint32_t triangleCount = geometry.GetTriangleCount();
+    blockTriangles = std::max(blockTriangles, 1u);
+
+    // Group the runs of triangles per material
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> materialTriangles(materialCount);
+    for (size_t i = 0; i < materialRuns.size(); i++)
+    {
+        const uint32_t firstTriangle = materialRuns[i].first;
+        const uint32_t lastTriangle = i + 1 < materialRuns.size() ? materialRuns[i + 1].first : triangleCount;
+        if (lastTriangle > firstTriangle)
+        {
+            materialTriangles[materialRuns[i].second].emplace_back(firstTriangle, lastTriangle);
+        }
+    }
+
+    std::vector<WeldBlock> blocks;
+    for (uint32_t material = 0; material < materialTriangles.size(); material++)
+    {
+        for (const auto& [firstTriangle, lastTriangle] : materialTriangles[material])
+        {
+            uint32_t triangle = firstTriangle;
+            while (triangle < lastTriangle)
+            {
+                if (blocks.empty() || blocks.back().material != material || blocks.back().triangleCount == blockTriangles)
+                {
+                    blocks.emplace_back().material = material;
+                }
+
+                WeldBlock& block = blocks.back();
+                const uint32_t taken = std::min(lastTriangle - triangle, blockTriangles - block.triangleCount);
+                block.triangleRanges.emplace_back(triangle, triangle + taken);
+                block.triangleCount += taken;
+                triangle += taken;
+            }
+        }
+    }
+
+    jobs.ParallelFor(static_cast<uint32_t>(blocks.size()), 1, [&](uint32_t begin, uint32_t end, uint32_t) -> void
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            weld_block(blocks[i], geometry);
+        }
+    });
+
+    return blocks;
+}
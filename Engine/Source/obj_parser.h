@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "vk_types.h"
+
+class JobSystem;
+
+// The CPU side of loading Wavefront OBJ files: parsing line-aligned chunks of the file in parallel and welding
+// the faces into indexed vertices. load_obj() puts the result on the GPU.
+namespace obj
+{
+    // Welding happens in independent blocks of at most this many triangles, so even a single huge mesh
+    // spreads over every thread. Each block becomes a surface with its own vertex range.
+    constexpr uint32_t WELD_BLOCK_TRIANGLES = 1 << 18;
+
+    // 0-based indices into the whole file, -1 when the corner does not have the attribute
+    struct Corner
+    {
+        int32_t position;
+        int32_t uv;
+        int32_t normal;
+
+        bool operator==(const Corner& other) const
+        {
+            return position == other.position && uv == other.uv && normal == other.normal;
+        }
+    };
+
+    // Everything an OBJ file holds, with the relative indices of its faces resolved. Strings point straight into the file
+    struct Geometry
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> uvs;
+        std::vector<glm::vec3> normals;
+        // Triangulated faces, three corners per triangle
+        std::vector<Corner> corners;
+        // usemtl statements, as the first triangle they apply to and the material name
+        std::vector<std::pair<uint32_t, std::string_view>> materialSwitches;
+        // The first mtllib statement, empty when there is none
+        std::string_view materialLibrary;
+
+        uint32_t GetTriangleCount() const { return static_cast<uint32_t>(corners.size() / 3); }
+    };
+
+    struct Material
+    {
+        std::string name;
+        glm::vec4 diffuseColor{1.0f};
+        std::string diffuseTexture;
+        bool bNearestFilter{false};
+    };
+
+    // Triangles of a single material, welded into vertices of their own
+    struct WeldBlock
+    {
+        uint32_t material;
+        // Ranges of Geometry::corners, in triangles
+        std::vector<std::pair<uint32_t, uint32_t>> triangleRanges;
+        uint32_t triangleCount{0};
+
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+    };
+
+    // Cuts the file into chunkCount line-aligned chunks and parses them on the job system
+    Geometry parse_geometry(JobSystem& jobs, const char* data, size_t size, size_t chunkCount);
+
+    // Parses a material library, which is tiny next to the geometry so a single pass will do
+    std::vector<Material> parse_materials(const char* data, size_t size);
+
+    // Splits the triangles into blocks of at most blockTriangles sharing a material and welds the corners of each block
+    // with the same position/uv/normal triplet into a single vertex. materialRuns holds the first triangle and material
+    // of every run of triangles, in increasing order of triangles, with the first run starting at 0. Materials must be
+    // below materialCount. Blocks come ordered by material
+    std::vector<WeldBlock> weld_geometry(
+        JobSystem& jobs,
+        const Geometry& geometry,
+        const std::vector<std::pair<uint32_t, uint32_t>>& materialRuns,
+        uint32_t materialCount,
+        uint32_t blockTriangles = WELD_BLOCK_TRIANGLES
+    );
+} // namespace obj
@@ -0,0 +1,911 @@
+#include "tests.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fmt/core.h>
+#include <limits>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "cooked_scene.h"
+#include "culling.h"
+#include "job_system.h"
+#include "mesh_optimizer.h"
+#include "obj_parser.h"
+
+namespace
+{
+    // Counts the failed checks of a suite, so a run lists every problem instead of stopping at the first
+    struct Checker
+    {
+        const char* suite;
+        uint32_t failureCount{0};
+
+        void Check(bool bPassed, const char* what)
+        {
+            if (!bPassed)
+            {
+                fmt::println("FAILED {}: {}", suite, what);
+                failureCount++;
+            }
+        }
+    };
+
+    // Vertices on a bumpy grid, every one at a distinct position so a position identifies its vertex
+    std::vector<Vertex> make_grid_vertices(uint32_t size)
+    {
+        std::vector<Vertex> vertices(static_cast<size_t>(size) * size);
+        for (uint32_t y = 0; y < size; y++)
+        {
+            for (uint32_t x = 0; x < size; x++)
+            {
+                Vertex& vertex = vertices[static_cast<size_t>(y) * size + x];
+                vertex = {};
+                vertex.position = glm::vec3{static_cast<float>(x), static_cast<float>(y), static_cast<float>((x * 7 + y * 3) % 5) * 0.25f};
+                vertex.normal = glm::vec3{0.0f, 0.0f, 1.0f};
+                vertex.uv_x = static_cast<float>(x) / static_cast<float>(size);
+                vertex.uv_y = static_cast<float>(y) / static_cast<float>(size);
+                vertex.color = glm::vec4{1.0f};
+            }
+        }
+        return vertices;
+    }
+
+    // Two triangles per grid cell, in a shuffled order so the optimizer has something to do
+    std::vector<uint32_t> make_grid_indices(uint32_t size, std::mt19937& random)
+    {
+        std::vector<std::array<uint32_t, 3>> triangles;
+        for (uint32_t y = 0; y + 1 < size; y++)
+        {
+            for (uint32_t x = 0; x + 1 < size; x++)
+            {
+                const uint32_t corner = y * size + x;
+                triangles.push_back({corner, corner + 1, corner + size});
+                triangles.push_back({corner + 1, corner + size + 1, corner + size});
+            }
+        }
+        std::shuffle(triangles.begin(), triangles.end(), random);
+
+        std::vector<uint32_t> indices;
+        for (const std::array<uint32_t, 3>& triangle : triangles)
+        {
+            indices.insert(indices.end(), triangle.begin(), triangle.end());
+        }
+        return indices;
+    }
+
+    using TriangleKey = std::array<float, 9>;
+
+    // The triangles by the positions of their corners, each rotated to start at its smallest corner so the winding
+    // is kept but the corner it starts at does not matter. Sorted, so two meshes compare as multisets of triangles
+    std::vector<TriangleKey> get_triangle_keys(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+    {
+        std::vector<TriangleKey> keys;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            std::array<std::array<float, 3>, 3> corners;
+            for (size_t k = 0; k < 3; k++)
+            {
+                const glm::vec3& position = vertices[indices[i + k]].position;
+                corners[k] = {position.x, position.y, position.z};
+            }
+            std::rotate(corners.begin(), std::min_element(corners.begin(), corners.end()), corners.end());
+
+            TriangleKey key;
+            for (size_t k = 0; k < 3; k++)
+            {
+                std::copy(corners[k].begin(), corners[k].end(), key.begin() + k * 3);
+            }
+            keys.push_back(key);
+        }
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    }
+
+    // Vertices on a grid displaced by a smooth wave of the given height, the plane for a height of 0
+    std::vector<Vertex> make_wave_vertices(uint32_t size, float height)
+    {
+        std::vector<Vertex> vertices = make_grid_vertices(size);
+        for (Vertex& vertex : vertices)
+        {
+            vertex.position.z = height * std::sin(vertex.position.x * 0.4f) * std::cos(vertex.position.y * 0.3f);
+        }
+        return vertices;
+    }
+
+    // Distance from p to the triangle abc: to its plane when p projects inside it, to the nearest edge otherwise
+    float get_triangle_distance(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+    {
+        const auto get_edge_distance = [&](const glm::vec3& from, const glm::vec3& to) -> float
+        {
+            const glm::vec3 edge = to - from;
+            const float t = glm::clamp(glm::dot(p - from, edge) / std::max(glm::dot(edge, edge), 1e-12f), 0.0f, 1.0f);
+            return glm::length(p - (from + edge * t));
+        };
+
+        const glm::vec3 normal = glm::cross(b - a, c - a);
+        const float normalLength = glm::length(normal);
+        if (normalLength > 0.0f)
+        {
+            const glm::vec3 unitNormal = normal / normalLength;
+            const float planeDistance = glm::dot(p - a, unitNormal);
+            const glm::vec3 projected = p - unitNormal * planeDistance;
+            if (glm::dot(glm::cross(b - a, projected - a), unitNormal) >= 0.0f
+                && glm::dot(glm::cross(c - b, projected - b), unitNormal) >= 0.0f
+                && glm::dot(glm::cross(a - c, projected - c), unitNormal) >= 0.0f)
+            {
+                return std::abs(planeDistance);
+            }
+        }
+        return std::min({get_edge_distance(a, b), get_edge_distance(b, c), get_edge_distance(c, a)});
+    }
+
+    // Indices of the vertex optimized mesh are in the order of first use: 0, then at most one past the largest so far
+    bool is_in_first_use_order(const std::vector<uint32_t>& indices)
+    {
+        uint32_t nextVertex = 0;
+        for (const uint32_t index : indices)
+        {
+            if (index > nextVertex)
+            {
+                return false;
+            }
+            if (index == nextVertex)
+            {
+                nextVertex++;
+            }
+        }
+        return true;
+    }
+}
+
+uint32_t tests::mesh_optimizer()
+{
+    Checker checker{"mesh optimizer"};
+    std::mt19937 random(1234);
+
+    constexpr uint32_t gridSize = 24;
+    const std::vector<Vertex> gridVertices = make_grid_vertices(gridSize);
+    const std::vector<uint32_t> gridIndices = make_grid_indices(gridSize, random);
+
+    // A plain mesh: every pass has to keep the triangles, and the cache pass must not make things worse
+    {
+        std::vector<uint32_t> indices = gridIndices;
+        meshopt::optimize_vertex_cache(indices.data(), indices.size(), gridVertices.size());
+        checker.Check(get_triangle_keys(gridVertices, indices) == get_triangle_keys(gridVertices, gridIndices), "vertex cache optimization changed the triangles");
+
+        const float acmrBefore = meshopt::analyze_vertex_cache(gridIndices.data(), gridIndices.size(), gridVertices.size()).GetACMR();
+        const float acmrAfter = meshopt::analyze_vertex_cache(indices.data(), indices.size(), gridVertices.size()).GetACMR();
+        checker.Check(acmrAfter < acmrBefore, "vertex cache optimization did not improve the ACMR of a shuffled grid");
+
+        meshopt::optimize_overdraw(indices.data(), indices.size(), gridVertices.data(), gridVertices.size(), 1.05f);
+        checker.Check(get_triangle_keys(gridVertices, indices) == get_triangle_keys(gridVertices, gridIndices), "overdraw optimization changed the triangles");
+
+        std::vector<Vertex> vertices = gridVertices;
+        const size_t referencedCount = meshopt::optimize_vertex_fetch(vertices.data(), indices.data(), indices.size(), vertices.size());
+        checker.Check(referencedCount == gridVertices.size(), "vertex fetch optimization lost referenced vertices");
+        checker.Check(is_in_first_use_order(indices), "vertex fetch optimization did not order the vertices by first use");
+        checker.Check(get_triangle_keys(vertices, indices) == get_triangle_keys(gridVertices, gridIndices), "vertex fetch optimization changed the triangles");
+    }
+
+    // Degenerate triangles, the first one included, used to break clustering and the cache optimizer's adjacency
+    for (const size_t triangleCount : {size_t{2}, size_t{65}, size_t{1000}})
+    {
+        std::uniform_int_distribution<uint32_t> vertex(0, static_cast<uint32_t>(gridVertices.size()) - 1);
+        std::vector<uint32_t> inputIndices = {5, 5, 6};
+        while (inputIndices.size() < triangleCount * 3)
+        {
+            const size_t triangle = inputIndices.size() / 3;
+            const uint32_t a = vertex(random);
+            const uint32_t b = triangle % 5 == 0 ? a : vertex(random);
+            const uint32_t c = triangle % 7 == 0 ? a : vertex(random);
+            inputIndices.insert(inputIndices.end(), {a, b, c});
+        }
+
+        std::vector<Vertex> vertices = gridVertices;
+        std::vector<uint32_t> indices = inputIndices;
+        meshopt::optimize_mesh(vertices.data(), vertices.size(), indices.data(), indices.size());
+        checker.Check(get_triangle_keys(vertices, indices) == get_triangle_keys(gridVertices, inputIndices), "optimizing a mesh with degenerate triangles changed the triangles");
+    }
+
+    return checker.failureCount;
+}
+
+uint32_t tests::simplifier()
+{
+    Checker checker{"simplifier"};
+    std::mt19937 random(1234);
+
+    constexpr uint32_t gridSize = 32;
+    const std::vector<uint32_t> inputIndices = make_grid_indices(gridSize, random);
+    meshopt::SimplifyWeights positionOnly;
+    positionOnly.normal = 0.0f;
+    positionOnly.uv = 0.0f;
+
+    for (const float height : {0.0f, 0.05f, 0.3f, 1.0f})
+    {
+        const std::vector<Vertex> vertices = make_wave_vertices(gridSize, height);
+
+        for (const size_t targetIndexCount : {inputIndices.size() / 2, inputIndices.size() / 4, inputIndices.size() / 10})
+        {
+            std::vector<uint32_t> indices(inputIndices.size());
+            float error = -1.0f;
+            const size_t indexCount = meshopt::simplify(indices.data(), inputIndices.data(), inputIndices.size(), vertices.data(), vertices.size(), targetIndexCount, positionOnly, error);
+            indices.resize(indexCount);
+
+            checker.Check(indexCount % 3 == 0 && indexCount <= targetIndexCount, "simplification missed its target on a grid");
+
+            bool bValid = true;
+            for (size_t i = 0; i < indexCount; i += 3)
+            {
+                bValid = bValid && indices[i] < vertices.size() && indices[i + 1] < vertices.size() && indices[i + 2] < vertices.size()
+                    && indices[i] != indices[i + 1] && indices[i + 1] != indices[i + 2] && indices[i + 2] != indices[i];
+            }
+            checker.Check(bValid, "simplification wrote an out of range index or a degenerate triangle");
+
+            // The reported error has to cover how far any input vertex ended up from the result
+            float maxDistance = 0.0f;
+            for (const Vertex& vertex : vertices)
+            {
+                float distance = std::numeric_limits<float>::max();
+                for (size_t i = 0; i < indexCount; i += 3)
+                {
+                    distance = std::min(distance, get_triangle_distance(vertex.position, vertices[indices[i]].position, vertices[indices[i + 1]].position, vertices[indices[i + 2]].position));
+                }
+                maxDistance = std::max(maxDistance, distance);
+            }
+            checker.Check(maxDistance <= error * 1.001f + 1e-4f, "an input vertex is further from the simplified mesh than the reported error");
+
+            if (height == 0.0f)
+            {
+                checker.Check(error < 1e-4f, "simplifying a plane reported an error");
+
+                // Locked borders and no flipped triangles: the plane still covers exactly the same area
+                float area = 0.0f;
+                for (size_t i = 0; i < indexCount; i += 3)
+                {
+                    const glm::vec3& a = vertices[indices[i]].position;
+                    area += glm::cross(vertices[indices[i + 1]].position - a, vertices[indices[i + 2]].position - a).z * 0.5f;
+                }
+                const float expectedArea = static_cast<float>((gridSize - 1) * (gridSize - 1));
+                checker.Check(std::abs(area - expectedArea) < expectedArea * 1e-4f, "simplifying a plane changed the area it covers");
+            }
+        }
+    }
+
+    // Nothing to do when the target is already met, and broken indices are passed through untouched
+    {
+        const std::vector<Vertex> vertices = make_wave_vertices(gridSize, 1.0f);
+        std::vector<uint32_t> indices(inputIndices.size());
+        float error = -1.0f;
+        size_t indexCount = meshopt::simplify(indices.data(), inputIndices.data(), inputIndices.size(), vertices.data(), vertices.size(), inputIndices.size(), meshopt::SimplifyWeights{}, error);
+        checker.Check(indexCount == inputIndices.size() && indices == inputIndices && error == 0.0f, "simplifying to the full index count changed the mesh");
+
+        std::vector<uint32_t> brokenIndices = inputIndices;
+        brokenIndices[4] = static_cast<uint32_t>(vertices.size());
+        indexCount = meshopt::simplify(indices.data(), brokenIndices.data(), brokenIndices.size(), vertices.data(), vertices.size(), brokenIndices.size() / 4, meshopt::SimplifyWeights{}, error);
+        checker.Check(indexCount == brokenIndices.size() && indices == brokenIndices, "out of range indices were not passed through");
+    }
+
+    return checker.failureCount;
+}
+
+uint32_t tests::meshlets()
+{
+    Checker checker{"meshlets"};
+    std::mt19937 random(1234);
+
+    constexpr uint32_t gridSize = 64;
+    const std::vector<Vertex> vertices = make_grid_vertices(gridSize);
+    const std::vector<uint32_t> inputIndices = make_grid_indices(gridSize, random);
+    const size_t triangleCount = inputIndices.size() / 3;
+
+    std::vector<uint32_t> indices = inputIndices;
+    std::vector<meshopt::MeshletRange> ranges;
+    meshopt::build_meshlets(indices.data(), indices.size(), vertices.data(), vertices.size(), ranges);
+    checker.Check(get_triangle_keys(vertices, indices) == get_triangle_keys(vertices, inputIndices), "building meshlets changed the triangles");
+
+    // Back to back ranges over the whole index list, each within the limits and counting its vertices right
+    size_t nextTriangle = 0;
+    bool bContiguous = true;
+    bool bWithinLimits = true;
+    bool bVertexCountsMatch = true;
+    for (const meshopt::MeshletRange& range : ranges)
+    {
+        bContiguous = bContiguous && range.firstTriangle == nextTriangle && range.triangleCount > 0;
+        nextTriangle = static_cast<size_t>(range.firstTriangle) + range.triangleCount;
+        if (nextTriangle > triangleCount)
+        {
+            bContiguous = false;
+            break;
+        }
+
+        std::vector<uint32_t> meshletVertices(indices.begin() + range.firstTriangle * 3, indices.begin() + nextTriangle * 3);
+        std::sort(meshletVertices.begin(), meshletVertices.end());
+        meshletVertices.erase(std::unique(meshletVertices.begin(), meshletVertices.end()), meshletVertices.end());
+
+        bWithinLimits = bWithinLimits && range.triangleCount <= meshopt::MESHLET_MAX_TRIANGLES && meshletVertices.size() <= meshopt::MESHLET_MAX_VERTICES;
+        bVertexCountsMatch = bVertexCountsMatch && range.vertexCount == meshletVertices.size();
+    }
+    checker.Check(bContiguous && nextTriangle == triangleCount, "meshlets do not cover every triangle exactly once");
+    checker.Check(bWithinLimits, "a meshlet has too many vertices or triangles");
+    checker.Check(bVertexCountsMatch, "a meshlet's vertex count is wrong");
+
+    // Reordering within the meshlets keeps every triangle in its meshlet
+    std::vector<uint32_t> optimizedIndices = indices;
+    bool bMeshletsKept = true;
+    for (const meshopt::MeshletRange& range : ranges)
+    {
+        const size_t begin = static_cast<size_t>(range.firstTriangle) * 3;
+        const size_t count = static_cast<size_t>(range.triangleCount) * 3;
+        meshopt::optimize_meshlet_vertex_cache(optimizedIndices.data() + begin, count);
+
+        const std::vector<uint32_t> before(indices.begin() + begin, indices.begin() + begin + count);
+        const std::vector<uint32_t> after(optimizedIndices.begin() + begin, optimizedIndices.begin() + begin + count);
+        bMeshletsKept = bMeshletsKept && get_triangle_keys(vertices, before) == get_triangle_keys(vertices, after);
+    }
+    checker.Check(bMeshletsKept, "optimizing a meshlet changed its triangles");
+
+    // Cameras all around the grid: whenever the cone says a meshlet faces away, every one of its triangles has to
+    std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+    std::vector<glm::vec3> cameras(64);
+    for (glm::vec3& camera : cameras)
+    {
+        camera = glm::vec3{coordinate(random), coordinate(random), coordinate(random)} + glm::vec3{gridSize * 0.5f, gridSize * 0.5f, 0.0f};
+    }
+
+    bool bSpheresContain = true;
+    bool bConesConservative = true;
+    uint32_t culledCount = 0;
+    for (const meshopt::MeshletRange& range : ranges)
+    {
+        const uint32_t* meshletIndices = indices.data() + static_cast<size_t>(range.firstTriangle) * 3;
+        const size_t count = static_cast<size_t>(range.triangleCount) * 3;
+        const meshopt::ClusterBounds bounds = meshopt::compute_cluster_bounds(meshletIndices, count, vertices.data());
+
+        for (size_t i = 0; i < count; i++)
+        {
+            bSpheresContain = bSpheresContain && glm::length(vertices[meshletIndices[i]].position - bounds.center) <= bounds.radius * 1.0001f + 1e-5f;
+        }
+
+        for (const glm::vec3& camera : cameras)
+        {
+            const glm::vec3 toCenter = bounds.center - camera;
+            if (glm::dot(toCenter, bounds.coneAxis) < bounds.coneCutoff * glm::length(toCenter) + bounds.radius)
+            {
+                continue;
+            }
+            culledCount++;
+
+            for (size_t i = 0; i < count; i += 3)
+            {
+                const glm::vec3& a = vertices[meshletIndices[i]].position;
+                const glm::vec3& b = vertices[meshletIndices[i + 1]].position;
+                const glm::vec3& c = vertices[meshletIndices[i + 2]].position;
+                bConesConservative = bConesConservative && glm::dot(glm::cross(b - a, c - a), camera - a) <= 1e-3f;
+            }
+        }
+    }
+    checker.Check(bSpheresContain, "a meshlet's bounding sphere misses some of its vertices");
+    checker.Check(bConesConservative, "a meshlet's cone culled it while one of its triangles faced the camera");
+    checker.Check(culledCount > 0, "no meshlet was ever cone culled, the cones are useless");
+
+    return checker.failureCount;
+}
+
+uint32_t tests::culling()
+{
+    Checker checker{"culling"};
+    std::mt19937 random(1234);
+
+    // The same reversed depth projection the engine renders with, looking down -z from the origin
+    glm::mat4 projection = glm::perspective(glm::radians(70.0f), 16.0f / 9.0f, 10000.0f, 0.1f);
+    projection[1][1] *= -1;
+    const culling::Frustum frustum = culling::extract_frustum(projection);
+
+    const auto is_inside = [&](const glm::vec3& point) -> bool
+    {
+        for (const glm::vec4& plane : frustum.planes)
+        {
+            if (glm::dot(glm::vec3(plane), point) + plane.w < 0.0f)
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    checker.Check(is_inside({0.0f, 0.0f, -1.0f}) && is_inside({0.0f, 0.0f, -9000.0f}), "points in front of the camera are outside the frustum");
+    checker.Check(!is_inside({0.0f, 0.0f, 1.0f}) && !is_inside({0.0f, 0.0f, -0.05f}) && !is_inside({0.0f, 0.0f, -20000.0f}), "points behind the camera or past the depth range are inside the frustum");
+    checker.Check(!is_inside({100.0f, 0.0f, -1.0f}) && !is_inside({0.0f, 100.0f, -1.0f}), "points beside the view are inside the frustum");
+
+    // An amount that is no multiple of 4 or 8, so the kernels' tails are covered as well
+    constexpr uint32_t objectCount = 10003;
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> angle(0.0f, glm::two_pi<float>());
+    std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> extent(0.1f, 5.0f);
+
+    std::vector<glm::mat4> worldMatrices(objectCount);
+    std::vector<float> centerX(objectCount), centerY(objectCount), centerZ(objectCount);
+    std::vector<float> extentX(objectCount), extentY(objectCount), extentZ(objectCount), radius(objectCount);
+    for (uint32_t i = 0; i < objectCount; i++)
+    {
+        const glm::vec3 axis = glm::normalize(glm::vec3{offset(random), offset(random), offset(random)} + glm::vec3{0.0f, 0.01f, 0.0f});
+        worldMatrices[i] = glm::translate(glm::mat4(1.0f), glm::vec3{position(random), position(random), position(random)});
+        worldMatrices[i] = glm::rotate(worldMatrices[i], angle(random), axis);
+        worldMatrices[i] = glm::scale(worldMatrices[i], glm::vec3{scale(random), scale(random), scale(random)});
+
+        centerX[i] = offset(random);
+        centerY[i] = offset(random);
+        centerZ[i] = offset(random);
+        extentX[i] = extent(random);
+        extentY[i] = extent(random);
+        extentZ[i] = extent(random);
+        radius[i] = std::sqrt(extentX[i] * extentX[i] + extentY[i] * extentY[i] + extentZ[i] * extentZ[i]);
+    }
+
+    const culling::BoxArrays boxes{centerX.data(), centerY.data(), centerZ.data(), extentX.data(), extentY.data(), extentZ.data()};
+    const culling::SphereArrays spheres{centerX.data(), centerY.data(), centerZ.data(), radius.data()};
+
+    std::vector<uint32_t> visibleIndices(objectCount);
+    const auto cull = [&](bool bBoxes, culling::InstructionSet instructionSet) -> std::vector<uint32_t>
+    {
+        const uint32_t visibleCount = bBoxes
+            ? culling::cull_boxes(frustum, boxes, worldMatrices.data(), objectCount, visibleIndices.data(), instructionSet)
+            : culling::cull_spheres(frustum, spheres, worldMatrices.data(), objectCount, visibleIndices.data(), instructionSet);
+        return std::vector<uint32_t>(visibleIndices.begin(), visibleIndices.begin() + visibleCount);
+    };
+
+    for (const bool bBoxes : {true, false})
+    {
+        const std::vector<uint32_t> reference = cull(bBoxes, culling::InstructionSet::Scalar);
+        checker.Check(std::is_sorted(reference.begin(), reference.end()) && std::adjacent_find(reference.begin(), reference.end()) == reference.end(), "visible indices are not strictly increasing");
+        checker.Check(!reference.empty() && reference.size() < objectCount / 2, "the scene around the camera should be partly visible");
+
+        // Every object whose center is in view is visible, whatever its bounds
+        std::vector<bool> bVisible(objectCount, false);
+        for (const uint32_t index : reference)
+        {
+            bVisible[index] = true;
+        }
+        bool bConservative = true;
+        for (uint32_t i = 0; i < objectCount; i++)
+        {
+            const glm::vec3 center = glm::vec3(worldMatrices[i] * glm::vec4{centerX[i], centerY[i], centerZ[i], 1.0f});
+            bConservative = bConservative && (bVisible[i] || !is_inside(center));
+        }
+        checker.Check(bConservative, bBoxes ? "a box with its center in view was culled" : "a sphere with its center in view was culled");
+
+        for (const culling::InstructionSet instructionSet : {culling::InstructionSet::Sse, culling::InstructionSet::Avx2})
+        {
+            if (culling::get_instruction_set() >= instructionSet)
+            {
+                checker.Check(cull(bBoxes, instructionSet) == reference, bBoxes ? "a SIMD box kernel disagrees with the scalar one" : "a SIMD sphere kernel disagrees with the scalar one");
+            }
+        }
+    }
+
+    return checker.failureCount;
+}
+
+uint32_t tests::obj_parser()
+{
+    Checker checker{"obj_parser"};
+
+    JobSystem jobs;
+    jobs.Init(3);
+
+    // A grid of quads written a row at a time, vertices first and the faces of the row after them. Every other quad
+    // refers to its corners relative to the last vertex written, and the quads cycle through the four corner formats
+    constexpr uint32_t columns = 9;
+    constexpr uint32_t rows = 7;
+    std::string text = "mtllib grid.mtl\n";
+    std::vector<obj::Corner> expectedCorners;
+    int32_t writtenVertices = 0;
+    int32_t writtenNormals = 0;
+    for (uint32_t y = 0; y <= rows; y++)
+    {
+        for (uint32_t x = 0; x <= columns; x++)
+        {
+            text += fmt::format("v {} {} {}\nvt {} {}\n", x, y, (x * 7 + y * 3) % 5, x * 0.1f, y * 0.1f);
+            writtenVertices++;
+        }
+        text += fmt::format("vn 0 {} 1\n", y);
+        writtenNormals++;
+
+        if (y == 0)
+        {
+            continue;
+        }
+        if (y == rows / 2)
+        {
+            text += "usemtl second\n";
+        }
+
+        for (uint32_t x = 0; x < columns; x++)
+        {
+            const uint32_t quad = (y - 1) * columns + x;
+            const bool bRelative = quad % 2 == 1;
+            const bool bUv = quad % 4 == 1 || quad % 4 == 3;
+            const bool bNormal = quad % 4 >= 2;
+
+            const std::array<int32_t, 4> positions = {
+                static_cast<int32_t>((y - 1) * (columns + 1) + x),
+                static_cast<int32_t>((y - 1) * (columns + 1) + x + 1),
+                static_cast<int32_t>(y * (columns + 1) + x + 1),
+                static_cast<int32_t>(y * (columns + 1) + x),
+            };
+
+            std::string face = "f";
+            std::array<obj::Corner, 4> corners;
+            for (size_t i = 0; i < 4; i++)
+            {
+                const int32_t position = bRelative ? positions[i] - writtenVertices : positions[i] + 1;
+                const int32_t normal = bRelative ? -1 : writtenNormals;
+                if (bUv && bNormal)
+                {
+                    face += fmt::format(" {}/{}/{}", position, position, normal);
+                }
+                else if (bUv)
+                {
+                    face += fmt::format(" {}/{}", position, position);
+                }
+                else if (bNormal)
+                {
+                    face += fmt::format(" {}//{}", position, normal);
+                }
+                else
+                {
+                    face += fmt::format(" {}", position);
+                }
+                corners[i] = {positions[i], bUv ? positions[i] : -1, bNormal ? writtenNormals - 1 : -1};
+            }
+            text += face + "\n";
+
+            // Quads triangulate as a fan around their first corner
+            for (const size_t i : {0, 1, 2, 0, 2, 3})
+            {
+                expectedCorners.push_back(corners[i]);
+            }
+        }
+    }
+
+    const uint32_t lineCount = static_cast<uint32_t>(std::count(text.begin(), text.end(), '\n'));
+    const uint32_t triangleCount = static_cast<uint32_t>(expectedCorners.size() / 3);
+    const uint32_t secondMaterialTriangle = (rows / 2 - 1) * columns * 2;
+
+    bool bCornersResolved = true;
+    bool bAttributesComplete = true;
+    bool bMaterialsFound = true;
+    for (const size_t chunkCount : {size_t{1}, size_t{2}, size_t{3}, size_t{5}, size_t{8}, size_t{13}, size_t{lineCount}})
+    {
+        const obj::Geometry geometry = obj::parse_geometry(jobs, text.data(), text.size(), chunkCount);
+        bCornersResolved = bCornersResolved && geometry.corners == expectedCorners;
+        bAttributesComplete = bAttributesComplete
+            && geometry.positions.size() == static_cast<size_t>(writtenVertices)
+            && geometry.uvs.size() == static_cast<size_t>(writtenVertices)
+            && geometry.normals.size() == static_cast<size_t>(writtenNormals)
+            && geometry.positions.back() == glm::vec3{columns, rows, (columns * 7 + rows * 3) % 5};
+        bMaterialsFound = bMaterialsFound
+            && geometry.materialLibrary == "grid.mtl"
+            && geometry.materialSwitches.size() == 1
+            && geometry.materialSwitches[0].first == secondMaterialTriangle
+            && geometry.materialSwitches[0].second == "second";
+    }
+    checker.Check(bCornersResolved, "faces resolved to other corners depending on where the file was cut");
+    checker.Check(bAttributesComplete, "vertex attributes went missing depending on where the file was cut");
+    checker.Check(bMaterialsFound, "usemtl or mtllib went missing depending on where the file was cut");
+
+    const std::string_view library = "newmtl first\nKd 1 0 0\n\nnewmtl second\r\nKd 0 1 0\r\nd 0.5\r\nmap_Kd -s 1 1 1 textures/grass.png\r\ninterpolateMode NEAREST_MAGNIFICATION\r\n";
+    const std::vector<obj::Material> materials = obj::parse_materials(library.data(), library.size());
+    checker.Check(
+        materials.size() == 2
+            && materials[0].name == "first"
+            && materials[0].diffuseColor == glm::vec4{1.0f, 0.0f, 0.0f, 1.0f}
+            && materials[1].name == "second"
+            && materials[1].diffuseColor == glm::vec4{0.0f, 1.0f, 0.0f, 0.5f}
+            && materials[1].diffuseTexture == "textures/grass.png"
+            && materials[1].bNearestFilter && !materials[0].bNearestFilter,
+        "the material library was read wrong"
+    );
+
+    // The second material only covers the middle rows, so the first one has two runs that end up in the same blocks
+    const obj::Geometry geometry = obj::parse_geometry(jobs, text.data(), text.size(), 4);
+    const std::vector<std::pair<uint32_t, uint32_t>> materialRuns = {{0, 0}, {secondMaterialTriangle, 1}, {secondMaterialTriangle + 2 * columns, 0}};
+    const auto get_material = [&](uint32_t triangle) -> uint32_t
+    {
+        return triangle >= secondMaterialTriangle && triangle < secondMaterialTriangle + 2 * columns ? 1 : 0;
+    };
+
+    for (const uint32_t blockTriangles : {1u, 2u, 5u, 17u, obj::WELD_BLOCK_TRIANGLES})
+    {
+        const std::vector<obj::WeldBlock> blocks = obj::weld_geometry(jobs, geometry, materialRuns, 2, blockTriangles);
+
+        std::vector<uint32_t> timesCovered(triangleCount, 0);
+        bool bWithinLimits = true;
+        bool bSameTriangles = true;
+        bool bRightMaterial = true;
+        bool bWelded = true;
+        for (const obj::WeldBlock& block : blocks)
+        {
+            bWithinLimits = bWithinLimits
+                && block.triangleCount > 0
+                && block.triangleCount <= blockTriangles
+                && block.indices.size() == static_cast<size_t>(block.triangleCount) * 3;
+            if (!bWithinLimits)
+            {
+                break;
+            }
+
+            // Every vertex of the block is another corner, and the corners it was welded from all became that vertex
+            std::vector<obj::Corner> uniqueCorners;
+            uint32_t blockTriangle = 0;
+            for (const auto& [firstTriangle, lastTriangle] : block.triangleRanges)
+            {
+                for (uint32_t triangle = firstTriangle; triangle < lastTriangle; triangle++, blockTriangle++)
+                {
+                    timesCovered[triangle]++;
+                    bRightMaterial = bRightMaterial && block.material == get_material(triangle);
+
+                    for (uint32_t corner = 0; corner < 3; corner++)
+                    {
+                        const obj::Corner& expected = expectedCorners[triangle * 3 + corner];
+                        const uint32_t index = block.indices[blockTriangle * 3 + corner];
+                        if (index >= block.vertices.size())
+                        {
+                            bSameTriangles = false;
+                            continue;
+                        }
+
+                        const Vertex& vertex = block.vertices[index];
+                        const float expectedUvY = expected.uv >= 0 ? 1.0f - geometry.uvs[expected.uv].y : 0.0f;
+                        const glm::vec3 expectedNormal = expected.normal >= 0 ? geometry.normals[expected.normal] : glm::vec3{1.0f, 0.0f, 0.0f};
+                        bSameTriangles = bSameTriangles
+                            && vertex.position == geometry.positions[expected.position]
+                            && vertex.uv_y == expectedUvY
+                            && vertex.normal == expectedNormal;
+
+                        if (std::find(uniqueCorners.begin(), uniqueCorners.end(), expected) == uniqueCorners.end())
+                        {
+                            uniqueCorners.push_back(expected);
+                        }
+                    }
+                }
+            }
+            bWelded = bWelded && blockTriangle == block.triangleCount && block.vertices.size() == uniqueCorners.size();
+        }
+
+        checker.Check(bWithinLimits, "a weld block is empty or holds more triangles than allowed");
+        checker.Check(std::all_of(timesCovered.begin(), timesCovered.end(), [](uint32_t count) { return count == 1; }), "welding did not keep every triangle exactly once");
+        checker.Check(bSameTriangles, "welded triangles do not use the corners they were parsed with");
+        checker.Check(bRightMaterial, "a triangle was welded into a block of another material");
+        checker.Check(bWelded, "a block has duplicate or unused vertices");
+        if (blockTriangles == obj::WELD_BLOCK_TRIANGLES)
+        {
+            checker.Check(blocks.size() == 2, "blocks of the same material were not merged");
+        }
+    }
+
+    return checker.failureCount;
+}
+
+uint32_t tests::cooked_scene()
+{
+    Checker checker{"cooked_scene"};
+    std::mt19937 random(1234);
+
+    // Two meshes over a grid of 16 bit indices, one with LODs and meshlets, instanced three times
+    constexpr uint32_t gridSize = 16;
+    const std::vector<Vertex> vertices = make_grid_vertices(gridSize);
+    const std::vector<uint32_t> gridIndices = make_grid_indices(gridSize, random);
+    const uint32_t surfaceIndexCount = static_cast<uint32_t>(gridIndices.size() / 2);
+
+    cooked::Scene scene;
+    scene.vertexFormat = VertexFormat::Full;
+    scene.indexStride = sizeof(uint16_t);
+    scene.vertexBufferSize = vertices.size() * sizeof(Vertex);
+    scene.indexBufferSize = gridIndices.size() * sizeof(uint16_t);
+
+    GeoSurface surface = {};
+    surface.startIndex = 0;
+    surface.count = surfaceIndexCount;
+    surface.vertexOffset = 0;
+    surface.materialIndex = 1;
+    surface.bounds = Bounds{glm::vec3{8.0f, 8.0f, 0.5f}, 11.0f, glm::vec3{8.0f, 8.0f, 0.5f}};
+    surface.lodCount = 1;
+    surface.lods[0] = SurfaceLod{surfaceIndexCount, surfaceIndexCount, 0.25f};
+    surface.firstMeshlet = 0;
+    surface.meshletCount = 2;
+
+    MeshAsset& firstMesh = scene.meshes.emplace_back();
+    firstMesh.name = "first";
+    firstMesh.surfaces.push_back(surface);
+
+    MeshAsset& secondMesh = scene.meshes.emplace_back();
+    secondMesh.name = "second mesh";
+    surface.startIndex = surfaceIndexCount;
+    surface.materialIndex = 0;
+    surface.lodCount = 0;
+    surface.meshletCount = 0;
+    secondMesh.surfaces.push_back(surface);
+    surface.startIndex = 0;
+    surface.count = 3;
+    secondMesh.surfaces.push_back(surface);
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        scene.instances.push_back({glm::translate(glm::mat4(1.0f), glm::vec3{static_cast<float>(i) * 20.0f, 0.0f, 0.0f}), i % 2});
+    }
+
+    Meshlet meshlet = {};
+    meshlet.center = glm::vec3{4.0f, 4.0f, 0.5f};
+    meshlet.radius = 6.0f;
+    meshlet.coneAxis = glm::vec3{0.0f, 0.0f, 1.0f};
+    meshlet.coneCutoff = 0.5f;
+    meshlet.startIndex = 0;
+    meshlet.count = 96;
+    scene.meshlets.push_back(meshlet);
+    meshlet.startIndex = 96;
+    scene.meshlets.push_back(meshlet);
+
+    scene.materials.resize(2);
+    scene.materials[0].baseColorFactor = glm::vec4{0.5f, 0.25f, 1.0f, 1.0f};
+    scene.materials[1].baseColorImage = 0;
+    scene.materials[1].magFilter = VK_FILTER_NEAREST;
+
+    // The payload is laid out like a staging buffer: vertices, indices, then the pixels of every image
+    std::vector<char> payload(scene.vertexBufferSize + scene.indexBufferSize);
+    std::memcpy(payload.data(), vertices.data(), scene.vertexBufferSize);
+    for (size_t i = 0; i < gridIndices.size(); i++)
+    {
+        const uint16_t index = static_cast<uint16_t>(gridIndices[i]);
+        std::memcpy(payload.data() + scene.vertexBufferSize + i * sizeof(uint16_t), &index, sizeof(uint16_t));
+    }
+    scene.images.push_back({4, 2, payload.size()});
+    for (uint32_t i = 0; i < 4 * 2 * 4; i++)
+    {
+        payload.push_back(static_cast<char>(i));
+    }
+
+    const auto write_file = [&](const cooked::Scene& written, const std::vector<char>& writtenPayload) -> std::vector<char>
+    {
+        std::vector<char> bytes = cooked::write_tables(written, writtenPayload.size());
+        bytes.insert(bytes.end(), writtenPayload.begin(), writtenPayload.end());
+        return bytes;
+    };
+    const auto read_file = [](const std::vector<char>& bytes, size_t size) -> cooked::ReadResult
+    {
+        cooked::Scene read;
+        uint64_t payloadOffset = 0;
+        uint64_t payloadSize = 0;
+        return cooked::read(bytes.data(), size, read, payloadOffset, payloadSize);
+    };
+
+    const std::vector<char> bytes = write_file(scene, payload);
+    cooked::Scene read;
+    uint64_t payloadOffset = 0;
+    uint64_t payloadSize = 0;
+    checker.Check(cooked::read(bytes.data(), bytes.size(), read, payloadOffset, payloadSize) == cooked::ReadResult::Success, "a freshly written scene was rejected");
+
+    const auto same_bytes = [](const auto& first, const auto& second) -> bool
+    {
+        return first.size() == second.size() && (first.empty() || std::memcmp(first.data(), second.data(), first.size() * sizeof(first[0])) == 0);
+    };
+    bool bSameMeshes = read.meshes.size() == scene.meshes.size();
+    for (size_t i = 0; bSameMeshes && i < scene.meshes.size(); i++)
+    {
+        bSameMeshes = read.meshes[i].name == scene.meshes[i].name && same_bytes(read.meshes[i].surfaces, scene.meshes[i].surfaces);
+    }
+    checker.Check(bSameMeshes, "meshes or their surfaces changed on the way through the cooked format");
+    checker.Check(
+        read.vertexFormat == scene.vertexFormat
+            && read.indexStride == scene.indexStride
+            && read.vertexBufferSize == scene.vertexBufferSize
+            && read.indexBufferSize == scene.indexBufferSize,
+        "the buffer layout changed on the way through the cooked format"
+    );
+    checker.Check(
+        same_bytes(read.instances, scene.instances)
+            && same_bytes(read.meshlets, scene.meshlets)
+            && same_bytes(read.materials, scene.materials)
+            && same_bytes(read.images, scene.images),
+        "instances, meshlets, materials or images changed on the way through the cooked format"
+    );
+    checker.Check(
+        payloadOffset % 4096 == 0
+            && payloadSize == payload.size()
+            && payloadOffset + payloadSize == bytes.size()
+            && std::memcmp(bytes.data() + payloadOffset, payload.data(), payload.size()) == 0,
+        "the payload does not follow the tables byte for byte"
+    );
+
+    // Every truncated file is rejected, whether the cut is in the header, the tables or the payload
+    bool bTruncationsRejected = true;
+    for (size_t size = 0; size < bytes.size(); size++)
+    {
+        bTruncationsRejected = bTruncationsRejected && read_file(bytes, size) != cooked::ReadResult::Success;
+    }
+    checker.Check(bTruncationsRejected, "a truncated file was accepted");
+
+    // The header starts with the magic, the version, the vertex format and the vertex and index strides
+    const auto read_patched = [&](size_t offset, uint32_t value) -> cooked::ReadResult
+    {
+        std::vector<char> patched = bytes;
+        std::memcpy(patched.data() + offset, &value, sizeof(uint32_t));
+        return read_file(patched, patched.size());
+    };
+    checker.Check(read_patched(0, 0x464C457F) == cooked::ReadResult::NotCooked, "a file with another magic was not told apart");
+    checker.Check(read_patched(4, 0) == cooked::ReadResult::OtherVersion, "a file of another version was accepted");
+    checker.Check(read_patched(8, 7) == cooked::ReadResult::OtherVersion, "a file with an unknown vertex format was accepted");
+    checker.Check(read_patched(12, sizeof(Vertex) + 4) == cooked::ReadResult::OtherVersion, "a file with another vertex layout was accepted");
+    checker.Check(read_patched(16, 3) == cooked::ReadResult::OtherVersion, "a file with an unknown index size was accepted");
+
+    // An index past the vertices of its surface would make the GPU read outside of the vertex buffer
+    std::vector<char> badIndex = bytes;
+    const uint16_t vertexCount = static_cast<uint16_t>(vertices.size());
+    std::memcpy(badIndex.data() + payloadOffset + scene.vertexBufferSize + 10 * sizeof(uint16_t), &vertexCount, sizeof(uint16_t));
+    checker.Check(read_file(badIndex, badIndex.size()) == cooked::ReadResult::Damaged, "an index past the vertex buffer was accepted");
+
+    // Tables pointing outside of what they describe
+    const auto damaged = [&](const char* what, auto&& damage) -> void
+    {
+        cooked::Scene damagedScene = scene;
+        damage(damagedScene);
+        const std::vector<char> damagedBytes = write_file(damagedScene, payload);
+        checker.Check(read_file(damagedBytes, damagedBytes.size()) == cooked::ReadResult::Damaged, what);
+    };
+    damaged("a surface past the index buffer was accepted", [&](cooked::Scene& s) { s.meshes[1].surfaces[0].count += 3; });
+    damaged("a LOD past the index buffer was accepted", [&](cooked::Scene& s) { s.meshes[0].surfaces[0].lods[0].startIndex += 3; });
+    damaged("too many LODs were accepted", [&](cooked::Scene& s) { s.meshes[0].surfaces[0].lodCount = MAX_SURFACE_LODS + 1; });
+    damaged("a surface without vertices was accepted", [&](cooked::Scene& s) { s.meshes[1].surfaces[1].vertexOffset = static_cast<int32_t>(vertices.size()); });
+    damaged("a negative vertex offset was accepted", [&](cooked::Scene& s) { s.meshes[1].surfaces[1].vertexOffset = -1; });
+    damaged("an unknown material was accepted", [&](cooked::Scene& s) { s.meshes[1].surfaces[1].materialIndex = 2; });
+    damaged("a surface with meshlets past the table was accepted", [&](cooked::Scene& s) { s.meshes[0].surfaces[0].meshletCount = 3; });
+    damaged("a meshlet past the index buffer was accepted", [&](cooked::Scene& s) { s.meshlets[1].startIndex = static_cast<uint32_t>(gridIndices.size()) - 3; });
+    damaged("an instance of an unknown mesh was accepted", [&](cooked::Scene& s) { s.instances[2].meshIndex = 2; });
+    damaged("a material with an unknown image was accepted", [&](cooked::Scene& s) { s.materials[1].baseColorImage = 1; });
+    damaged("an image past the payload was accepted", [&](cooked::Scene& s) { s.images[0].height = 3; });
+    damaged("vertex and index buffers past the payload were accepted", [&](cooked::Scene& s) { s.indexBufferSize = payload.size(); });
+
+    // Flipping random bytes of the header and tables must never get a file past the checks that makes anything
+    // read outside of it, which the address sanitizer catches in builds that have it
+    std::uniform_int_distribution<size_t> tableByte(0, payloadOffset - 1);
+    std::uniform_int_distribution<int> byteValue(0, 255);
+    for (uint32_t i = 0; i < 2000; i++)
+    {
+        std::vector<char> flipped = bytes;
+        flipped[tableByte(random)] = static_cast<char>(byteValue(random));
+        cooked::Scene flippedScene;
+        cooked::read(flipped.data(), flipped.size(), flippedScene, payloadOffset, payloadSize);
+    }
+
+    return checker.failureCount;
+}
+
+uint32_t tests::run_all()
+{
+    uint32_t failureCount = mesh_optimizer();
+    failureCount += simplifier();
+    failureCount += meshlets();
+    failureCount += culling();
+    failureCount += obj_parser();
+    failureCount += cooked_scene();
+
+    if (failureCount == 0)
+    {
+        fmt::println("All tests passed");
+    }
+    else
+    {
+        fmt::println("{} checks failed", failureCount);
+    }
+    return failureCount;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+// Behaviour checks of the CPU side algorithms that run without a window or a Vulkan device.
+// Selected from the command line, see main.cpp. Every suite prints the checks that failed and returns how many did.
+namespace tests
+{
+    // Every optimization pass only reorders, the same triangles come out as went in
+    uint32_t mesh_optimizer();
+
+    // Simplified meshes index the same vertices, hit their target, and stay within the error they report
+    uint32_t simplifier();
+
+    // Meshlets stay within their limits, cover every triangle once, and their bounds and cones are conservative
+    uint32_t meshlets();
+
+    // Every instruction set finds the same objects visible as the scalar kernels, and none of them culls anything visible
+    uint32_t culling();
+
+    // OBJ faces resolve their relative indices wherever the file is cut into chunks, and welding keeps every triangle
+    // however the faces are split into blocks
+    uint32_t obj_parser();
+
+    // Cooked scenes read back exactly as they were written, and truncated or damaged files are rejected
+    uint32_t cooked_scene();
+
+    // Runs every suite above, returns the total amount of failed checks
+    uint32_t run_all();
+} // namespace tests
@@ -0,0 +1,232 @@
+﻿#include <vk_defragmenter.h>
+
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+    // Bounds the CPU side of a pass as well, every move creates a buffer and records a copy
+    constexpr uint32_t MAX_MOVES_PER_PASS = 64;
+
+    void memory_barrier(
+        VkCommandBuffer command,
+        VkPipelineStageFlags2 srcStageMask,
+        VkAccessFlags2 srcAccessMask,
+        VkPipelineStageFlags2 dstStageMask,
+        VkAccessFlags2 dstAccessMask
+    ) {
+        VkMemoryBarrier2 memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+        memoryBarrier.srcStageMask = srcStageMask;
+        memoryBarrier.srcAccessMask = srcAccessMask;
+        memoryBarrier.dstStageMask = dstStageMask;
+        memoryBarrier.dstAccessMask = dstAccessMask;
+
+        VkDependencyInfo dependencyInfo = {};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.memoryBarrierCount = 1;
+        dependencyInfo.pMemoryBarriers = &memoryBarrier;
+        vkCmdPipelineBarrier2(command, &dependencyInfo);
+    }
+}
+
+void Defragmenter::Init(VkDevice device, VmaAllocator allocator, VkDeviceSize maxBytesPerPass)
+{
+    this->device = device;
+    this->allocator = allocator;
+    this->maxBytesPerPass = maxBytesPerPass;
+}
+
+void Defragmenter::Destroy()
+{
+    if (!IsRunning())
+    {
+        return;
+    }
+
+    if (bPassInFlight)
+    {
+        EndPass();
+    }
+    Finish();
+}
+
+void Defragmenter::Register(AllocatedBuffer* buffer, VkBufferUsageFlags usage, VkDeviceAddress* address)
+{
+    assert((usage & (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)) == (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT));
+
+    Relocatable relocatable;
+    relocatable.buffer = buffer;
+    relocatable.usage = usage;
+    relocatable.address = address;
+    relocatables[buffer->allocation] = relocatable;
+}
+
+bool Defragmenter::Unregister(VmaAllocation allocation)
+{
+    relocatables.erase(allocation);
+
+    if (!IsMoving(allocation))
+    {
+        return true;
+    }
+
+    // The copy out of the old buffer is still in flight, that buffer stays in retiredBuffers until the pass ends.
+    // Destroying the move makes VMA free both the old and the new place for us
+    for (uint32_t i = 0; i < pass.moveCount; i++)
+    {
+        if (pass.pMoves[i].srcAllocation == allocation)
+        {
+            pass.pMoves[i].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_DESTROY;
+        }
+    }
+    movedAllocations.erase(std::find(movedAllocations.begin(), movedAllocations.end(), allocation));
+    return false;
+}
+
+bool Defragmenter::IsMoving(VmaAllocation allocation) const
+{
+    return bPassInFlight && std::find(movedAllocations.begin(), movedAllocations.end(), allocation) != movedAllocations.end();
+}
+
+void Defragmenter::Start()
+{
+    if (IsRunning() || relocatables.empty())
+    {
+        return;
+    }
+
+    VmaDefragmentationInfo defragmentationInfo = {};
+    defragmentationInfo.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+    defragmentationInfo.maxBytesPerPass = maxBytesPerPass;
+    defragmentationInfo.maxAllocationsPerPass = MAX_MOVES_PER_PASS;
+    VK_CHECK(vmaBeginDefragmentation(allocator, &defragmentationInfo, &context));
+}
+
+void Defragmenter::RecordPass(VkCommandBuffer command, uint64_t completedValue, uint64_t signalValue)
+{
+    if (!IsRunning())
+    {
+        return;
+    }
+
+    if (bPassInFlight)
+    {
+        // Earlier frames may still read the old buffers, waiting on the pass's own frame covers them as well
+        if (completedValue < passValue)
+        {
+            return;
+        }
+
+        if (EndPass() == VK_SUCCESS)
+        {
+            Finish();
+            return;
+        }
+    }
+
+    if (vmaBeginDefragmentationPass(allocator, context, &pass) == VK_SUCCESS)
+    {
+        Finish();
+        return;
+    }
+
+    // Earlier frames on this queue may still be writing the buffers that are about to be copied
+    memory_barrier(
+        command,
+        VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        VK_ACCESS_2_MEMORY_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+        VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT
+    );
+
+    for (uint32_t i = 0; i < pass.moveCount; i++)
+    {
+        VmaDefragmentationMove& move = pass.pMoves[i];
+        const auto it = relocatables.find(move.srcAllocation);
+        if (it == relocatables.end())
+        {
+            move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+
+        // The new buffer takes over right away, the rest of this frame already reads from where it moved to
+        Relocatable& relocatable = it->second;
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = relocatable.buffer->info.size;
+        bufferInfo.usage = relocatable.usage;
+
+        VkBuffer newBuffer;
+        VK_CHECK(vkCreateBuffer(device, &bufferInfo, nullptr, &newBuffer));
+        VK_CHECK(vmaBindBufferMemory(allocator, move.dstTmpAllocation, newBuffer));
+
+        VkBufferCopy copy = {};
+        copy.size = bufferInfo.size;
+        vkCmdCopyBuffer(command, relocatable.buffer->buffer, newBuffer, 1, &copy);
+
+        retiredBuffers.push_back(relocatable.buffer->buffer);
+        movedAllocations.push_back(move.srcAllocation);
+        relocatable.buffer->buffer = newBuffer;
+        if (relocatable.address)
+        {
+            VkBufferDeviceAddressInfo addressInfo = {};
+            addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+            addressInfo.buffer = newBuffer;
+            *relocatable.address = vkGetBufferDeviceAddress(device, &addressInfo);
+        }
+    }
+
+    memory_barrier(
+        command,
+        VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+        VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT
+    );
+
+    bPassInFlight = true;
+    passValue = signalValue;
+}
+
+VkResult Defragmenter::EndPass()
+{
+    for (VkBuffer buffer : retiredBuffers)
+    {
+        vkDestroyBuffer(device, buffer, nullptr);
+    }
+
+    // The moved allocations point at their new memory from here on
+    const VkResult result = vmaEndDefragmentationPass(allocator, context, &pass);
+    for (VmaAllocation allocation : movedAllocations)
+    {
+        const auto it = relocatables.find(allocation);
+        if (it != relocatables.end())
+        {
+            vmaGetAllocationInfo(allocator, allocation, &it->second.buffer->info);
+        }
+    }
+
+    retiredBuffers.clear();
+    movedAllocations.clear();
+    bPassInFlight = false;
+    return result;
+}
+
+void Defragmenter::Finish()
+{
+    VmaDefragmentationStats stats = {};
+    vmaEndDefragmentation(allocator, context, &stats);
+    context = VK_NULL_HANDLE;
+
+    if (stats.allocationsMoved > 0 || stats.deviceMemoryBlocksFreed > 0)
+    {
+        fmt::println(
+            "Defragmentation moved {} buffers ({:.2f} MB) and released {} memory blocks ({:.2f} MB)",
+            stats.allocationsMoved,
+            static_cast<double>(stats.bytesMoved) / (1024.0 * 1024.0),
+            stats.deviceMemoryBlocksFreed,
+            static_cast<double>(stats.bytesFreed) / (1024.0 * 1024.0)
+        );
+    }
+}
@@ -0,0 +1,61 @@
+﻿#pragma once
+
+#include <unordered_map>
+#include <vk_types.h>
+
+// Moves buffers within the allocator's memory blocks to keep them dense, so memory freed by streaming can be reused by
+// larger allocations and empty blocks go back to the driver. Work is split into passes of a bounded amount of bytes,
+// one per frame: the copies are recorded into the frame's command buffer and the old buffers are destroyed once
+// that frame is done. Only registered buffers move, everything else stays where it is.
+// Only use it from the main thread.
+class Defragmenter
+{
+public:
+    void Init(VkDevice device, VmaAllocator allocator, VkDeviceSize maxBytesPerPass);
+    // The GPU has to be idle, a pass still in flight is finished first
+    void Destroy();
+
+    // Whenever the buffer moves, its handle, allocation info and address are patched in place, so buffer and address
+    // have to stay where they are until it is unregistered. address may be null. usage is what the buffer was created
+    // with, including both transfer bits
+    void Register(AllocatedBuffer* buffer, VkBufferUsageFlags usage, VkDeviceAddress* address);
+    // Returns false when the buffer was being moved. The move is cancelled and the allocation freed once the pass is
+    // done, so the caller only destroys the buffer handle and must not free the allocation itself
+    bool Unregister(VmaAllocation allocation);
+    bool IsMoving(VmaAllocation allocation) const;
+
+    // Starts moving registered buffers together, nothing happens until the next RecordPass()
+    void Start();
+    bool IsRunning() const { return context != VK_NULL_HANDLE; }
+
+    // Finishes the previous pass once completedValue reaches the value its frame signaled, then records the copies of the
+    // next one into command. Must come before anything in command uses the registered buffers, which it makes wait on
+    // the copies. signalValue is the value the frame of command signals once it is done
+    void RecordPass(VkCommandBuffer command, uint64_t completedValue, uint64_t signalValue);
+
+private:
+    struct Relocatable
+    {
+        AllocatedBuffer* buffer{nullptr};
+        VkBufferUsageFlags usage{0};
+        VkDeviceAddress* address{nullptr};
+    };
+
+    // Returns VK_SUCCESS when there is nothing left to move
+    VkResult EndPass();
+    void Finish();
+
+    VkDevice device{VK_NULL_HANDLE};
+    VmaAllocator allocator{VK_NULL_HANDLE};
+    VkDeviceSize maxBytesPerPass{0};
+
+    std::unordered_map<VmaAllocation, Relocatable> relocatables;
+
+    VmaDefragmentationContext context{VK_NULL_HANDLE};
+    VmaDefragmentationPassMoveInfo pass{};
+    bool bPassInFlight{false};
+    // Frame timeline value after which the GPU is done with both the copies and the old buffers
+    uint64_t passValue{0};
+    std::vector<VmaAllocation> movedAllocations;
+    std::vector<VkBuffer> retiredBuffers;
+};
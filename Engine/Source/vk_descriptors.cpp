@@ -1 +1,336 @@
 ﻿#include <vk_descriptors.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+void DescriptorLayoutBuilder::AddBinding(uint32_t binding, VkDescriptorType type, uint32_t count)
+{
+    VkDescriptorSetLayoutBinding newBinding = {};
+    newBinding.binding = binding;
+    newBinding.descriptorCount = count;
+    newBinding.descriptorType = type;
+
+    bindings.push_back(newBinding);
+}
+
+void DescriptorLayoutBuilder::Clear()
+{
+    bindings.clear();
+}
+
+VkDescriptorSetLayout DescriptorLayoutBuilder::Build(VkDevice device, VkShaderStageFlags shaderStages, const void* pNext, VkDescriptorSetLayoutCreateFlags flags)
+{
+    for (auto& binding : bindings)
+    {
+        binding.stageFlags |= shaderStages;
+    }
+
+    VkDescriptorSetLayoutCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    info.pNext = pNext;
+
+    info.pBindings = bindings.data();
+    info.bindingCount = static_cast<uint32_t>(bindings.size());
+    info.flags = flags;
+
+    VkDescriptorSetLayout set;
+    VK_CHECK(vkCreateDescriptorSetLayout(device, &info, nullptr, &set));
+
+    return set;
+}
+
+void DescriptorAllocatorGrowable::Init(VkDevice device, uint32_t initialSets, const std::vector<PoolSizeRatio>& poolRatios)
+{
+    ratios = poolRatios;
+
+    readyPools.push_back(CreatePool(device, initialSets));
+
+    // Grow it next allocation
+    setsPerPool = std::min(static_cast<uint32_t>(initialSets * 1.5f), MAX_SETS_PER_POOL);
+}
+
+void DescriptorAllocatorGrowable::ClearPools(VkDevice device)
+{
+    // Resetting a pool frees every set in it at once, which is a lot cheaper than freeing sets one by one
+    for (VkDescriptorPool pool : readyPools)
+    {
+        VK_CHECK(vkResetDescriptorPool(device, pool, 0));
+    }
+
+    for (VkDescriptorPool pool : fullPools)
+    {
+        VK_CHECK(vkResetDescriptorPool(device, pool, 0));
+        readyPools.push_back(pool);
+    }
+
+    fullPools.clear();
+}
+
+void DescriptorAllocatorGrowable::DestroyPools(VkDevice device)
+{
+    for (VkDescriptorPool pool : readyPools)
+    {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    readyPools.clear();
+
+    for (VkDescriptorPool pool : fullPools)
+    {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    fullPools.clear();
+}
+
+VkDescriptorSet DescriptorAllocatorGrowable::Allocate(VkDevice device, VkDescriptorSetLayout layout, const void* pNext)
+{
+    // Get or create a pool to allocate from
+    VkDescriptorPool poolToUse = GetPool(device);
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext = pNext;
+    allocInfo.descriptorPool = poolToUse;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    VkDescriptorSet descriptorSet;
+    VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet);
+
+    // Allocation failed. Park the pool and try again with the next one
+    if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+    {
+        fullPools.push_back(poolToUse);
+
+        poolToUse = GetPool(device);
+        allocInfo.descriptorPool = poolToUse;
+
+        VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
+    }
+
+    readyPools.push_back(poolToUse);
+    return descriptorSet;
+}
+
+VkDescriptorPool DescriptorAllocatorGrowable::GetPool(VkDevice device)
+{
+    if (!readyPools.empty())
+    {
+        VkDescriptorPool pool = readyPools.back();
+        readyPools.pop_back();
+        return pool;
+    }
+
+    // Only reached while the allocator is still growing towards its peak
+    VkDescriptorPool newPool = CreatePool(device, setsPerPool);
+    setsPerPool = std::min(static_cast<uint32_t>(setsPerPool * 1.5f), MAX_SETS_PER_POOL);
+
+    return newPool;
+}
+
+VkDescriptorPool DescriptorAllocatorGrowable::CreatePool(VkDevice device, uint32_t setCount) const
+{
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    poolSizes.reserve(ratios.size());
+    for (const PoolSizeRatio& ratio : ratios)
+    {
+        poolSizes.push_back(VkDescriptorPoolSize{
+            ratio.type,
+            std::max(static_cast<uint32_t>(ratio.ratio * static_cast<float>(setCount)), 1u)
+        });
+    }
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.pNext = nullptr;
+    poolInfo.flags = 0;
+    poolInfo.maxSets = setCount;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+
+    VkDescriptorPool newPool;
+    VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &newPool));
+    return newPool;
+}
+
+void DescriptorWriter::WriteImage(uint32_t binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type, uint32_t arrayElement)
+{
+    const VkDescriptorImageInfo& info = imageInfos.emplace_back(VkDescriptorImageInfo{sampler, image, layout});
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+
+    write.dstBinding = binding;
+    write.dstArrayElement = arrayElement;
+    write.dstSet = VK_NULL_HANDLE; // Left empty for now until we need to write it
+    write.descriptorCount = 1;
+    write.descriptorType = type;
+    write.pImageInfo = &info;
+
+    writes.push_back(write);
+}
+
+void DescriptorWriter::WriteBuffer(uint32_t binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType type)
+{
+    const VkDescriptorBufferInfo& info = bufferInfos.emplace_back(VkDescriptorBufferInfo{buffer, offset, size});
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+
+    write.dstBinding = binding;
+    write.dstSet = VK_NULL_HANDLE; // Left empty for now until we need to write it
+    write.descriptorCount = 1;
+    write.descriptorType = type;
+    write.pBufferInfo = &info;
+
+    writes.push_back(write);
+}
+
+void DescriptorWriter::Clear()
+{
+    imageInfos.clear();
+    bufferInfos.clear();
+    writes.clear();
+}
+
+void DescriptorWriter::UpdateSet(VkDevice device, VkDescriptorSet set)
+{
+    for (VkWriteDescriptorSet& write : writes)
+    {
+        write.dstSet = set;
+    }
+
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void BindlessTable::Init(VkDevice device, VkPhysicalDevice gpu, VmaAllocator allocator, uint32_t maxTextures, uint32_t maxSamplers, uint32_t maxMaterials)
+{
+    this->device = device;
+    this->allocator = allocator;
+
+    // Stay within what the device allows for update-after-bind sets
+    VkPhysicalDeviceVulkan12Properties properties12 = {};
+    properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &properties12;
+    vkGetPhysicalDeviceProperties2(gpu, &properties);
+
+    this->maxTextures = std::min(maxTextures, properties12.maxDescriptorSetUpdateAfterBindSampledImages);
+    this->maxSamplers = std::min(maxSamplers, properties12.maxDescriptorSetUpdateAfterBindSamplers);
+    this->maxMaterials = maxMaterials;
+
+    // Slots are filled in while the set is bound, and most of them are never filled at all
+    const VkDescriptorBindingFlags bindingFlags[] = {
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+    };
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.pNext = nullptr;
+    bindingFlagsInfo.bindingCount = 2;
+    bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+    DescriptorLayoutBuilder builder;
+    builder.AddBinding(TEXTURE_BINDING, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, this->maxTextures);
+    builder.AddBinding(SAMPLER_BINDING, VK_DESCRIPTOR_TYPE_SAMPLER, this->maxSamplers);
+    layout = builder.Build(
+        device,
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+        &bindingFlagsInfo,
+        VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT
+    );
+
+    const VkDescriptorPoolSize poolSizes[] = {
+        {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, this->maxTextures},
+        {VK_DESCRIPTOR_TYPE_SAMPLER, this->maxSamplers},
+    };
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.pNext = nullptr;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+    VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool));
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.pNext = nullptr;
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+    VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, &set));
+
+    // Materials are small and written once, so they can live in host visible memory the GPU reads directly
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.pNext = nullptr;
+    bufferInfo.size = sizeof(GPUMaterial) * maxMaterials;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+    VmaAllocationCreateInfo vmaAllocInfo = {};
+    vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    vmaAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    VK_CHECK(vmaCreateBuffer(allocator, &bufferInfo, &vmaAllocInfo, &materialBuffer.buffer, &materialBuffer.allocation, &materialBuffer.info));
+
+    VkBufferDeviceAddressInfo addressInfo = {};
+    addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+    addressInfo.buffer = materialBuffer.buffer;
+    materialBufferAddress = vkGetBufferDeviceAddress(device, &addressInfo);
+}
+
+void BindlessTable::Destroy()
+{
+    vmaDestroyBuffer(allocator, materialBuffer.buffer, materialBuffer.allocation);
+    vkDestroyDescriptorPool(device, pool, nullptr);
+    vkDestroyDescriptorSetLayout(device, layout, nullptr);
+}
+
+uint32_t BindlessTable::AddTexture(VkImageView view)
+{
+    std::lock_guard lock(mutex);
+    assert(textureCount < maxTextures);
+
+    const uint32_t index = textureCount++;
+
+    // Writing a slot no draw uses yet is allowed while the set is in use, thanks to update-after-bind
+    DescriptorWriter writer;
+    writer.WriteImage(TEXTURE_BINDING, view, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, index);
+    writer.UpdateSet(device, set);
+
+    return index;
+}
+
+uint32_t BindlessTable::AddSampler(VkSampler sampler)
+{
+    std::lock_guard lock(mutex);
+    assert(samplerCount < maxSamplers);
+
+    const uint32_t index = samplerCount++;
+
+    DescriptorWriter writer;
+    writer.WriteImage(SAMPLER_BINDING, VK_NULL_HANDLE, sampler, VK_IMAGE_LAYOUT_UNDEFINED, VK_DESCRIPTOR_TYPE_SAMPLER, index);
+    writer.UpdateSet(device, set);
+
+    return index;
+}
+
+uint32_t BindlessTable::AddMaterial(const GPUMaterial& material)
+{
+    std::lock_guard lock(mutex);
+    assert(materialCount < maxMaterials);
+
+    const uint32_t index = materialCount++;
+
+    // No draw references the slot yet, so it is safe to write while the GPU reads the others
+    GPUMaterial* materials = static_cast<GPUMaterial*>(materialBuffer.info.pMappedData);
+    std::memcpy(&materials[index], &material, sizeof(GPUMaterial));
+    VK_CHECK(vmaFlushAllocation(allocator, materialBuffer.allocation, sizeof(GPUMaterial) * index, sizeof(GPUMaterial)));
+
+    return index;
+}
\ No newline at end of file
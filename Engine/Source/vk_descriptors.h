@@ -1,3 +1,103 @@
 ﻿#pragma once
 
+#include <mutex>
 #include <vk_types.h>
+
+struct DescriptorLayoutBuilder
+{
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+
+    void AddBinding(uint32_t binding, VkDescriptorType type, uint32_t count = 1);
+    void Clear();
+    VkDescriptorSetLayout Build(VkDevice device, VkShaderStageFlags shaderStages, const void* pNext = nullptr, VkDescriptorSetLayoutCreateFlags flags = 0);
+};
+
+// Descriptor allocator that grows by chaining pools instead of failing.
+// Pools that ran out are parked in fullPools, and ClearPools() resets every pool at once and makes
+// them all ready again. Once the busiest frame has been seen, no new pools are ever created.
+struct DescriptorAllocatorGrowable
+{
+    // Amount of descriptors of a type to reserve per set in a pool
+    struct PoolSizeRatio
+    {
+        VkDescriptorType type;
+        float ratio;
+    };
+
+    void Init(VkDevice device, uint32_t initialSets, const std::vector<PoolSizeRatio>& poolRatios);
+    void ClearPools(VkDevice device);
+    void DestroyPools(VkDevice device);
+
+    VkDescriptorSet Allocate(VkDevice device, VkDescriptorSetLayout layout, const void* pNext = nullptr);
+
+private:
+    VkDescriptorPool GetPool(VkDevice device);
+    VkDescriptorPool CreatePool(VkDevice device, uint32_t setCount) const;
+
+    // Upper bound on how big a single pool grows
+    static constexpr uint32_t MAX_SETS_PER_POOL = 4092;
+
+    std::vector<PoolSizeRatio> ratios;
+    std::vector<VkDescriptorPool> fullPools;
+    std::vector<VkDescriptorPool> readyPools;
+    uint32_t setsPerPool{0};
+};
+
+struct DescriptorWriter
+{
+    // The infos have to stay at a stable address until UpdateSet(), which a deque guarantees
+    std::deque<VkDescriptorImageInfo> imageInfos;
+    std::deque<VkDescriptorBufferInfo> bufferInfos;
+    std::vector<VkWriteDescriptorSet> writes;
+
+    void WriteImage(uint32_t binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type, uint32_t arrayElement = 0);
+    void WriteBuffer(uint32_t binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType type);
+
+    void Clear();
+    void UpdateSet(VkDevice device, VkDescriptorSet set);
+};
+
+// Global bindless resource table.
+// Every texture and sampler the engine knows about lives in one update-after-bind, partially bound
+// descriptor set that is bound once per frame. Materials live in a buffer the shaders reach through
+// its device address. Draws only push indices, so switching materials never binds descriptor sets.
+//   binding 0: sampled images, indexed by texture index
+//   binding 1: samplers, indexed by sampler index
+class BindlessTable
+{
+public:
+    static constexpr uint32_t TEXTURE_BINDING = 0;
+    static constexpr uint32_t SAMPLER_BINDING = 1;
+
+    void Init(VkDevice device, VkPhysicalDevice gpu, VmaAllocator allocator, uint32_t maxTextures, uint32_t maxSamplers, uint32_t maxMaterials);
+    void Destroy();
+
+    // Registration is thread safe, so loaders can register straight from their jobs.
+    // The returned indices stay valid for as long as the table exists.
+    uint32_t AddTexture(VkImageView view);
+    uint32_t AddSampler(VkSampler sampler);
+    uint32_t AddMaterial(const GPUMaterial& material);
+
+    VkDescriptorSetLayout GetLayout() const { return layout; }
+    VkDescriptorSet GetSet() const { return set; }
+    VkDeviceAddress GetMaterialBufferAddress() const { return materialBufferAddress; }
+
+private:
+    VkDevice device{VK_NULL_HANDLE};
+    VmaAllocator allocator{VK_NULL_HANDLE};
+
+    VkDescriptorSetLayout layout{VK_NULL_HANDLE};
+    VkDescriptorPool pool{VK_NULL_HANDLE};
+    VkDescriptorSet set{VK_NULL_HANDLE};
+
+    AllocatedBuffer materialBuffer{};
+    VkDeviceAddress materialBufferAddress{0};
+
+    std::mutex mutex;
+    uint32_t maxTextures{0};
+    uint32_t maxSamplers{0};
+    uint32_t maxMaterials{0};
+    uint32_t textureCount{0};
+    uint32_t samplerCount{0};
+    uint32_t materialCount{0};
+};
\ No newline at end of file
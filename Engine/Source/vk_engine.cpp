@@ -1,7 +1,10 @@
 ﻿//> includes
 #include "vk_engine.h"
 
+#include <algorithm>
 #include <chrono>
+#include <fstream>
+#include <glm/gtc/matrix_transform.hpp>
 #include <SDL.h>
 #include <SDL_vulkan.h>
 #include <thread>
@@ -10,6 +13,7 @@
 #include <vma/vk_mem_alloc.h>
 
 
+#include "culling.h"
 #include "vk_images.h"
 #include "vk_initializers.h"
 #include "vk_types.h"
@@ -19,30 +23,123 @@ constexpr bool bUseValidationLayers = true;
 
 VulkanEngine& VulkanEngine::Get() { return *loadedEngine; }
 
+namespace
+{
+    // How often UpdateMemoryBudgets() looks at whether memory is sparse enough to defragment
+    constexpr uint64_t DEFRAGMENTATION_CHECK_INTERVAL = 600;
+    // Defragmentation starts once this share of the device local memory blocks is unused, and at least this much of it
+    constexpr double DEFRAGMENTATION_UNUSED_SHARE = 0.25;
+    constexpr VkDeviceSize DEFRAGMENTATION_MIN_UNUSED_BYTES = 32 * 1024 * 1024;
+
+    // Global barrier between two passes over buffers, images get theirs from vkutil::transition_image()
+    void memory_barrier(
+        VkCommandBuffer command,
+        VkPipelineStageFlags2 srcStageMask,
+        VkAccessFlags2 srcAccessMask,
+        VkPipelineStageFlags2 dstStageMask,
+        VkAccessFlags2 dstAccessMask
+    ) {
+        VkMemoryBarrier2 memoryBarrier{};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+        memoryBarrier.pNext = nullptr;
+        memoryBarrier.srcStageMask = srcStageMask;
+        memoryBarrier.srcAccessMask = srcAccessMask;
+        memoryBarrier.dstStageMask = dstStageMask;
+        memoryBarrier.dstAccessMask = dstAccessMask;
+
+        VkDependencyInfo dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.pNext = nullptr;
+        dependencyInfo.memoryBarrierCount = 1;
+        dependencyInfo.pMemoryBarriers = &memoryBarrier;
+
+        vkCmdPipelineBarrier2(command, &dependencyInfo);
+    }
+}
+
+void DeletionQueue::Reserve(size_t count)
+{
+    pipelines.reserve(count);
+    pipelineLayouts.reserve(count);
+    descriptorPools.reserve(count);
+    descriptorSetLayouts.reserve(count);
+    samplers.reserve(count);
+    imageViews.reserve(count);
+    images.reserve(count);
+    buffers.reserve(count);
+    deletors.reserve(count);
+}
+
+void DeletionQueue::Flush(VkDevice device, VmaAllocator allocator)
+{
+    // Destroy users before the objects they use: pipelines before their layouts,
+    // layouts before the set layouts and views before the images they look at.
+    for (VkPipeline pipeline : pipelines) { vkDestroyPipeline(device, pipeline, nullptr); }
+    for (VkPipelineLayout layout : pipelineLayouts) { vkDestroyPipelineLayout(device, layout, nullptr); }
+    for (VkDescriptorPool pool : descriptorPools) { vkDestroyDescriptorPool(device, pool, nullptr); }
+    for (VkDescriptorSetLayout layout : descriptorSetLayouts) { vkDestroyDescriptorSetLayout(device, layout, nullptr); }
+    for (VkSampler sampler : samplers) { vkDestroySampler(device, sampler, nullptr); }
+    for (VkImageView view : imageViews) { vkDestroyImageView(device, view, nullptr); }
+    for (const ImageAllocation& image : images) { vmaDestroyImage(allocator, image.image, image.allocation); }
+    for (const BufferAllocation& buffer : buffers) { vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation); }
+
+    // Reverse iterate the deletion to execute all the function
+    for (auto it = deletors.rbegin(); it != deletors.rend(); it++) {
+        (*it)(); //call functors
+    }
+
+    // clear() keeps the capacity around, which is what makes the next flush allocation free
+    pipelines.clear();
+    pipelineLayouts.clear();
+    descriptorPools.clear();
+    descriptorSetLayouts.clear();
+    samplers.clear();
+    imageViews.clear();
+    images.clear();
+    buffers.clear();
+    deletors.clear();
+}
+
 void VulkanEngine::Init()
 {
     // only one engine initialization is allowed with the application.
     assert(loadedEngine == nullptr);
     loadedEngine = this;
 
+    jobs.Init(settings.workerThreadCount > 0 ? std::optional<uint32_t>(settings.workerThreadCount) : std::nullopt);
+
+    // Everything that exists once per frame in flight is sized from this
+    frames.resize(std::max<uint32_t>(settings.framesInFlight, 1));
+    for (auto& frame : frames)
+    {
+        frame.deletionQueue.Reserve(64);
+    }
+
     // We initialize SDL and create a window with it.
-    SDL_Init(SDL_INIT_VIDEO);
+    // Headless render nodes have no display, so we skip the window entirely there.
+    if (!settings.bHeadless)
+    {
+        SDL_Init(SDL_INIT_VIDEO);
 
-    const SDL_WindowFlags windowFlags = SDL_WINDOW_VULKAN;
+        const SDL_WindowFlags windowFlags = SDL_WINDOW_VULKAN;
 
-    window = SDL_CreateWindow(
-        "Vulkan Engine",
-        SDL_WINDOWPOS_UNDEFINED,
-        SDL_WINDOWPOS_UNDEFINED,
-        static_cast<int>(windowExtent.width),
-        static_cast<int>(windowExtent.height),
-        windowFlags
-    );
+        window = SDL_CreateWindow(
+            "Vulkan Engine",
+            SDL_WINDOWPOS_UNDEFINED,
+            SDL_WINDOWPOS_UNDEFINED,
+            static_cast<int>(windowExtent.width),
+            static_cast<int>(windowExtent.height),
+            windowFlags
+        );
+    }
 
     InitVulkan();
     InitSwapchain();
     InitCommands();
     InitSyncStructures();
+    InitDescriptors();
+    InitPipelines();
+    InitDefaultData();
 
     // everything went fine
     bIsInitialized = true;
@@ -54,49 +151,115 @@ void VulkanEngine::Cleanup()
     {
         // Make sure the GPU has stopped doing its things
         vkDeviceWaitIdle(device);
-        mainDeletionQueue.Flush();
-        
-        for (int i = 0; i < FRAME_OVERLAP; i++)
+        ReportFrameStats();
+        if (settings.bDumpMemoryStatsOnExit)
+        {
+            DumpMemoryStats();
+        }
+
+        // Moves in flight have to land before the buffers they move are freed
+        defragmenter.Destroy();
+
+        // Scenes own buffers and images from the allocator, and views registered in the bindless table
+        loadedScenes.clear();
+
+        for (auto& frame : frames)
         {
-            auto& frame = frames[i];
+            frame.deletionQueue.Flush(device, allocator);
             vkDestroyCommandPool(device, frame.commandPool, nullptr);
+            for (const ThreadCommandPool& threadPool : frame.threadPools)
+            {
+                vkDestroyCommandPool(device, threadPool.pool, nullptr);
+            }
 
-            vkDestroyFence(device, frame.renderFence, nullptr);
             vkDestroySemaphore(device, frame.renderSemaphore, nullptr);
             vkDestroySemaphore(device, frame.swapchainSemaphore, nullptr);
         }
+
+        vkDestroySemaphore(device, frameTimeline, nullptr);
+
+        uploads.Destroy();
+
+        // Compiles that are still running would be lost otherwise
+        pipelineCompiler.Destroy();
+        pipelineCache.Save();
+        pipelineCache.Destroy();
         
+        bindless.Destroy();
+
+        // The headless images are owned by the allocator, so they have to go before it does
         DestroySwapchain();
-        
-        vkDestroySurfaceKHR(instance, surface, nullptr);
+        mainDeletionQueue.Flush(device, allocator);
+
+        if (!settings.bHeadless)
+        {
+            vkDestroySurfaceKHR(instance, surface, nullptr);
+        }
         vkDestroyDevice(device, nullptr);
         
         vkb::destroy_debug_utils_messenger(instance, debugMessenger);
         vkDestroyInstance(instance, nullptr);
-        SDL_DestroyWindow(window);
+        if (window)
+        {
+            SDL_DestroyWindow(window);
+        }
     }
 
+    jobs.Shutdown();
+
     // clear engine pointer
     loadedEngine = nullptr;
 }
 
 void VulkanEngine::Draw()
 {
-    // Wait until the GPU has finished rendering the last frame. Timeout of 1 second
-    VK_CHECK(vkWaitForFences(device, 1, &GetCurrentFrame().renderFence, true, 1000000000));
-    GetCurrentFrame().deletionQueue.Flush();
-    VK_CHECK(vkResetFences(device, 1, &GetCurrentFrame().renderFence));
+    const auto frameStart = std::chrono::high_resolution_clock::now();
+    if (frameNumber > 0)
+    {
+        stats.totalFrameTimeMs += std::chrono::duration<double, std::milli>(frameStart - stats.lastFrameStart).count();
+        stats.frameTimeSamples++;
+    }
+    stats.lastFrameStart = frameStart;
+
+    // Wait until the GPU has finished rendering the frame that last used this frame slot.
+    // There is nothing to reset afterward, the timeline just keeps counting up.
+    if (frameNumber >= GetFrameOverlap())
+    {
+        WaitForFrameCount(frameNumber - GetFrameOverlap() + 1);
+
+        const auto retired = std::chrono::high_resolution_clock::now();
+        stats.totalLatencyMs += std::chrono::duration<double, std::milli>(retired - GetCurrentFrame().startTime).count();
+        stats.latencySamples++;
+    }
+    GetCurrentFrame().deletionQueue.Flush(device, allocator);
+    GetCurrentFrame().frameData.Reset();
+    GetCurrentFrame().startTime = frameStart;
+    UpdateMemoryBudgets();
+
+    // Now that we are sure that the commands finished executing,
+    // we can safely reset every command pool of this frame in one go.
+    VK_CHECK(vkResetCommandPool(device, GetCurrentFrame().commandPool, 0));
+    for (ThreadCommandPool& threadPool : GetCurrentFrame().threadPools)
+    {
+        VK_CHECK(vkResetCommandPool(device, threadPool.pool, 0));
+        threadPool.usedSecondaryCount = 0;
+    }
 
     // Request image from the swapchain
     uint32_t swapchainImageIndex;
-    VK_CHECK(vkAcquireNextImageKHR(device, swapchain, 1000000000, GetCurrentFrame().swapchainSemaphore, nullptr, &swapchainImageIndex));
+    if (settings.bHeadless)
+    {
+        // The offscreen ring is at least as deep as the frame ring, so the timeline wait above
+        // already guarantees the GPU is done with the image we are about to reuse.
+        swapchainImageIndex = static_cast<uint32_t>(static_cast<size_t>(frameNumber) % swapchainImages.size());
+    }
+    else
+    {
+        VK_CHECK(vkAcquireNextImageKHR(device, swapchain, 1000000000, GetCurrentFrame().swapchainSemaphore, nullptr, &swapchainImageIndex));
+    }
     
     VkCommandBuffer command = GetCurrentFrame().commandBuffer;
 
-    // Now that we are sure that the commands finished executing,
-    // we can safely reset the command buffer to begin recording again.
-    VK_CHECK(vkResetCommandBuffer(command, 0));
-
     // Begin the command buffer recording. We will use this command buffer exactly once,
     // so we want to let vulkan know that.
     VkCommandBufferBeginInfo commandBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
@@ -104,59 +267,850 @@ void VulkanEngine::Draw()
     // Start the command buffer recording
     VK_CHECK(vkBeginCommandBuffer(command, &commandBeginInfo));
 
+    // Buffers that move this frame are patched before anything below records them
+    defragmenter.RecordPass(command, GetCompletedFrameCount(), GetFrameTimelineValue(frameNumber));
+
     // Make the swapchain image into a writable mode before rendering
-    vkutil::transition_image(command, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    vkutil::transition_image(command, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    vkutil::transition_image(command, depthImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+    const SceneView sceneView = GetSceneView();
+
+    // Make a clear-color from the frame number. This will flash with a 120 frame period.
+    float flash = abs(sin(static_cast<float>(frameNumber) / 120.f));
+    VkClearValue clearValue;
+    clearValue.color = {{0.0f, 0.0f, flash, 1.0f}};
+
+    VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(swapchainImageViews[swapchainImageIndex], &clearValue, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+    if (bTransientDepth)
+    {
+        // Nothing reads the depth after the pass, so it can stay in tile memory
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    }
+
+    if (settings.bGpuDriven)
+    {
+        RecordGpuDrivenScene(command, sceneView, colorAttachment, depthAttachment);
+    }
+    else
+    {
+        // The secondaries only have to exist by the time they are executed, recording them here keeps the primary simple
+        RecordScene(sceneView);
+        RecordFrameDataUpload(command);
+
+        // Clear the image as part of the main rendering pass. The contents of the pass come from
+        // secondary command buffers, so they can be recorded on any amount of threads.
+        VkRenderingInfo renderInfo = vkinit::rendering_info(swapchainExtend, &colorAttachment, &depthAttachment);
+        renderInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+
+        vkCmdBeginRendering(command, &renderInfo);
+        ExecuteSecondaryCommands(command);
+        vkCmdEndRendering(command);
+    }
+
+    // Make the swapchain image into presentable mode
+    // Headless images are never presented, so we leave them ready to be copied out instead
+    const VkImageLayout finalLayout = settings.bHeadless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    vkutil::transition_image(command, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, finalLayout);
+
+    // Finalize the command buffer (we can no longer add commands, but it can now be executed)
+    VK_CHECK(vkEndCommandBuffer(command));
+
+    // Prepare the submission to the queue
+    // We want to wait on the swapchainSemaphore, as that semaphore is signaled when the swapchain is ready
+    // We will signal the frame timeline with this frame's value, and the renderSemaphore to signal
+    // that rendering has finished for present
+    VkCommandBufferSubmitInfo commandInfo = vkinit::command_buffer_submit_info(command);
+
+    VkSemaphoreSubmitInfo waitInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, GetCurrentFrame().swapchainSemaphore);
+    VkSemaphoreSubmitInfo signalInfos[] = {
+        vkinit::timeline_semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frameTimeline, GetFrameTimelineValue(frameNumber)),
+        vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, GetCurrentFrame().renderSemaphore),
+    };
+
+    // In headless mode there is no acquire to wait on and no present to signal
+    VkSubmitInfo2 submit = vkinit::submit_info(&commandInfo, signalInfos, settings.bHeadless ? nullptr : &waitInfo);
+    submit.signalSemaphoreInfoCount = settings.bHeadless ? 1 : 2;
+
+    // Submit command buffer to the queue and execute it.
+    // The frame timeline will reach this frame's value once the graphics commands finish execution
+    VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &submit, nullptr));
+
+    // Prepare present
+    // This will put the image we just rendered to into the visible window.
+    // We want to wait on the renderSemaphore for that, as its necessary
+    // that drawing commands have finished before the image is displayed to the user
+    // Headless "presents" by simply moving on to the next image in the ring.
+    if (!settings.bHeadless)
+    {
+        VkPresentInfoKHR presentInfo = {};
+        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        presentInfo.pNext = nullptr;
+        presentInfo.pSwapchains = &swapchain;
+        presentInfo.swapchainCount = 1;
+
+        presentInfo.pWaitSemaphores = &GetCurrentFrame().renderSemaphore;
+        presentInfo.waitSemaphoreCount = 1;
+
+        presentInfo.pImageIndices = &swapchainImageIndex;
+        VK_CHECK(vkQueuePresentKHR(graphicsQueue, &presentInfo));
+    }
+
+    // Increase the number of frames drawn
+    frameNumber++;
+}
+
+uint64_t VulkanEngine::GetCompletedFrameCount() const
+{
+    uint64_t value;
+    VK_CHECK(vkGetSemaphoreCounterValue(device, frameTimeline, &value));
+    return value;
+}
+
+bool VulkanEngine::IsFrameComplete(uint64_t frame) const
+{
+    return GetCompletedFrameCount() >= GetFrameTimelineValue(frame);
+}
+
+void VulkanEngine::WaitForFrameCount(uint64_t completedFrames) const
+{
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.pNext = nullptr;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &frameTimeline;
+    waitInfo.pValues = &completedFrames;
+
+    // Timeout of 1 second
+    VK_CHECK(vkWaitSemaphores(device, &waitInfo, 1000000000));
+}
+
+void VulkanEngine::ImmediateSubmit(std::function<void(VkCommandBuffer command)>&& function)
+{
+    VK_CHECK(vkResetFences(device, 1, &immFence));
+    VK_CHECK(vkResetCommandBuffer(immCommandBuffer, 0));
+
+    VkCommandBuffer command = immCommandBuffer;
+
+    VkCommandBufferBeginInfo commandBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    VK_CHECK(vkBeginCommandBuffer(command, &commandBeginInfo));
+
+    function(command);
+
+    VK_CHECK(vkEndCommandBuffer(command));
+
+    VkCommandBufferSubmitInfo commandInfo = vkinit::command_buffer_submit_info(command);
+    VkSubmitInfo2 submit = vkinit::submit_info(&commandInfo, nullptr, nullptr);
+
+    // Submit command buffer to the queue and execute it.
+    // immFence will now block until the graphic commands finish execution
+    VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &submit, immFence));
+    VK_CHECK(vkWaitForFences(device, 1, &immFence, true, 9999999999));
+}
+
+AllocatedBuffer VulkanEngine::CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.pNext = nullptr;
+    bufferInfo.size = allocSize;
+    bufferInfo.usage = usage;
+
+    // Host visible buffers stay mapped for their whole lifetime, the pointer is in info.pMappedData
+    VmaAllocationCreateInfo allocationInfo = {};
+    allocationInfo.usage = memoryUsage;
+    allocationInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    AllocatedBuffer newBuffer;
+    VK_CHECK(vmaCreateBuffer(allocator, &bufferInfo, &allocationInfo, &newBuffer.buffer, &newBuffer.allocation, &newBuffer.info));
+
+    return newBuffer;
+}
+
+void VulkanEngine::DestroyBuffer(const AllocatedBuffer& buffer)
+{
+    if (defragmenter.Unregister(buffer.allocation))
+    {
+        vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+    }
+    else
+    {
+        // Caught in the middle of a move, the defragmenter frees the memory once the copy is done
+        vkDestroyBuffer(device, buffer.buffer, nullptr);
+    }
+}
+
+VkDeviceAddress VulkanEngine::GetBufferAddress(const AllocatedBuffer& buffer) const
+{
+    VkBufferDeviceAddressInfo deviceAddressInfo = {};
+    deviceAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+    deviceAddressInfo.buffer = buffer.buffer;
+    return vkGetBufferDeviceAddress(device, &deviceAddressInfo);
+}
+
+void VulkanEngine::CreateRelocatableBuffer(AllocatedBuffer& buffer, VkDeviceAddress* address, size_t size, VkBufferUsageFlags usage)
+{
+    // Moves copy the buffer over to its new place on the GPU
+    usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    buffer = CreateBuffer(size, usage, VMA_MEMORY_USAGE_GPU_ONLY);
+    if (address)
+    {
+        *address = GetBufferAddress(buffer);
+    }
+    defragmenter.Register(&buffer, usage, address);
+}
+
+DynamicBuffer VulkanEngine::CreateDynamicBuffer(size_t size, VkBufferUsageFlags usage)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.pNext = nullptr;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    // VMA picks device local host visible memory when there is some, and only falls back to memory the CPU cannot
+    // map when there is not, which the host access flags allow it to do
+    VmaAllocationCreateInfo allocationInfo = {};
+    allocationInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    if (settings.bDirectDeviceWrites)
+    {
+        allocationInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT
+            | VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT
+            | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    }
+
+    DynamicBuffer newBuffer;
+    newBuffer.size = size;
+    VK_CHECK(vmaCreateBuffer(allocator, &bufferInfo, &allocationInfo, &newBuffer.buffer.buffer, &newBuffer.buffer.allocation, &newBuffer.buffer.info));
+    newBuffer.address = GetBufferAddress(newBuffer.buffer);
+
+    // Only memory the CPU can see gets mapped, anything else is written through a staging copy
+    if (newBuffer.buffer.info.pMappedData == nullptr)
+    {
+        newBuffer.staging = CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+    }
+
+    return newBuffer;
+}
+
+void VulkanEngine::DestroyDynamicBuffer(const DynamicBuffer& buffer)
+{
+    DestroyBuffer(buffer.buffer);
+    if (!buffer.IsDirect())
+    {
+        DestroyBuffer(buffer.staging);
+    }
+}
+
+void VulkanEngine::FlushDynamicBuffer(const DynamicBuffer& buffer, size_t size)
+{
+    assert(size <= buffer.size);
+
+    const VmaAllocation allocation = buffer.IsDirect() ? buffer.buffer.allocation : buffer.staging.allocation;
+    VK_CHECK(vmaFlushAllocation(allocator, allocation, 0, size));
+}
+
+void VulkanEngine::RecordDynamicBufferCopy(VkCommandBuffer command, const DynamicBuffer& buffer, size_t size)
+{
+    if (buffer.IsDirect())
+    {
+        return;
+    }
+
+    VkBufferCopy copy = {};
+    copy.srcOffset = 0;
+    copy.dstOffset = 0;
+    copy.size = size;
+    vkCmdCopyBuffer(command, buffer.staging.buffer, buffer.buffer.buffer, 1, &copy);
+}
+
+AllocatedImage VulkanEngine::CreateImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, VmaMemoryUsage memoryUsage)
+{
+    AllocatedImage newImage;
+    newImage.imageFormat = format;
+    newImage.imageExtent = size;
+
+    const VkImageCreateInfo imageInfo = vkinit::image_create_info(format, usage, size);
+
+    // Always allocate images on dedicated GPU memory
+    VmaAllocationCreateInfo allocationInfo = {};
+    allocationInfo.usage = memoryUsage;
+    allocationInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VK_CHECK(vmaCreateImage(allocator, &imageInfo, &allocationInfo, &newImage.image, &newImage.allocation, nullptr));
+
+    // If the format is a depth format, we will need to have it use the correct aspect flag
+    const VkImageAspectFlags aspectFlag = format == VK_FORMAT_D32_SFLOAT ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+
+    const VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(format, newImage.image, aspectFlag);
+    VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &newImage.imageView));
+
+    return newImage;
+}
+
+AllocatedImage VulkanEngine::CreateTransientAttachment(VkExtent3D size, VkFormat format, VkImageUsageFlags usage)
+{
+    usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+    // Desktop GPUs usually have no lazily allocated memory type, the attachment gets regular device memory there
+    const VkImageCreateInfo imageInfo = vkinit::image_create_info(format, usage, size);
+    VmaAllocationCreateInfo allocationInfo = {};
+    allocationInfo.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+    uint32_t memoryTypeIndex;
+    const bool bLazilyAllocated = vmaFindMemoryTypeIndexForImageInfo(allocator, &imageInfo, &allocationInfo, &memoryTypeIndex) == VK_SUCCESS;
+
+    return CreateImage(size, format, usage, bLazilyAllocated ? VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED : VMA_MEMORY_USAGE_GPU_ONLY);
+}
+
+void VulkanEngine::DestroyImage(const AllocatedImage& image)
+{
+    vkDestroyImageView(device, image.imageView, nullptr);
+    vmaDestroyImage(allocator, image.image, image.allocation);
+}
+
+void VulkanEngine::UploadDrawBuffers(LoadedScene& scene)
+{
+    static_assert(sizeof(GPUSurface::lods) / sizeof(GPUSurfaceLod) == MAX_SURFACE_LODS);
+
+    // The surfaces of every mesh in a single table, firstSurface tells where each mesh starts
+    std::vector<GPUSurface> surfaces;
+    std::vector<uint32_t> firstSurface;
+    firstSurface.reserve(scene.meshes.size());
+    for (const MeshAsset& mesh : scene.meshes)
+    {
+        firstSurface.push_back(static_cast<uint32_t>(surfaces.size()));
+        for (const GeoSurface& surface : mesh.surfaces)
+        {
+            GPUSurface& gpuSurface = surfaces.emplace_back();
+            gpuSurface.startIndex = surface.startIndex;
+            gpuSurface.count = surface.count;
+            gpuSurface.vertexOffset = surface.vertexOffset;
+            gpuSurface.materialIndex = surface.materialIndex;
+            gpuSurface.lodCount = surface.lodCount;
+            for (uint32_t lod = 0; lod < surface.lodCount; lod++)
+            {
+                gpuSurface.lods[lod] = {surface.lods[lod].startIndex, surface.lods[lod].count, surface.lods[lod].error, 0};
+            }
+        }
+    }
+
+    // Packed positions are relative to their surface's bounds, which every object of the surface bakes into its matrix
+    const bool bPackedVertices = scene.meshBuffers.vertexFormat == VertexFormat::Packed;
+
+    std::vector<GPUDrawObject> objects;
+    for (const MeshInstance& instance : scene.instances)
+    {
+        // Same scale the CPU path grows the LOD errors and bounding spheres with
+        const float instanceScale = std::max({
+            glm::length(glm::vec3(instance.worldMatrix[0])),
+            glm::length(glm::vec3(instance.worldMatrix[1])),
+            glm::length(glm::vec3(instance.worldMatrix[2]))
+        });
+
+        const std::vector<GeoSurface>& meshSurfaces = scene.meshes[instance.meshIndex].surfaces;
+        for (size_t i = 0; i < meshSurfaces.size(); i++)
+        {
+            const GeoSurface& surface = meshSurfaces[i];
+
+            GPUDrawObject& object = objects.emplace_back();
+            object.worldMatrix = bPackedVertices ? instance.worldMatrix * get_dequantization_matrix(surface.bounds) : instance.worldMatrix;
+            object.boundingSphere = glm::vec4(
+                glm::vec3(instance.worldMatrix * glm::vec4(surface.bounds.origin, 1.0f)),
+                surface.bounds.sphereRadius * instanceScale
+            );
+            object.surfaceIndex = firstSurface[instance.meshIndex] + static_cast<uint32_t>(i);
+            object.materialIndex = surface.materialIndex;
+            object.lodScale = instanceScale;
+            object.padding = 0;
+        }
+    }
+
+    if (objects.empty())
+    {
+        return;
+    }
+
+    GPUDrawBuffers& drawBuffers = scene.drawBuffers;
+    const size_t objectBufferSize = objects.size() * sizeof(GPUDrawObject);
+    const size_t surfaceBufferSize = surfaces.size() * sizeof(GPUSurface);
+
+    CreateRelocatableBuffer(
+        drawBuffers.objectBuffer,
+        &drawBuffers.objectBufferAddress,
+        objectBufferSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+    );
+    CreateRelocatableBuffer(
+        drawBuffers.surfaceBuffer,
+        &drawBuffers.surfaceBufferAddress,
+        surfaceBufferSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+    );
+    // Sized for every object surviving the cull, which is what the draw's max count is set to as well
+    CreateRelocatableBuffer(
+        drawBuffers.drawCommandBuffer,
+        &drawBuffers.drawCommandBufferAddress,
+        objects.size() * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+    );
+    CreateRelocatableBuffer(
+        drawBuffers.drawCountBuffer,
+        &drawBuffers.drawCountBufferAddress,
+        sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+    );
+    // Whether every object passed the occlusion test last frame, starts out with nothing visible
+    CreateRelocatableBuffer(
+        drawBuffers.visibilityBuffer,
+        &drawBuffers.visibilityBufferAddress,
+        objects.size() * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+    );
+    drawBuffers.objectCount = static_cast<uint32_t>(objects.size());
+
+    // The objects never change after this, so they live in GPU memory and are uploaded once.
+    // The first frame culls with them, so there is nothing to gain from not waiting here
+    uploads.UploadBuffer(drawBuffers.objectBuffer.buffer, 0, objects.data(), objectBufferSize);
+    uploads.UploadBuffer(drawBuffers.surfaceBuffer.buffer, 0, surfaces.data(), surfaceBufferSize);
+    uploads.FillBuffer(drawBuffers.visibilityBuffer.buffer, 0, objects.size() * sizeof(uint32_t), 0);
+    uploads.Wait(uploads.Flush());
+
+    fmt::println(
+        "{} objects of {} surfaces ready to be culled on the GPU ({:.2f} MB)",
+        objects.size(),
+        surfaces.size(),
+        static_cast<double>(objectBufferSize + surfaceBufferSize) / (1024.0 * 1024.0)
+    );
+}
+
+VkCommandBuffer VulkanEngine::BeginSecondaryCommands(uint32_t threadIndex, const VkCommandBufferInheritanceRenderingInfo& renderingInfo)
+{
+    assert(threadIndex < GetCurrentFrame().threadPools.size());
+    ThreadCommandPool& threadPool = GetCurrentFrame().threadPools[threadIndex];
+
+    // Only grows until the busiest frame has been seen, after that buffers are recycled with the pool
+    if (threadPool.usedSecondaryCount == threadPool.secondaryBuffers.size())
+    {
+        VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(threadPool.pool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+        VkCommandBuffer newBuffer;
+        VK_CHECK(vkAllocateCommandBuffers(device, &cmdAllocInfo, &newBuffer));
+        threadPool.secondaryBuffers.push_back(newBuffer);
+    }
+
+    VkCommandBuffer command = threadPool.secondaryBuffers[threadPool.usedSecondaryCount++];
+
+    VkCommandBufferInheritanceInfo inheritanceInfo = {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.pNext = &renderingInfo;
+
+    // Every secondary is executed inside the frame's dynamic rendering, see Draw()
+    VkCommandBufferBeginInfo commandBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+    commandBeginInfo.pInheritanceInfo = &inheritanceInfo;
+    VK_CHECK(vkBeginCommandBuffer(command, &commandBeginInfo));
+
+    return command;
+}
+
+void VulkanEngine::ExecuteSecondaryCommands(VkCommandBuffer primary)
+{
+    // Executed grouped by thread, in the order each thread recorded them
+    for (const ThreadCommandPool& threadPool : GetCurrentFrame().threadPools)
+    {
+        if (threadPool.usedSecondaryCount > 0)
+        {
+            vkCmdExecuteCommands(primary, threadPool.usedSecondaryCount, threadPool.secondaryBuffers.data());
+        }
+    }
+}
+
+VkCommandBufferInheritanceRenderingInfo VulkanEngine::GetSceneRenderingInheritance() const
+{
+    VkCommandBufferInheritanceRenderingInfo renderingInfo = {};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+    renderingInfo.pNext = nullptr;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachmentFormats = &swapchainImageFormat;
+    renderingInfo.depthAttachmentFormat = depthImage.imageFormat;
+    renderingInfo.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+    renderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    return renderingInfo;
+}
+
+VulkanEngine::SceneView VulkanEngine::GetSceneView() const
+{
+    SceneView sceneView;
+    sceneView.view = mainCamera.GetViewMatrix();
+    sceneView.nearPlane = 0.1f;
+    sceneView.farPlane = 10000.0f;
+
+    // Camera projection, with near and far swapped for reversed depth
+    const float fieldOfView = glm::radians(70.0f);
+    sceneView.projection = glm::perspective(
+        fieldOfView,
+        static_cast<float>(swapchainExtend.width) / static_cast<float>(swapchainExtend.height),
+        sceneView.farPlane,
+        sceneView.nearPlane
+    );
+
+    // Invert the Y direction on projection matrix so that we are more similar to opengl and gltf axis
+    sceneView.projection[1][1] *= -1;
+
+    sceneView.viewProjection = sceneView.projection * sceneView.view;
+
+    // An error of one unit at a distance of one unit covers this many pixels on screen
+    const float pixelsPerUnit = static_cast<float>(swapchainExtend.height) / (2.0f * std::tan(fieldOfView * 0.5f));
+    sceneView.lodErrorPerDistance = settings.lodPixelError / pixelsPerUnit;
+
+    return sceneView;
+}
+
+void VulkanEngine::RecordFrameDataUpload(VkCommandBuffer command)
+{
+    const DynamicBuffer& buffer = GetCurrentFrame().frameData.GetBuffer();
+    const size_t usedSize = GetCurrentFrame().frameData.GetUsedSize();
+    if (usedSize == 0)
+    {
+        return;
+    }
+
+    // Host writes flushed before the submit are visible to it without a barrier, only a staging copy needs one
+    FlushDynamicBuffer(buffer, usedSize);
+    if (buffer.IsDirect())
+    {
+        return;
+    }
+
+    RecordDynamicBufferCopy(command, buffer, usedSize);
+    memory_barrier(
+        command,
+        VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+        VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        VK_ACCESS_2_UNIFORM_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT
+    );
+}
+
+void VulkanEngine::RecordGpuDrivenScene(
+    VkCommandBuffer command,
+    const SceneView& sceneView,
+    VkRenderingAttachmentInfo colorAttachment,
+    VkRenderingAttachmentInfo depthAttachment
+) {
+    // The side planes of a symmetric frustum, x * scale = -z in view space, normalized so the cull can compare
+    // distances against sphere radii. The Y flip of the projection does not matter, the shader tests both sides at once
+    const float scaleX = sceneView.projection[0][0];
+    const float scaleY = std::abs(sceneView.projection[1][1]);
+    const float lengthX = std::sqrt(scaleX * scaleX + 1.0f);
+    const float lengthY = std::sqrt(scaleY * scaleY + 1.0f);
+
+    // Built on the stack and written in one go, frameData may be write combined device memory
+    GPUCullData cullData = {};
+    cullData.view = sceneView.view;
+    cullData.frustum = {scaleX / lengthX, 1.0f / lengthX, scaleY / lengthY, 1.0f / lengthY};
+    cullData.projection = {scaleX, scaleY, sceneView.projection[2][2], sceneView.projection[3][2]};
+    cullData.lodErrorPerDistance = sceneView.lodErrorPerDistance;
+    cullData.nearPlane = sceneView.nearPlane;
+    cullData.farPlane = sceneView.farPlane;
+    cullData.depthPyramidSize = {static_cast<float>(depthPyramid.imageExtent.width), static_cast<float>(depthPyramid.imageExtent.height)};
+
+    FrameData& frame = GetCurrentFrame();
+    frame.cullDataAddress = frame.frameData.Push(cullData).deviceAddress;
+    RecordFrameDataUpload(command);
+
+    if (!settings.bOcclusionCulling)
+    {
+        RecordCulling(command, CullPass::All);
+        RecordIndirectDraws(command, sceneView, colorAttachment, depthAttachment);
+        return;
+    }
+
+    // Two-phase occlusion culling. What was visible last frame is drawn first, which covers most of what is visible now
+    // and occludes most of the rest. Everything else is tested against the depth that leaves behind.
+    RecordCulling(command, CullPass::Early);
+    RecordIndirectDraws(command, sceneView, colorAttachment, depthAttachment);
+
+    vkutil::transition_image(command, depthImage.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
+    RecordDepthPyramid(command);
+
+    // The late pass draws what became visible on top of the early pass, so nothing may be cleared this time
+    RecordCulling(command, CullPass::Late);
+    vkutil::transition_image(command, depthImage.image, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    RecordIndirectDraws(command, sceneView, colorAttachment, depthAttachment);
+}
+
+void VulkanEngine::RecordCulling(VkCommandBuffer command, CullPass pass)
+{
+    // Earlier passes may still be drawing from the command and count buffers we are about to overwrite,
+    // or writing the visibility this pass reads
+    memory_barrier(
+        command,
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT
+    );
+
+    for (const auto& [path, loadedScene] : loadedScenes)
+    {
+        if (loadedScene->drawBuffers.objectCount > 0)
+        {
+            vkCmdFillBuffer(command, loadedScene->drawBuffers.drawCountBuffer.buffer, 0, sizeof(uint32_t), 0);
+        }
+    }
+
+    memory_barrier(
+        command,
+        VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+        VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT
+    );
+
+    vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+    vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullSet, 0, nullptr);
+
+    GPUCullPushConstants pushConstants;
+    pushConstants.cullData = GetCurrentFrame().cullDataAddress;
+    pushConstants.pass = pass;
+
+    for (const auto& [path, loadedScene] : loadedScenes)
+    {
+        const GPUDrawBuffers& drawBuffers = loadedScene->drawBuffers;
+        if (drawBuffers.objectCount == 0)
+        {
+            continue;
+        }
+
+        pushConstants.objectBuffer = drawBuffers.objectBufferAddress;
+        pushConstants.surfaceBuffer = drawBuffers.surfaceBufferAddress;
+        pushConstants.visibilityBuffer = drawBuffers.visibilityBufferAddress;
+        pushConstants.drawCommandBuffer = drawBuffers.drawCommandBufferAddress;
+        pushConstants.drawCountBuffer = drawBuffers.drawCountBufferAddress;
+        pushConstants.objectCount = drawBuffers.objectCount;
+        vkCmdPushConstants(command, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCullPushConstants), &pushConstants);
+
+        // One invocation per object, cull.comp has a workgroup size of 64
+        vkCmdDispatch(command, (drawBuffers.objectCount + 63) / 64, 1, 1);
+    }
+
+    // The draws read the commands and their count in the indirect stage, before any shader runs
+    memory_barrier(
+        command,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT
+    );
+}
+
+void VulkanEngine::RecordDepthPyramid(VkCommandBuffer command)
+{
+    // The last workgroup to finish is found by counting them, from zero every time
+    vkCmdFillBuffer(command, depthPyramidCounterBuffer.buffer, 0, sizeof(uint32_t), 0);
+    memory_barrier(
+        command,
+        VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+        VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT
+    );
+
+    // Every texel is rewritten, so whatever the previous frame left in the pyramid can be discarded
+    vkutil::transition_image(command, depthPyramid.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+    const VkExtent3D pyramidExtent = depthPyramid.imageExtent;
+    const uint32_t groupCountX = (pyramidExtent.width + 31) / 32;
+    const uint32_t groupCountY = (pyramidExtent.height + 31) / 32;
+
+    GPUDepthPyramidPushConstants pushConstants;
+    pushConstants.depthSize = {swapchainExtend.width, swapchainExtend.height};
+    pushConstants.pyramidSize = {pyramidExtent.width, pyramidExtent.height};
+    pushConstants.levelCount = static_cast<uint32_t>(depthPyramidLevelViews.size());
+    pushConstants.groupCount = groupCountX * groupCountY;
+    pushConstants.counterBuffer = depthPyramidCounterBufferAddress;
+
+    vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipeline);
+    vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipelineLayout, 0, 1, &depthPyramidSet, 0, nullptr);
+    vkCmdPushConstants(command, depthPyramidPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUDepthPyramidPushConstants), &pushConstants);
+
+    // A single dispatch of 32x32 tiles builds every level
+    vkCmdDispatch(command, groupCountX, groupCountY, 1);
+
+    memory_barrier(
+        command,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_READ_BIT
+    );
+}
+
+void VulkanEngine::RecordIndirectDraws(
+    VkCommandBuffer command,
+    const SceneView& sceneView,
+    const VkRenderingAttachmentInfo& colorAttachment,
+    const VkRenderingAttachmentInfo& depthAttachment
+) {
+    const VkDescriptorSet bindlessSet = bindless.GetSet();
+
+    VkViewport viewport = {};
+    viewport.x = 0;
+    viewport.y = 0;
+    viewport.width = static_cast<float>(swapchainExtend.width);
+    viewport.height = static_cast<float>(swapchainExtend.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor = {};
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    scissor.extent = swapchainExtend;
+
+    // Culling already happened on the GPU, what is left is a single draw per scene, recorded straight into the primary
+    VkRenderingInfo renderInfo = vkinit::rendering_info(swapchainExtend, &colorAttachment, &depthAttachment);
+    vkCmdBeginRendering(command, &renderInfo);
+
+    vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipelineLayout, 0, 1, &bindlessSet, 0, nullptr);
+    vkCmdSetViewport(command, 0, 1, &viewport);
+    vkCmdSetScissor(command, 0, 1, &scissor);
+
+    GPUIndirectDrawPushConstants pushConstants;
+    pushConstants.viewProjection = sceneView.viewProjection;
+    pushConstants.materialBuffer = bindless.GetMaterialBufferAddress();
+
+    for (const auto& [path, loadedScene] : loadedScenes)
+    {
+        const LoadedScene& scene = *loadedScene;
+        if (scene.drawBuffers.objectCount == 0)
+        {
+            continue;
+        }
+
+        vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, GetIndirectMeshPipeline(scene.meshBuffers.vertexFormat));
+        vkCmdBindIndexBuffer(command, scene.meshBuffers.indexBuffer.buffer, 0, scene.meshBuffers.indexType);
+
+        pushConstants.vertexBuffer = scene.meshBuffers.vertexBufferAddress;
+        pushConstants.objectBuffer = scene.drawBuffers.objectBufferAddress;
+        vkCmdPushConstants(command, meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GPUIndirectDrawPushConstants), &pushConstants);
+
+        vkCmdDrawIndexedIndirectCount(
+            command,
+            scene.drawBuffers.drawCommandBuffer.buffer,
+            0,
+            scene.drawBuffers.drawCountBuffer.buffer,
+            0,
+            scene.drawBuffers.objectCount,
+            sizeof(VkDrawIndexedIndirectCommand)
+        );
+    }
+
+    vkCmdEndRendering(command);
+}
+
+void VulkanEngine::RecordScene(const SceneView& sceneView)
+{
+    const glm::mat4& viewProjection = sceneView.viewProjection;
+    const culling::Frustum frustum = culling::extract_frustum(viewProjection);
+    const float nearPlane = sceneView.nearPlane;
+    const float lodErrorPerDistance = sceneView.lodErrorPerDistance;
+    const glm::vec3 cameraPosition = mainCamera.position;
+
+    const VkCommandBufferInheritanceRenderingInfo inheritance = GetSceneRenderingInheritance();
+    const VkDescriptorSet bindlessSet = bindless.GetSet();
+    const VkDeviceAddress materialBufferAddress = bindless.GetMaterialBufferAddress();
+
+    VkViewport viewport = {};
+    viewport.x = 0;
+    viewport.y = 0;
+    viewport.width = static_cast<float>(swapchainExtend.width);
+    viewport.height = static_cast<float>(swapchainExtend.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor = {};
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    scissor.extent = swapchainExtend;
 
-    // Make a clear-color from the frame number. This will flash with a 120 frame period.
-    float flash = abs(sin(static_cast<float>(frameNumber) / 120.f));
-    VkClearColorValue clearValue = {{0.0f, 0.0f, flash, 1.0f}};
-    VkImageSubresourceRange clearRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+    for (const auto& [path, loadedScene] : loadedScenes)
+    {
+        const LoadedScene& scene = *loadedScene;
+        const VkPipeline pipeline = GetMeshPipeline(scene.meshBuffers.vertexFormat);
+        // Packed positions are relative to their surface's bounds, the matrix maps them back
+        const bool bPackedVertices = scene.meshBuffers.vertexFormat == VertexFormat::Packed;
 
-    // Clear image
-    vkCmdClearColorImage(command, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_GENERAL, &clearValue, 1, &clearRange);
+        // Every batch of instances becomes its own secondary command buffer, on whichever thread picks it up
+        constexpr uint32_t batchSize = 64;
+        jobs.ParallelFor(static_cast<uint32_t>(scene.instances.size()), batchSize, [&](uint32_t begin, uint32_t end, uint32_t threadIndex) -> void
+        {
+            // Only the instances whose bounding sphere touches the view are recorded, the indices are relative to begin
+            const InstanceBounds& bounds = scene.instanceBounds;
+            culling::SphereArrays spheres = {};
+            spheres.centerX = bounds.centerX.data() + begin;
+            spheres.centerY = bounds.centerY.data() + begin;
+            spheres.centerZ = bounds.centerZ.data() + begin;
+            spheres.radius = bounds.radius.data() + begin;
+            std::array<uint32_t, batchSize> visibleIndices;
+            const uint32_t visibleCount = culling::cull_spheres(frustum, spheres, bounds.worldMatrices.data() + begin, end - begin, visibleIndices.data());
 
-    // Make the swapchain image into presentable mode
-    vkutil::transition_image(command, swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+            VkCommandBuffer command = BeginSecondaryCommands(threadIndex, inheritance);
 
-    // Finalize the command buffer (we can no longer add commands, but it can now be executed)
-    VK_CHECK(vkEndCommandBuffer(command));
+            // Secondaries inherit nothing but the attachments, so each one sets up its own state
+            vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipelineLayout, 0, 1, &bindlessSet, 0, nullptr);
+            vkCmdSetViewport(command, 0, 1, &viewport);
+            vkCmdSetScissor(command, 0, 1, &scissor);
+            vkCmdBindIndexBuffer(command, scene.meshBuffers.indexBuffer.buffer, 0, scene.meshBuffers.indexType);
 
-    // Prepare the submission to the queue
-    // We want to wait on the swapchainSemaphore, as that semaphore is signaled when the swapchain is ready
-    // We will signal the renderSemaphore, to signal that rendering has finished
-    VkCommandBufferSubmitInfo commandInfo = vkinit::command_buffer_submit_info(command);
+            GPUDrawPushConstants pushConstants;
+            pushConstants.vertexBuffer = scene.meshBuffers.vertexBufferAddress;
+            pushConstants.materialBuffer = materialBufferAddress;
 
-    VkSemaphoreSubmitInfo waitInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, GetCurrentFrame().swapchainSemaphore);
-    VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, GetCurrentFrame().renderSemaphore);
+            for (uint32_t visibleIndex = 0; visibleIndex < visibleCount; visibleIndex++)
+            {
+                const MeshInstance& instance = scene.instances[begin + visibleIndices[visibleIndex]];
+                const glm::mat4 instanceMatrix = viewProjection * instance.worldMatrix;
 
-    VkSubmitInfo2 submit = vkinit::submit_info(&commandInfo, &signalInfo, &waitInfo);
+                // LOD errors are in the space of the mesh, the largest axis scale bounds how much the instance grows them
+                const float instanceScale = std::max({
+                    glm::length(glm::vec3(instance.worldMatrix[0])),
+                    glm::length(glm::vec3(instance.worldMatrix[1])),
+                    glm::length(glm::vec3(instance.worldMatrix[2]))
+                });
 
-    // Submit command buffer to the queue and execute it.
-    // renderFence will now block until the graphics commands finish execution
-    VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &submit, GetCurrentFrame().renderFence));
+                for (const GeoSurface& surface : scene.meshes[instance.meshIndex].surfaces)
+                {
+                    // Measured to the nearest point of the bounding sphere, so the error is never underestimated
+                    const glm::vec3 center = glm::vec3(instance.worldMatrix * glm::vec4(surface.bounds.origin, 1.0f));
+                    const float distance = std::max(glm::length(center - cameraPosition) - surface.bounds.sphereRadius * instanceScale, nearPlane);
+                    const SurfaceLod lod = select_surface_lod(surface, lodErrorPerDistance * distance / instanceScale);
 
-    // Prepare present
-    // This will put the image we just rendered to into the visible window.
-    // We want to wait on the renderSemaphore for that, as its necessary
-    // that drawing commands have finished before the image is displayed to the user
-    VkPresentInfoKHR presentInfo = {};
-    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    presentInfo.pNext = nullptr;
-    presentInfo.pSwapchains = &swapchain;
-    presentInfo.swapchainCount = 1;
-
-    presentInfo.pWaitSemaphores = &GetCurrentFrame().renderSemaphore;
-    presentInfo.waitSemaphoreCount = 1;
-    
-    presentInfo.pImageIndices = &swapchainImageIndex;
-    VK_CHECK(vkQueuePresentKHR(graphicsQueue, &presentInfo));
+                    pushConstants.worldMatrix = bPackedVertices ? instanceMatrix * get_dequantization_matrix(surface.bounds) : instanceMatrix;
+                    pushConstants.materialIndex = surface.materialIndex;
+                    vkCmdPushConstants(command, meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
+                    vkCmdDrawIndexed(command, lod.count, 1, lod.startIndex, surface.vertexOffset, 0);
+                }
+            }
 
-    // Increase the number of frames drawn
-    frameNumber++;
+            VK_CHECK(vkEndCommandBuffer(command));
+        });
+    }
 }
 
 void VulkanEngine::Run()
 {
+    if (settings.bHeadless)
+    {
+        RunHeadless();
+        return;
+    }
+
     SDL_Event e;
     bool bQuit = false;
 
@@ -175,10 +1129,12 @@ void VulkanEngine::Run()
                 if (e.window.event == SDL_WINDOWEVENT_RESTORED) { bStopRendering = false; }
             }
 
-            if (e.type == SDL_KEYDOWN)
+            if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F2)
             {
-                fmt::print("Key pressed: {}.\n", SDL_GetKeyName(e.key.keysym.sym));
+                DumpMemoryStats();
             }
+
+            mainCamera.ProcessSDLEvent(e);
         }
 
         // do not draw if we are minimized
@@ -189,8 +1145,124 @@ void VulkanEngine::Run()
             continue;
         }
 
+        mainCamera.Update();
+        Draw();
+    }
+}
+
+void VulkanEngine::RunHeadless()
+{
+    // Nothing paces us here (no events, no vsync), so this measures raw frame throughput
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    for (uint32_t i = 0; i < settings.headlessFrameCount; i++)
+    {
         Draw();
     }
+
+    VK_CHECK(vkDeviceWaitIdle(device));
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    const double totalMs = std::chrono::duration<double, std::milli>(end - start).count();
+    const double frameMs = settings.headlessFrameCount > 0 ? totalMs / settings.headlessFrameCount : 0.0;
+
+    fmt::println(
+        "Rendered {} headless frames in {:.2f} ms ({:.3f} ms/frame, {:.1f} fps)",
+        settings.headlessFrameCount,
+        totalMs,
+        frameMs,
+        frameMs > 0.0 ? 1000.0 / frameMs : 0.0
+    );
+}
+
+void VulkanEngine::UpdateMemoryBudgets()
+{
+    vmaSetCurrentFrameIndex(allocator, static_cast<uint32_t>(frameNumber));
+    vmaGetHeapBudgets(allocator, heapBudgets.data());
+
+    for (uint32_t i = 0; i < heapBudgets.size(); i++)
+    {
+        const VmaBudget& budget = heapBudgets[i];
+        const uint32_t heapBit = 1u << i;
+        if (budget.usage > budget.budget && (heapsOverBudget & heapBit) == 0)
+        {
+            fmt::println(
+                "Memory heap {} is over budget: {:.1f} of {:.1f} MB in use",
+                i,
+                static_cast<double>(budget.usage) / (1024.0 * 1024.0),
+                static_cast<double>(budget.budget) / (1024.0 * 1024.0)
+            );
+        }
+        heapsOverBudget = budget.usage > budget.budget ? heapsOverBudget | heapBit : heapsOverBudget & ~heapBit;
+    }
+
+    if (settings.defragmentationBytesPerFrame == 0 || defragmenter.IsRunning() || frameNumber < nextDefragmentationCheck)
+    {
+        return;
+    }
+    nextDefragmentationCheck = frameNumber + DEFRAGMENTATION_CHECK_INTERVAL;
+
+    // Memory held in blocks without an allocation in it, which is what streaming leaves behind as holes
+    const VkPhysicalDeviceMemoryProperties* memoryProperties = nullptr;
+    vmaGetMemoryProperties(allocator, &memoryProperties);
+    VkDeviceSize blockBytes = 0;
+    VkDeviceSize allocationBytes = 0;
+    for (uint32_t i = 0; i < heapBudgets.size(); i++)
+    {
+        if (memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+        {
+            blockBytes += heapBudgets[i].statistics.blockBytes;
+            allocationBytes += heapBudgets[i].statistics.allocationBytes;
+        }
+    }
+
+    const VkDeviceSize unusedBytes = blockBytes - allocationBytes;
+    if (unusedBytes >= DEFRAGMENTATION_MIN_UNUSED_BYTES && static_cast<double>(unusedBytes) > static_cast<double>(blockBytes) * DEFRAGMENTATION_UNUSED_SHARE)
+    {
+        defragmenter.Start();
+    }
+}
+
+void VulkanEngine::DumpMemoryStats() const
+{
+    char* statsString = nullptr;
+    vmaBuildStatsString(allocator, &statsString, VK_TRUE);
+
+    std::ofstream file(settings.memoryStatsPath, std::ios::trunc);
+    file << statsString;
+    vmaFreeStatsString(allocator, statsString);
+
+    if (!file)
+    {
+        fmt::println("Failed to write memory statistics to {}", settings.memoryStatsPath);
+        return;
+    }
+    fmt::println("Wrote memory statistics to {}", settings.memoryStatsPath);
+}
+
+void VulkanEngine::ReportFrameStats() const
+{
+    const double frameMs = stats.frameTimeSamples > 0 ? stats.totalFrameTimeMs / static_cast<double>(stats.frameTimeSamples) : 0.0;
+    const double latencyMs = stats.latencySamples > 0 ? stats.totalLatencyMs / static_cast<double>(stats.latencySamples) : 0.0;
+
+    fmt::println(
+        "Frames in flight: {} | average frame time {:.3f} ms | average latency {:.3f} ms | {} frames",
+        GetFrameOverlap(),
+        frameMs,
+        latencyMs,
+        frameNumber
+    );
+
+    for (uint32_t i = 0; i < heapBudgets.size(); i++)
+    {
+        fmt::println(
+            "Memory heap {}: {:.1f} of {:.1f} MB in use, {:.1f} MB allocated by the engine",
+            i,
+            static_cast<double>(heapBudgets[i].usage) / (1024.0 * 1024.0),
+            static_cast<double>(heapBudgets[i].budget) / (1024.0 * 1024.0),
+            static_cast<double>(heapBudgets[i].statistics.allocationBytes) / (1024.0 * 1024.0)
+        );
+    }
 }
 
 void VulkanEngine::InitVulkan()
@@ -203,6 +1275,7 @@ void VulkanEngine::InitVulkan()
         .request_validation_layers(bUseValidationLayers)
         .use_default_debug_messenger()
         .require_api_version(1, 3, 0)
+        .set_headless(settings.bHeadless)
         .build();
 
     vkb::Instance vkbInstance = result.value();
@@ -211,7 +1284,10 @@ void VulkanEngine::InitVulkan()
     instance = vkbInstance.instance;
     debugMessenger = vkbInstance.debug_messenger;
 
-    SDL_Vulkan_CreateSurface(window, instance, &surface);
+    if (!settings.bHeadless)
+    {
+        SDL_Vulkan_CreateSurface(window, instance, &surface);
+    }
 
     // Vulkan 1.3 features
     VkPhysicalDeviceVulkan13Features features13{};
@@ -222,17 +1298,45 @@ void VulkanEngine::InitVulkan()
     VkPhysicalDeviceVulkan12Features features12{};
     features12.bufferDeviceAddress = true;
     features12.descriptorIndexing = true;
+    features12.timelineSemaphore = true;
+    // Bindless resource table
+    features12.runtimeDescriptorArray = true;
+    features12.descriptorBindingPartiallyBound = true;
+    features12.descriptorBindingSampledImageUpdateAfterBind = true;
+    features12.descriptorBindingUpdateUnusedWhilePending = true;
+    features12.shaderSampledImageArrayNonUniformIndexing = true;
+
+    // The GPU driven path draws any amount of commands from a buffer, with a count the GPU wrote itself,
+    // and the vertex shaders find their object through the first instance of the command.
+    // The depth pyramid downsampler picks the level it writes from an array of storage images
+    VkPhysicalDeviceFeatures features{};
+    if (settings.bGpuDriven)
+    {
+        features12.drawIndirectCount = true;
+        features.multiDrawIndirect = true;
+        features.drawIndirectFirstInstance = true;
+        features.shaderStorageImageArrayDynamicIndexing = true;
+    }
 
     // Use vkbootstrap to select a GPU
     // We want a GPU that can write tot he SDL surface and supports vulkan 1.3 with the correct features
+    // Without a surface (headless) any device will do, including software implementations
     vkb::PhysicalDeviceSelector selector{vkbInstance};
-    vkb::PhysicalDevice physicalDevice = selector
+    selector
         .set_minimum_version(1, 3)
         .set_required_features_13(features13)
         .set_required_features_12(features12)
-        .set_surface(surface)
-        .select()
-        .value();
+        .set_required_features(features);
+
+    if (!settings.bHeadless)
+    {
+        selector.set_surface(surface);
+    }
+
+    vkb::PhysicalDevice physicalDevice = selector.select().value();
+
+    // Lets VMA report what the OS actually grants us rather than an estimate
+    const bool bMemoryBudget = physicalDevice.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
 
     // Create the final vulkan device
     vkb::DeviceBuilder deviceBuilder{physicalDevice};
@@ -246,13 +1350,64 @@ void VulkanEngine::InitVulkan()
     graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
     graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+    // Uploads prefer a transfer-only family, which usually maps to the copy engines, then any family without graphics
+    if (auto dedicatedTransfer = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer); dedicatedTransfer.has_value())
+    {
+        transferQueue = dedicatedTransfer.value();
+        transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+    }
+    else if (auto separateTransfer = vkbDevice.get_queue(vkb::QueueType::transfer); separateTransfer.has_value())
+    {
+        transferQueue = separateTransfer.value();
+        transferQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::transfer).value();
+    }
+    else
+    {
+        transferQueue = graphicsQueue;
+        transferQueueFamily = graphicsQueueFamily;
+    }
+
     // Initialize the memory allocator
     VmaAllocatorCreateInfo allocatorInfo = {};
     allocatorInfo.physicalDevice = chosenGPU;
     allocatorInfo.device = device;
     allocatorInfo.instance = instance;
+    allocatorInfo.vulkanApiVersion = VK_API_VERSION_1_3;
     allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+    if (bMemoryBudget)
+    {
+        allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+    }
     vmaCreateAllocator(&allocatorInfo, &allocator);
+    defragmenter.Init(device, allocator, settings.defragmentationBytesPerFrame);
+
+    // Device local memory the CPU can map is either a small window of at most 256MB, or with resizable BAR all of VRAM
+    const VkPhysicalDeviceMemoryProperties* memoryProperties = nullptr;
+    vmaGetMemoryProperties(allocator, &memoryProperties);
+    heapBudgets.resize(memoryProperties->memoryHeapCount);
+    const VkMemoryPropertyFlags directFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    for (uint32_t i = 0; i < memoryProperties->memoryTypeCount; i++)
+    {
+        const VkMemoryType& memoryType = memoryProperties->memoryTypes[i];
+        if ((memoryType.propertyFlags & directFlags) == directFlags)
+        {
+            hostVisibleDeviceHeapSize = std::max(hostVisibleDeviceHeapSize, memoryProperties->memoryHeaps[memoryType.heapIndex].size);
+        }
+    }
+
+    if (hostVisibleDeviceHeapSize == 0)
+    {
+        fmt::println("No host visible device memory, per-frame data goes through staging copies");
+    }
+    else
+    {
+        fmt::println(
+            "Host visible device memory: {} MB{}{}",
+            hostVisibleDeviceHeapSize / (1024 * 1024),
+            hostVisibleDeviceHeapSize > 256ull * 1024 * 1024 ? " (resizable BAR)" : "",
+            settings.bDirectDeviceWrites ? "" : ", direct writes disabled"
+        );
+    }
 
     mainDeletionQueue.PushFunction([&]() -> void
     {
@@ -263,44 +1418,476 @@ void VulkanEngine::InitVulkan()
 void VulkanEngine::InitSwapchain()
 {
     CreateSwapchain(windowExtent.width, windowExtent.height);
+
+    // Depth image matching the window, shared by every frame since the queue executes them in order.
+    // The GPU driven path also samples it, to build the depth pyramid from, everything else only needs it while drawing
+    const VkExtent3D depthExtent = {swapchainExtend.width, swapchainExtend.height, 1};
+    bTransientDepth = !settings.bGpuDriven;
+    if (bTransientDepth)
+    {
+        depthImage = CreateTransientAttachment(depthExtent, VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+
+        VkMemoryPropertyFlags depthMemoryProperties = 0;
+        vmaGetAllocationMemoryProperties(allocator, depthImage.allocation, &depthMemoryProperties);
+        fmt::println(
+            "Depth attachment is transient{}",
+            (depthMemoryProperties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) ? " and lazily allocated" : ", without lazily allocated memory on this device"
+        );
+    }
+    else
+    {
+        depthImage = CreateImage(depthExtent, VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+    }
+
+    mainDeletionQueue.PushImageView(depthImage.imageView);
+    mainDeletionQueue.PushImage(depthImage.image, depthImage.allocation);
+
+    if (settings.bGpuDriven)
+    {
+        CreateDepthPyramid(swapchainExtend.width, swapchainExtend.height);
+    }
+}
+
+void VulkanEngine::CreateDepthPyramid(uint32_t width, uint32_t height)
+{
+    // Rounding down to a power of two keeps every level exactly half of the one above it,
+    // so a texel always covers the same 2x2 texels one level up
+    const auto previous_power_of_two = [](uint32_t value) -> uint32_t
+    {
+        uint32_t result = 1;
+        while (result * 2 <= value)
+        {
+            result *= 2;
+        }
+        return result;
+    };
+
+    const VkExtent3D pyramidExtent = {previous_power_of_two(width), previous_power_of_two(height), 1};
+    uint32_t levelCount = 1;
+    while ((std::max(pyramidExtent.width, pyramidExtent.height) >> levelCount) > 0)
+    {
+        levelCount++;
+    }
+    // depth_pyramid.comp binds a fixed amount of levels, enough for a 32768 pixel wide window
+    levelCount = std::min(levelCount, 16u);
+
+    depthPyramid.imageFormat = VK_FORMAT_R32_SFLOAT;
+    depthPyramid.imageExtent = pyramidExtent;
+
+    VkImageCreateInfo imageInfo = vkinit::image_create_info(
+        depthPyramid.imageFormat,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        pyramidExtent
+    );
+    imageInfo.mipLevels = levelCount;
+
+    VmaAllocationCreateInfo allocationInfo = {};
+    allocationInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    allocationInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VK_CHECK(vmaCreateImage(allocator, &imageInfo, &allocationInfo, &depthPyramid.image, &depthPyramid.allocation, nullptr));
+
+    // The culling samples every level through a single view, the downsampler writes them through one view each
+    VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(depthPyramid.imageFormat, depthPyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+    viewInfo.subresourceRange.levelCount = levelCount;
+    VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &depthPyramid.imageView));
+    mainDeletionQueue.PushImageView(depthPyramid.imageView);
+
+    depthPyramidLevelViews.resize(levelCount);
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        VkImageViewCreateInfo levelViewInfo = vkinit::imageview_create_info(depthPyramid.imageFormat, depthPyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+        levelViewInfo.subresourceRange.baseMipLevel = level;
+        VK_CHECK(vkCreateImageView(device, &levelViewInfo, nullptr, &depthPyramidLevelViews[level]));
+        mainDeletionQueue.PushImageView(depthPyramidLevelViews[level]);
+    }
+
+    mainDeletionQueue.PushImage(depthPyramid.image, depthPyramid.allocation);
+
+    depthPyramidCounterBuffer = CreateBuffer(
+        sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY
+    );
+    depthPyramidCounterBufferAddress = GetBufferAddress(depthPyramidCounterBuffer);
+    mainDeletionQueue.PushBuffer(depthPyramidCounterBuffer.buffer, depthPyramidCounterBuffer.allocation);
 }
 
 void VulkanEngine::InitCommands()
 {
     // Create a command pool for commands submitted to the graphics queue
-    // We also want the pool to allow for resetting of individual command buffers
-    VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+    // Pools are reset as a whole every frame, so individual command buffers never need resetting
+    VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+    // Job system thread indices double as recording thread indices, so every one of them needs a pool
+    const uint32_t recordingThreadCount = jobs.GetThreadCount();
 
-    for (int i = 0; i < FRAME_OVERLAP; i++)
+    for (size_t i = 0; i < frames.size(); i++)
     {
         VK_CHECK(vkCreateCommandPool(device, &commandPoolInfo, nullptr, &frames[i].commandPool));
 
         // Allocate the default command buffer that we will use for rendering
         VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(frames[i].commandPool, 1);
         VK_CHECK(vkAllocateCommandBuffers(device, &cmdAllocInfo, &frames[i].commandBuffer));
+
+        // Command pools are not thread safe, so every recording thread gets its own for every frame
+        frames[i].threadPools.resize(recordingThreadCount);
+        for (ThreadCommandPool& threadPool : frames[i].threadPools)
+        {
+            VK_CHECK(vkCreateCommandPool(device, &commandPoolInfo, nullptr, &threadPool.pool));
+        }
     }
+
+    // Immediate submits reuse a single command buffer, which is reset before every use
+    VkCommandPoolCreateInfo immCommandPoolInfo = vkinit::command_pool_create_info(graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+    VK_CHECK(vkCreateCommandPool(device, &immCommandPoolInfo, nullptr, &immCommandPool));
+
+    VkCommandBufferAllocateInfo immAllocInfo = vkinit::command_buffer_allocate_info(immCommandPool, 1);
+    VK_CHECK(vkAllocateCommandBuffers(device, &immAllocInfo, &immCommandBuffer));
+
+    uploads.Init(device, allocator, transferQueue, transferQueueFamily, graphicsQueue, graphicsQueueFamily, settings.stagingRingSize);
+    fmt::println(
+        "Uploading on {} (queue family {}) through a {:.0f} MB staging ring",
+        uploads.HasDedicatedQueue() ? "a dedicated transfer queue" : "the graphics queue",
+        transferQueueFamily,
+        static_cast<double>(uploads.GetRingSize()) / (1024.0 * 1024.0)
+    );
+
+    mainDeletionQueue.PushFunction([this]() -> void
+    {
+        vkDestroyCommandPool(device, immCommandPool, nullptr);
+    });
 }
 
 void VulkanEngine::InitSyncStructures()
 {
     // Create synchronization structures
-    // One fence to control when the GPU has finished rendering the frame,
-    // and 2 semaphores to synchronize rendering with swapchain
-    // We want the fence to start signalled so we can wait on it on the first time
-    VkFenceCreateInfo fenceInfo = vkinit::fence_create_info(VK_FENCE_CREATE_SIGNALED_BIT);
+    // One timeline semaphore shared by all frames to control when the GPU has finished rendering a frame,
+    // and 2 semaphores per frame to synchronize rendering with swapchain
+    // The timeline starts at 0, meaning no frame has completed yet
+    VkSemaphoreTypeCreateInfo timelineInfo = vkinit::semaphore_type_create_info(VK_SEMAPHORE_TYPE_TIMELINE, 0);
+    VkSemaphoreCreateInfo timelineSemaphoreInfo = vkinit::semaphore_create_info();
+    timelineSemaphoreInfo.pNext = &timelineInfo;
+    VK_CHECK(vkCreateSemaphore(device, &timelineSemaphoreInfo, nullptr, &frameTimeline));
+
     VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info();
 
-    for (int i = 0; i < FRAME_OVERLAP; i++)
+    for (size_t i = 0; i < frames.size(); i++)
     {
-        VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &frames[i].renderFence));
-        
         VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frames[i].swapchainSemaphore));
         VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frames[i].renderSemaphore));
     }
+
+    VkFenceCreateInfo fenceInfo = vkinit::fence_create_info();
+    VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &immFence));
+    mainDeletionQueue.PushFunction([this]() -> void
+    {
+        vkDestroyFence(device, immFence, nullptr);
+    });
 } 
 
+void VulkanEngine::InitDescriptors()
+{
+    // Offsets into frameData have to work for dynamic uniform and storage buffer descriptors as well
+    VkPhysicalDeviceProperties gpuProperties;
+    vkGetPhysicalDeviceProperties(chosenGPU, &gpuProperties);
+    const VkDeviceSize frameDataAlignment = std::max(
+        gpuProperties.limits.minUniformBufferOffsetAlignment,
+        gpuProperties.limits.minStorageBufferOffsetAlignment
+    );
+
+    for (auto& frame : frames)
+    {
+        const DynamicBuffer frameDataBuffer = CreateDynamicBuffer(
+            settings.frameDataSize,
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+        );
+        frame.frameData.Init(frameDataBuffer, frameDataAlignment);
+        mainDeletionQueue.PushFunction([this, frameDataBuffer]() -> void
+        {
+            DestroyDynamicBuffer(frameDataBuffer);
+        });
+    }
+
+    bindless.Init(device, chosenGPU, allocator, 16384, 64, 4096);
+
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.pNext = nullptr;
+
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    VK_CHECK(vkCreateSampler(device, &samplerInfo, nullptr, &defaultSamplerNearest));
+
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    VK_CHECK(vkCreateSampler(device, &samplerInfo, nullptr, &defaultSamplerLinear));
+
+    mainDeletionQueue.PushSampler(defaultSamplerNearest);
+    mainDeletionQueue.PushSampler(defaultSamplerLinear);
+
+    defaultSamplerLinearIndex = bindless.AddSampler(defaultSamplerLinear);
+    defaultSamplerNearestIndex = bindless.AddSampler(defaultSamplerNearest);
+
+    if (!settings.bGpuDriven)
+    {
+        return;
+    }
+
+    // The depth and its pyramid are only ever read with texelFetch, the sampler just has to exist
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    VK_CHECK(vkCreateSampler(device, &samplerInfo, nullptr, &depthSampler));
+    mainDeletionQueue.PushSampler(depthSampler);
+
+    const std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> globalSizes = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 16},
+    };
+    globalDescriptorAllocator.Init(device, 2, globalSizes);
+    mainDeletionQueue.PushFunction([this]() -> void
+    {
+        globalDescriptorAllocator.DestroyPools(device);
+    });
+
+    // depth_pyramid.comp: the depth image, and every level of the pyramid as a storage image
+    {
+        DescriptorLayoutBuilder builder;
+        builder.AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        builder.AddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 16);
+        depthPyramidSetLayout = builder.Build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+        mainDeletionQueue.PushDescriptorSetLayout(depthPyramidSetLayout);
+    }
+
+    depthPyramidSet = globalDescriptorAllocator.Allocate(device, depthPyramidSetLayout);
+    {
+        DescriptorWriter writer;
+        writer.WriteImage(0, depthImage.imageView, depthSampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        // Levels past the last one are never touched, but every array element has to be valid
+        for (uint32_t level = 0; level < 16; level++)
+        {
+            const VkImageView levelView = depthPyramidLevelViews[std::min(level, static_cast<uint32_t>(depthPyramidLevelViews.size()) - 1)];
+            writer.WriteImage(1, levelView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, level);
+        }
+        writer.UpdateSet(device, depthPyramidSet);
+    }
+
+    // cull.comp: the whole pyramid
+    {
+        DescriptorLayoutBuilder builder;
+        builder.AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        cullSetLayout = builder.Build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+        mainDeletionQueue.PushDescriptorSetLayout(cullSetLayout);
+    }
+
+    cullSet = globalDescriptorAllocator.Allocate(device, cullSetLayout);
+    {
+        DescriptorWriter writer;
+        writer.WriteImage(0, depthPyramid.imageView, depthSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.UpdateSet(device, cullSet);
+    }
+}
+
+void VulkanEngine::InitPipelines()
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    pipelineCache.Init(device, chosenGPU, settings.pipelineCachePath);
+    pipelineCompiler.Init(device, jobs, pipelineCache);
+
+    // All mesh pipelines share a layout: the bindless table at set 0, and a single push constant block
+    // with the matrix, the vertex and material buffer addresses and the material index or, for indirect draws, the object buffer
+    VkPushConstantRange bufferRange = {};
+    bufferRange.offset = 0;
+    bufferRange.size = static_cast<uint32_t>(std::max(sizeof(GPUDrawPushConstants), sizeof(GPUIndirectDrawPushConstants)));
+    bufferRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayout bindlessLayout = bindless.GetLayout();
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = vkinit::pipeline_layout_create_info();
+    pipelineLayoutInfo.pPushConstantRanges = &bufferRange;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &bindlessLayout;
+    pipelineLayoutInfo.setLayoutCount = 1;
+
+    VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &meshPipelineLayout));
+    mainDeletionQueue.PushPipelineLayout(meshPipelineLayout);
+
+    PipelineBuilder pipelineBuilder;
+    pipelineBuilder.pipelineLayout = meshPipelineLayout;
+    pipelineBuilder.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    pipelineBuilder.SetPolygonMode(VK_POLYGON_MODE_FILL);
+    pipelineBuilder.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    pipelineBuilder.SetMultisamplingNone();
+    pipelineBuilder.DisableBlending();
+    // Reversed depth, 1 is near and 0 is far
+    pipelineBuilder.EnableDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+    pipelineBuilder.SetColorAttachmentFormat(swapchainImageFormat);
+    pipelineBuilder.SetDepthFormat(depthImage.imageFormat);
+
+    const std::string meshVertexPath = settings.shaderDirectory + "mesh.vert.spv";
+    const std::string packedMeshVertexPath = settings.shaderDirectory + "mesh_packed.vert.spv";
+    const std::string fallbackFragmentPath = settings.shaderDirectory + "mesh_fallback.frag.spv";
+
+    // The fallbacks are tiny and built right away, so draws always have something to bind
+    VkShaderModule meshVertexShader;
+    VkShaderModule packedMeshVertexShader;
+    VkShaderModule fallbackFragmentShader;
+    if (!vkutil::load_shader_module(meshVertexPath.c_str(), device, &meshVertexShader)
+        || !vkutil::load_shader_module(packedMeshVertexPath.c_str(), device, &packedMeshVertexShader)
+        || !vkutil::load_shader_module(fallbackFragmentPath.c_str(), device, &fallbackFragmentShader))
+    {
+        fmt::println("Error when building the fallback mesh shader modules");
+        abort();
+    }
+
+    pipelineBuilder.SetShaders(meshVertexShader, fallbackFragmentShader);
+    meshFallbackPipeline = pipelineBuilder.BuildPipeline(device, pipelineCache.Get());
+    mainDeletionQueue.PushPipeline(meshFallbackPipeline);
+
+    pipelineBuilder.SetShaders(packedMeshVertexShader, fallbackFragmentShader);
+    packedMeshFallbackPipeline = pipelineBuilder.BuildPipeline(device, pipelineCache.Get());
+    mainDeletionQueue.PushPipeline(packedMeshFallbackPipeline);
+
+    vkDestroyShaderModule(device, meshVertexShader, nullptr);
+    vkDestroyShaderModule(device, packedMeshVertexShader, nullptr);
+
+    // The full pipelines compile in the background, GetMeshPipeline() switches over once they are done
+    const std::string meshFragmentPath = settings.shaderDirectory + "mesh.frag.spv";
+    meshPipeline = pipelineCompiler.CompileAsync(pipelineBuilder, meshVertexPath, meshFragmentPath);
+    packedMeshPipeline = pipelineCompiler.CompileAsync(pipelineBuilder, packedMeshVertexPath, meshFragmentPath);
+
+    if (settings.bGpuDriven)
+    {
+        const std::string indirectMeshVertexPath = settings.shaderDirectory + "mesh_indirect.vert.spv";
+        const std::string packedIndirectMeshVertexPath = settings.shaderDirectory + "mesh_packed_indirect.vert.spv";
+        const std::string cullPath = settings.shaderDirectory + "cull.comp.spv";
+        const std::string depthPyramidPath = settings.shaderDirectory + "depth_pyramid.comp.spv";
+
+        VkShaderModule indirectMeshVertexShader;
+        VkShaderModule packedIndirectMeshVertexShader;
+        VkShaderModule cullShader;
+        VkShaderModule depthPyramidShader;
+        if (!vkutil::load_shader_module(indirectMeshVertexPath.c_str(), device, &indirectMeshVertexShader)
+            || !vkutil::load_shader_module(packedIndirectMeshVertexPath.c_str(), device, &packedIndirectMeshVertexShader)
+            || !vkutil::load_shader_module(cullPath.c_str(), device, &cullShader)
+            || !vkutil::load_shader_module(depthPyramidPath.c_str(), device, &depthPyramidShader))
+        {
+            fmt::println("Error when building the GPU driven shader modules");
+            abort();
+        }
+
+        pipelineBuilder.SetShaders(indirectMeshVertexShader, fallbackFragmentShader);
+        indirectMeshFallbackPipeline = pipelineBuilder.BuildPipeline(device, pipelineCache.Get());
+        mainDeletionQueue.PushPipeline(indirectMeshFallbackPipeline);
+
+        pipelineBuilder.SetShaders(packedIndirectMeshVertexShader, fallbackFragmentShader);
+        packedIndirectMeshFallbackPipeline = pipelineBuilder.BuildPipeline(device, pipelineCache.Get());
+        mainDeletionQueue.PushPipeline(packedIndirectMeshFallbackPipeline);
+
+        indirectMeshPipeline = pipelineCompiler.CompileAsync(pipelineBuilder, indirectMeshVertexPath, meshFragmentPath);
+        packedIndirectMeshPipeline = pipelineCompiler.CompileAsync(pipelineBuilder, packedIndirectMeshVertexPath, meshFragmentPath);
+
+        // Culling has nothing to fall back to, so it is built right away. Besides its push constants it only reads the depth pyramid
+        VkPushConstantRange cullRange = {};
+        cullRange.offset = 0;
+        cullRange.size = sizeof(GPUCullPushConstants);
+        cullRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkPipelineLayoutCreateInfo cullLayoutInfo = vkinit::pipeline_layout_create_info();
+        cullLayoutInfo.pPushConstantRanges = &cullRange;
+        cullLayoutInfo.pushConstantRangeCount = 1;
+        cullLayoutInfo.pSetLayouts = &cullSetLayout;
+        cullLayoutInfo.setLayoutCount = 1;
+
+        VK_CHECK(vkCreatePipelineLayout(device, &cullLayoutInfo, nullptr, &cullPipelineLayout));
+        mainDeletionQueue.PushPipelineLayout(cullPipelineLayout);
+
+        cullPipeline = vkutil::build_compute_pipeline(device, cullPipelineLayout, cullShader, pipelineCache.Get());
+        if (cullPipeline == VK_NULL_HANDLE)
+        {
+            abort();
+        }
+        mainDeletionQueue.PushPipeline(cullPipeline);
+
+        VkPushConstantRange depthPyramidRange = {};
+        depthPyramidRange.offset = 0;
+        depthPyramidRange.size = sizeof(GPUDepthPyramidPushConstants);
+        depthPyramidRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkPipelineLayoutCreateInfo depthPyramidLayoutInfo = vkinit::pipeline_layout_create_info();
+        depthPyramidLayoutInfo.pPushConstantRanges = &depthPyramidRange;
+        depthPyramidLayoutInfo.pushConstantRangeCount = 1;
+        depthPyramidLayoutInfo.pSetLayouts = &depthPyramidSetLayout;
+        depthPyramidLayoutInfo.setLayoutCount = 1;
+
+        VK_CHECK(vkCreatePipelineLayout(device, &depthPyramidLayoutInfo, nullptr, &depthPyramidPipelineLayout));
+        mainDeletionQueue.PushPipelineLayout(depthPyramidPipelineLayout);
+
+        depthPyramidPipeline = vkutil::build_compute_pipeline(device, depthPyramidPipelineLayout, depthPyramidShader, pipelineCache.Get());
+        if (depthPyramidPipeline == VK_NULL_HANDLE)
+        {
+            abort();
+        }
+        mainDeletionQueue.PushPipeline(depthPyramidPipeline);
+
+        vkDestroyShaderModule(device, indirectMeshVertexShader, nullptr);
+        vkDestroyShaderModule(device, packedIndirectMeshVertexShader, nullptr);
+        vkDestroyShaderModule(device, cullShader, nullptr);
+        vkDestroyShaderModule(device, depthPyramidShader, nullptr);
+    }
+
+    vkDestroyShaderModule(device, fallbackFragmentShader, nullptr);
+
+    // Compare this between a first launch and the ones after it to see what the cache buys us.
+    // Only the pipelines built right here are in it, the asynchronous ones report their own time when they finish
+    const double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    fmt::println(
+        "Fallback and compute pipelines ready in {:.2f} ms with a {} pipeline cache (loading the cache took {:.2f} ms)",
+        totalMs,
+        pipelineCache.IsWarm() ? "warm" : "cold",
+        pipelineCache.GetLoadTimeMs()
+    );
+}
+
+void VulkanEngine::InitDefaultData()
+{
+    mainCamera.velocity = glm::vec3(0.0f);
+    mainCamera.position = glm::vec3(30.0f, -0.0f, -85.0f);
+    mainCamera.pitch = 0.0f;
+    mainCamera.yaw = 0.0f;
+
+    SceneLoadOptions loadOptions;
+    loadOptions.cookPath = settings.cookPath;
+    loadOptions.bOptimizeMeshes = settings.bOptimizeMeshes;
+    loadOptions.vertexFormat = settings.bPackVertices ? VertexFormat::Packed : VertexFormat::Full;
+    loadOptions.bGenerateLods = settings.bGenerateLods;
+    loadOptions.bBuildMeshlets = settings.bBuildMeshlets;
+
+    std::optional<std::shared_ptr<LoadedScene>> scene = load_scene(this, settings.scenePath, loadOptions);
+    if (scene.has_value())
+    {
+        if (settings.bGpuDriven)
+        {
+            UploadDrawBuffers(**scene);
+        }
+        loadedScenes[settings.scenePath] = *scene;
+    }
+}
+
 void VulkanEngine::CreateSwapchain(uint32_t width, uint32_t height)
 {
+    if (settings.bHeadless)
+    {
+        CreateHeadlessImages(width, height);
+        return;
+    }
+
     vkb::SwapchainBuilder swapchainBuilder{chosenGPU, device, surface};
 
     swapchainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
@@ -322,8 +1909,61 @@ void VulkanEngine::CreateSwapchain(uint32_t width, uint32_t height)
     swapchainImageViews = vkbSwapchain.get_image_views().value();
 }
 
+void VulkanEngine::CreateHeadlessImages(uint32_t width, uint32_t height)
+{
+    swapchainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+    swapchainExtend = {width, height};
+
+    const VkExtent3D imageExtent = {width, height, 1};
+
+    // We render into these just like swapchain images, and want to be able to copy the results out
+    const VkImageUsageFlags usageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+        | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+        | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    const VkImageCreateInfo imageInfo = vkinit::image_create_info(swapchainImageFormat, usageFlags, imageExtent);
+
+    // Allocate from gpu local memory
+    VmaAllocationCreateInfo allocationInfo = {};
+    allocationInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    allocationInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    // The ring has to be at least as deep as the frames in flight, otherwise we would be clearing
+    // an image the GPU is still working on
+    const uint32_t imageCount = std::max<uint32_t>(settings.headlessImageCount, GetFrameOverlap());
+    headlessImages.resize(imageCount);
+
+    for (AllocatedImage& image : headlessImages)
+    {
+        image.imageFormat = swapchainImageFormat;
+        image.imageExtent = imageExtent;
+
+        VK_CHECK(vmaCreateImage(allocator, &imageInfo, &allocationInfo, &image.image, &image.allocation, nullptr));
+
+        const VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(image.imageFormat, image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+        VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &image.imageView));
+
+        // Draw() only ever looks at these, so it does not need to care where the images came from
+        swapchainImages.push_back(image.image);
+        swapchainImageViews.push_back(image.imageView);
+    }
+}
+
 void VulkanEngine::DestroySwapchain()
 {
+    if (settings.bHeadless)
+    {
+        for (const AllocatedImage& image : headlessImages)
+        {
+            vkDestroyImageView(device, image.imageView, nullptr);
+            vmaDestroyImage(allocator, image.image, image.allocation);
+        }
+
+        headlessImages.clear();
+        swapchainImages.clear();
+        swapchainImageViews.clear();
+        return;
+    }
+
     vkDestroySwapchainKHR(device, swapchain, nullptr);
 
     // Destroy swapchain resources
@@ -3,54 +3,164 @@
 
 #pragma once
 
+#include <chrono>
+#include <unordered_map>
 #include <vkbootstrap/VkBootstrap.h>
+#include "camera.h"
+#include "job_system.h"
+#include "vk_defragmenter.h"
+#include "vk_descriptors.h"
+#include "vk_frame_allocator.h"
 #include "vk_initializers.h"
+#include "vk_loader.h"
+#include "vk_pipelines.h"
 #include "vk_types.h"
+#include "vk_upload.h"
 
 struct DeletionQueue
 {
-    std::deque<std::function<void()>> deletors;
+    // Typed handles are stored in flat arrays that keep their capacity between flushes,
+    // so once a queue has seen its peak load, pushing and flushing no longer allocates.
+    struct BufferAllocation
+    {
+        VkBuffer buffer;
+        VmaAllocation allocation;
+    };
+
+    struct ImageAllocation
+    {
+        VkImage image;
+        VmaAllocation allocation;
+    };
+
+    std::vector<VkPipeline> pipelines;
+    std::vector<VkPipelineLayout> pipelineLayouts;
+    std::vector<VkDescriptorPool> descriptorPools;
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts;
+    std::vector<VkSampler> samplers;
+    std::vector<VkImageView> imageViews;
+    std::vector<ImageAllocation> images;
+    std::vector<BufferAllocation> buffers;
+
+    // Fallback for everything that is not a plain handle. These run after the typed handles are gone.
+    std::vector<std::function<void()>> deletors;
+
+    void PushPipeline(VkPipeline pipeline) { pipelines.push_back(pipeline); }
+    void PushPipelineLayout(VkPipelineLayout layout) { pipelineLayouts.push_back(layout); }
+    void PushDescriptorPool(VkDescriptorPool pool) { descriptorPools.push_back(pool); }
+    void PushDescriptorSetLayout(VkDescriptorSetLayout layout) { descriptorSetLayouts.push_back(layout); }
+    void PushSampler(VkSampler sampler) { samplers.push_back(sampler); }
+    void PushImageView(VkImageView view) { imageViews.push_back(view); }
+    void PushImage(VkImage image, VmaAllocation allocation) { images.push_back({image, allocation}); }
+    void PushBuffer(VkBuffer buffer, VmaAllocation allocation) { buffers.push_back({buffer, allocation}); }
 
     void PushFunction(std::function<void()>&& function)
     {
-        deletors.push_back(function);
+        deletors.push_back(std::move(function));
     }
 
-    void Flush()
-    {
-        // Reverse iterate the deletion to execute all the function
-        for (auto it = deletors.rbegin(); it != deletors.rend(); it++) {
-            (*it)(); //call functors
-        }
+    // Reserve room up front, so even the first frames do not grow the arrays
+    void Reserve(size_t count);
 
-        deletors.clear();
-    }
+    void Flush(VkDevice device, VmaAllocator allocator);
+};
+
+// Command pool owned by a single recording thread for a single frame.
+// Everything allocated from it is recycled at once with vkResetCommandPool.
+struct ThreadCommandPool
+{
+    VkCommandPool pool;
+    std::vector<VkCommandBuffer> secondaryBuffers;
+    // Amount of secondaryBuffers handed out this frame, in recording order
+    uint32_t usedSecondaryCount{0};
 };
 
 struct FrameData
 {
     VkCommandPool commandPool;
     VkCommandBuffer commandBuffer;
+    // One pool per recording thread, indexed by thread index
+    std::vector<ThreadCommandPool> threadPools;
     VkSemaphore swapchainSemaphore;
     VkSemaphore renderSemaphore;
-    VkFence renderFence;
+    // Per-frame data belongs in frameData, this is for resources that happen to die while the frame is in flight
     DeletionQueue deletionQueue;
+    // Uniforms and instance data written for this frame only. Reset as a whole once the frame retires
+    FrameAllocator frameData;
+    // Where this frame's GPUCullData was allocated in frameData, only used by the GPU driven path
+    VkDeviceAddress cullDataAddress{0};
+
+    // When the CPU started working on the frame currently occupying this slot
+    std::chrono::high_resolution_clock::time_point startTime;
 };
 
-constexpr uint8_t FRAME_OVERLAP = 2;
+struct EngineSettings
+{
+    // Depth of the frame ring. 1 for the lowest latency, 3 for the highest throughput
+    uint32_t framesInFlight{2};
+    // Amount of job system worker threads. 0 uses one per hardware thread, minus the main thread
+    uint32_t workerThreadCount{0};
+    // Render into an offscreen image ring instead of a window and swapchain
+    bool bHeadless{false};
+    // Depth of the offscreen image ring used in headless mode
+    uint32_t headlessImageCount{3};
+    // Amount of frames rendered by Run() in headless mode before returning
+    uint32_t headlessFrameCount{1000};
+    // Where the pipeline cache is loaded from on startup and written back to on shutdown
+    std::string pipelineCachePath{"pipeline_cache.bin"};
+    // Where the compiled SPIR-V shaders are loaded from
+    std::string shaderDirectory{"Shaders/"};
+    // Scene loaded during Init(), glTF, OBJ or cooked
+    std::string scenePath{"Assets/structure.glb"};
+    // When set, the scene loaded during Init() is also written here in the cooked format
+    std::string cookPath;
+    // Optimize the scene's meshes for the vertex cache, overdraw and vertex fetch while loading
+    bool bOptimizeMeshes{true};
+    // Store the scene's vertices as PackedVertex instead of Vertex
+    bool bPackVertices{false};
+    // Simplify the scene's meshes into LOD chains while loading. Best combined with cookPath, as it is slow
+    bool bGenerateLods{false};
+    // Split the scene's meshes into meshlets while loading
+    bool bBuildMeshlets{true};
+    // Surfaces are drawn with the coarsest LOD whose error covers at most this many pixels on screen
+    float lodPixelError{1.0f};
+    // Cull and pick LODs on the GPU, which draws every scene with a single indirect draw. Keeps the CPU cost of a frame
+    // independent of the amount of objects
+    bool bGpuDriven{false};
+    // Also cull objects hidden behind what was visible last frame, using a depth pyramid. Only used by the GPU driven path
+    bool bOcclusionCulling{true};
+    // Size of the staging ring every upload goes through. Larger uploads are split up, but wait on each other more
+    size_t stagingRingSize{64 * 1024 * 1024};
+    // Write per-frame data straight into device local memory when the device exposes it to the CPU.
+    // Off always goes through a staging copy, which is what happens on devices without such memory anyway
+    bool bDirectDeviceWrites{true};
+    // Size of the linear allocator every frame in flight writes its per-frame data into
+    size_t frameDataSize{4 * 1024 * 1024};
+    // Scene buffers are moved together this many bytes per frame once too much device local memory sits unused inside
+    // the allocator's blocks. 0 never moves anything
+    size_t defragmentationBytesPerFrame{16 * 1024 * 1024};
+    // Where DumpMemoryStats() writes the allocator's statistics to, as JSON
+    std::string memoryStatsPath{"memory_stats.json"};
+    // Dump the statistics once more on shutdown, before the scenes are freed
+    bool bDumpMemoryStatsOnExit{false};
+};
 
 class VulkanEngine
 {
 public:
     bool bIsInitialized{false};
-    int frameNumber{0};
+    uint64_t frameNumber{0};
     bool bStopRendering{false};
     VkExtent2D windowExtent{1700,900};
+    EngineSettings settings;
 
     struct SDL_Window* window{nullptr};
 
     static VulkanEngine& Get();
 
+    // Engine-wide task scheduler, running from the start of Init() until the end of Cleanup()
+    JobSystem jobs;
+
     //initializes everything in the engine
     void Init();
 
@@ -76,20 +186,213 @@ public:
     std::vector<VkImageView> swapchainImageViews;
     VkExtent2D swapchainExtend;
 
-    FrameData frames[FRAME_OVERLAP];
-    FrameData& GetCurrentFrame() { return frames[frameNumber % FRAME_OVERLAP]; }
+    // Offscreen images standing in for the swapchain in headless mode
+    std::vector<AllocatedImage> headlessImages;
+    AllocatedImage depthImage;
+    // Only lives within a single rendering pass, so its contents are not stored. Not when the GPU driven path samples it
+    bool bTransientDepth{false};
+
+    // Sized from settings.framesInFlight during Init()
+    std::vector<FrameData> frames;
+    uint32_t GetFrameOverlap() const { return static_cast<uint32_t>(frames.size()); }
+    FrameData& GetCurrentFrame() { return frames[frameNumber % frames.size()]; }
+
+    struct FrameStats
+    {
+        std::chrono::high_resolution_clock::time_point lastFrameStart;
+        double totalFrameTimeMs{0.0};
+        uint64_t frameTimeSamples{0};
+        // Latency is measured from the moment the CPU starts a frame until it observes the GPU finishing it
+        double totalLatencyMs{0.0};
+        uint64_t latencySamples{0};
+    } stats;
+
+    // Usage and budget of every memory heap, refreshed at the start of every frame. Budgets come from
+    // VK_EXT_memory_budget when the device has it, otherwise they are estimated by VMA
+    std::vector<VmaBudget> heapBudgets;
+    // Writes vmaBuildStatsString() to settings.memoryStatsPath, F2 does this while running
+    void DumpMemoryStats() const;
+
+    // Device-wide timeline semaphore. Frame N signals value N + 1 once the GPU has finished it,
+    // so its counter doubles as "amount of frames completed" and never has to be reset.
+    VkSemaphore frameTimeline;
+    static uint64_t GetFrameTimelineValue(uint64_t frame) { return frame + 1; }
+    uint64_t GetCompletedFrameCount() const;
+    bool IsFrameComplete(uint64_t frame) const;
+    void WaitForFrameCount(uint64_t completedFrames) const;
+
+    // Hands out a secondary command buffer from threadIndex's pool for the current frame, already begun.
+    // The commands continue the frame's dynamic rendering, describe its attachments with renderingInfo.
+    // Each thread index must only be used by one thread at a time.
+    // The caller ends the command buffer; ExecuteSecondaryCommands() stitches it into the frame's rendering.
+    VkCommandBuffer BeginSecondaryCommands(uint32_t threadIndex, const VkCommandBufferInheritanceRenderingInfo& renderingInfo);
+    void ExecuteSecondaryCommands(VkCommandBuffer primary);
+    uint32_t GetRecordingThreadCount() const { return static_cast<uint32_t>(frames[0].threadPools.size()); }
+
+    // Describes the attachments of the frame's main rendering pass for secondary command buffers
+    VkCommandBufferInheritanceRenderingInfo GetSceneRenderingInheritance() const;
 
     VkQueue graphicsQueue;
     uint32_t graphicsQueueFamily;
+    // A queue of its own for uploads when the device has one, the graphics queue otherwise
+    VkQueue transferQueue;
+    uint32_t transferQueueFamily;
+    UploadManager uploads;
+    Defragmenter defragmenter;
     DeletionQueue mainDeletionQueue;
     VmaAllocator allocator;
+    // Largest heap that is both device local and host visible, 0 when the device has none
+    VkDeviceSize hostVisibleDeviceHeapSize{0};
+    PipelineCache pipelineCache;
+    PipelineCompiler pipelineCompiler;
+
+    // Every texture, sampler and material, bound once per frame at set 0
+    BindlessTable bindless;
+    VkSampler defaultSamplerLinear;
+    VkSampler defaultSamplerNearest;
+    uint32_t defaultSamplerLinearIndex;
+    uint32_t defaultSamplerNearestIndex;
+
+    VkPipelineLayout meshPipelineLayout;
+    // Built synchronously during Init(), drawn with until meshPipeline has finished compiling
+    VkPipeline meshFallbackPipeline;
+    PipelineHandle meshPipeline;
+    // The same pair for scenes with packed vertices, which only differ in the vertex shader
+    VkPipeline packedMeshFallbackPipeline;
+    PipelineHandle packedMeshPipeline;
+    VkPipeline GetMeshPipeline(VertexFormat format) const
+    {
+        return format == VertexFormat::Packed
+            ? PipelineCompiler::Resolve(packedMeshPipeline, packedMeshFallbackPipeline)
+            : PipelineCompiler::Resolve(meshPipeline, meshFallbackPipeline);
+    }
+
+    // Everything the GPU driven path needs, only built when settings.bGpuDriven is set.
+    // The indirect mesh pipelines share meshPipelineLayout, their vertex shaders find the object they draw by instance index
+    VkPipeline indirectMeshFallbackPipeline{VK_NULL_HANDLE};
+    PipelineHandle indirectMeshPipeline;
+    VkPipeline packedIndirectMeshFallbackPipeline{VK_NULL_HANDLE};
+    PipelineHandle packedIndirectMeshPipeline;
+    VkPipeline GetIndirectMeshPipeline(VertexFormat format) const
+    {
+        return format == VertexFormat::Packed
+            ? PipelineCompiler::Resolve(packedIndirectMeshPipeline, packedIndirectMeshFallbackPipeline)
+            : PipelineCompiler::Resolve(indirectMeshPipeline, indirectMeshFallbackPipeline);
+    }
+    VkPipelineLayout cullPipelineLayout{VK_NULL_HANDLE};
+    VkPipeline cullPipeline{VK_NULL_HANDLE};
+    VkDescriptorSetLayout cullSetLayout{VK_NULL_HANDLE};
+    VkDescriptorSet cullSet{VK_NULL_HANDLE};
+
+    // Hierarchical depth for occlusion culling. Every texel holds the farthest depth of the area it covers,
+    // level 0 is the depth image rounded down to a power of two
+    AllocatedImage depthPyramid;
+    std::vector<VkImageView> depthPyramidLevelViews;
+    VkSampler depthSampler{VK_NULL_HANDLE};
+    // Counts finished workgroups so the last one can reduce the smallest levels
+    AllocatedBuffer depthPyramidCounterBuffer;
+    VkDeviceAddress depthPyramidCounterBufferAddress{0};
+    VkDescriptorSetLayout depthPyramidSetLayout{VK_NULL_HANDLE};
+    VkDescriptorSet depthPyramidSet{VK_NULL_HANDLE};
+    VkPipelineLayout depthPyramidPipelineLayout{VK_NULL_HANDLE};
+    VkPipeline depthPyramidPipeline{VK_NULL_HANDLE};
+    // Sets that live as long as the engine
+    DescriptorAllocatorGrowable globalDescriptorAllocator;
+
+    // Immediate submit structures
+    VkFence immFence;
+    VkCommandBuffer immCommandBuffer;
+    VkCommandPool immCommandPool;
+
+    // Records function into a one-off command buffer, submits it and blocks until the GPU has executed it.
+    // Meant for uploads at load time, only call it from the main thread.
+    void ImmediateSubmit(std::function<void(VkCommandBuffer command)>&& function);
+
+    AllocatedBuffer CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
+    void DestroyBuffer(const AllocatedBuffer& buffer);
+    VkDeviceAddress GetBufferAddress(const AllocatedBuffer& buffer) const;
+    // Creates a device local buffer the defragmenter may move, which patches buffer and address in place when it does.
+    // Both have to stay where they are until the buffer is destroyed. address may be null
+    void CreateRelocatableBuffer(AllocatedBuffer& buffer, VkDeviceAddress* address, size_t size, VkBufferUsageFlags usage);
+    // Buffers for data written by the CPU every frame, see DynamicBuffer. TRANSFER_DST is added to usage
+    DynamicBuffer CreateDynamicBuffer(size_t size, VkBufferUsageFlags usage);
+    void DestroyDynamicBuffer(const DynamicBuffer& buffer);
+    // Makes the first size bytes the CPU wrote visible to the device, or to the copy when the buffer is staged
+    void FlushDynamicBuffer(const DynamicBuffer& buffer, size_t size);
+    // Copies what was written from the staging copy into the buffer, does nothing for direct buffers.
+    // The caller makes the copy visible to its readers with a barrier from VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT
+    void RecordDynamicBufferCopy(VkCommandBuffer command, const DynamicBuffer& buffer, size_t size);
+    AllocatedImage CreateImage(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, VmaMemoryUsage memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY);
+    // For attachments that never outlive the rendering pass writing them, so they are never stored either.
+    // Lazily allocated where the device has such memory, which tile based GPUs never back with actual memory
+    AllocatedImage CreateTransientAttachment(VkExtent3D size, VkFormat format, VkImageUsageFlags usage);
+    void DestroyImage(const AllocatedImage& image);
+
+    // Flattens the instances and surfaces of a loaded scene into the buffers cull.comp works from.
+    // Instances are not expected to move afterward. Must be called from the main thread.
+    void UploadDrawBuffers(LoadedScene& scene);
+
+    Camera mainCamera;
+    std::unordered_map<std::string, std::shared_ptr<LoadedScene>> loadedScenes;
 
 private:
     void InitVulkan();
     void InitSwapchain();
     void InitCommands();
     void InitSyncStructures();
+    void InitDescriptors();
+    void InitPipelines();
+    void InitDefaultData();
 
     void CreateSwapchain(uint32_t width, uint32_t height);
+    void CreateDepthPyramid(uint32_t width, uint32_t height);
+    void CreateHeadlessImages(uint32_t width, uint32_t height);
     void DestroySwapchain();
+
+    // Camera state shared by the CPU and GPU driven paths
+    struct SceneView
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 viewProjection;
+        float nearPlane;
+        float farPlane;
+        // A LOD error of this much at a distance of one unit covers settings.lodPixelError pixels on screen
+        float lodErrorPerDistance;
+    };
+    SceneView GetSceneView() const;
+
+    // Publishes everything allocated from the frame's frameData so far. Called once per frame, after the last
+    // allocation and before the first command reading any of it
+    void RecordFrameDataUpload(VkCommandBuffer command);
+
+    // Records the loaded scenes into secondary command buffers, spread over the job system
+    void RecordScene(const SceneView& sceneView);
+    // Records culling and the indirect draws straight into the frame's command buffer. The attachments are cleared by
+    // the first rendering pass, the late pass of occlusion culling loads them
+    void RecordGpuDrivenScene(
+        VkCommandBuffer command,
+        const SceneView& sceneView,
+        VkRenderingAttachmentInfo colorAttachment,
+        VkRenderingAttachmentInfo depthAttachment
+    );
+    // Records cull.comp for every loaded scene, filling the indirect commands of the next RecordIndirectDraws
+    void RecordCulling(VkCommandBuffer command, CullPass pass);
+    // Reduces the depth image into depthPyramid, expects it in VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL
+    void RecordDepthPyramid(VkCommandBuffer command);
+    void RecordIndirectDraws(
+        VkCommandBuffer command,
+        const SceneView& sceneView,
+        const VkRenderingAttachmentInfo& colorAttachment,
+        const VkRenderingAttachmentInfo& depthAttachment
+    );
+
+    void RunHeadless();
+    void ReportFrameStats() const;
+
+    // Refreshes heapBudgets and starts the defragmenter when memory gets sparse
+    void UpdateMemoryBudgets();
+    // Heaps whose usage went over budget, one bit per heap, so crossing it is only reported once
+    uint32_t heapsOverBudget{0};
+    uint64_t nextDefragmentationCheck{0};
 };
\ No newline at end of file
@@ -0,0 +1,45 @@
+﻿#include <vk_frame_allocator.h>
+
+#include <algorithm>
+
+FrameAllocator::FrameAllocator(FrameAllocator&& other) noexcept
+    : buffer(other.buffer)
+    , data(other.data)
+    , minAlignment(other.minAlignment)
+    , head(other.head.load(std::memory_order_relaxed))
+{
+}
+
+void FrameAllocator::Init(const DynamicBuffer& buffer, VkDeviceSize minAlignment)
+{
+    this->buffer = buffer;
+    this->minAlignment = std::max<size_t>(this->minAlignment, static_cast<size_t>(minAlignment));
+    data = static_cast<uint8_t*>(buffer.GetWritePointer());
+    head.store(0, std::memory_order_relaxed);
+}
+
+FrameAllocation FrameAllocator::Allocate(size_t size, size_t alignment)
+{
+    alignment = std::max(alignment, minAlignment);
+
+    // Aligning has to happen against the head this allocation ends up taking, other threads may move it in between
+    size_t offset = head.load(std::memory_order_relaxed);
+    size_t alignedOffset;
+    do
+    {
+        alignedOffset = (offset + alignment - 1) & ~(alignment - 1);
+        if (alignedOffset + size > buffer.size)
+        {
+            fmt::println("Frame allocation of {} bytes does not fit, {} of {} bytes are in use", size, offset, buffer.size);
+            abort();
+        }
+    }
+    while (!head.compare_exchange_weak(offset, alignedOffset + size, std::memory_order_relaxed));
+
+    FrameAllocation allocation;
+    allocation.buffer = buffer.buffer.buffer;
+    allocation.offset = alignedOffset;
+    allocation.mappedData = data + alignedOffset;
+    allocation.deviceAddress = buffer.address + alignedOffset;
+    return allocation;
+}
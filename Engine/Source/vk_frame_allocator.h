@@ -0,0 +1,55 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <vk_types.h>
+
+// A piece of a FrameAllocator, valid until the frame it was allocated in retires
+struct FrameAllocation
+{
+    VkBuffer buffer{VK_NULL_HANDLE};
+    // Usable as a dynamic offset, it is aligned to at least the uniform and storage buffer offset alignments
+    VkDeviceSize offset{0};
+    // Write only and front to back, it may be write combined memory
+    void* mappedData{nullptr};
+    VkDeviceAddress deviceAddress{0};
+};
+
+// Linear allocator over one large DynamicBuffer, for the uniforms, instance data and anything else the CPU writes for a
+// single frame. Every frame in flight has its own, which is reset as a whole once its frame retires, so per-frame data
+// never has to go through buffers of its own and a deletion queue. Allocating is a compare-exchange loop on the head,
+// lock free, so any thread may do it.
+class FrameAllocator
+{
+public:
+    FrameAllocator() = default;
+    // Only moved while the frames are set up, never while allocating
+    FrameAllocator(FrameAllocator&& other) noexcept;
+
+    // The buffer stays owned by the caller. Every allocation is aligned to at least minAlignment
+    void Init(const DynamicBuffer& buffer, VkDeviceSize minAlignment);
+
+    // alignment has to be a power of two, 0 uses the minimum alignment
+    FrameAllocation Allocate(size_t size, size_t alignment = 0);
+    // Allocates room for value and writes it in one go
+    template <typename T>
+    FrameAllocation Push(const T& value, size_t alignment = 0)
+    {
+        FrameAllocation allocation = Allocate(sizeof(T), alignment);
+        std::memcpy(allocation.mappedData, &value, sizeof(T));
+        return allocation;
+    }
+
+    // Only once the GPU is done with everything allocated since the last reset
+    void Reset() { head.store(0, std::memory_order_relaxed); }
+
+    const DynamicBuffer& GetBuffer() const { return buffer; }
+    // Everything allocated since the last reset lies in [0, GetUsedSize())
+    size_t GetUsedSize() const { return head.load(std::memory_order_relaxed); }
+
+private:
+    DynamicBuffer buffer{};
+    uint8_t* data{nullptr};
+    size_t minAlignment{16};
+    std::atomic<size_t> head{0};
+};
@@ -9,13 +9,15 @@ VkCommandPoolCreateInfo vkinit::command_pool_create_info(
     info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     info.pNext = nullptr;
 
+    info.queueFamilyIndex = queueFamilyIndex;
     info.flags = flags;
     return info;
 }
 
 VkCommandBufferAllocateInfo vkinit::command_buffer_allocate_info(
     const VkCommandPool pool,
-    const uint32_t count /*= 1*/
+    const uint32_t count /*= 1*/,
+    const VkCommandBufferLevel level /*= VK_COMMAND_BUFFER_LEVEL_PRIMARY*/
 ) {
     VkCommandBufferAllocateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -23,7 +25,7 @@ VkCommandBufferAllocateInfo vkinit::command_buffer_allocate_info(
 
     info.commandPool = pool;
     info.commandBufferCount = count;
-    info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    info.level = level;
     return info;
 }
 //< init_cmd
@@ -64,6 +66,18 @@ VkSemaphoreCreateInfo vkinit::semaphore_create_info(
     info.flags = flags;
     return info;
 }
+
+VkSemaphoreTypeCreateInfo vkinit::semaphore_type_create_info(
+    const VkSemaphoreType type,
+    const uint64_t initialValue /*= 0*/
+) {
+    VkSemaphoreTypeCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    info.pNext = nullptr;
+    info.semaphoreType = type;
+    info.initialValue = initialValue;
+    return info;
+}
 //< init_sync
 
 //> init_submit
@@ -82,6 +96,17 @@ VkSemaphoreSubmitInfo vkinit::semaphore_submit_info(
     return submitInfo;
 }
 
+VkSemaphoreSubmitInfo vkinit::timeline_semaphore_submit_info(
+    const VkPipelineStageFlags2 stageMask,
+    const VkSemaphore semaphore,
+    const uint64_t value
+) {
+    VkSemaphoreSubmitInfo submitInfo = semaphore_submit_info(stageMask, semaphore);
+    submitInfo.value = value;
+
+    return submitInfo;
+}
+
 VkCommandBufferSubmitInfo vkinit::command_buffer_submit_info(
     const VkCommandBuffer cmd
 ) {
@@ -9,7 +9,7 @@ namespace vkinit
 {
     //> init_cmd
     VkCommandPoolCreateInfo command_pool_create_info(uint32_t queueFamilyIndex, VkCommandPoolCreateFlags flags = 0);
-    VkCommandBufferAllocateInfo command_buffer_allocate_info(VkCommandPool pool, uint32_t count = 1);
+    VkCommandBufferAllocateInfo command_buffer_allocate_info(VkCommandPool pool, uint32_t count = 1, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
     //< init_cmd
 
     VkCommandBufferBeginInfo command_buffer_begin_info(VkCommandBufferUsageFlags flags = 0);
@@ -18,6 +18,7 @@ namespace vkinit
     VkFenceCreateInfo fence_create_info(VkFenceCreateFlags flags = 0);
 
     VkSemaphoreCreateInfo semaphore_create_info(VkSemaphoreCreateFlags flags = 0);
+    VkSemaphoreTypeCreateInfo semaphore_type_create_info(VkSemaphoreType type, uint64_t initialValue = 0);
 
     VkSubmitInfo2 submit_info(const VkCommandBufferSubmitInfo* cmd, const VkSemaphoreSubmitInfo* signalSemaphoreInfo, const VkSemaphoreSubmitInfo* waitSemaphoreInfo);
     VkPresentInfoKHR present_info();
@@ -31,6 +32,7 @@ namespace vkinit
     VkImageSubresourceRange image_subresource_range(VkImageAspectFlags aspectMask);
 
     VkSemaphoreSubmitInfo semaphore_submit_info(VkPipelineStageFlags2 stageMask, VkSemaphore semaphore);
+    VkSemaphoreSubmitInfo timeline_semaphore_submit_info(VkPipelineStageFlags2 stageMask, VkSemaphore semaphore, uint64_t value);
     VkDescriptorSetLayoutBinding descriptorset_layout_binding(VkDescriptorType type, VkShaderStageFlags stageFlags, uint32_t binding);
     VkDescriptorSetLayoutCreateInfo descriptorset_layout_create_info(const VkDescriptorSetLayoutBinding* bindings, uint32_t bindingCount);
     VkWriteDescriptorSet write_descriptor_image(VkDescriptorType type, VkDescriptorSet dstSet, const VkDescriptorImageInfo* imageInfo, uint32_t binding);
@@ -1 +1,1538 @@
 ﻿#include <vk_loader.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <unordered_map>
+#include <fastgltf/glm_element_traits.hpp>
+#include <fastgltf/parser.hpp>
+#include <fastgltf/tools.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image/stb_image.h>
+
+#include "cooked_scene.h"
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
+#include "obj_parser.h"
+#include "vk_engine.h"
+#include "vk_initializers.h"
+#include "vk_types.h"
+
+namespace
+{
+    // Pixels decoded by stb_image. Always 4 channels, so every texture can share one format
+    struct DecodedImage
+    {
+        int width{0};
+        int height{0};
+        stbi_uc* pixels{nullptr};
+        // Where the pixels go in the staging buffer
+        size_t stagingOffset{0};
+
+        size_t GetByteSize() const { return static_cast<size_t>(width) * static_cast<size_t>(height) * 4; }
+    };
+
+    // A material as the importers describe it, before anything is registered in the bindless table
+    // What an importer hands over once the vertices, indices and pixels are in the staging buffer
+    struct StagedScene
+    {
+        AllocatedBuffer staging;
+        size_t stagingSize{0};
+        size_t vertexBufferSize{0};
+        size_t indexBufferSize{0};
+        // 2 or 4 bytes, see get_index_size()
+        uint32_t indexSize{sizeof(uint32_t)};
+        VertexFormat vertexFormat{VertexFormat::Full};
+        std::vector<DecodedImage> images;
+        std::vector<SceneMaterial> materials;
+    };
+
+    // Post-transform cache behaviour of a surface before and after it was optimized
+    struct SurfaceStatistics
+    {
+        meshopt::VertexCacheStatistics before;
+        meshopt::VertexCacheStatistics after;
+    };
+
+    // Where a primitive ends up in the scene's shared vertex and index buffers
+    struct PrimitiveRange
+    {
+        const fastgltf::Primitive* primitive;
+        uint32_t meshIndex;
+        uint32_t surfaceIndex;
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+    };
+
+    VkFilter extract_filter(fastgltf::Filter filter)
+    {
+        switch (filter)
+        {
+        // Nearest samplers
+        case fastgltf::Filter::Nearest:
+        case fastgltf::Filter::NearestMipMapNearest:
+        case fastgltf::Filter::NearestMipMapLinear:
+            return VK_FILTER_NEAREST;
+
+        // Linear samplers
+        case fastgltf::Filter::Linear:
+        case fastgltf::Filter::LinearMipMapNearest:
+        case fastgltf::Filter::LinearMipMapLinear:
+        default:
+            return VK_FILTER_LINEAR;
+        }
+    }
+
+    DecodedImage decode_file(const std::filesystem::path& path)
+    {
+        DecodedImage decoded;
+
+        int channels;
+        decoded.pixels = stbi_load(path.string().c_str(), &decoded.width, &decoded.height, &channels, 4);
+        if (!decoded.pixels)
+        {
+            decoded.width = 0;
+            decoded.height = 0;
+        }
+
+        return decoded;
+    }
+
+    void decode_from_memory(const uint8_t* data, size_t size, DecodedImage& decoded)
+    {
+        int channels;
+        decoded.pixels = stbi_load_from_memory(data, static_cast<int>(size), &decoded.width, &decoded.height, &channels, 4);
+    }
+
+    DecodedImage decode_image(const fastgltf::Asset& asset, const fastgltf::Image& image, const std::filesystem::path& directory)
+    {
+        DecodedImage decoded;
+
+        std::visit(fastgltf::visitor{
+            [](const auto&) {},
+            [&](const fastgltf::sources::URI& filePath)
+            {
+                // Images stored at an offset inside another file are not supported
+                if (filePath.fileByteOffset != 0 || !filePath.uri.isLocalPath())
+                {
+                    return;
+                }
+
+                decoded = decode_file(directory / filePath.uri.fspath());
+            },
+            [&](const fastgltf::sources::Vector& vector)
+            {
+                decode_from_memory(vector.bytes.data(), vector.bytes.size(), decoded);
+            },
+            [&](const fastgltf::sources::BufferView& view)
+            {
+                // Embedded in a .glb, the parser already loaded the buffer holding it
+                const fastgltf::BufferView& bufferView = asset.bufferViews[view.bufferViewIndex];
+                const fastgltf::Buffer& buffer = asset.buffers[bufferView.bufferIndex];
+
+                std::visit(fastgltf::visitor{
+                    [](const auto&) {},
+                    [&](const fastgltf::sources::Vector& vector)
+                    {
+                        decode_from_memory(vector.bytes.data() + bufferView.byteOffset, bufferView.byteLength, decoded);
+                    },
+                    [&](const fastgltf::sources::ByteView& byteView)
+                    {
+                        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(byteView.bytes.data());
+                        decode_from_memory(bytes + bufferView.byteOffset, bufferView.byteLength, decoded);
+                    },
+                }, buffer.data);
+            },
+        }, image.data);
+
+        if (!decoded.pixels)
+        {
+            decoded.width = 0;
+            decoded.height = 0;
+        }
+
+        return decoded;
+    }
+
+    glm::mat4 get_local_matrix(const fastgltf::Node& node)
+    {
+        glm::mat4 matrix{1.0f};
+
+        std::visit(fastgltf::visitor{
+            [&](const fastgltf::Node::TransformMatrix& transform)
+            {
+                matrix = glm::make_mat4(transform.data());
+            },
+            [&](const fastgltf::Node::TRS& transform)
+            {
+                const glm::vec3 translation(transform.translation[0], transform.translation[1], transform.translation[2]);
+                // glTF stores quaternions as xyzw, glm wants them as wxyz
+                const glm::quat rotation(transform.rotation[3], transform.rotation[0], transform.rotation[1], transform.rotation[2]);
+                const glm::vec3 scale(transform.scale[0], transform.scale[1], transform.scale[2]);
+
+                matrix = glm::translate(glm::mat4(1.0f), translation) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), scale);
+            },
+        }, node.transform);
+
+        return matrix;
+    }
+
+    Bounds compute_bounds(const Vertex* vertices, size_t count)
+    {
+        if (count == 0)
+        {
+            return Bounds{glm::vec3{0.0f}, 0.0f, glm::vec3{0.0f}};
+        }
+
+        glm::vec3 minPosition = vertices[0].position;
+        glm::vec3 maxPosition = vertices[0].position;
+        for (size_t i = 1; i < count; i++)
+        {
+            minPosition = glm::min(minPosition, vertices[i].position);
+            maxPosition = glm::max(maxPosition, vertices[i].position);
+        }
+
+        Bounds bounds;
+        bounds.origin = (maxPosition + minPosition) * 0.5f;
+        bounds.extents = (maxPosition - minPosition) * 0.5f;
+        bounds.sphereRadius = glm::length(bounds.extents);
+        return bounds;
+    }
+
+    // Builds the primitive's vertices and indices into the given vectors, which are resized to fit
+    void build_primitive(const fastgltf::Asset& asset, const PrimitiveRange& range, std::vector<Vertex>& primitiveVertices, std::vector<uint32_t>& primitiveIndices)
+    {
+        const fastgltf::Primitive& primitive = *range.primitive;
+        primitiveVertices.resize(range.vertexCount);
+        primitiveIndices.resize(range.indexCount);
+
+        const fastgltf::Accessor& positions = asset.accessors[primitive.findAttribute("POSITION")->second];
+        fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, positions, [&](glm::vec3 position, size_t index)
+        {
+            Vertex& vertex = primitiveVertices[index];
+            vertex.position = position;
+            vertex.normal = {1.0f, 0.0f, 0.0f};
+            vertex.color = glm::vec4{1.0f};
+            vertex.uv_x = 0.0f;
+            vertex.uv_y = 0.0f;
+        });
+
+        const auto normals = primitive.findAttribute("NORMAL");
+        if (normals != primitive.attributes.end())
+        {
+            fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, asset.accessors[normals->second], [&](glm::vec3 normal, size_t index)
+            {
+                primitiveVertices[index].normal = normal;
+            });
+        }
+
+        const auto uvs = primitive.findAttribute("TEXCOORD_0");
+        if (uvs != primitive.attributes.end())
+        {
+            fastgltf::iterateAccessorWithIndex<glm::vec2>(asset, asset.accessors[uvs->second], [&](glm::vec2 uv, size_t index)
+            {
+                primitiveVertices[index].uv_x = uv.x;
+                primitiveVertices[index].uv_y = uv.y;
+            });
+        }
+
+        const auto colors = primitive.findAttribute("COLOR_0");
+        if (colors != primitive.attributes.end())
+        {
+            const fastgltf::Accessor& colorAccessor = asset.accessors[colors->second];
+            if (colorAccessor.type == fastgltf::AccessorType::Vec4)
+            {
+                fastgltf::iterateAccessorWithIndex<glm::vec4>(asset, colorAccessor, [&](glm::vec4 color, size_t index)
+                {
+                    primitiveVertices[index].color = color;
+                });
+            }
+            else
+            {
+                fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, colorAccessor, [&](glm::vec3 color, size_t index)
+                {
+                    primitiveVertices[index].color = glm::vec4(color, 1.0f);
+                });
+            }
+        }
+
+        // Indices stay local to the primitive, the draw adds the vertex offset
+        if (primitive.indicesAccessor.has_value())
+        {
+            fastgltf::iterateAccessorWithIndex<uint32_t>(asset, asset.accessors[*primitive.indicesAccessor], [&](uint32_t index, size_t i)
+            {
+                primitiveIndices[i] = index;
+            });
+        }
+        else
+        {
+            // Non-indexed primitives draw their vertices in order
+            for (uint32_t i = 0; i < range.indexCount; i++)
+            {
+                primitiveIndices[i] = i;
+            }
+        }
+    }
+
+    size_t align_up(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    // Folds the sphere onto an octahedron and unfolds that onto a square, which spreads the precision far more
+    // evenly than storing two angles or dropping z
+    glm::vec2 encode_octahedral(glm::vec3 normal)
+    {
+        normal /= std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+
+        glm::vec2 encoded(normal.x, normal.y);
+        if (normal.z < 0.0f)
+        {
+            encoded.x = (1.0f - std::abs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f);
+            encoded.y = (1.0f - std::abs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f);
+        }
+
+        return encoded;
+    }
+
+    PackedVertex pack_vertex(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& inverseBoundsSize)
+    {
+        const glm::vec3 position = glm::clamp((vertex.position - boundsMin) * inverseBoundsSize, glm::vec3(0.0f), glm::vec3(1.0f));
+        const float normalLength = glm::length(vertex.normal);
+
+        PackedVertex packed;
+        packed.position[0] = static_cast<uint16_t>(std::lround(position.x * 65535.0f));
+        packed.position[1] = static_cast<uint16_t>(std::lround(position.y * 65535.0f));
+        packed.position[2] = static_cast<uint16_t>(std::lround(position.z * 65535.0f));
+        packed.padding = 0;
+        packed.normal = glm::packSnorm2x16(normalLength > 0.0f ? encode_octahedral(vertex.normal / normalLength) : glm::vec2(0.0f));
+        packed.uv = glm::packHalf2x16(glm::vec2(vertex.uv_x, vertex.uv_y));
+        packed.color = glm::packUnorm4x8(vertex.color);
+        return packed;
+    }
+
+    // Surface indices are local to the surface, so they fit 16 bits whenever no surface has more vertices than that.
+    // Halves the index buffer and the index fetches of most scenes
+    uint32_t get_index_size(size_t maxSurfaceVertexCount)
+    {
+        return maxSurfaceVertexCount <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
+
+    // LOD chains end before a level would be left with fewer triangles than this
+    constexpr uint32_t MIN_LOD_INDEX_COUNT = 3 * 32;
+
+    // Every LOD level aims for half the triangles of the one before
+    uint32_t get_lod_index_budget(uint32_t indexCount, uint32_t level)
+    {
+        return (indexCount >> level) / 3 * 3;
+    }
+
+    // Room a surface keeps behind its own indices for its LOD chain. The room of a level is taken whether or not
+    // the simplifier manages to get down to it, so every surface's range is known before anything is simplified
+    uint32_t get_lod_chain_index_budget(uint32_t indexCount)
+    {
+        uint32_t total = 0;
+        for (uint32_t level = 1; level <= MAX_SURFACE_LODS; level++)
+        {
+            const uint32_t budget = get_lod_index_budget(indexCount, level);
+            if (budget < MIN_LOD_INDEX_COUNT)
+            {
+                break;
+            }
+            total += budget;
+        }
+
+        return total;
+    }
+
+    // Copies indices to the staging buffer, narrowing them to the scene's index size on the way
+    void write_staged_indices(const StagedScene& staged, uint32_t firstIndex, const uint32_t* indices, size_t indexCount)
+    {
+        uint8_t* stagingData = static_cast<uint8_t*>(staged.staging.info.pMappedData);
+        uint8_t* stagingIndices = stagingData + staged.vertexBufferSize + static_cast<size_t>(firstIndex) * staged.indexSize;
+        if (staged.indexSize == sizeof(uint16_t))
+        {
+            uint16_t* narrowIndices = reinterpret_cast<uint16_t*>(stagingIndices);
+            for (size_t i = 0; i < indexCount; i++)
+            {
+                narrowIndices[i] = static_cast<uint16_t>(indices[i]);
+            }
+        }
+        else
+        {
+            std::memcpy(stagingIndices, indices, indexCount * sizeof(uint32_t));
+        }
+    }
+
+    // Simplifies the surface level by level into the room get_lod_chain_index_budget() left behind it.
+    // The chain ends early when a level does not fit its room, as the simplifier ran out of edges it may collapse
+    void stage_surface_lods(
+        const StagedScene& staged,
+        GeoSurface& surface,
+        const Vertex* vertices,
+        size_t vertexCount,
+        const uint32_t* indices,
+        size_t indexCount,
+        bool bOptimize
+    ) {
+        thread_local std::vector<uint32_t> previousIndices;
+        thread_local std::vector<uint32_t> lodIndices;
+        previousIndices.assign(indices, indices + indexCount);
+
+        uint32_t lodStart = surface.startIndex + surface.count;
+        float error = 0.0f;
+        surface.lodCount = 0;
+
+        for (uint32_t level = 1; level <= MAX_SURFACE_LODS; level++)
+        {
+            const uint32_t budget = get_lod_index_budget(surface.count, level);
+            if (budget < MIN_LOD_INDEX_COUNT)
+            {
+                break;
+            }
+
+            float levelError = 0.0f;
+            lodIndices.resize(previousIndices.size());
+            const size_t lodIndexCount = meshopt::simplify(
+                lodIndices.data(),
+                previousIndices.data(),
+                previousIndices.size(),
+                vertices,
+                vertexCount,
+                budget,
+                meshopt::SimplifyWeights{},
+                levelError
+            );
+            if (lodIndexCount == 0 || lodIndexCount > budget)
+            {
+                break;
+            }
+            lodIndices.resize(lodIndexCount);
+
+            if (bOptimize)
+            {
+                meshopt::optimize_vertex_cache(lodIndices.data(), lodIndices.size(), vertexCount);
+            }
+
+            // Every level is simplified from the one before, so the errors add up
+            error += levelError;
+
+            SurfaceLod& lod = surface.lods[surface.lodCount++];
+            lod.startIndex = lodStart;
+            lod.count = static_cast<uint32_t>(lodIndexCount);
+            lod.error = error;
+            write_staged_indices(staged, lod.startIndex, lodIndices.data(), lodIndices.size());
+
+            lodStart += budget;
+            previousIndices.swap(lodIndices);
+        }
+    }
+
+    // Reorders the surface's triangles into meshlets. The order within a meshlet is optimized for the vertex cache again
+    // when asked to, and the vertices are moved into the new order they are used in.
+    void build_surface_meshlets(
+        const GeoSurface& surface,
+        Vertex* vertices,
+        size_t vertexCount,
+        uint32_t* indices,
+        size_t indexCount,
+        bool bOptimize,
+        std::vector<Meshlet>& meshlets
+    ) {
+        thread_local std::vector<meshopt::MeshletRange> ranges;
+        ranges.clear();
+        meshopt::build_meshlets(indices, indexCount, vertices, vertexCount, ranges);
+
+        if (bOptimize)
+        {
+            for (const meshopt::MeshletRange& range : ranges)
+            {
+                meshopt::optimize_meshlet_vertex_cache(indices + static_cast<size_t>(range.firstTriangle) * 3, static_cast<size_t>(range.triangleCount) * 3);
+            }
+            meshopt::optimize_vertex_fetch(vertices, indices, indexCount, vertexCount);
+        }
+
+        meshlets.reserve(ranges.size());
+        for (const meshopt::MeshletRange& range : ranges)
+        {
+            const uint32_t* meshletIndices = indices + static_cast<size_t>(range.firstTriangle) * 3;
+            const meshopt::ClusterBounds bounds = meshopt::compute_cluster_bounds(meshletIndices, static_cast<size_t>(range.triangleCount) * 3, vertices);
+
+            Meshlet& meshlet = meshlets.emplace_back();
+            meshlet.center = bounds.center;
+            meshlet.radius = bounds.radius;
+            meshlet.coneAxis = bounds.coneAxis;
+            meshlet.coneCutoff = bounds.coneCutoff;
+            meshlet.startIndex = surface.startIndex + range.firstTriangle * 3;
+            meshlet.count = range.triangleCount * 3;
+            meshlet.padding[0] = 0;
+            meshlet.padding[1] = 0;
+        }
+    }
+
+    // Moves the meshlets of a surface into the scene, in the order the surfaces are added
+    void append_meshlets(LoadedScene& scene, GeoSurface& surface, std::vector<Meshlet>& meshlets)
+    {
+        surface.firstMeshlet = static_cast<uint32_t>(scene.meshlets.size());
+        surface.meshletCount = static_cast<uint32_t>(meshlets.size());
+        scene.meshlets.insert(scene.meshlets.end(), meshlets.begin(), meshlets.end());
+        std::vector<Meshlet>().swap(meshlets);
+    }
+
+    // Optimizes a surface, splits it into meshlets and builds its LOD chain when asked to,
+    // then copies it to its place in the staging buffer
+    void stage_surface(
+        const StagedScene& staged,
+        GeoSurface& surface,
+        Vertex* vertices,
+        size_t vertexCount,
+        uint32_t* indices,
+        size_t indexCount,
+        const SceneLoadOptions& options,
+        SurfaceStatistics& statistics,
+        std::vector<Meshlet>& meshlets
+    ) {
+        if (options.bOptimizeMeshes)
+        {
+            statistics.before = meshopt::analyze_vertex_cache(indices, indexCount, vertexCount);
+            meshopt::optimize_mesh(vertices, vertexCount, indices, indexCount);
+        }
+
+        if (options.bBuildMeshlets)
+        {
+            build_surface_meshlets(surface, vertices, vertexCount, indices, indexCount, options.bOptimizeMeshes, meshlets);
+        }
+
+        if (options.bOptimizeMeshes)
+        {
+            statistics.after = meshopt::analyze_vertex_cache(indices, indexCount, vertexCount);
+        }
+
+        // Staging memory can be write-combined, which only copes with writes going through it in order
+        uint8_t* stagingData = static_cast<uint8_t*>(staged.staging.info.pMappedData);
+        uint8_t* stagingVertices = stagingData + static_cast<size_t>(surface.vertexOffset) * get_vertex_stride(staged.vertexFormat);
+        if (staged.vertexFormat == VertexFormat::Packed)
+        {
+            // Quantized against the same bounds get_dequantization_matrix() maps them back onto
+            const glm::vec3 boundsMin = surface.bounds.origin - surface.bounds.extents;
+            const glm::vec3 boundsSize = surface.bounds.extents * 2.0f;
+            const glm::vec3 inverseBoundsSize(
+                boundsSize.x > 0.0f ? 1.0f / boundsSize.x : 0.0f,
+                boundsSize.y > 0.0f ? 1.0f / boundsSize.y : 0.0f,
+                boundsSize.z > 0.0f ? 1.0f / boundsSize.z : 0.0f
+            );
+
+            PackedVertex* packedVertices = reinterpret_cast<PackedVertex*>(stagingVertices);
+            for (size_t i = 0; i < vertexCount; i++)
+            {
+                packedVertices[i] = pack_vertex(vertices[i], boundsMin, inverseBoundsSize);
+            }
+        }
+        else
+        {
+            std::memcpy(stagingVertices, vertices, vertexCount * sizeof(Vertex));
+        }
+
+        write_staged_indices(staged, surface.startIndex, indices, indexCount);
+
+        if (options.bGenerateLods)
+        {
+            stage_surface_lods(staged, surface, vertices, vertexCount, indices, indexCount, options.bOptimizeMeshes);
+        }
+    }
+
+    void print_cache_statistics(const std::vector<SurfaceStatistics>& surfaces)
+    {
+        SurfaceStatistics total;
+        for (const SurfaceStatistics& surface : surfaces)
+        {
+            total.before.Add(surface.before);
+            total.after.Add(surface.after);
+        }
+
+        fmt::println(
+            "Vertex cache (FIFO {}): ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}",
+            meshopt::ANALYSIS_CACHE_SIZE,
+            total.before.GetACMR(),
+            total.after.GetACMR(),
+            total.before.GetATVR(),
+            total.after.GetATVR()
+        );
+    }
+
+    void print_lod_statistics(const LoadedScene& scene)
+    {
+        size_t surfaceCount = 0;
+        size_t lodCount = 0;
+        size_t fullTriangles = 0;
+        size_t coarsestTriangles = 0;
+        for (const MeshAsset& mesh : scene.meshes)
+        {
+            for (const GeoSurface& surface : mesh.surfaces)
+            {
+                surfaceCount++;
+                lodCount += surface.lodCount;
+                fullTriangles += surface.count / 3;
+                coarsestTriangles += (surface.lodCount > 0 ? surface.lods[surface.lodCount - 1].count : surface.count) / 3;
+            }
+        }
+
+        fmt::println(
+            "LODs: {} levels over {} surfaces, {} triangles at full detail and {} at the coarsest",
+            lodCount,
+            surfaceCount,
+            fullTriangles,
+            coarsestTriangles
+        );
+    }
+
+    // Lays the decoded images out back to back in the staging buffer, starting at offset. Returns the end of the last one
+    size_t layout_staging_images(std::vector<DecodedImage>& images, size_t offset)
+    {
+        // Buffer to image copies have to start on a texel, 16 bit indices can leave the offset two bytes short of one
+        offset = align_up(offset, 4);
+        for (DecodedImage& image : images)
+        {
+            image.stagingOffset = offset;
+            offset += image.GetByteSize();
+        }
+
+        return offset;
+    }
+
+    // Copies the pixels of every decoded image to its spot in the staging buffer, one job per image
+    void copy_images_to_staging(JobSystem& jobs, const std::vector<DecodedImage>& images, uint8_t* stagingData, JobSystem::Counter& counter)
+    {
+        for (const DecodedImage& image : images)
+        {
+            if (image.pixels)
+            {
+                jobs.Run([&image, stagingData](uint32_t) -> void
+                {
+                    std::memcpy(stagingData + image.stagingOffset, image.pixels, image.GetByteSize());
+                }, &counter);
+            }
+        }
+    }
+
+    // Creates the scene's GPU buffers and images and fills them from a staging buffer laid out as
+    // [vertices][indices][pixels of every image], all with a single upload batch. Afterwards the staging buffer
+    // is destroyed and the decoded pixels are freed. Returns the bindless texture index of every image,
+    // or NO_BINDLESS_INDEX for the ones that failed to decode.
+    std::vector<uint32_t> upload_scene(VulkanEngine* engine, LoadedScene& scene, StagedScene& staged, std::string_view filePath)
+    {
+        const AllocatedBuffer& staging = staged.staging;
+        const size_t vertexBufferSize = staged.vertexBufferSize;
+        const size_t indexBufferSize = staged.indexBufferSize;
+        std::vector<DecodedImage>& decodedImages = staged.images;
+
+        VK_CHECK(vmaFlushAllocation(engine->allocator, staging.allocation, 0, VK_WHOLE_SIZE));
+
+        // The scene lives behind a shared_ptr, so its buffers stay put for the defragmenter to patch
+        engine->CreateRelocatableBuffer(
+            scene.meshBuffers.vertexBuffer,
+            &scene.meshBuffers.vertexBufferAddress,
+            vertexBufferSize,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+        );
+        engine->CreateRelocatableBuffer(scene.meshBuffers.indexBuffer, nullptr, indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+        scene.meshBuffers.indexType = staged.indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+        scene.meshBuffers.vertexFormat = staged.vertexFormat;
+
+        // Images that failed to decode are skipped, materials using them fall back to untextured
+        std::vector<size_t> uploadedImages;
+        for (size_t i = 0; i < decodedImages.size(); i++)
+        {
+            const DecodedImage& decoded = decodedImages[i];
+            if (decoded.GetByteSize() == 0)
+            {
+                fmt::println("Failed to decode image {} of {}", i, filePath);
+                continue;
+            }
+
+            const VkExtent3D imageSize = {static_cast<uint32_t>(decoded.width), static_cast<uint32_t>(decoded.height), 1};
+            scene.images.push_back(engine->CreateImage(imageSize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT));
+            uploadedImages.push_back(i);
+        }
+
+        // The staging buffer is the scene's own, so the copies come straight out of it instead of going through the ring.
+        // Loading is done once they are, which keeps the scene from being drawn before its buffers are filled
+        UploadManager& uploads = engine->uploads;
+        uploads.CopyBuffer(staging.buffer, 0, scene.meshBuffers.vertexBuffer.buffer, 0, vertexBufferSize);
+        uploads.CopyBuffer(staging.buffer, vertexBufferSize, scene.meshBuffers.indexBuffer.buffer, 0, indexBufferSize);
+        for (size_t i = 0; i < scene.images.size(); i++)
+        {
+            const AllocatedImage& image = scene.images[i];
+            uploads.CopyBufferToImage(staging.buffer, decodedImages[uploadedImages[i]].stagingOffset, image.image, image.imageExtent);
+        }
+        uploads.Wait(uploads.Flush());
+
+        engine->DestroyBuffer(staging);
+        for (DecodedImage& image : decodedImages)
+        {
+            stbi_image_free(image.pixels);
+        }
+
+        std::vector<uint32_t> textureIndices(decodedImages.size(), NO_BINDLESS_INDEX);
+        for (size_t i = 0; i < scene.images.size(); i++)
+        {
+            textureIndices[uploadedImages[i]] = engine->bindless.AddTexture(scene.images[i].imageView);
+        }
+
+        return textureIndices;
+    }
+
+    // Only cooking reads the staging buffer back, which is a lot faster from cached memory than from write-combined memory
+    AllocatedBuffer create_staging(VulkanEngine* engine, size_t size, bool bReadBack)
+    {
+        return engine->CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, bReadBack ? VMA_MEMORY_USAGE_GPU_TO_CPU : VMA_MEMORY_USAGE_CPU_ONLY);
+    }
+
+    //> cooked format
+    // Must run before the staging buffer is uploaded and the materials are registered, while the surfaces
+    // still point at the scene's own materials
+    bool write_cooked_scene(const LoadedScene& scene, const StagedScene& staged, std::string_view cookPath)
+    {
+        cooked::Scene cookedScene;
+        cookedScene.vertexFormat = staged.vertexFormat;
+        cookedScene.indexStride = staged.indexSize;
+        cookedScene.vertexBufferSize = staged.vertexBufferSize;
+        cookedScene.indexBufferSize = staged.indexBufferSize;
+        cookedScene.meshes = scene.meshes;
+        cookedScene.instances = scene.instances;
+        cookedScene.meshlets = scene.meshlets;
+        cookedScene.materials = staged.materials;
+        cookedScene.images.reserve(staged.images.size());
+        for (const DecodedImage& image : staged.images)
+        {
+            cookedScene.images.push_back({static_cast<uint32_t>(image.width), static_cast<uint32_t>(image.height), image.stagingOffset});
+        }
+
+        const std::vector<char> bytes = cooked::write_tables(cookedScene, staged.stagingSize);
+
+        const std::string path(cookPath);
+        const std::string temporaryPath = path + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()))
+                || !file.write(static_cast<const char*>(staged.staging.info.pMappedData), static_cast<std::streamsize>(staged.stagingSize)))
+            {
+                fmt::println("Failed to write cooked scene to {}", temporaryPath);
+                return false;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, path, error);
+        if (error)
+        {
+            fmt::println("Failed to replace cooked scene {}: {}", path, error.message());
+            std::filesystem::remove(temporaryPath, error);
+            return false;
+        }
+
+        fmt::println("Cooked {} ({} bytes of tables, {} bytes of payload)", path, bytes.size(), staged.stagingSize);
+        return true;
+    }
+    //< cooked format
+
+    uint32_t get_sampler_key(VkFilter magFilter, VkFilter minFilter)
+    {
+        return (static_cast<uint32_t>(magFilter) << 16) | static_cast<uint32_t>(minFilter);
+    }
+
+    // Registers the scene's materials in the bindless table and points every surface at its registered material
+    void register_materials(VulkanEngine* engine, LoadedScene& scene, const std::vector<SceneMaterial>& materials, const std::vector<uint32_t>& textureIndices)
+    {
+        // The engine's samplers cover materials filtering the same way in both directions, mixed filters get one of their own
+        std::unordered_map<uint32_t, uint32_t> samplerIndices;
+        samplerIndices[get_sampler_key(VK_FILTER_LINEAR, VK_FILTER_LINEAR)] = engine->defaultSamplerLinearIndex;
+        samplerIndices[get_sampler_key(VK_FILTER_NEAREST, VK_FILTER_NEAREST)] = engine->defaultSamplerNearestIndex;
+
+        std::vector<uint32_t> materialIndices;
+        materialIndices.reserve(materials.size());
+        for (const SceneMaterial& material : materials)
+        {
+            const uint32_t samplerKey = get_sampler_key(material.magFilter, material.minFilter);
+            auto sampler = samplerIndices.find(samplerKey);
+            if (sampler == samplerIndices.end())
+            {
+                VkSamplerCreateInfo samplerInfo = {};
+                samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+                samplerInfo.pNext = nullptr;
+                samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+                samplerInfo.minLod = 0;
+                samplerInfo.magFilter = material.magFilter;
+                samplerInfo.minFilter = material.minFilter;
+
+                VkSampler newSampler;
+                VK_CHECK(vkCreateSampler(engine->device, &samplerInfo, nullptr, &newSampler));
+                scene.samplers.push_back(newSampler);
+                sampler = samplerIndices.emplace(samplerKey, engine->bindless.AddSampler(newSampler)).first;
+            }
+
+            GPUMaterial gpuMaterial = {};
+            gpuMaterial.baseColorFactor = material.baseColorFactor;
+            gpuMaterial.baseColorTexture = material.baseColorImage < textureIndices.size() ? textureIndices[material.baseColorImage] : NO_BINDLESS_INDEX;
+            gpuMaterial.baseColorSampler = sampler->second;
+
+            materialIndices.push_back(engine->bindless.AddMaterial(gpuMaterial));
+        }
+
+        for (MeshAsset& mesh : scene.meshes)
+        {
+            for (GeoSurface& surface : mesh.surfaces)
+            {
+                surface.materialIndex = materialIndices[surface.materialIndex];
+            }
+        }
+    }
+
+    // The sphere around all surfaces of each mesh, copied out to every instance of it
+    void compute_instance_bounds(LoadedScene& scene)
+    {
+        std::vector<glm::vec4> meshSpheres;
+        meshSpheres.reserve(scene.meshes.size());
+        for (const MeshAsset& mesh : scene.meshes)
+        {
+            if (mesh.surfaces.empty())
+            {
+                meshSpheres.push_back(glm::vec4{0.0f});
+                continue;
+            }
+
+            glm::vec3 minPosition = mesh.surfaces[0].bounds.origin - mesh.surfaces[0].bounds.extents;
+            glm::vec3 maxPosition = mesh.surfaces[0].bounds.origin + mesh.surfaces[0].bounds.extents;
+            for (const GeoSurface& surface : mesh.surfaces)
+            {
+                minPosition = glm::min(minPosition, surface.bounds.origin - surface.bounds.extents);
+                maxPosition = glm::max(maxPosition, surface.bounds.origin + surface.bounds.extents);
+            }
+
+            const glm::vec3 center = (maxPosition + minPosition) * 0.5f;
+            float radius = 0.0f;
+            for (const GeoSurface& surface : mesh.surfaces)
+            {
+                radius = std::max(radius, glm::length(surface.bounds.origin - center) + surface.bounds.sphereRadius);
+            }
+            meshSpheres.push_back(glm::vec4{center, radius});
+        }
+
+        InstanceBounds& bounds = scene.instanceBounds;
+        const size_t instanceCount = scene.instances.size();
+        bounds.worldMatrices.resize(instanceCount);
+        bounds.centerX.resize(instanceCount);
+        bounds.centerY.resize(instanceCount);
+        bounds.centerZ.resize(instanceCount);
+        bounds.radius.resize(instanceCount);
+        for (size_t i = 0; i < instanceCount; i++)
+        {
+            const MeshInstance& instance = scene.instances[i];
+            const glm::vec4& sphere = meshSpheres[instance.meshIndex];
+            bounds.worldMatrices[i] = instance.worldMatrix;
+            bounds.centerX[i] = sphere.x;
+            bounds.centerY[i] = sphere.y;
+            bounds.centerZ[i] = sphere.z;
+            bounds.radius[i] = sphere.w;
+        }
+    }
+
+    // The part every loader shares once its staging buffer is filled: cook the scene when asked to, upload it
+    // and register its materials. Fails when the scene could not be cooked, after freeing what was staged
+    bool finish_scene(VulkanEngine* engine, LoadedScene& scene, StagedScene& staged, std::string_view filePath, std::string_view cookPath)
+    {
+        if (!cookPath.empty() && !write_cooked_scene(scene, staged, cookPath))
+        {
+            engine->DestroyBuffer(staged.staging);
+            for (DecodedImage& image : staged.images)
+            {
+                stbi_image_free(image.pixels);
+            }
+            return false;
+        }
+
+        if (staged.vertexFormat == VertexFormat::Packed)
+        {
+            const size_t vertexCount = staged.vertexBufferSize / sizeof(PackedVertex);
+            fmt::println(
+                "Packed vertices take {:.2f} MB instead of {:.2f} MB",
+                static_cast<double>(staged.vertexBufferSize) / (1024.0 * 1024.0),
+                static_cast<double>(vertexCount * sizeof(Vertex)) / (1024.0 * 1024.0)
+            );
+        }
+
+        compute_instance_bounds(scene);
+
+        const std::vector<uint32_t> textureIndices = upload_scene(engine, scene, staged, filePath);
+
+        register_materials(engine, scene, staged.materials, textureIndices);
+        return true;
+    }
+}
+
+std::optional<std::shared_ptr<LoadedScene>> load_gltf(VulkanEngine* engine, std::string_view filePath, const SceneLoadOptions& options)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    fmt::println("Loading GLTF: {}", filePath);
+
+    std::shared_ptr<LoadedScene> scene = std::make_shared<LoadedScene>();
+    scene->creator = engine;
+    LoadedScene& file = *scene;
+
+    fastgltf::Parser parser{};
+
+    constexpr auto gltfOptions = fastgltf::Options::DontRequireValidAssetMember
+        | fastgltf::Options::AllowDouble
+        | fastgltf::Options::LoadGLBBuffers
+        | fastgltf::Options::LoadExternalBuffers;
+
+    const std::filesystem::path path = filePath;
+    const std::filesystem::path directory = path.parent_path();
+
+    fastgltf::GltfDataBuffer data;
+    if (!data.loadFromFile(path))
+    {
+        fmt::println("Failed to read GLTF: {}", filePath);
+        return {};
+    }
+
+    // Parsing is single threaded, everything after it is spread over the job system
+    fastgltf::Expected<fastgltf::Asset> load = fastgltf::determineGltfFileType(&data) == fastgltf::GltfType::GLB
+        ? parser.loadBinaryGLTF(&data, directory, gltfOptions)
+        : parser.loadGLTF(&data, directory, gltfOptions);
+
+    if (load.error() != fastgltf::Error::None)
+    {
+        fmt::println("Failed to load GLTF: {}", fastgltf::getErrorMessage(load.error()));
+        return {};
+    }
+
+    const fastgltf::Asset& asset = load.get();
+    JobSystem& jobs = engine->jobs;
+
+    // Decoding is by far the most expensive part of loading, and no image depends on another
+    std::vector<DecodedImage> decodedImages(asset.images.size());
+    jobs.ParallelFor(static_cast<uint32_t>(asset.images.size()), 1, [&](uint32_t begin, uint32_t end, uint32_t) -> void
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            decodedImages[i] = decode_image(asset, asset.images[i], directory);
+        }
+    });
+
+    StagedScene staged;
+    staged.materials.reserve(asset.materials.size() + 1);
+    for (const fastgltf::Material& material : asset.materials)
+    {
+        SceneMaterial& sceneMaterial = staged.materials.emplace_back();
+        sceneMaterial.baseColorFactor = glm::vec4(
+            material.pbrData.baseColorFactor[0],
+            material.pbrData.baseColorFactor[1],
+            material.pbrData.baseColorFactor[2],
+            material.pbrData.baseColorFactor[3]
+        );
+
+        if (material.pbrData.baseColorTexture.has_value())
+        {
+            const fastgltf::Texture& texture = asset.textures[material.pbrData.baseColorTexture->textureIndex];
+            if (texture.imageIndex.has_value())
+            {
+                sceneMaterial.baseColorImage = static_cast<uint32_t>(*texture.imageIndex);
+            }
+            if (texture.samplerIndex.has_value())
+            {
+                const fastgltf::Sampler& sampler = asset.samplers[*texture.samplerIndex];
+                sceneMaterial.magFilter = extract_filter(sampler.magFilter.value_or(fastgltf::Filter::Nearest));
+                sceneMaterial.minFilter = extract_filter(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
+            }
+        }
+    }
+
+    // Primitives without a material are drawn plain white
+    uint32_t defaultMaterial = NO_BINDLESS_INDEX;
+
+    // Lay every primitive out back to back in the shared buffers. Only the accessor counts are needed for that,
+    // which leaves the actual vertex and index data free to be built in parallel afterwards.
+    std::vector<PrimitiveRange> primitives;
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    uint32_t maxSurfaceVertexCount = 0;
+
+    file.meshes.reserve(asset.meshes.size());
+    for (const fastgltf::Mesh& mesh : asset.meshes)
+    {
+        MeshAsset& newMesh = file.meshes.emplace_back();
+        newMesh.name = std::string_view(mesh.name);
+
+        for (const fastgltf::Primitive& primitive : mesh.primitives)
+        {
+            const auto positions = primitive.findAttribute("POSITION");
+            if (primitive.type != fastgltf::PrimitiveType::Triangles || positions == primitive.attributes.end())
+            {
+                continue;
+            }
+
+            PrimitiveRange range;
+            range.primitive = &primitive;
+            range.meshIndex = static_cast<uint32_t>(file.meshes.size() - 1);
+            range.surfaceIndex = static_cast<uint32_t>(newMesh.surfaces.size());
+            range.firstVertex = vertexCount;
+            range.vertexCount = static_cast<uint32_t>(asset.accessors[positions->second].count);
+            range.firstIndex = indexCount;
+            range.indexCount = primitive.indicesAccessor.has_value()
+                ? static_cast<uint32_t>(asset.accessors[*primitive.indicesAccessor].count)
+                : range.vertexCount;
+            primitives.push_back(range);
+            const uint32_t lodIndexCount = options.bGenerateLods ? get_lod_chain_index_budget(range.indexCount) : 0;
+
+            GeoSurface surface;
+            surface.startIndex = range.firstIndex;
+            surface.count = range.indexCount;
+            surface.vertexOffset = static_cast<int32_t>(range.firstVertex);
+            // The glTF material index for now, swapped for the bindless one once the materials are registered
+            if (primitive.materialIndex.has_value())
+            {
+                surface.materialIndex = static_cast<uint32_t>(*primitive.materialIndex);
+            }
+            else
+            {
+                if (defaultMaterial == NO_BINDLESS_INDEX)
+                {
+                    defaultMaterial = static_cast<uint32_t>(staged.materials.size());
+                    staged.materials.emplace_back();
+                }
+                surface.materialIndex = defaultMaterial;
+            }
+            newMesh.surfaces.push_back(surface);
+
+            vertexCount += range.vertexCount;
+            indexCount += range.indexCount + lodIndexCount;
+            maxSurfaceVertexCount = std::max(maxSurfaceVertexCount, range.vertexCount);
+        }
+    }
+
+    if (vertexCount == 0)
+    {
+        for (DecodedImage& image : decodedImages)
+        {
+            stbi_image_free(image.pixels);
+        }
+
+        fmt::println("GLTF has no triangle meshes: {}", filePath);
+        return {};
+    }
+
+    // Everything is uploaded from a single staging buffer: the vertices, then the indices, then the pixels of every image
+    staged.indexSize = get_index_size(maxSurfaceVertexCount);
+    staged.vertexFormat = options.vertexFormat;
+    staged.vertexBufferSize = vertexCount * get_vertex_stride(staged.vertexFormat);
+    staged.indexBufferSize = indexCount * staged.indexSize;
+    staged.stagingSize = layout_staging_images(decodedImages, staged.vertexBufferSize + staged.indexBufferSize);
+    staged.staging = create_staging(engine, staged.stagingSize, !options.cookPath.empty());
+    uint8_t* stagingData = static_cast<uint8_t*>(staged.staging.info.pMappedData);
+
+    // Every primitive and image writes to its own part of the staging buffer, so they can all go wide at once
+    JobSystem::Counter imageCopies;
+    copy_images_to_staging(jobs, decodedImages, stagingData, imageCopies);
+
+    std::vector<SurfaceStatistics> statistics(primitives.size());
+    std::vector<std::vector<Meshlet>> primitiveMeshlets(primitives.size());
+    jobs.ParallelFor(static_cast<uint32_t>(primitives.size()), 8, [&](uint32_t begin, uint32_t end, uint32_t) -> void
+    {
+        // Primitives are built and optimized in cached memory, reused by every primitive this thread builds
+        thread_local std::vector<Vertex> primitiveVertices;
+        thread_local std::vector<uint32_t> primitiveIndices;
+
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const PrimitiveRange& range = primitives[i];
+            GeoSurface& surface = file.meshes[range.meshIndex].surfaces[range.surfaceIndex];
+
+            build_primitive(asset, range, primitiveVertices, primitiveIndices);
+            surface.bounds = compute_bounds(primitiveVertices.data(), primitiveVertices.size());
+            stage_surface(
+                staged,
+                surface,
+                primitiveVertices.data(),
+                primitiveVertices.size(),
+                primitiveIndices.data(),
+                primitiveIndices.size(),
+                options,
+                statistics[i],
+                primitiveMeshlets[i]
+            );
+        }
+    });
+    jobs.Wait(imageCopies);
+
+    for (size_t i = 0; i < primitives.size(); i++)
+    {
+        append_meshlets(file, file.meshes[primitives[i].meshIndex].surfaces[primitives[i].surfaceIndex], primitiveMeshlets[i]);
+    }
+
+    // Flatten the node hierarchy into mesh instances, starting from every node nobody claims as a child
+    std::vector<bool> bHasParent(asset.nodes.size(), false);
+    for (const fastgltf::Node& node : asset.nodes)
+    {
+        for (size_t child : node.children)
+        {
+            bHasParent[child] = true;
+        }
+    }
+
+    std::vector<std::pair<size_t, glm::mat4>> pending;
+    for (size_t i = 0; i < asset.nodes.size(); i++)
+    {
+        if (!bHasParent[i])
+        {
+            pending.emplace_back(i, glm::mat4{1.0f});
+        }
+    }
+
+    while (!pending.empty())
+    {
+        const auto [nodeIndex, parentMatrix] = pending.back();
+        pending.pop_back();
+
+        const fastgltf::Node& node = asset.nodes[nodeIndex];
+        const glm::mat4 worldMatrix = parentMatrix * get_local_matrix(node);
+
+        if (node.meshIndex.has_value())
+        {
+            file.instances.push_back({worldMatrix, static_cast<uint32_t>(*node.meshIndex)});
+        }
+
+        for (size_t child : node.children)
+        {
+            pending.emplace_back(child, worldMatrix);
+        }
+    }
+
+    staged.images = std::move(decodedImages);
+    if (!finish_scene(engine, file, staged, filePath, options.cookPath))
+    {
+        return {};
+    }
+
+    const double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    fmt::println(
+        "Loaded {} in {:.2f} ms on {} threads ({} meshes, {} instances, {} images, {} vertices)",
+        filePath,
+        totalMs,
+        jobs.GetThreadCount(),
+        file.meshes.size(),
+        file.instances.size(),
+        file.images.size(),
+        vertexCount
+    );
+    if (options.bOptimizeMeshes)
+    {
+        print_cache_statistics(statistics);
+    }
+    if (options.bGenerateLods)
+    {
+        print_lod_statistics(file);
+    }
+
+    return scene;
+}
+
+//> obj
+namespace
+{
+    // Chunks smaller than this are not worth the scheduling
+    constexpr size_t OBJ_MIN_CHUNK_SIZE = 256 * 1024;
+
+    std::vector<obj::Material> read_obj_materials(const std::filesystem::path& path)
+    {
+        MappedFile file;
+        if (!file.Open(path))
+        {
+            fmt::println("Failed to read material library: {}", path.string());
+            return {};
+        }
+
+        return obj::parse_materials(file.GetData(), file.GetSize());
+    }
+}
+
+std::optional<std::shared_ptr<LoadedScene>> load_obj(VulkanEngine* engine, std::string_view filePath, const SceneLoadOptions& options)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    fmt::println("Loading OBJ: {}", filePath);
+
+    const std::filesystem::path path = filePath;
+    const std::filesystem::path directory = path.parent_path();
+
+    MappedFile file;
+    if (!file.Open(path))
+    {
+        fmt::println("Failed to read OBJ: {}", filePath);
+        return {};
+    }
+
+    JobSystem& jobs = engine->jobs;
+
+    // A few chunks per thread, so chunks with uneven amounts of work still balance out
+    const size_t chunkCount = std::clamp<size_t>(file.GetSize() / OBJ_MIN_CHUNK_SIZE, 1, static_cast<size_t>(jobs.GetThreadCount()) * 4);
+    const obj::Geometry geometry = obj::parse_geometry(jobs, file.GetData(), file.GetSize(), chunkCount);
+    const uint32_t triangleCount = geometry.GetTriangleCount();
+
+    std::vector<obj::Material> materials;
+    if (!geometry.materialLibrary.empty())
+    {
+        materials = read_obj_materials(directory / std::filesystem::path(std::string(geometry.materialLibrary)));
+    }
+
+    std::unordered_map<std::string_view, uint32_t> materialLookup;
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        materialLookup.emplace(materials[i].name, static_cast<uint32_t>(i));
+    }
+
+    // Faces before the first usemtl, or using a material the library does not define, get a plain white one
+    const uint32_t defaultMaterial = static_cast<uint32_t>(materials.size());
+
+    // Turn the usemtl statements into runs of triangles sharing a material
+    std::vector<std::pair<uint32_t, uint32_t>> materialRuns = {{0, defaultMaterial}};
+    for (const auto& [firstTriangle, name] : geometry.materialSwitches)
+    {
+        const auto found = materialLookup.find(name);
+        materialRuns.emplace_back(firstTriangle, found != materialLookup.end() ? found->second : defaultMaterial);
+    }
+
+    // Every texture decodes on its own job, while the geometry is being welded
+    std::vector<std::string> texturePaths;
+    std::vector<uint32_t> materialTextures(materials.size(), NO_BINDLESS_INDEX);
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        if (materials[i].diffuseTexture.empty())
+        {
+            continue;
+        }
+
+        const auto found = std::find(texturePaths.begin(), texturePaths.end(), materials[i].diffuseTexture);
+        materialTextures[i] = static_cast<uint32_t>(found - texturePaths.begin());
+        if (found == texturePaths.end())
+        {
+            texturePaths.push_back(materials[i].diffuseTexture);
+        }
+    }
+
+    std::vector<DecodedImage> decodedImages(texturePaths.size());
+    JobSystem::Counter imageDecodes;
+    for (size_t i = 0; i < texturePaths.size(); i++)
+    {
+        jobs.Run([&, i](uint32_t) -> void
+        {
+            decodedImages[i] = decode_file(directory / texturePaths[i]);
+        }, &imageDecodes);
+    }
+
+    std::vector<obj::WeldBlock> blocks = obj::weld_geometry(jobs, geometry, materialRuns, defaultMaterial + 1);
+    jobs.Wait(imageDecodes);
+
+    std::shared_ptr<LoadedScene> scene = std::make_shared<LoadedScene>();
+    scene->creator = engine;
+    LoadedScene& loaded = *scene;
+
+    MeshAsset& mesh = loaded.meshes.emplace_back();
+    mesh.name = path.stem().string();
+
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    size_t maxSurfaceVertexCount = 0;
+    for (const obj::WeldBlock& block : blocks)
+    {
+        GeoSurface surface;
+        surface.startIndex = indexCount;
+        surface.count = static_cast<uint32_t>(block.indices.size());
+        surface.vertexOffset = static_cast<int32_t>(vertexCount);
+        // The OBJ material for now, swapped for the bindless one once the materials are registered
+        surface.materialIndex = block.material;
+        mesh.surfaces.push_back(surface);
+
+        vertexCount += static_cast<uint32_t>(block.vertices.size());
+        indexCount += surface.count + (options.bGenerateLods ? get_lod_chain_index_budget(surface.count) : 0);
+        maxSurfaceVertexCount = std::max(maxSurfaceVertexCount, block.vertices.size());
+    }
+
+    if (vertexCount == 0)
+    {
+        for (DecodedImage& image : decodedImages)
+        {
+            stbi_image_free(image.pixels);
+        }
+
+        fmt::println("OBJ has no faces: {}", filePath);
+        return {};
+    }
+
+    StagedScene staged;
+    staged.indexSize = get_index_size(maxSurfaceVertexCount);
+    staged.vertexFormat = options.vertexFormat;
+    staged.vertexBufferSize = vertexCount * get_vertex_stride(staged.vertexFormat);
+    staged.indexBufferSize = indexCount * staged.indexSize;
+    staged.stagingSize = layout_staging_images(decodedImages, staged.vertexBufferSize + staged.indexBufferSize);
+    staged.staging = create_staging(engine, staged.stagingSize, !options.cookPath.empty());
+    uint8_t* stagingData = static_cast<uint8_t*>(staged.staging.info.pMappedData);
+
+    JobSystem::Counter imageCopies;
+    copy_images_to_staging(jobs, decodedImages, stagingData, imageCopies);
+
+    std::vector<SurfaceStatistics> statistics(blocks.size());
+    std::vector<std::vector<Meshlet>> blockMeshlets(blocks.size());
+    jobs.ParallelFor(static_cast<uint32_t>(blocks.size()), 1, [&](uint32_t begin, uint32_t end, uint32_t) -> void
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            obj::WeldBlock& block = blocks[i];
+            mesh.surfaces[i].bounds = compute_bounds(block.vertices.data(), block.vertices.size());
+            stage_surface(
+                staged,
+                mesh.surfaces[i],
+                block.vertices.data(),
+                block.vertices.size(),
+                block.indices.data(),
+                block.indices.size(),
+                options,
+                statistics[i],
+                blockMeshlets[i]
+            );
+
+            std::vector<Vertex>().swap(block.vertices);
+            std::vector<uint32_t>().swap(block.indices);
+        }
+    });
+    jobs.Wait(imageCopies);
+
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        append_meshlets(loaded, mesh.surfaces[i], blockMeshlets[i]);
+    }
+
+    // The last material is the plain white one
+    staged.materials.resize(materials.size() + 1);
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        SceneMaterial& sceneMaterial = staged.materials[i];
+        sceneMaterial.baseColorFactor = materials[i].diffuseColor;
+        sceneMaterial.baseColorImage = materialTextures[i];
+        if (materials[i].bNearestFilter)
+        {
+            sceneMaterial.magFilter = VK_FILTER_NEAREST;
+            sceneMaterial.minFilter = VK_FILTER_NEAREST;
+        }
+    }
+
+    loaded.instances.push_back({glm::mat4{1.0f}, 0});
+
+    staged.images = std::move(decodedImages);
+    if (!finish_scene(engine, loaded, staged, filePath, options.cookPath))
+    {
+        return {};
+    }
+
+    const double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    fmt::println(
+        "Loaded {} in {:.2f} ms on {} threads ({} chunks, {} triangles, {} welded vertices, {} surfaces)",
+        filePath,
+        totalMs,
+        jobs.GetThreadCount(),
+        chunkCount,
+        triangleCount,
+        vertexCount,
+        mesh.surfaces.size()
+    );
+    if (options.bOptimizeMeshes)
+    {
+        print_cache_statistics(statistics);
+    }
+    if (options.bGenerateLods)
+    {
+        print_lod_statistics(loaded);
+    }
+
+    return scene;
+}
+//< obj
+
+//> cooked
+namespace
+{
+    // Copies from the mapped file to the staging buffer are split into slices of this size,
+    // so the page faults of a big file are taken on every thread instead of one
+    constexpr size_t COOKED_COPY_SLICE_SIZE = 4 * 1024 * 1024;
+}
+
+std::optional<std::shared_ptr<LoadedScene>> load_cooked(VulkanEngine* engine, std::string_view filePath)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    fmt::println("Loading cooked scene: {}", filePath);
+
+    MappedFile file;
+    if (!file.Open(std::filesystem::path(filePath)))
+    {
+        fmt::println("Failed to read cooked scene: {}", filePath);
+        return {};
+    }
+
+    cooked::Scene cookedScene;
+    uint64_t payloadOffset = 0;
+    uint64_t payloadSize = 0;
+    switch (cooked::read(file.GetData(), file.GetSize(), cookedScene, payloadOffset, payloadSize))
+    {
+    case cooked::ReadResult::Success:
+        break;
+    case cooked::ReadResult::NotCooked:
+        fmt::println("Not a cooked scene: {}", filePath);
+        return {};
+    case cooked::ReadResult::OtherVersion:
+        fmt::println("Cooked scene {} was cooked by another version of the format, cook it again", filePath);
+        return {};
+    case cooked::ReadResult::Damaged:
+        fmt::println("Cooked scene is damaged: {}", filePath);
+        return {};
+    }
+
+    StagedScene staged;
+    staged.vertexBufferSize = static_cast<size_t>(cookedScene.vertexBufferSize);
+    staged.indexBufferSize = static_cast<size_t>(cookedScene.indexBufferSize);
+    staged.indexSize = cookedScene.indexStride;
+    staged.vertexFormat = cookedScene.vertexFormat;
+    staged.materials = std::move(cookedScene.materials);
+    staged.stagingSize = static_cast<size_t>(payloadSize);
+    staged.staging = create_staging(engine, staged.stagingSize, false);
+
+    // The payload already is the staging buffer, byte for byte
+    const char* payload = file.GetData() + payloadOffset;
+    char* stagingData = static_cast<char*>(staged.staging.info.pMappedData);
+    const uint32_t sliceCount = static_cast<uint32_t>((staged.stagingSize + COOKED_COPY_SLICE_SIZE - 1) / COOKED_COPY_SLICE_SIZE);
+
+    JobSystem& jobs = engine->jobs;
+    jobs.ParallelFor(sliceCount, 1, [&](uint32_t begin, uint32_t end, uint32_t) -> void
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const size_t offset = static_cast<size_t>(i) * COOKED_COPY_SLICE_SIZE;
+            std::memcpy(stagingData + offset, payload + offset, std::min(COOKED_COPY_SLICE_SIZE, staged.stagingSize - offset));
+        }
+    });
+
+    staged.images.resize(cookedScene.images.size());
+    for (size_t i = 0; i < cookedScene.images.size(); i++)
+    {
+        const cooked::Image& image = cookedScene.images[i];
+        staged.images[i].width = static_cast<int>(image.width);
+        staged.images[i].height = static_cast<int>(image.height);
+        staged.images[i].stagingOffset = static_cast<size_t>(image.payloadOffset);
+    }
+
+    std::shared_ptr<LoadedScene> scene = std::make_shared<LoadedScene>();
+    scene->creator = engine;
+    LoadedScene& loaded = *scene;
+
+    loaded.meshes = std::move(cookedScene.meshes);
+    loaded.instances = std::move(cookedScene.instances);
+    loaded.meshlets = std::move(cookedScene.meshlets);
+
+    // Cooked scenes are not cooked again, so this cannot fail
+    finish_scene(engine, loaded, staged, filePath, {});
+
+    const double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    fmt::println(
+        "Loaded {} in {:.2f} ms ({} meshes, {} instances, {} images, {} bytes of payload)",
+        filePath,
+        totalMs,
+        loaded.meshes.size(),
+        loaded.instances.size(),
+        loaded.images.size(),
+        staged.stagingSize
+    );
+
+    return scene;
+}
+//< cooked
+
+glm::mat4 get_dequantization_matrix(const Bounds& bounds)
+{
+    const glm::mat4 translation = glm::translate(glm::mat4(1.0f), bounds.origin - bounds.extents);
+    return glm::scale(translation, bounds.extents * 2.0f);
+}
+
+SurfaceLod select_surface_lod(const GeoSurface& surface, float maxError)
+{
+    SurfaceLod selected{surface.startIndex, surface.count, 0.0f};
+
+    // Errors only grow along the chain
+    for (uint32_t lod = 0; lod < surface.lodCount && surface.lods[lod].error <= maxError; lod++)
+    {
+        selected = surface.lods[lod];
+    }
+
+    return selected;
+}
+
+std::optional<std::shared_ptr<LoadedScene>> load_scene(VulkanEngine* engine, std::string_view filePath, const SceneLoadOptions& options)
+{
+    const std::filesystem::path extension = std::filesystem::path(filePath).extension();
+    if (extension == ".cooked")
+    {
+        if (!options.cookPath.empty())
+        {
+            fmt::println("{} is already cooked, not cooking it again", filePath);
+        }
+        return load_cooked(engine, filePath);
+    }
+
+    if (extension == ".obj" || extension == ".OBJ")
+    {
+        return load_obj(engine, filePath, options);
+    }
+
+    return load_gltf(engine, filePath, options);
+}
+
+void LoadedScene::ClearAll()
+{
+    if (!creator)
+    {
+        return;
+    }
+
+    // The bindless slots of the textures, samplers and materials are not recycled,
+    // scenes are expected to live until the engine shuts down
+    for (const AllocatedImage& image : images)
+    {
+        creator->DestroyImage(image);
+    }
+
+    for (VkSampler sampler : samplers)
+    {
+        vkDestroySampler(creator->device, sampler, nullptr);
+    }
+
+    creator->DestroyBuffer(meshBuffers.indexBuffer);
+    creator->DestroyBuffer(meshBuffers.vertexBuffer);
+
+    if (drawBuffers.objectCount > 0)
+    {
+        creator->DestroyBuffer(drawBuffers.objectBuffer);
+        creator->DestroyBuffer(drawBuffers.surfaceBuffer);
+        creator->DestroyBuffer(drawBuffers.drawCommandBuffer);
+        creator->DestroyBuffer(drawBuffers.drawCountBuffer);
+        creator->DestroyBuffer(drawBuffers.visibilityBuffer);
+    }
+
+    images.clear();
+    samplers.clear();
+    creator = nullptr;
+}
\ No newline at end of file
@@ -1 +1,162 @@
 ﻿#pragma once
+
+#include <filesystem>
+#include <string_view>
+#include "vk_types.h"
+
+class VulkanEngine;
+
+// Box and sphere around a range of vertices, in the space of the mesh
+struct Bounds
+{
+    glm::vec3 origin;
+    float sphereRadius;
+    glm::vec3 extents;
+};
+
+// Maps the 0..1 positions of a packed vertex back onto the bounds they were quantized to
+glm::mat4 get_dequantization_matrix(const Bounds& bounds);
+
+// Simplified version of a surface, indexing the same vertices
+struct SurfaceLod
+{
+    uint32_t startIndex;
+    uint32_t count;
+    // How far the simplified surface strays from the full one at most, in the space of the mesh
+    float error;
+};
+
+constexpr uint32_t MAX_SURFACE_LODS = 4;
+
+// Cluster of up to 64 vertices and 124 triangles of a surface, drawn as its own range of the scene's index buffer.
+// Laid out for std430, so the scene's meshlets can be handed to the GPU as they are.
+struct Meshlet
+{
+    // Bounding sphere, in the space of the mesh
+    glm::vec3 center;
+    float radius;
+    // The meshlet faces away from a camera at p when dot(center - p, coneAxis) >= coneCutoff * length(center - p) + radius.
+    // A cutoff of 1 never passes that test
+    glm::vec3 coneAxis;
+    float coneCutoff;
+    uint32_t startIndex;
+    uint32_t count;
+    uint32_t padding[2];
+};
+
+// Range of the scene's shared index buffer drawn with a single material
+struct GeoSurface
+{
+    uint32_t startIndex;
+    uint32_t count;
+    // Indices are local to their primitive, this moves them to where its vertices live in the shared buffer
+    int32_t vertexOffset;
+    // Index into the bindless material table
+    uint32_t materialIndex;
+    Bounds bounds;
+    // Coarser and coarser versions of the surface, only there when the loader was asked to generate them
+    uint32_t lodCount{0};
+    SurfaceLod lods[MAX_SURFACE_LODS]{};
+    // The full surface split into LoadedScene::meshlets, when the loader was asked to build them
+    uint32_t firstMeshlet{0};
+    uint32_t meshletCount{0};
+};
+
+// The coarsest version of the surface that strays less than maxError from it, the full surface when none does.
+// maxError is in the space of the mesh
+SurfaceLod select_surface_lod(const GeoSurface& surface, float maxError);
+
+struct MeshAsset
+{
+    std::string name;
+    std::vector<GeoSurface> surfaces;
+};
+
+// A mesh placed in the world. The node hierarchy is flattened into these while loading
+struct MeshInstance
+{
+    glm::mat4 worldMatrix;
+    uint32_t meshIndex;
+};
+
+// A material of the scene as the importer found it, before it is registered in the bindless table
+struct SceneMaterial
+{
+    glm::vec4 baseColorFactor{1.0f};
+    // Index into the scene's images, NO_BINDLESS_INDEX when untextured
+    uint32_t baseColorImage{NO_BINDLESS_INDEX};
+    VkFilter magFilter{VK_FILTER_LINEAR};
+    VkFilter minFilter{VK_FILTER_LINEAR};
+};
+
+// Bounding sphere of every instance around all surfaces of its mesh, in the structure-of-arrays form the CPU culling
+// reads. The spheres are in the space of the mesh, worldMatrices holds the instances' matrices side by side
+struct InstanceBounds
+{
+    std::vector<glm::mat4> worldMatrices;
+    std::vector<float> centerX;
+    std::vector<float> centerY;
+    std::vector<float> centerZ;
+    std::vector<float> radius;
+};
+
+struct LoadedScene
+{
+    std::vector<MeshAsset> meshes;
+    std::vector<MeshInstance> instances;
+    std::vector<Meshlet> meshlets;
+    // One element per instance, filled by every loader once the instances are known
+    InstanceBounds instanceBounds;
+
+    // All meshes of the scene share a single vertex and index buffer
+    GPUMeshBuffers meshBuffers{};
+    // Only created when the engine draws the scene GPU driven, see VulkanEngine::UploadDrawBuffers()
+    GPUDrawBuffers drawBuffers{};
+    std::vector<AllocatedImage> images;
+    std::vector<VkSampler> samplers;
+
+    VulkanEngine* creator{nullptr};
+
+    LoadedScene() = default;
+    LoadedScene(const LoadedScene&) = delete;
+    LoadedScene& operator=(const LoadedScene&) = delete;
+    ~LoadedScene() { ClearAll(); }
+
+private:
+    void ClearAll();
+};
+
+// Extra work the loaders do on top of getting the scene onto the GPU
+struct SceneLoadOptions
+{
+    // When set, the scene is also written here in the cooked format, which load_cooked() reads back without parsing anything.
+    // The load fails when the file cannot be written
+    std::string cookPath;
+    // Reorder the triangles and vertices of every surface for the vertex cache, overdraw and vertex fetch.
+    // Cooked scenes keep the order they were cooked with
+    bool bOptimizeMeshes{true};
+    // Packed vertices take less than half the memory and fetch bandwidth. Cooked scenes keep the format they were cooked with
+    VertexFormat vertexFormat{VertexFormat::Full};
+    // Simplify every surface into a chain of LODs with half the triangles each. Slow, meant for cooking
+    bool bGenerateLods{false};
+    // Split every surface into meshlets for cluster culling. Reorders the triangles of the surface
+    bool bBuildMeshlets{true};
+};
+
+// The loaders below upload everything a file references with a single submission. The heavy lifting is spread
+// over the engine's job system, the calls themselves block until the scene is ready to be drawn.
+// Must be called from the main thread.
+
+// Loads a .gltf or .glb file. Images are decoded and primitives are built in parallel
+std::optional<std::shared_ptr<LoadedScene>> load_gltf(VulkanEngine* engine, std::string_view filePath, const SceneLoadOptions& options = {});
+
+// Loads an .obj file and the .mtl library it references. The file is memory mapped and parsed in line-aligned chunks
+// on every thread, after which duplicate position/uv/normal triplets are welded. Every material gets its own surfaces.
+std::optional<std::shared_ptr<LoadedScene>> load_obj(VulkanEngine* engine, std::string_view filePath, const SceneLoadOptions& options = {});
+
+// Loads a scene written by one of the loaders above. The file is memory mapped and its payload is already laid out
+// the way the staging buffer wants it, so loading comes down to a copy and the upload.
+std::optional<std::shared_ptr<LoadedScene>> load_cooked(VulkanEngine* engine, std::string_view filePath);
+
+// Picks the loader from the file extension. Cooked scenes use .cooked
+std::optional<std::shared_ptr<LoadedScene>> load_scene(VulkanEngine* engine, std::string_view filePath, const SceneLoadOptions& options = {});
\ No newline at end of file
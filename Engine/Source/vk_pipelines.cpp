@@ -1 +1,397 @@
 ﻿#include <vk_pipelines.h>
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "vk_initializers.h"
+
+bool vkutil::load_shader_module(const char* filePath, VkDevice device, VkShaderModule* outShaderModule)
+{
+    // Open the file. With cursor at the end
+    std::ifstream file(filePath, std::ios::ate | std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // Find what the size of the file is by looking up the location of the cursor
+    // Because the cursor is at the end, it gives the size directly in bytes
+    const size_t fileSize = static_cast<size_t>(file.tellg());
+
+    // Spirv expects the buffer to be on uint32, so make sure to reserve a int
+    // vector big enough for the entire file
+    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+
+    // Put file cursor at beginning and load the entire file into the buffer
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(fileSize));
+    file.close();
+
+    // Create a new shader module, using the buffer we loaded
+    VkShaderModuleCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.pNext = nullptr;
+
+    // codeSize has to be in bytes, so multiply the ints in the buffer by size of int to know the real size of the buffer
+    createInfo.codeSize = buffer.size() * sizeof(uint32_t);
+    createInfo.pCode = buffer.data();
+
+    // Check that the creation goes well
+    VkShaderModule shaderModule;
+    if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    *outShaderModule = shaderModule;
+    return true;
+}
+
+VkPipeline vkutil::build_compute_pipeline(VkDevice device, VkPipelineLayout layout, VkShaderModule computeShader, VkPipelineCache cache)
+{
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.pNext = nullptr;
+    pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, computeShader);
+    pipelineInfo.layout = layout;
+
+    VkPipeline newPipeline;
+    if (vkCreateComputePipelines(device, cache, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS)
+    {
+        fmt::println("failed to create compute pipeline");
+        return VK_NULL_HANDLE;
+    }
+
+    return newPipeline;
+}
+
+void PipelineBuilder::Clear()
+{
+    // Clear all of the structs we need back to 0 with their correct stype
+    inputAssembly = {};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    rasterizer = {};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    colorBlendAttachment = {};
+    multisampling = {};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    pipelineLayout = {};
+    depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    renderInfo = {};
+    renderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+    colorAttachmentFormat = VK_FORMAT_UNDEFINED;
+
+    shaderStages.clear();
+}
+
+VkPipeline PipelineBuilder::BuildPipeline(VkDevice device, VkPipelineCache cache)
+{
+    // Make viewport state from our stored viewport and scissor.
+    // At the moment we wont support multiple viewports or scissors
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.pNext = nullptr;
+
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    // Setup dummy color blending. We aren't using transparent objects yet
+    // The blending is just "no blend", but we do write to the color attachment
+    VkPipelineColorBlendStateCreateInfo colorBlending = {};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.pNext = nullptr;
+
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.logicOp = VK_LOGIC_OP_COPY;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    // Completely clear VertexInputStateCreateInfo, as we have no need for it
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    // Point the rendering info at our own copy of the format, the builder may have been copied since it was set
+    renderInfo.colorAttachmentCount = colorAttachmentFormat == VK_FORMAT_UNDEFINED ? 0 : 1;
+    renderInfo.pColorAttachmentFormats = &colorAttachmentFormat;
+
+    VkDynamicState state[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+
+    VkPipelineDynamicStateCreateInfo dynamicInfo = {};
+
+    dynamicInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicInfo.pDynamicStates = &state[0];
+    dynamicInfo.dynamicStateCount = 2;
+
+    // Build the actual pipeline
+    // We now use all of the info structs we have been writing into into this one to create the pipeline
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    // Connect the renderInfo to the pNext extension mechanism
+    pipelineInfo.pNext = &renderInfo;
+
+    pipelineInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+    pipelineInfo.pStages = shaderStages.data();
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pDynamicState = &dynamicInfo;
+    pipelineInfo.layout = pipelineLayout;
+
+    // Its easy to error out on create graphics pipeline, so we handle it a bit better than the common VK_CHECK case
+    VkPipeline newPipeline;
+    if (vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS)
+    {
+        fmt::println("failed to create pipeline");
+        return VK_NULL_HANDLE;
+    }
+
+    return newPipeline;
+}
+
+void PipelineBuilder::SetShaders(VkShaderModule vertexShader, VkShaderModule fragmentShader)
+{
+    shaderStages.clear();
+
+    shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, vertexShader));
+    shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader));
+}
+
+void PipelineBuilder::SetInputTopology(VkPrimitiveTopology topology)
+{
+    inputAssembly.topology = topology;
+    // We are not going to use primitive restart
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+}
+
+void PipelineBuilder::SetPolygonMode(VkPolygonMode mode)
+{
+    rasterizer.polygonMode = mode;
+    rasterizer.lineWidth = 1.f;
+}
+
+void PipelineBuilder::SetCullMode(VkCullModeFlags cullMode, VkFrontFace frontFace)
+{
+    rasterizer.cullMode = cullMode;
+    rasterizer.frontFace = frontFace;
+}
+
+void PipelineBuilder::SetMultisamplingNone()
+{
+    multisampling.sampleShadingEnable = VK_FALSE;
+    // Multisampling defaulted to no multisampling (1 sample per pixel)
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampling.minSampleShading = 1.0f;
+    multisampling.pSampleMask = nullptr;
+    // No alpha to coverage either
+    multisampling.alphaToCoverageEnable = VK_FALSE;
+    multisampling.alphaToOneEnable = VK_FALSE;
+}
+
+void PipelineBuilder::DisableBlending()
+{
+    // Default write mask
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    // No blending
+    colorBlendAttachment.blendEnable = VK_FALSE;
+}
+
+void PipelineBuilder::SetColorAttachmentFormat(VkFormat format)
+{
+    colorAttachmentFormat = format;
+}
+
+void PipelineBuilder::SetDepthFormat(VkFormat format)
+{
+    renderInfo.depthAttachmentFormat = format;
+}
+
+void PipelineBuilder::DisableDepthTest()
+{
+    depthStencil.depthTestEnable = VK_FALSE;
+    depthStencil.depthWriteEnable = VK_FALSE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_NEVER;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+    depthStencil.front = {};
+    depthStencil.back = {};
+    depthStencil.minDepthBounds = 0.f;
+    depthStencil.maxDepthBounds = 1.f;
+}
+
+void PipelineBuilder::EnableDepthTest(bool bDepthWriteEnable, VkCompareOp op)
+{
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = bDepthWriteEnable;
+    depthStencil.depthCompareOp = op;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+    depthStencil.front = {};
+    depthStencil.back = {};
+    depthStencil.minDepthBounds = 0.f;
+    depthStencil.maxDepthBounds = 1.f;
+}
+
+void PipelineCache::Init(VkDevice device, VkPhysicalDevice gpu, const std::string& path)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    this->device = device;
+    this->path = path;
+    vkGetPhysicalDeviceProperties(gpu, &gpuProperties);
+
+    std::vector<char> data;
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (file.is_open())
+    {
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+    bWarm = !data.empty() && IsCompatible(data);
+    if (!data.empty() && !bWarm)
+    {
+        fmt::println("Pipeline cache at {} was written by a different GPU or driver, starting cold", path);
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo = {};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.pNext = nullptr;
+    cacheInfo.initialDataSize = bWarm ? data.size() : 0;
+    cacheInfo.pInitialData = bWarm ? data.data() : nullptr;
+    VK_CHECK(vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache));
+
+    loadTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void PipelineCache::Save() const
+{
+    size_t size = 0;
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &size, nullptr));
+
+    std::vector<char> data(size);
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &size, data.data()));
+
+    const std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.write(data.data(), static_cast<std::streamsize>(size)))
+        {
+            fmt::println("Failed to write pipeline cache to {}", temporaryPath);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error)
+    {
+        fmt::println("Failed to replace pipeline cache {}: {}", path, error.message());
+        std::filesystem::remove(temporaryPath, error);
+    }
+}
+
+void PipelineCache::Destroy()
+{
+    vkDestroyPipelineCache(device, cache, nullptr);
+    cache = VK_NULL_HANDLE;
+}
+
+bool PipelineCache::IsCompatible(const std::vector<char>& data) const
+{
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header))
+    {
+        return false;
+    }
+
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    return header.headerSize >= sizeof(header)
+        && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header.vendorID == gpuProperties.vendorID
+        && header.deviceID == gpuProperties.deviceID
+        && std::memcmp(header.pipelineCacheUUID, gpuProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+
+void PipelineCompiler::Init(VkDevice device, JobSystem& jobs, PipelineCache& cache)
+{
+    this->device = device;
+    this->jobs = &jobs;
+    this->cache = &cache;
+}
+
+void PipelineCompiler::Destroy()
+{
+    WaitIdle();
+
+    for (const PipelineHandle& handle : compiledPipelines)
+    {
+        if (handle->IsReady())
+        {
+            vkDestroyPipeline(device, handle->pipeline.load(), nullptr);
+        }
+    }
+
+    compiledPipelines.clear();
+}
+
+PipelineHandle PipelineCompiler::CompileAsync(const PipelineBuilder& builder, const std::string& vertexPath, const std::string& fragmentPath)
+{
+    PipelineHandle handle = std::make_shared<AsyncPipeline>();
+    compiledPipelines.push_back(handle);
+
+    // In the background, so a frame waiting on its own jobs never ends up compiling on the main thread
+    jobs->RunBackground([this, builder, vertexPath, fragmentPath, handle](uint32_t) mutable
+    {
+        const auto start = std::chrono::high_resolution_clock::now();
+
+        VkShaderModule vertexShader = VK_NULL_HANDLE;
+        VkShaderModule fragmentShader = VK_NULL_HANDLE;
+
+        const bool bLoaded = vkutil::load_shader_module(vertexPath.c_str(), device, &vertexShader)
+            && vkutil::load_shader_module(fragmentPath.c_str(), device, &fragmentShader);
+
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        if (bLoaded)
+        {
+            // The pipeline cache is internally synchronized, so every worker can compile against it directly
+            builder.SetShaders(vertexShader, fragmentShader);
+            pipeline = builder.BuildPipeline(device, cache->Get());
+        }
+        else
+        {
+            fmt::println("Error when building the shader modules {} and {}", vertexPath, fragmentPath);
+        }
+
+        // Modules are only needed while compiling
+        vkDestroyShaderModule(device, vertexShader, nullptr);
+        vkDestroyShaderModule(device, fragmentShader, nullptr);
+
+        if (pipeline == VK_NULL_HANDLE)
+        {
+            handle->bFailed.store(true, std::memory_order_release);
+            return;
+        }
+
+        handle->pipeline.store(pipeline, std::memory_order_release);
+
+        const double compileMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        fmt::println("Compiled the pipeline for {} and {} in {:.2f} ms", vertexPath, fragmentPath, compileMs);
+    }, &pendingCompiles);
+
+    return handle;
+}
+
+void PipelineCompiler::WaitIdle() const
+{
+    jobs->Wait(pendingCompiles);
+}
\ No newline at end of file
@@ -1,5 +1,117 @@
 ﻿#pragma once
 
+#include <atomic>
 #include <vk_types.h>
 
-namespace vkutil {};
+#include "job_system.h"
+
+namespace vkutil
+{
+    bool load_shader_module(const char* filePath, VkDevice device, VkShaderModule* outShaderModule);
+
+    // Compute pipelines only have a single stage and a layout, so they do not need a builder
+    VkPipeline build_compute_pipeline(VkDevice device, VkPipelineLayout layout, VkShaderModule computeShader, VkPipelineCache cache = VK_NULL_HANDLE);
+};
+
+class PipelineBuilder
+{
+public:
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+    VkPipelineRasterizationStateCreateInfo rasterizer;
+    VkPipelineColorBlendAttachmentState colorBlendAttachment;
+    VkPipelineMultisampleStateCreateInfo multisampling;
+    VkPipelineLayout pipelineLayout;
+    VkPipelineDepthStencilStateCreateInfo depthStencil;
+    VkPipelineRenderingCreateInfo renderInfo;
+    VkFormat colorAttachmentFormat;
+
+    PipelineBuilder() { Clear(); }
+
+    void Clear();
+
+    // The builder only holds plain data, so it can be copied into a job and built on any thread
+    VkPipeline BuildPipeline(VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE);
+
+    void SetShaders(VkShaderModule vertexShader, VkShaderModule fragmentShader);
+    void SetInputTopology(VkPrimitiveTopology topology);
+    void SetPolygonMode(VkPolygonMode mode);
+    void SetCullMode(VkCullModeFlags cullMode, VkFrontFace frontFace);
+    void SetMultisamplingNone();
+    void DisableBlending();
+    void SetColorAttachmentFormat(VkFormat format);
+    void SetDepthFormat(VkFormat format);
+    void DisableDepthTest();
+    void EnableDepthTest(bool bDepthWriteEnable, VkCompareOp op);
+};
+
+// Pipeline that is compiled on a job system worker.
+// pipeline stays VK_NULL_HANDLE until the compile has finished, and never changes after that.
+struct AsyncPipeline
+{
+    std::atomic<VkPipeline> pipeline{VK_NULL_HANDLE};
+    std::atomic<bool> bFailed{false};
+
+    bool IsReady() const { return pipeline.load(std::memory_order_acquire) != VK_NULL_HANDLE; }
+};
+
+using PipelineHandle = std::shared_ptr<AsyncPipeline>;
+
+// VkPipelineCache that survives restarts.
+// The blob is only trusted when its header matches the GPU and driver we are running on,
+// anything else would at best be ignored by the driver and at worst crash it.
+class PipelineCache
+{
+public:
+    void Init(VkDevice device, VkPhysicalDevice gpu, const std::string& path);
+    // Writes the cache to a temporary file first and renames it over the old one,
+    // so a crash halfway through never leaves a truncated cache behind.
+    void Save() const;
+    void Destroy();
+
+    VkPipelineCache Get() const { return cache; }
+    // Whether Init() found a valid cache blob on disk
+    bool IsWarm() const { return bWarm; }
+    double GetLoadTimeMs() const { return loadTimeMs; }
+
+private:
+    bool IsCompatible(const std::vector<char>& data) const;
+
+    VkDevice device{VK_NULL_HANDLE};
+    VkPhysicalDeviceProperties gpuProperties{};
+    VkPipelineCache cache{VK_NULL_HANDLE};
+    std::string path;
+    bool bWarm{false};
+    double loadTimeMs{0.0};
+};
+
+// Compiles pipelines on the job system so first use of a pipeline never stalls a frame.
+// Draws Resolve() the pipeline they want, and get the fallback they provide while it is still compiling.
+// Every compile prints how long it took once it is done.
+class PipelineCompiler
+{
+public:
+    void Init(VkDevice device, JobSystem& jobs, PipelineCache& cache);
+    // Waits for outstanding compiles and destroys every pipeline this compiler produced
+    void Destroy();
+
+    // Shader loading happens inside the job as well, the builder's shader stages are replaced by these
+    PipelineHandle CompileAsync(const PipelineBuilder& builder, const std::string& vertexPath, const std::string& fragmentPath);
+
+    static VkPipeline Resolve(const PipelineHandle& handle, VkPipeline fallback)
+    {
+        return handle && handle->IsReady() ? handle->pipeline.load(std::memory_order_acquire) : fallback;
+    }
+
+    // Blocks until every compile submitted so far has finished
+    void WaitIdle() const;
+
+private:
+    VkDevice device{VK_NULL_HANDLE};
+    JobSystem* jobs{nullptr};
+    PipelineCache* cache{nullptr};
+
+    JobSystem::Counter pendingCompiles;
+    std::vector<PipelineHandle> compiledPipelines;
+};
\ No newline at end of file
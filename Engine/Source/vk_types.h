@@ -13,12 +13,226 @@
 
 #include <fmt/core.h>
 #include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 
 #include <vma/vk_mem_alloc.h>
 #include <vulkan/vk_enum_string_helper.h>
 #include <vulkan/vulkan.h>
 
+struct AllocatedImage
+{
+    VkImage image;
+    VkImageView imageView;
+    VmaAllocation allocation;
+    VkExtent3D imageExtent;
+    VkFormat imageFormat;
+};
+
+struct AllocatedBuffer
+{
+    VkBuffer buffer;
+    VmaAllocation allocation;
+    VmaAllocationInfo info;
+};
+
+// A buffer the CPU rewrites every frame. Lives in device local memory the CPU writes to directly when the device
+// exposes it as host visible (resizable BAR), otherwise in device local memory behind a host visible staging copy
+struct DynamicBuffer
+{
+    AllocatedBuffer buffer{};
+    // Only created when the CPU cannot write buffer directly
+    AllocatedBuffer staging{};
+    VkDeviceAddress address{0};
+    size_t size{0};
+
+    bool IsDirect() const { return staging.buffer == VK_NULL_HANDLE; }
+    // Write combined when direct, write it front to back and never read from it
+    void* GetWritePointer() const { return IsDirect() ? buffer.info.pMappedData : staging.info.pMappedData; }
+};
+
+// Layout shared with the shaders, which pull vertices through a buffer device address
+struct Vertex
+{
+    glm::vec3 position;
+    float uv_x;
+    glm::vec3 normal;
+    float uv_y;
+    glm::vec4 color;
+};
+
+// Compact encoding of Vertex, decoded by mesh_packed.vert. Less than half the size, at the cost of some precision
+struct PackedVertex
+{
+    // 16 bit unorm, relative to the bounds of the surface the vertex belongs to
+    uint16_t position[3];
+    uint16_t padding;
+    // Octahedral encoding, 2x16 bit snorm
+    uint32_t normal;
+    // 2x half float, in steps of 1/2048 just below 1. Fine for most textures, coarse on very large atlases
+    uint32_t uv;
+    // RGBA8 unorm
+    uint32_t color;
+};
+
+// How a scene's vertex buffer is laid out
+enum class VertexFormat : uint32_t
+{
+    Full,   // Vertex
+    Packed, // PackedVertex
+};
+
+inline uint32_t get_vertex_stride(VertexFormat format)
+{
+    return format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+// Vertex and index data living on the GPU, the vertices are pulled in the shaders through vertexBufferAddress
+struct GPUMeshBuffers
+{
+    AllocatedBuffer indexBuffer;
+    AllocatedBuffer vertexBuffer;
+    VkDeviceAddress vertexBufferAddress;
+    // 16 bit when every surface has few enough vertices for its local indices to fit
+    VkIndexType indexType;
+    VertexFormat vertexFormat;
+};
+
+// Entry of the bindless material table, read by the shaders through a buffer device address
+struct GPUMaterial
+{
+    glm::vec4 baseColorFactor;
+    // Index into the bindless texture table, or NO_BINDLESS_INDEX for untextured materials
+    uint32_t baseColorTexture;
+    // Index into the bindless sampler table
+    uint32_t baseColorSampler;
+    uint32_t padding[2];
+};
+
+constexpr uint32_t NO_BINDLESS_INDEX = ~0u;
+
+// A surface of a mesh placed in the world, one per instance and surface. The persistent input of cull.comp
+struct GPUDrawObject
+{
+    // Includes the dequantization of the surface when the scene has packed vertices
+    glm::mat4 worldMatrix;
+    // World space center and radius
+    glm::vec4 boundingSphere;
+    // Index into the scene's GPUSurface table
+    uint32_t surfaceIndex;
+    // Index into the bindless material table
+    uint32_t materialIndex;
+    // How much the instance grows the surface's LOD errors, the largest scale of its axes
+    float lodScale;
+    uint32_t padding;
+};
+
+struct GPUSurfaceLod
+{
+    uint32_t startIndex;
+    uint32_t count;
+    float error;
+    uint32_t padding;
+};
+
+// GeoSurface as cull.comp sees it, shared by every object drawing the surface
+struct GPUSurface
+{
+    uint32_t startIndex;
+    uint32_t count;
+    int32_t vertexOffset;
+    uint32_t materialIndex;
+    uint32_t lodCount;
+    uint32_t padding[3];
+    GPUSurfaceLod lods[4];
+};
+
+// What a scene needs to be culled and drawn without the CPU looking at its objects
+struct GPUDrawBuffers
+{
+    AllocatedBuffer objectBuffer;
+    AllocatedBuffer surfaceBuffer;
+    // One uint per object, whether it was visible at the end of the previous frame
+    AllocatedBuffer visibilityBuffer;
+    // Written by cull.comp every frame, one VkDrawIndexedIndirectCommand per surviving object and the amount of them
+    AllocatedBuffer drawCommandBuffer;
+    AllocatedBuffer drawCountBuffer;
+    VkDeviceAddress objectBufferAddress;
+    VkDeviceAddress surfaceBufferAddress;
+    VkDeviceAddress visibilityBufferAddress;
+    VkDeviceAddress drawCommandBufferAddress;
+    VkDeviceAddress drawCountBufferAddress;
+    uint32_t objectCount;
+};
+
+// Push constants for our mesh object draws
+struct GPUDrawPushConstants
+{
+    glm::mat4 worldMatrix;
+    VkDeviceAddress vertexBuffer;
+    VkDeviceAddress materialBuffer;
+    uint32_t materialIndex;
+};
+
+// Push constants for GPU driven draws, laid out so the fragment shader finds the material buffer where it always does
+struct GPUIndirectDrawPushConstants
+{
+    glm::mat4 viewProjection;
+    VkDeviceAddress vertexBuffer;
+    VkDeviceAddress materialBuffer;
+    VkDeviceAddress objectBuffer;
+};
+
+// Camera state cull.comp works with, written once per frame
+struct GPUCullData
+{
+    glm::mat4 view;
+    // Left/right and top/bottom planes of the symmetric frustum, as (x.x, x.z, y.y, y.z) in view space
+    glm::vec4 frustum;
+    // projection[0][0], projection[1][1], projection[2][2] and projection[3][2], enough to project bounding spheres
+    glm::vec4 projection;
+    float lodErrorPerDistance;
+    float nearPlane;
+    float farPlane;
+    float padding0;
+    // Size of the first level of the depth pyramid
+    glm::vec2 depthPyramidSize;
+    glm::vec2 padding1;
+};
+
+// Which objects a cull.comp dispatch draws, see the two-phase occlusion culling in VulkanEngine::Draw()
+enum class CullPass : uint32_t
+{
+    Early, // Objects visible last frame, without occlusion test
+    Late,  // Objects not drawn by the early pass that pass the test against the depth pyramid. Updates the visibility
+    All,   // Every object in the frustum, when occlusion culling is off
+};
+
+// Push constants for cull.comp
+struct GPUCullPushConstants
+{
+    VkDeviceAddress cullData;
+    VkDeviceAddress objectBuffer;
+    VkDeviceAddress surfaceBuffer;
+    VkDeviceAddress visibilityBuffer;
+    VkDeviceAddress drawCommandBuffer;
+    VkDeviceAddress drawCountBuffer;
+    uint32_t objectCount;
+    CullPass pass;
+};
+
+// Push constants for depth_pyramid.comp
+struct GPUDepthPyramidPushConstants
+{
+    glm::uvec2 depthSize;
+    glm::uvec2 pyramidSize;
+    uint32_t levelCount;
+    uint32_t groupCount;
+    // Counts the workgroups that are done, the last one reduces the levels no single workgroup covers
+    VkDeviceAddress counterBuffer;
+};
+
 #define VK_CHECK(x)                                                     \
     do {                                                                \
         VkResult err = x;                                               \
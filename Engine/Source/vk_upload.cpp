@@ -0,0 +1,456 @@
+﻿#include <vk_upload.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "vk_initializers.h"
+
+namespace
+{
+    // Copies are split into pieces of at most this much of the ring, so a piece always fits once older uploads finish
+    constexpr size_t RING_CHUNK_DIVISOR = 4;
+    // Smaller rings split uploads into slivers, and an empty one could never hold a piece at all.
+    // Also leaves room for a row of any image the engine can create
+    constexpr size_t MIN_RING_SIZE = 1024 * 1024;
+    // Satisfies the offset alignment of buffer to image copies for every format the engine uploads
+    constexpr size_t STAGING_ALIGNMENT = 16;
+
+    size_t align_up(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+void UploadManager::Init(
+    VkDevice device,
+    VmaAllocator allocator,
+    VkQueue transferQueue,
+    uint32_t transferQueueFamily,
+    VkQueue graphicsQueue,
+    uint32_t graphicsQueueFamily,
+    size_t ringSize
+) {
+    this->device = device;
+    this->allocator = allocator;
+    this->transferQueue = transferQueue;
+    this->transferQueueFamily = transferQueueFamily;
+    this->graphicsQueue = graphicsQueue;
+    this->graphicsQueueFamily = graphicsQueueFamily;
+    this->ringSize = std::max(ringSize, MIN_RING_SIZE);
+    if (ringSize < MIN_RING_SIZE)
+    {
+        fmt::println("A staging ring of {} bytes is too small to upload through, using {} bytes instead", ringSize, MIN_RING_SIZE);
+    }
+
+    VkCommandPoolCreateInfo transferPoolInfo = vkinit::command_pool_create_info(transferQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+    VK_CHECK(vkCreateCommandPool(device, &transferPoolInfo, nullptr, &transferPool));
+    if (HasDedicatedQueue())
+    {
+        VkCommandPoolCreateInfo acquirePoolInfo = vkinit::command_pool_create_info(graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+        VK_CHECK(vkCreateCommandPool(device, &acquirePoolInfo, nullptr, &acquirePool));
+    }
+
+    VkSemaphoreTypeCreateInfo timelineInfo = vkinit::semaphore_type_create_info(VK_SEMAPHORE_TYPE_TIMELINE, 0);
+    VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info();
+    semaphoreInfo.pNext = &timelineInfo;
+    VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline));
+
+    // Written once by the CPU and read once by the copy, which is what write-combined host memory is good at
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = this->ringSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VmaAllocationCreateInfo allocationInfo = {};
+    allocationInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+    allocationInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    const VkResult result = vmaCreateBuffer(allocator, &bufferInfo, &allocationInfo, &ring.buffer, &ring.allocation, &ring.info);
+    if (result != VK_SUCCESS)
+    {
+        fmt::println("Failed to allocate a staging ring of {} bytes: {}", this->ringSize, string_VkResult(result));
+        abort();
+    }
+    ringData = static_cast<uint8_t*>(ring.info.pMappedData);
+}
+
+void UploadManager::Destroy()
+{
+    Wait(Flush());
+    Reclaim();
+
+    vmaDestroyBuffer(allocator, ring.buffer, ring.allocation);
+    vkDestroySemaphore(device, timeline, nullptr);
+    vkDestroyCommandPool(device, transferPool, nullptr);
+    if (acquirePool != VK_NULL_HANDLE)
+    {
+        vkDestroyCommandPool(device, acquirePool, nullptr);
+    }
+}
+
+void UploadManager::UploadBuffer(VkBuffer buffer, size_t offset, const void* data, size_t size)
+{
+    // Zero sized copies and barriers are invalid
+    if (size == 0)
+    {
+        return;
+    }
+
+    const size_t chunkSize = ringSize / RING_CHUNK_DIVISOR;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    for (size_t done = 0; done < size; done += chunkSize)
+    {
+        const size_t copySize = std::min(chunkSize, size - done);
+        const size_t stagingOffset = AllocateStaging(copySize, STAGING_ALIGNMENT);
+        std::memcpy(ringData + stagingOffset, bytes + done, copySize);
+        VK_CHECK(vmaFlushAllocation(allocator, ring.allocation, stagingOffset, copySize));
+
+        VkBufferCopy copy = {};
+        copy.srcOffset = stagingOffset;
+        copy.dstOffset = offset + done;
+        copy.size = copySize;
+        vkCmdCopyBuffer(GetCommand(), ring.buffer, buffer, 1, &copy);
+    }
+
+    ReleaseBuffer(buffer, offset, size);
+}
+
+void UploadManager::UploadImage(VkImage image, VkExtent3D extent, uint32_t texelSize, const void* texels)
+{
+    // Images go up in bands of whole rows, a flush between two bands leaves the image in the transfer layout,
+    // which the next batch simply continues with
+    const size_t rowSize = static_cast<size_t>(extent.width) * texelSize;
+    const uint32_t rowsPerChunk = static_cast<uint32_t>(std::max<size_t>(ringSize / RING_CHUNK_DIVISOR / rowSize, 1));
+    const uint8_t* bytes = static_cast<const uint8_t*>(texels);
+
+    for (uint32_t row = 0; row < extent.height; row += rowsPerChunk)
+    {
+        const uint32_t rowCount = std::min(rowsPerChunk, extent.height - row);
+        const size_t copySize = rowSize * rowCount;
+        const size_t stagingOffset = AllocateStaging(copySize, STAGING_ALIGNMENT);
+        std::memcpy(ringData + stagingOffset, bytes + rowSize * row, copySize);
+        VK_CHECK(vmaFlushAllocation(allocator, ring.allocation, stagingOffset, copySize));
+
+        VkCommandBuffer command = GetCommand();
+        if (row == 0)
+        {
+            PrepareImageCopy(command, image);
+        }
+
+        VkBufferImageCopy copyRegion = {};
+        copyRegion.bufferOffset = stagingOffset;
+        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copyRegion.imageSubresource.mipLevel = 0;
+        copyRegion.imageSubresource.baseArrayLayer = 0;
+        copyRegion.imageSubresource.layerCount = 1;
+        copyRegion.imageOffset = {0, static_cast<int32_t>(row), 0};
+        copyRegion.imageExtent = {extent.width, rowCount, 1};
+        vkCmdCopyBufferToImage(command, ring.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+    }
+
+    ReleaseImage(image);
+}
+
+void UploadManager::FillBuffer(VkBuffer buffer, size_t offset, size_t size, uint32_t value)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    vkCmdFillBuffer(GetCommand(), buffer, offset, size, value);
+    ReleaseBuffer(buffer, offset, size);
+}
+
+void UploadManager::CopyBuffer(VkBuffer source, size_t sourceOffset, VkBuffer destination, size_t destinationOffset, size_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    VkBufferCopy copy = {};
+    copy.srcOffset = sourceOffset;
+    copy.dstOffset = destinationOffset;
+    copy.size = size;
+    vkCmdCopyBuffer(GetCommand(), source, destination, 1, &copy);
+
+    ReleaseBuffer(destination, destinationOffset, size);
+}
+
+void UploadManager::CopyBufferToImage(VkBuffer source, size_t sourceOffset, VkImage image, VkExtent3D extent)
+{
+    VkCommandBuffer command = GetCommand();
+    PrepareImageCopy(command, image);
+
+    VkBufferImageCopy copyRegion = {};
+    copyRegion.bufferOffset = sourceOffset;
+    copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copyRegion.imageSubresource.mipLevel = 0;
+    copyRegion.imageSubresource.baseArrayLayer = 0;
+    copyRegion.imageSubresource.layerCount = 1;
+    copyRegion.imageExtent = extent;
+    vkCmdCopyBufferToImage(command, source, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+    ReleaseImage(image);
+}
+
+uint64_t UploadManager::Flush()
+{
+    if (openBatch.transferCommand == VK_NULL_HANDLE)
+    {
+        return lastValue;
+    }
+
+    Batch batch = openBatch;
+    batch.ringEnd = ringHead;
+
+    // Release barriers only need their source half, the acquire on the graphics queue provides the destination half
+    VkDependencyInfo releaseInfo = {};
+    releaseInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    releaseInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(bufferReleases.size());
+    releaseInfo.pBufferMemoryBarriers = bufferReleases.data();
+    releaseInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageReleases.size());
+    releaseInfo.pImageMemoryBarriers = imageReleases.data();
+    vkCmdPipelineBarrier2(batch.transferCommand, &releaseInfo);
+    VK_CHECK(vkEndCommandBuffer(batch.transferCommand));
+
+    VkCommandBufferSubmitInfo transferCommandInfo = vkinit::command_buffer_submit_info(batch.transferCommand);
+    VkSemaphoreSubmitInfo copiedInfo = vkinit::timeline_semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timeline, ++lastValue);
+    VkSubmitInfo2 transferSubmit = vkinit::submit_info(&transferCommandInfo, &copiedInfo, nullptr);
+    VK_CHECK(vkQueueSubmit2(transferQueue, 1, &transferSubmit, VK_NULL_HANDLE));
+
+    if (HasDedicatedQueue())
+    {
+        // The graphics queue only waits for the copies right before the acquire, nothing it already has queued is held up
+        if (!freeAcquireCommands.empty())
+        {
+            batch.acquireCommand = freeAcquireCommands.back();
+            freeAcquireCommands.pop_back();
+        }
+        else
+        {
+            VkCommandBufferAllocateInfo allocateInfo = vkinit::command_buffer_allocate_info(acquirePool, 1);
+            VK_CHECK(vkAllocateCommandBuffers(device, &allocateInfo, &batch.acquireCommand));
+        }
+
+        VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        VK_CHECK(vkBeginCommandBuffer(batch.acquireCommand, &beginInfo));
+
+        for (VkBufferMemoryBarrier2& barrier : bufferReleases)
+        {
+            barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+            barrier.srcAccessMask = VK_ACCESS_2_NONE;
+            barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+            barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+        }
+        for (VkImageMemoryBarrier2& barrier : imageReleases)
+        {
+            barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+            barrier.srcAccessMask = VK_ACCESS_2_NONE;
+            barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+            barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+        }
+        vkCmdPipelineBarrier2(batch.acquireCommand, &releaseInfo);
+        VK_CHECK(vkEndCommandBuffer(batch.acquireCommand));
+
+        VkCommandBufferSubmitInfo acquireCommandInfo = vkinit::command_buffer_submit_info(batch.acquireCommand);
+        VkSemaphoreSubmitInfo waitInfo = vkinit::timeline_semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timeline, lastValue);
+        VkSemaphoreSubmitInfo acquiredInfo = vkinit::timeline_semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timeline, ++lastValue);
+        VkSubmitInfo2 acquireSubmit = vkinit::submit_info(&acquireCommandInfo, &acquiredInfo, &waitInfo);
+        VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &acquireSubmit, VK_NULL_HANDLE));
+    }
+
+    batch.value = lastValue;
+    submittedBatches.push_back(batch);
+
+    openBatch = {};
+    bOpenBatchUsesRing = false;
+    bufferReleases.clear();
+    imageReleases.clear();
+
+    return lastValue;
+}
+
+bool UploadManager::IsComplete(uint64_t value) const
+{
+    uint64_t completedValue;
+    VK_CHECK(vkGetSemaphoreCounterValue(device, timeline, &completedValue));
+    return completedValue >= value;
+}
+
+void UploadManager::Wait(uint64_t value) const
+{
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.pNext = nullptr;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline;
+    waitInfo.pValues = &value;
+
+    // Large uploads can take a while, there is no sensible timeout
+    VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+}
+
+VkCommandBuffer UploadManager::GetCommand()
+{
+    if (openBatch.transferCommand != VK_NULL_HANDLE)
+    {
+        return openBatch.transferCommand;
+    }
+
+    Reclaim();
+    if (!freeTransferCommands.empty())
+    {
+        openBatch.transferCommand = freeTransferCommands.back();
+        freeTransferCommands.pop_back();
+    }
+    else
+    {
+        VkCommandBufferAllocateInfo allocateInfo = vkinit::command_buffer_allocate_info(transferPool, 1);
+        VK_CHECK(vkAllocateCommandBuffers(device, &allocateInfo, &openBatch.transferCommand));
+    }
+
+    VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    VK_CHECK(vkBeginCommandBuffer(openBatch.transferCommand, &beginInfo));
+
+    return openBatch.transferCommand;
+}
+
+size_t UploadManager::AllocateStaging(size_t size, size_t alignment)
+{
+    Reclaim();
+
+    size_t offset;
+    while (!TryAllocateStaging(size, alignment, offset))
+    {
+        // The ring is full, so wait for the oldest upload. If that is the one being recorded, it has to go out first
+        if (submittedBatches.empty())
+        {
+            Flush();
+        }
+        if (submittedBatches.empty())
+        {
+            fmt::println("Staging allocation of {} bytes does not fit in a {} byte ring", size, ringSize);
+            abort();
+        }
+        Wait(submittedBatches.front().value);
+        Reclaim();
+    }
+
+    bOpenBatchUsesRing = true;
+    return offset;
+}
+
+bool UploadManager::TryAllocateStaging(size_t size, size_t alignment, size_t& offset)
+{
+    offset = align_up(ringHead, alignment);
+
+    if (bRingWrapped)
+    {
+        // Only the space up to the tail is free
+        if (offset + size > ringTail)
+        {
+            return false;
+        }
+    }
+    else if (offset + size > ringSize)
+    {
+        // Go around to the start, the rest of the end stays unused until the tail passes it
+        if (size > ringTail)
+        {
+            return false;
+        }
+        offset = 0;
+        bRingWrapped = true;
+        openBatch.bWrappedRing = true;
+    }
+
+    ringHead = offset + size;
+    return true;
+}
+
+void UploadManager::Reclaim()
+{
+    while (!submittedBatches.empty() && IsComplete(submittedBatches.front().value))
+    {
+        const Batch& batch = submittedBatches.front();
+        freeTransferCommands.push_back(batch.transferCommand);
+        if (batch.acquireCommand != VK_NULL_HANDLE)
+        {
+            freeAcquireCommands.push_back(batch.acquireCommand);
+        }
+
+        ringTail = batch.ringEnd;
+        if (batch.bWrappedRing)
+        {
+            bRingWrapped = false;
+        }
+        submittedBatches.pop_front();
+    }
+
+    // Nothing is in use anymore, starting over at the front keeps large allocations from having to wrap
+    if (submittedBatches.empty() && !bOpenBatchUsesRing)
+    {
+        ringHead = 0;
+        ringTail = 0;
+        bRingWrapped = false;
+    }
+}
+
+void UploadManager::PrepareImageCopy(VkCommandBuffer command, VkImage image)
+{
+    // Whatever the image held before is overwritten, so its old contents can be discarded
+    VkImageMemoryBarrier2 barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+    barrier.srcAccessMask = VK_ACCESS_2_NONE;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+
+    VkDependencyInfo dependencyInfo = {};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(command, &dependencyInfo);
+}
+
+void UploadManager::ReleaseBuffer(VkBuffer buffer, size_t offset, size_t size)
+{
+    VkBufferMemoryBarrier2 barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    // Ignored by a release. Without a dedicated queue this is a plain barrier, done by the time the value is reached anyway
+    barrier.dstStageMask = HasDedicatedQueue() ? VK_PIPELINE_STAGE_2_NONE : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    barrier.dstAccessMask = HasDedicatedQueue() ? VK_ACCESS_2_NONE : VK_ACCESS_2_MEMORY_READ_BIT;
+    barrier.srcQueueFamilyIndex = HasDedicatedQueue() ? transferQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = HasDedicatedQueue() ? graphicsQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    bufferReleases.push_back(barrier);
+}
+
+void UploadManager::ReleaseImage(VkImage image)
+{
+    VkImageMemoryBarrier2 barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.dstStageMask = HasDedicatedQueue() ? VK_PIPELINE_STAGE_2_NONE : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    barrier.dstAccessMask = HasDedicatedQueue() ? VK_ACCESS_2_NONE : VK_ACCESS_2_MEMORY_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = HasDedicatedQueue() ? transferQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = HasDedicatedQueue() ? graphicsQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+    imageReleases.push_back(barrier);
+}
@@ -0,0 +1,103 @@
+﻿#pragma once
+
+#include <deque>
+#include <vk_types.h>
+
+// Uploads buffer and image contents on a transfer queue, so streaming never takes time from the graphics queue.
+// Data is copied into a persistently mapped staging ring and the copies are batched until Flush(), which submits
+// them at once and returns a timeline value that is reached once they are done. When the transfer queue is of another
+// family than the graphics queue, Flush() also releases every resource from the transfer family and has the graphics
+// queue acquire it, so a resource is ready for rendering as soon as its value is reached.
+// Only use it from the main thread, Flush() submits to the graphics queue as well.
+class UploadManager
+{
+public:
+    void Init(
+        VkDevice device,
+        VmaAllocator allocator,
+        VkQueue transferQueue,
+        uint32_t transferQueueFamily,
+        VkQueue graphicsQueue,
+        uint32_t graphicsQueueFamily,
+        size_t ringSize
+    );
+    // Waits for outstanding uploads
+    void Destroy();
+
+    // Copies data into the ring right away, so it may be freed on return. Larger uploads are split up over the ring
+    void UploadBuffer(VkBuffer buffer, size_t offset, const void* data, size_t size);
+    // Fills the first level of a color image from tightly packed texels, the image ends up in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    void UploadImage(VkImage image, VkExtent3D extent, uint32_t texelSize, const void* texels);
+    void FillBuffer(VkBuffer buffer, size_t offset, size_t size, uint32_t value);
+
+    // Copies out of a staging buffer the caller owns, which has to stay alive until the value of the next Flush() is reached
+    void CopyBuffer(VkBuffer source, size_t sourceOffset, VkBuffer destination, size_t destinationOffset, size_t size);
+    void CopyBufferToImage(VkBuffer source, size_t sourceOffset, VkImage image, VkExtent3D extent);
+
+    // Submits everything recorded since the last flush. Returns the timeline value that marks it as done,
+    // or the value of the previous flush when there was nothing to submit
+    uint64_t Flush();
+    bool IsComplete(uint64_t value) const;
+    void Wait(uint64_t value) const;
+
+    bool HasDedicatedQueue() const { return transferQueueFamily != graphicsQueueFamily; }
+    // What Init() was asked for, raised to the smallest ring uploads work with
+    size_t GetRingSize() const { return ringSize; }
+
+private:
+    // Everything recorded between two flushes
+    struct Batch
+    {
+        VkCommandBuffer transferCommand{VK_NULL_HANDLE};
+        // Acquires the batch's resources on the graphics queue, only used with a dedicated transfer queue
+        VkCommandBuffer acquireCommand{VK_NULL_HANDLE};
+        uint64_t value{0};
+        // Where the ring's head was at the flush, everything before it is free again once value is reached
+        size_t ringEnd{0};
+        // The ring wrapped around to its start during this batch
+        bool bWrappedRing{false};
+    };
+
+    VkCommandBuffer GetCommand();
+    size_t AllocateStaging(size_t size, size_t alignment);
+    bool TryAllocateStaging(size_t size, size_t alignment, size_t& offset);
+    // Recycles the batches the GPU has finished, and the ring space they used
+    void Reclaim();
+
+    // Moves an image into the layout copies write to
+    void PrepareImageCopy(VkCommandBuffer command, VkImage image);
+    // Queue family ownership moves to the graphics queue after the copies, images change layout along with it
+    void ReleaseBuffer(VkBuffer buffer, size_t offset, size_t size);
+    void ReleaseImage(VkImage image);
+
+    VkDevice device{VK_NULL_HANDLE};
+    VmaAllocator allocator{VK_NULL_HANDLE};
+    VkQueue transferQueue{VK_NULL_HANDLE};
+    uint32_t transferQueueFamily{0};
+    VkQueue graphicsQueue{VK_NULL_HANDLE};
+    uint32_t graphicsQueueFamily{0};
+
+    VkCommandPool transferPool{VK_NULL_HANDLE};
+    VkCommandPool acquirePool{VK_NULL_HANDLE};
+    std::vector<VkCommandBuffer> freeTransferCommands;
+    std::vector<VkCommandBuffer> freeAcquireCommands;
+
+    // Signaled by every flush, twice with a dedicated transfer queue: once by the copies and once by the acquire
+    VkSemaphore timeline{VK_NULL_HANDLE};
+    uint64_t lastValue{0};
+
+    AllocatedBuffer ring{};
+    uint8_t* ringData{nullptr};
+    size_t ringSize{0};
+    // New allocations go at the head, the tail is the start of the oldest allocation still in use
+    size_t ringHead{0};
+    size_t ringTail{0};
+    // The head went around to the start of the ring and is behind the tail now
+    bool bRingWrapped{false};
+
+    Batch openBatch{};
+    bool bOpenBatchUsesRing{false};
+    std::vector<VkBufferMemoryBarrier2> bufferReleases;
+    std::vector<VkImageMemoryBarrier2> imageReleases;
+    std::deque<Batch> submittedBatches;
+};
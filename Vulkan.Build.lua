@@ -1,3 +1,28 @@
+-- fastgltf parses with simdjson. The header and license of its v3.10.1 amalgamation are vendored, the matching
+-- simdjson.cpp is fetched from the same release the first time the project files are generated. It is only kept when it
+-- carries the generator stamp of the vendored header, so the two halves always come from the same amalgamation
+local simdjsonDirectory = path.join(_SCRIPT_DIR, "Engine/ThirdParty/simdjson")
+local simdjsonSource = path.join(simdjsonDirectory, "simdjson.cpp")
+if not os.isfile(simdjsonSource) then
+    local function read_first_line(filePath)
+        local file = io.open(filePath, "r")
+        if not file then
+            return nil
+        end
+        local line = file:read("*l")
+        file:close()
+        return line
+    end
+
+    local url = "https://raw.githubusercontent.com/simdjson/simdjson/v3.10.1/singleheader/simdjson.cpp"
+    print("Downloading " .. url)
+    local result, code = http.download(url, simdjsonSource)
+    if code ~= 200 or read_first_line(simdjsonSource) ~= read_first_line(path.join(simdjsonDirectory, "simdjson.h")) then
+        os.remove(simdjsonSource)
+        error("Failed to fetch a simdjson.cpp matching the vendored simdjson.h from " .. url .. ": " .. result)
+    end
+end
+
 workspace "Vulkan"
     architecture "x86_64"
     configurations { "Debug", "Release" }
@@ -22,6 +47,8 @@ project "Engine"
         "%{prj.name}/Assets/**",
         "%{prj.name}/Shaders/**",
         "%{prj.name}/ThirdParty/vkbootstrap/VkBootstrap.cpp", -- I don't want this included in the engine, but oh well
+        "%{prj.name}/ThirdParty/fastgltf/src/*.cpp",
+        "%{prj.name}/ThirdParty/simdjson/simdjson.cpp",
     }
 
     includedirs {
@@ -31,6 +58,7 @@ project "Engine"
         "$(VULKAN_SDK)/include/",
         "%{prj.name}/ThirdParty/",
         "%{prj.name}/ThirdParty/*/include",
+        "%{prj.name}/ThirdParty/simdjson/",
     }
 
     libdirs {
@@ -44,8 +72,18 @@ project "Engine"
 
     defines {
         "FMT_HEADER_ONLY",
+        -- Vulkan clips depth to 0..1, glm builds its projections for OpenGL's -1..1 without this
+        "GLM_FORCE_DEPTH_ZERO_TO_ONE",
     }
 
+    -- Compile GLSL shaders to SPIR-V next to their source, the engine loads the .spv files at runtime
+    filter "files:**.vert or **.frag or **.comp"
+        buildmessage "Compiling shader %{file.relpath}"
+        buildcommands {
+            '"$(VULKAN_SDK)/Bin/glslangValidator.exe" -V --target-env vulkan1.3 -o "%{file.relpath}.spv" "%{file.relpath}"',
+        }
+        buildoutputs { "%{file.relpath}.spv" }
+
     filter "system:windows"
         systemversion "latest"
         postbuildcommands {